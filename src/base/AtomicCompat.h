@@ -0,0 +1,103 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_ATOMICCOMPAT_H
+#define RG_ATOMICCOMPAT_H
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QtGlobal>
+
+namespace Rosegarden {
+
+/**
+ * Atomic loads and stores that build with both Qt 4 and Qt 5.
+ *
+ * Qt 5's QAtomicInt and QAtomicPointer have load(), loadAcquire(),
+ * store() and storeRelease(), but Qt 4.8 has none of them.  There the
+ * relaxed versions are the plain (volatile) reads and writes of the
+ * value, and the ordered ones use the equivalent read-modify-write
+ * operations, which are dearer but correct.
+ */
+
+inline int atomicLoad(const QAtomicInt &a)
+{
+#if QT_VERSION >= 0x050000
+    return a.load();
+#else
+    return a;
+#endif
+}
+
+inline int atomicLoadAcquire(const QAtomicInt &a)
+{
+#if QT_VERSION >= 0x050000
+    return a.loadAcquire();
+#else
+    return const_cast<QAtomicInt &>(a).fetchAndAddAcquire(0);
+#endif
+}
+
+inline void atomicStore(QAtomicInt &a, int value)
+{
+#if QT_VERSION >= 0x050000
+    a.store(value);
+#else
+    a = value;
+#endif
+}
+
+inline void atomicStoreRelease(QAtomicInt &a, int value)
+{
+#if QT_VERSION >= 0x050000
+    a.storeRelease(value);
+#else
+    a.fetchAndStoreRelease(value);
+#endif
+}
+
+template <typename T>
+inline T *atomicLoad(const QAtomicPointer<T> &a)
+{
+#if QT_VERSION >= 0x050000
+    return a.load();
+#else
+    return a;
+#endif
+}
+
+template <typename T>
+inline T *atomicLoadAcquire(const QAtomicPointer<T> &a)
+{
+#if QT_VERSION >= 0x050000
+    return a.loadAcquire();
+#else
+    return const_cast<QAtomicPointer<T> &>(a).fetchAndAddAcquire(0);
+#endif
+}
+
+template <typename T>
+inline void atomicStoreRelease(QAtomicPointer<T> &a, T *value)
+{
+#if QT_VERSION >= 0x050000
+    a.storeRelease(value);
+#else
+    a.fetchAndStoreRelease(value);
+#endif
+}
+
+}
+
+#endif
@@ -41,17 +41,23 @@ const PropertyName NOTE_DOTS            = "notedots";
 
 const PropertyName MARK_COUNT		= "marks";
 
+static std::vector<PropertyName> makeFirstFiveMarkPropertyNames()
+{
+    std::vector<PropertyName> names;
+    names.push_back(PropertyName("mark1"));
+    names.push_back(PropertyName("mark2"));
+    names.push_back(PropertyName("mark3"));
+    names.push_back(PropertyName("mark4"));
+    names.push_back(PropertyName("mark5"));
+    return names;
+}
+
 PropertyName getMarkPropertyName(int markNo)
 {
-    static std::vector<PropertyName> firstFive;
-
-    if (firstFive.empty()) {
-	firstFive.push_back(PropertyName("mark1"));
-	firstFive.push_back(PropertyName("mark2"));
-	firstFive.push_back(PropertyName("mark3"));
-	firstFive.push_back(PropertyName("mark4"));
-	firstFive.push_back(PropertyName("mark5"));
-    }
+    // Filled in as it's initialised, which is thread-safe, as marks
+    // may be added on several threads at once
+    static const std::vector<PropertyName> firstFive
+	(makeFirstFiveMarkPropertyNames());
 
     if (markNo < 5) return firstFive[markNo];
 
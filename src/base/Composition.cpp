@@ -1317,7 +1317,7 @@ static int DEBUG_silence_recursive_tempo_printout = 0;
 #endif
 
 RealTime
-Composition::time2RealTime(timeT t, tempoT tempo) const
+Composition::time2RealTime(timeT t, tempoT tempo)
 {
     static timeT cdur = Note(Note::Crotchet).getDuration();
 
@@ -1347,7 +1347,7 @@ Composition::time2RealTime(timeT t, tempoT tempo) const
 
 RealTime
 Composition::time2RealTime(timeT time, tempoT tempo,
-                           timeT targetTime, tempoT targetTempo) const
+                           timeT targetTime, tempoT targetTempo)
 {
     static timeT cdur = Note(Note::Crotchet).getDuration();
 
@@ -1397,7 +1397,7 @@ Composition::time2RealTime(timeT time, tempoT tempo,
 }
 
 timeT
-Composition::realTime2Time(RealTime rt, tempoT tempo) const
+Composition::realTime2Time(RealTime rt, tempoT tempo)
 {
     static timeT cdur = Note(Note::Crotchet).getDuration();
 
@@ -1426,7 +1426,7 @@ Composition::realTime2Time(RealTime rt, tempoT tempo) const
 
 timeT
 Composition::realTime2Time(RealTime rt, tempoT tempo,
-                           timeT targetTime, tempoT targetTempo) const
+                           timeT targetTime, tempoT targetTempo)
 {
     static timeT cdur = Note(Note::Crotchet).getDuration();
 
@@ -1505,6 +1505,12 @@ Composition::timeRatioToTempo(RealTime &realTime,
     return averageTempo;
 }
 
+bool
+Composition::getTempoTarget(int n, tempoT &target, timeT &targetTime) const
+{
+    return getTempoTarget(m_tempoSegment.begin() + n, target, targetTime);
+}
+
 bool
 Composition::getTempoTarget(ReferenceSegment::const_iterator i,
                             tempoT &target,
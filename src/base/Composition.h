@@ -629,6 +629,15 @@ public:
      */
     std::pair<bool, tempoT> getTempoRamping(int n, bool calculate = true) const;
 
+    /**
+     * Return whether tempo change number n is ramped, and if it is,
+     * return the tempo it ramps to and the time at which it gets
+     * there: the time of the next tempo change, or the end marker if
+     * this is the last.  These are the ramps getElapsedRealTime()
+     * follows.
+     */
+    bool getTempoTarget(int n, tempoT &target, timeT &targetTime) const;
+
     /**
      * Remove tempo change event n from the composition.
      */
@@ -687,6 +696,17 @@ public:
         else         return getElapsedRealTime(t0) - getElapsedRealTime(t1);
     }
 
+    /**
+     * Return the real time taken by the given timeT duration at the
+     * given tempo, or, with a target, from the start of a smooth
+     * change from tempo to targetTempo lasting targetTempoTime.
+     * These are the conversions getElapsedRealTime() makes from the
+     * last tempo change before the time it is given.
+     */
+    static RealTime time2RealTime(timeT time, tempoT tempo);
+    static RealTime time2RealTime(timeT time, tempoT tempo,
+                                  timeT targetTempoTime, tempoT targetTempo);
+
     static tempoT
         timeRatioToTempo(RealTime &realTime,
                          timeT beatTime, tempoT rampTo);
@@ -1015,12 +1035,9 @@ protected:
     /// affects m_tempoSegment
     void calculateTempoTimestamps() const;
     mutable bool m_tempoTimestampsNeedCalculating;
-    RealTime time2RealTime(timeT time, tempoT tempo) const;
-    RealTime time2RealTime(timeT time, tempoT tempo,
-                           timeT targetTempoTime, tempoT targetTempo) const;
-    timeT realTime2Time(RealTime rtime, tempoT tempo) const;
-    timeT realTime2Time(RealTime rtime, tempoT tempo,
-                        timeT targetTempoTime, tempoT targetTempo) const;
+    static timeT realTime2Time(RealTime rtime, tempoT tempo);
+    static timeT realTime2Time(RealTime rtime, tempoT tempo,
+                               timeT targetTempoTime, tempoT targetTempo);
     bool getTempoTarget(ReferenceSegment::const_iterator i,
                         tempoT &target,
                         timeT &targetTime) const;
@@ -19,8 +19,12 @@
 #include "Event.h"
 #include "XmlExportable.h"
 #include "NotationTypes.h"
+#include "MidiTypes.h"
 #include "BaseProperties.h"
 
+#include <QReadWriteLock>
+
+#include <map>
 #include <sstream>
 
 namespace Rosegarden 
@@ -32,41 +36,133 @@ PropertyName Event::EventData::NotationTime = "!notationtime";
 PropertyName Event::EventData::NotationDuration = "!notationduration";
 
 
+// The types almost every event has.  Each is interned as the string
+// defined for it, so that isa() called with that string only has to
+// compare addresses.  The ids are their indices here.
+static const std::string *const knownTypes[] = {
+    &Note::EventType,
+    &Note::EventRestType,
+    &Controller::EventType,
+    &PitchBend::EventType,
+    &Clef::EventType,
+    &Key::EventType,
+    &Indication::EventType,
+    &Text::EventType,
+    &Symbol::EventType,
+    &ProgramChange::EventType,
+    &KeyPressure::EventType,
+    &ChannelPressure::EventType,
+    &SystemExclusive::EventType
+};
+static const int knownTypeCount = sizeof(knownTypes) / sizeof(knownTypes[0]);
+
+// Any others, as they are first used.  Their interned strings are
+// the keys, which std::map never moves.
+typedef std::map<std::string, Event::TypeId> OtherTypeMap;
+static OtherTypeMap *otherTypes = 0;
+
+// Events are made on the threads that quantize segments as well as
+// the GUI's
+static QReadWriteLock *typeLock()
+{
+    static QReadWriteLock lock;
+    return &lock;
+}
+
+static void
+internType(const std::string &type, const std::string *&name, Event::TypeId &id)
+{
+    for (int i = 0; i < knownTypeCount; ++i) {
+        if (&type == knownTypes[i] || type == *knownTypes[i]) {
+            name = knownTypes[i];
+            id = i;
+            return;
+        }
+    }
+
+    {
+        QReadLocker locker(typeLock());
+
+        if (otherTypes) {
+            OtherTypeMap::const_iterator i(otherTypes->find(type));
+            if (i != otherTypes->end()) {
+                name = &i->first;
+                id = i->second;
+                return;
+            }
+        }
+    }
+
+    QWriteLocker locker(typeLock());
+
+    if (!otherTypes) otherTypes = new OtherTypeMap;
+
+    // Another thread may have got here first
+    OtherTypeMap::iterator i(otherTypes->find(type));
+
+    if (i == otherTypes->end()) {
+        Event::TypeId nextId = knownTypeCount + Event::TypeId(otherTypes->size());
+        i = otherTypes->insert(OtherTypeMap::value_type(type, nextId)).first;
+    }
+
+    name = &i->first;
+    id = i->second;
+}
+
+Event::TypeId
+Event::getTypeId(const std::string &type)
+{
+    const std::string *name;
+    TypeId id;
+    internType(type, name, id);
+    return id;
+}
+
+
 Event::EventData::EventData(const std::string &type, timeT absoluteTime,
 			    timeT duration, short subOrdering) :
     m_refCount(1),
-    m_type(type),
     m_absoluteTime(absoluteTime),
     m_duration(duration),
     m_subOrdering(subOrdering),
     m_properties(0)
 {
-    // empty
+    internType(type, m_type, m_typeId);
 }
 
-Event::EventData::EventData(const std::string &type, timeT absoluteTime,
-			    timeT duration, short subOrdering,
-			    const PropertyMap *properties) :
+Event::EventData::EventData(const std::string *type, TypeId typeId,
+			    timeT absoluteTime, timeT duration, short subOrdering,
+			    const FlatPropertyMap *properties) :
     m_refCount(1),
+    m_typeId(typeId),
     m_type(type),
     m_absoluteTime(absoluteTime),
     m_duration(duration),
     m_subOrdering(subOrdering),
-    m_properties(properties ? new PropertyMap(*properties) : 0)
+    m_properties(properties ? new FlatPropertyMap(*properties) : 0)
 {
     // empty
 }
 
 Event::EventData *Event::EventData::unshare()
 {
-    --m_refCount;
-
+    // Copy before letting go: once the count drops, the last other
+    // sharer may change this in place
     EventData *newData = new EventData
-	(m_type, m_absoluteTime, m_duration, m_subOrdering, m_properties);
+	(m_type, m_typeId, m_absoluteTime, m_duration, m_subOrdering,
+	 m_properties);
+
+    // The others may all have let go since the count was checked
+    if (!m_refCount.deref()) delete this;
 
     return newData;
 }
 
+void Event::EventData::setType(const std::string &type)
+{
+    internType(type, m_type, m_typeId);
+}
+
 Event::EventData::~EventData()
 {
     if (m_properties) delete m_properties;
@@ -76,18 +172,18 @@ timeT
 Event::EventData::getNotationTime() const
 {
     if (!m_properties) return m_absoluteTime;
-    PropertyMap::const_iterator i = m_properties->find(NotationTime);
+    FlatPropertyMap::const_iterator i = m_properties->find(NotationTime);
     if (i == m_properties->end()) return m_absoluteTime;
-    else return static_cast<PropertyStore<Int> *>(i->second)->getData();
+    else return FlatPropertyValue<Int>::get(*i);
 }
 
 timeT
 Event::EventData::getNotationDuration() const
 {
     if (!m_properties) return m_duration;
-    PropertyMap::const_iterator i = m_properties->find(NotationDuration);
+    FlatPropertyMap::const_iterator i = m_properties->find(NotationDuration);
     if (i == m_properties->end()) return m_duration;
-    else return static_cast<PropertyStore<Int> *>(i->second)->getData();
+    else return FlatPropertyValue<Int>::get(*i);
 }
 
 timeT
@@ -102,25 +198,19 @@ Event::getGreaterDuration()
 void
 Event::EventData::setTime(const PropertyName &name, timeT t, timeT deft)
 {
-    if (!m_properties) m_properties = new PropertyMap();
-    PropertyMap::iterator i = m_properties->find(name);
-
     if (t != deft) {
-	if (i == m_properties->end()) {
-	    m_properties->insert(PropertyPair(name, new PropertyStore<Int>(t)));
-	} else {
-	    static_cast<PropertyStore<Int> *>(i->second)->setData(t);
-	}
-    } else if (i != m_properties->end()) {
-	delete i->second;
-	m_properties->erase(i);
+	if (!m_properties) m_properties = new FlatPropertyMap();
+	FlatPropertyValue<Int>::set(*m_properties->insert(name, Int), t);
+    } else if (m_properties) {
+	FlatPropertyMap::iterator i = m_properties->find(name);
+	if (i != m_properties->end()) m_properties->erase(i);
     }
 }
 
-PropertyMap *
-Event::find(const PropertyName &name, PropertyMap::iterator &i)
+FlatPropertyMap *
+Event::find(const PropertyName &name, FlatPropertyMap::iterator &i)
 {
-    PropertyMap *map = m_data->m_properties;
+    FlatPropertyMap *map = m_data->m_properties;
 
     if (!map || ((i = map->find(name)) == map->end())) {
 
@@ -141,8 +231,8 @@ Event::has(const PropertyName &name) const
     ++m_hasCount;
 #endif
 
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    FlatPropertyMap::const_iterator i;
+    const FlatPropertyMap *map = find(name, i);
     if (map) return true;
     else return false;
 }
@@ -155,12 +245,9 @@ Event::unset(const PropertyName &name)
 #endif
 
     unshare();
-    PropertyMap::iterator i;
-    PropertyMap *map = find(name, i);
-    if (map) {
-	delete i->second;
-	map->erase(i);
-    }
+    FlatPropertyMap::iterator i;
+    FlatPropertyMap *map = find(name, i);
+    if (map) map->erase(i);
 }
     
 
@@ -168,10 +255,10 @@ PropertyType
 Event::getPropertyType(const PropertyName &name) const
     // throw (NoData)
 {
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    FlatPropertyMap::const_iterator i;
+    const FlatPropertyMap *map = find(name, i);
     if (map) {
-        return i->second->getType();
+        return i->type;
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
     }
@@ -182,10 +269,10 @@ string
 Event::getPropertyTypeAsString(const PropertyName &name) const
     // throw (NoData)
 {
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    FlatPropertyMap::const_iterator i;
+    const FlatPropertyMap *map = find(name, i);
     if (map) {
-        return i->second->getTypeName();
+        return i->getTypeName();
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
     }
@@ -196,10 +283,10 @@ string
 Event::getAsString(const PropertyName &name) const
     // throw (NoData)
 {
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    FlatPropertyMap::const_iterator i;
+    const FlatPropertyMap *map = find(name, i);
     if (map) {
-        return i->second->unparse();
+        return i->unparse();
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
     }
@@ -307,7 +394,7 @@ Event::toXmlString(timeT expectedTime) const
 void
 Event::dump(ostream& out) const
 {
-    out << "Event type : " << m_data->m_type.c_str() << '\n';
+    out << "Event type : " << m_data->m_type->c_str() << '\n';
 
     out << "\tAbsolute Time : " << m_data->m_absoluteTime
 	<< "\n\tDuration : " << m_data->m_duration
@@ -315,18 +402,18 @@ Event::dump(ostream& out) const
         << "\n\tPersistent properties : \n";
 
     if (m_data->m_properties) {
-	for (PropertyMap::const_iterator i = m_data->m_properties->begin();
+	for (FlatPropertyMap::const_iterator i = m_data->m_properties->begin();
 	     i != m_data->m_properties->end(); ++i) {
-	    out << "\t\t" << i->first.getName() << " [" << i->first.getValue() << "] \t" << *(i->second) << "\n";
+	    out << "\t\t" << i->name.getName() << " [" << i->name.getValue() << "] \t" << i->getTypeName() << " - " << i->unparse() << "\n";
 	}
     }
 
     if (m_nonPersistentProperties) {
 	out << "\n\tNon-persistent properties : \n";
 
-	for (PropertyMap::const_iterator i = m_nonPersistentProperties->begin();
+	for (FlatPropertyMap::const_iterator i = m_nonPersistentProperties->begin();
 	     i != m_nonPersistentProperties->end(); ++i) {
-	    out << "\t\t" << i->first.getName() << " [" << i->first.getValue() << "] \t" << *(i->second) << '\n';
+	    out << "\t\t" << i->name.getName() << " [" << i->name.getValue() << "] \t" << i->getTypeName() << " - " << i->unparse() << '\n';
 	}
     }
 
@@ -383,15 +470,15 @@ Event::getPropertyNames() const
 {
     PropertyNames v;
     if (m_data->m_properties) {
-	for (PropertyMap::const_iterator i = m_data->m_properties->begin();
+	for (FlatPropertyMap::const_iterator i = m_data->m_properties->begin();
 	     i != m_data->m_properties->end(); ++i) {
-	    v.push_back(i->first);
+	    v.push_back(i->name);
 	}
     }
     if (m_nonPersistentProperties) {
-	for (PropertyMap::const_iterator i = m_nonPersistentProperties->begin();
+	for (FlatPropertyMap::const_iterator i = m_nonPersistentProperties->begin();
 	     i != m_nonPersistentProperties->end(); ++i) {
-	    v.push_back(i->first);
+	    v.push_back(i->name);
 	}
     }
     return v;
@@ -402,9 +489,9 @@ Event::getPersistentPropertyNames() const
 {
     PropertyNames v;
     if (m_data->m_properties) {
-	for (PropertyMap::const_iterator i = m_data->m_properties->begin();
+	for (FlatPropertyMap::const_iterator i = m_data->m_properties->begin();
 	     i != m_data->m_properties->end(); ++i) {
-	    v.push_back(i->first);
+	    v.push_back(i->name);
 	}
     }
     return v;
@@ -415,9 +502,9 @@ Event::getNonPersistentPropertyNames() const
 {
     PropertyNames v;
     if (m_nonPersistentProperties) {
-	for (PropertyMap::const_iterator i = m_nonPersistentProperties->begin();
+	for (FlatPropertyMap::const_iterator i = m_nonPersistentProperties->begin();
 	     i != m_nonPersistentProperties->end(); ++i) {
-	    v.push_back(i->first);
+	    v.push_back(i->name);
 	}
     }
     return v;
@@ -429,6 +516,20 @@ Event::clearNonPersistentProperties()
     if (m_nonPersistentProperties) m_nonPersistentProperties->clear();
 }
 
+void
+Event::copyNonPersistentProperties(const Event &e)
+{
+    if (&e == this) return;
+
+    delete m_nonPersistentProperties;
+    m_nonPersistentProperties = 0;
+
+    if (e.m_nonPersistentProperties) {
+        m_nonPersistentProperties =
+            new FlatPropertyMap(*e.m_nonPersistentProperties);
+    }
+}
+
 void
 Event::unsafeChangeTime(timeT offset)
 {
@@ -443,19 +544,19 @@ Event::unsafeChangeTime(timeT offset)
 size_t
 Event::getStorageSize() const
 {
-    size_t s = sizeof(Event) + sizeof(EventData) + m_data->m_type.size();
+    size_t s = sizeof(Event) + sizeof(EventData);
     if (m_data->m_properties) {
-	for (PropertyMap::const_iterator i = m_data->m_properties->begin();
+	s += sizeof(FlatPropertyMap);
+	for (FlatPropertyMap::const_iterator i = m_data->m_properties->begin();
 	     i != m_data->m_properties->end(); ++i) {
-	    s += sizeof(i->first);
-	    s += i->second->getStorageSize();
+	    s += i->getStorageSize();
 	}
     }
     if (m_nonPersistentProperties) {
-	for (PropertyMap::const_iterator i = m_nonPersistentProperties->begin();
+	s += sizeof(FlatPropertyMap);
+	for (FlatPropertyMap::const_iterator i = m_nonPersistentProperties->begin();
 	     i != m_nonPersistentProperties->end(); ++i) {
-	    s += sizeof(i->first);
-	    s += i->second->getStorageSize();
+	    s += i->getStorageSize();
 	}
     }
     return s;
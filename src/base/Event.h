@@ -17,7 +17,8 @@
 #ifndef RG_EVENT_H
 #define RG_EVENT_H
 
-#include "PropertyMap.h"
+#include "AtomicCompat.h"
+#include "FlatPropertyMap.h"
 #include "Exception.h"
 
 #include <string>
@@ -25,6 +26,8 @@
 #include <iostream> // TODO remove (after changing the dump() signature)
 #include "misc/Debug.h"
 
+#include <QAtomicInt>
+
 
 namespace Rosegarden
 {
@@ -79,6 +82,14 @@ public:
                       expected + ", found " + actual + ")", file, line) { }
     };
 
+    /**
+     * The small integer an event type is interned to.  Two events have
+     * the same type exactly when they have the same type id, but the
+     * ids are given out as types are first used and may differ from
+     * one run of the program to the next, so they must not be saved.
+     */
+    typedef int TypeId;
+
     ///////////////////////////////////////////////////////////
     ////////////////////// CONSTRUCTORS ///////////////////////
     ///////////////////////////////////////////////////////////
@@ -182,12 +193,34 @@ public:
      * Returns the type of the Event (usually a Note, an Accidental, a
      * Key ... see NotationTypes.h for more examples)
      */
-    const std::string &getType() const    { return  m_data->m_type; }
+    const std::string &getType() const    { return *m_data->m_type; }
+
+    /**
+     * Returns the id the Event's type is interned to
+     */
+    TypeId getTypeId() const              { return  m_data->m_typeId; }
 
     /**
      * Tests if the Event is of the type in parameter
+     *
+     * The type names defined in NotationTypes.h and MidiTypes.h are
+     * interned as themselves, so testing against one of those, as
+     * nearly all callers do, finds a match by comparing addresses.
+     */
+    bool  isa(const std::string &t) const {
+        return (m_data->m_type == &t || *m_data->m_type == t);
+    }
+
+    /**
+     * Tests if the Event's type is the one with the given id
+     */
+    bool  isa(TypeId id) const { return (m_data->m_typeId == id); }
+
+    /**
+     * Returns the id the type in parameter is interned to
      */
-    bool  isa(const std::string &t) const { return (m_data->m_type == t); }
+    static TypeId getTypeId(const std::string &type);
+
     timeT getAbsoluteTime() const    { return m_data->m_absoluteTime; }
     timeT getDuration()     const    { return m_data->m_duration; }
     short getSubOrdering()  const    { return m_data->m_subOrdering; }
@@ -317,6 +350,12 @@ public:
      */
     void clearNonPersistentProperties();
 
+    /**
+     * Replace the non persistent properties with copies of \a e's,
+     * which the copy constructor doesn't copy
+     */
+    void copyNonPersistentProperties(const Event &e);
+
     // Move Event in time without any ancillary co-ordination.
     /**
      * UNSAFE.  Don't call this unless you know exactly what you're
@@ -399,7 +438,7 @@ protected:
         m_data(new EventData("", 0, 0, 0)),
         m_nonPersistentProperties(0) { }
 
-    void setType(const std::string &t) { unshare(); m_data->m_type = t; }
+    void setType(const std::string &t) { unshare(); m_data->setType(t); }
     void setAbsoluteTime(timeT t)      { unshare(); m_data->m_absoluteTime = t; }
     void setDuration(timeT d)          { unshare(); m_data->m_duration = d; }
     void setSubOrdering(short o)       { unshare(); m_data->m_subOrdering = o; }
@@ -413,19 +452,27 @@ private:
     {
         EventData(const std::string &type,
                   timeT absoluteTime, timeT duration, short subOrdering);
-        EventData(const std::string &type,
+        EventData(const std::string *type, TypeId typeId,
                   timeT absoluteTime, timeT duration, short subOrdering,
-                  const PropertyMap *properties);
+                  const FlatPropertyMap *properties);
         EventData *unshare();
         ~EventData();
-        unsigned int m_refCount;
 
-        std::string m_type;
+        // Atomic, so that events sharing data can be copied, changed
+        // and deleted from different threads, as Qt's implicitly
+        // shared classes can
+        QAtomicInt m_refCount;
+        TypeId m_typeId;
+
+        // The interned name, shared by all events of the type
+        const std::string *m_type;
+        void setType(const std::string &type);
+
         timeT m_absoluteTime;
         timeT m_duration;
         short m_subOrdering;
 
-        PropertyMap *m_properties;
+        FlatPropertyMap *m_properties;
 
         // These are properties because we don't care so much about
         // raw speed in get/set, but we do care about storage size for
@@ -448,15 +495,15 @@ private:
     };
 
     EventData *m_data;
-    PropertyMap *m_nonPersistentProperties; // Unique to an instance
+    FlatPropertyMap *m_nonPersistentProperties; // Unique to an instance
 
     void share(const Event &e) {
         m_data = e.m_data;
-        m_data->m_refCount++;
+        m_data->m_refCount.ref();
     }
 
     bool unshare() { // returns true if unshare was necessary
-        if (m_data->m_refCount > 1) {
+        if (atomicLoad(m_data->m_refCount) > 1) {
             m_data = m_data->unshare();
             return true;
         } else {
@@ -465,27 +512,38 @@ private:
     }
 
     void lose() {
-        if (--m_data->m_refCount == 0) delete m_data;
+        if (!m_data->m_refCount.deref()) delete m_data;
         delete m_nonPersistentProperties;
         m_nonPersistentProperties = 0;
     }
 
     // returned iterator (in i) only valid if return map value is non-zero
-    PropertyMap *find(const PropertyName &name, PropertyMap::iterator &i);
+    FlatPropertyMap *find(const PropertyName &name,
+                          FlatPropertyMap::iterator &i);
 
-    const PropertyMap *find(const PropertyName &name,
-                            PropertyMap::const_iterator &i) const {
-        PropertyMap::iterator j;
-        PropertyMap *map = const_cast<Event *>(this)->find(name, j);
+    const FlatPropertyMap *find(const PropertyName &name,
+                                FlatPropertyMap::const_iterator &i) const {
+        FlatPropertyMap::iterator j;
+        FlatPropertyMap *map = const_cast<Event *>(this)->find(name, j);
         i = j;
         return map;
     }
 
-    PropertyMap::iterator insert(const PropertyPair &pair, bool persistent) {
-        PropertyMap **map =
+    FlatPropertyMap *getMap(bool persistent) {
+        FlatPropertyMap **map =
             (persistent ? &m_data->m_properties : &m_nonPersistentProperties);
-        if (!*map) *map = new PropertyMap();
-        return (*map)->insert(pair).first;
+        if (!*map) *map = new FlatPropertyMap();
+        return *map;
+    }
+
+    FlatPropertyMap::iterator insert(const PropertyName &name,
+                                     PropertyType type, bool persistent) {
+        return getMap(persistent)->insert(name, type);
+    }
+
+    FlatPropertyMap::iterator insert(const FlatPropertyMap::Entry &entry,
+                                     bool persistent) {
+        return getMap(persistent)->insert(entry);
     }
 
 #ifndef NDEBUG
@@ -507,21 +565,20 @@ Event::get(const PropertyName &name, typename PropertyDefn<P>::basic_type &val)
     ++m_getCount;
 #endif
 
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    FlatPropertyMap::const_iterator i;
+    const FlatPropertyMap *map = find(name, i);
 
     if (map) {
 
-        PropertyStoreBase *sb = i->second;
-        if (sb->getType() == P) {
-            val = (static_cast<PropertyStore<P> *>(sb))->getData();
+        if (i->type == P) {
+            val = FlatPropertyValue<P>::get(*i);
             return true;
         }
         else {
 #ifndef NDEBUG
             RG_DEBUG << "get() Error: Attempt to get property \"" << name.getName()
                  << "\" as" << PropertyDefn<P>::typeName() <<", actual type is"
-                 << sb->getTypeName();
+                 << i->getTypeName();
 #endif
             return false;
         }
@@ -541,17 +598,16 @@ Event::get(const PropertyName &name) const
     ++m_getCount;
 #endif
 
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    FlatPropertyMap::const_iterator i;
+    const FlatPropertyMap *map = find(name, i);
 
     if (map) {
 
-        PropertyStoreBase *sb = i->second;
-        if (sb->getType() == P)
-            return (static_cast<PropertyStore<P> *>(sb))->getData();
+        if (i->type == P)
+            return FlatPropertyValue<P>::get(*i);
         else {
             throw BadType(name.getName(),
-                          PropertyDefn<P>::typeName(), sb->getTypeName(),
+                          PropertyDefn<P>::typeName(), i->getTypeName(),
                           __FILE__, __LINE__);
         }
 
@@ -571,8 +627,8 @@ bool
 Event::isPersistent(const PropertyName &name) const
     // throw (NoData)
 {
-    PropertyMap::const_iterator i;
-    const PropertyMap *map = find(name, i);
+    FlatPropertyMap::const_iterator i;
+    const FlatPropertyMap *map = find(name, i);
 
     if (map) {
         return (map == m_data->m_properties);
@@ -588,12 +644,14 @@ Event::setPersistence(const PropertyName &name, bool persistent)
     // throw (NoData)
 {
     unshare();
-    PropertyMap::iterator i;
-    PropertyMap *map = find(name, i);
+    FlatPropertyMap::iterator i;
+    FlatPropertyMap *map = find(name, i);
 
     if (map) {
-        insert(*i, persistent);
-        map->erase(i);
+        if ((map == m_data->m_properties) != persistent) {
+            insert(*i, persistent);
+            map->erase(i);
+        }
     } else {
         throw NoData(name.getName(), __FILE__, __LINE__);
     }
@@ -610,31 +668,31 @@ Event::set(const PropertyName &name, typename PropertyDefn<P>::basic_type value,
     ++m_setCount;
 #endif
 
-    // this is a little slow, could bear improvement
-
     unshare();
-    PropertyMap::iterator i;
-    PropertyMap *map = find(name, i);
+    FlatPropertyMap::iterator i;
+    FlatPropertyMap *map = find(name, i);
 
     if (map) {
         bool persistentBefore = (map == m_data->m_properties);
         if (persistentBefore != persistent) {
-            i = insert(*i, persistent);
-            map->erase(name);
+            // The two maps are distinct, so inserting into one leaves
+            // iterators into the other valid
+            FlatPropertyMap::iterator j = insert(*i, persistent);
+            map->erase(i);
+            i = j;
         }
 
-        PropertyStoreBase *sb = i->second;
-        if (sb->getType() == P) {
-            (static_cast<PropertyStore<P> *>(sb))->setData(value);
+        if (i->type == P) {
+            FlatPropertyValue<P>::set(*i, value);
         } else {
             throw BadType(name.getName(),
-                          PropertyDefn<P>::typeName(), sb->getTypeName(),
+                          PropertyDefn<P>::typeName(), i->getTypeName(),
                           __FILE__, __LINE__);
         }
 
     } else {
-        PropertyStoreBase *p = new PropertyStore<P>(value);
-        insert(PropertyPair(name, p), persistent);
+        i = insert(name, P, persistent);
+        FlatPropertyValue<P>::set(*i, value);
     }
 }
 
@@ -654,24 +712,22 @@ Event::setMaybe(const PropertyName &name, typename PropertyDefn<P>::basic_type v
 #endif
 
     unshare();
-    PropertyMap::iterator i;
-    PropertyMap *map = find(name, i);
+    FlatPropertyMap::iterator i;
+    FlatPropertyMap *map = find(name, i);
 
     if (map) {
         if (map == m_data->m_properties) return; // persistent, so ignore it
 
-        PropertyStoreBase *sb = i->second;
-
-        if (sb->getType() == P) {
-            (static_cast<PropertyStore<P> *>(sb))->setData(value);
+        if (i->type == P) {
+            FlatPropertyValue<P>::set(*i, value);
         } else {
             throw BadType(name.getName(),
-                          PropertyDefn<P>::typeName(), sb->getTypeName(),
+                          PropertyDefn<P>::typeName(), i->getTypeName(),
                           __FILE__, __LINE__);
         }
     } else {
-        PropertyStoreBase *p = new PropertyStore<P>(value);
-        insert(PropertyPair(name, p), false);
+        i = insert(name, P, false);
+        FlatPropertyValue<P>::set(*i, value);
     }
 }
 
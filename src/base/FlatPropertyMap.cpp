@@ -0,0 +1,205 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "FlatPropertyMap.h"
+
+#include <algorithm>
+
+namespace Rosegarden
+{
+using std::string;
+
+
+string
+FlatPropertyMap::Entry::getTypeName() const
+{
+    switch (type) {
+    case Int:       return PropertyDefn<Int>::typeName();
+    case String:    return PropertyDefn<String>::typeName();
+    case Bool:      return PropertyDefn<Bool>::typeName();
+    case RealTimeT: return PropertyDefn<RealTimeT>::typeName();
+    }
+    return "Undefined";
+}
+
+string
+FlatPropertyMap::Entry::unparse() const
+{
+    switch (type) {
+    case Int:
+        return PropertyDefn<Int>::unparse(FlatPropertyValue<Int>::get(*this));
+    case String:
+        return PropertyDefn<String>::unparse(FlatPropertyValue<String>::get(*this));
+    case Bool:
+        return PropertyDefn<Bool>::unparse(FlatPropertyValue<Bool>::get(*this));
+    case RealTimeT:
+        return PropertyDefn<RealTimeT>::unparse(FlatPropertyValue<RealTimeT>::get(*this));
+    }
+    return "";
+}
+
+size_t
+FlatPropertyMap::Entry::getStorageSize() const
+{
+    if (type == String) return sizeof(*this) + sizeof(string) + value.s->size();
+    return sizeof(*this);
+}
+
+
+FlatPropertyMap::FlatPropertyMap(const FlatPropertyMap &pm) :
+    m_entries(0),
+    m_size(0),
+    m_capacity(0)
+{
+    if (pm.m_size == 0) return;
+
+    m_entries = new Entry[pm.m_size];
+    m_capacity = pm.m_size;
+
+    for (unsigned int i = 0; i < pm.m_size; ++i) {
+        m_entries[i].name = pm.m_entries[i].name;
+        m_entries[i].type = pm.m_entries[i].type;
+        copyValue(m_entries[i], pm.m_entries[i]);
+    }
+    m_size = pm.m_size;
+}
+
+FlatPropertyMap::~FlatPropertyMap()
+{
+    clear();
+    delete[] m_entries;
+}
+
+void
+FlatPropertyMap::clear()
+{
+    for (unsigned int i = 0; i < m_size; ++i) destroyValue(m_entries[i]);
+    m_size = 0;
+}
+
+FlatPropertyMap::iterator
+FlatPropertyMap::lowerBound(const PropertyName &name)
+{
+    // Most events have only a handful of properties, for which a
+    // linear scan beats a binary search
+
+    if (m_size <= 8) {
+        iterator i = begin();
+        while (i != end() && i->name < name) ++i;
+        return i;
+    }
+
+    iterator lo = begin();
+    size_t n = m_size;
+    while (n > 0) {
+        size_t half = n / 2;
+        iterator mid = lo + half;
+        if (mid->name < name) {
+            lo = mid + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+    return lo;
+}
+
+FlatPropertyMap::iterator
+FlatPropertyMap::makeSlot(iterator at)
+{
+    size_t index = at - m_entries;
+
+    if (m_size == m_capacity) {
+        unsigned int capacity = (m_capacity == 0 ? 4 : m_capacity * 2);
+        Entry *entries = new Entry[capacity];
+        // Values are moved bitwise: ownership of any string passes to
+        // the new array along with the pointer
+        std::copy(m_entries, m_entries + index, entries);
+        std::copy(m_entries + index, m_entries + m_size, entries + index + 1);
+        delete[] m_entries;
+        m_entries = entries;
+        m_capacity = capacity;
+    } else {
+        std::copy_backward(m_entries + index, m_entries + m_size,
+                           m_entries + m_size + 1);
+    }
+
+    ++m_size;
+    return m_entries + index;
+}
+
+FlatPropertyMap::iterator
+FlatPropertyMap::insert(const PropertyName &name, PropertyType type)
+{
+    iterator i = lowerBound(name);
+    if (i != end() && i->name == name) return i;
+
+    i = makeSlot(i);
+    i->name = name;
+    i->type = type;
+    initValue(*i);
+    return i;
+}
+
+FlatPropertyMap::iterator
+FlatPropertyMap::insert(const Entry &entry)
+{
+    iterator i = lowerBound(entry.name);
+
+    if (i != end() && i->name == entry.name) {
+        destroyValue(*i);
+    } else {
+        i = makeSlot(i);
+        i->name = entry.name;
+    }
+
+    i->type = entry.type;
+    copyValue(*i, entry);
+    return i;
+}
+
+void
+FlatPropertyMap::erase(iterator i)
+{
+    destroyValue(*i);
+    std::copy(i + 1, end(), i);
+    --m_size;
+}
+
+void
+FlatPropertyMap::initValue(Entry &e)
+{
+    switch (e.type) {
+    case Int:       e.value.i = 0; break;
+    case String:    e.value.s = new string(); break;
+    case Bool:      e.value.b = false; break;
+    case RealTimeT: e.value.rt.sec = e.value.rt.nsec = 0; break;
+    }
+}
+
+void
+FlatPropertyMap::copyValue(Entry &to, const Entry &from)
+{
+    if (from.type == String) to.value.s = new string(*from.value.s);
+    else to.value = from.value;
+}
+
+void
+FlatPropertyMap::destroyValue(Entry &e)
+{
+    if (e.type == String) delete e.value.s;
+}
+
+}
@@ -0,0 +1,164 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_FLAT_PROPERTY_MAP_H
+#define RG_FLAT_PROPERTY_MAP_H
+
+#include "Property.h"
+#include "base/PropertyName.h"
+
+#include <string>
+#include <cstddef>
+
+namespace Rosegarden
+{
+
+/**
+ * FlatPropertyMap is the property storage used by Event.
+ *
+ * Unlike PropertyMap, which is a std::map of individually allocated
+ * and virtual PropertyStore objects, this keeps all of its entries in
+ * a single contiguous array sorted by the interned PropertyName value.
+ * Each entry holds its value in a tagged union, so the only per-
+ * property heap allocation is for the text of String properties.
+ *
+ * Events rarely have more than a dozen properties, so a lookup is a
+ * short binary search over one cache-friendly block rather than a walk
+ * through tree nodes scattered across the heap.
+ *
+ * Iterators are plain pointers into the array and are invalidated by
+ * any insertion or removal.
+ */
+class FlatPropertyMap
+{
+public:
+    struct Entry
+    {
+        PropertyName name;
+        PropertyType type;
+        union {
+            long i;
+            bool b;
+            struct { int sec; int nsec; } rt;
+            std::string *s;
+        } value;
+
+        std::string getTypeName() const;
+        std::string unparse() const;
+        size_t getStorageSize() const;
+    };
+
+    typedef Entry *iterator;
+    typedef const Entry *const_iterator;
+
+    FlatPropertyMap() : m_entries(0), m_size(0), m_capacity(0) { }
+    FlatPropertyMap(const FlatPropertyMap &);
+    ~FlatPropertyMap();
+
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+
+    iterator begin() { return m_entries; }
+    iterator end() { return m_entries + m_size; }
+    const_iterator begin() const { return m_entries; }
+    const_iterator end() const { return m_entries + m_size; }
+
+    /// Return the entry for name, or end() if there is none.
+    iterator find(const PropertyName &name) {
+        iterator i = lowerBound(name);
+        if (i != end() && i->name == name) return i;
+        return end();
+    }
+    const_iterator find(const PropertyName &name) const {
+        return const_cast<FlatPropertyMap *>(this)->find(name);
+    }
+
+    /**
+     * Return the entry for name, creating it with the given type and a
+     * default value if it doesn't exist yet.  The type of an existing
+     * entry is left unchanged.
+     */
+    iterator insert(const PropertyName &name, PropertyType type);
+
+    /**
+     * Insert a deep copy of an entry taken from another map, replacing
+     * any existing entry of the same name.
+     */
+    iterator insert(const Entry &entry);
+
+    void erase(iterator i);
+    void clear();
+
+private:
+    FlatPropertyMap &operator=(const FlatPropertyMap &); // not provided
+
+    iterator lowerBound(const PropertyName &name);
+    iterator makeSlot(iterator at);
+
+    static void initValue(Entry &e);
+    static void copyValue(Entry &to, const Entry &from);
+    static void destroyValue(Entry &e);
+
+    Entry *m_entries;
+    unsigned int m_size;
+    unsigned int m_capacity;
+};
+
+
+/**
+ * Typed access to the value held in a FlatPropertyMap::Entry.  The
+ * caller is responsible for checking that the entry's type is P.
+ */
+template <PropertyType P>
+struct FlatPropertyValue
+{
+};
+
+template <>
+struct FlatPropertyValue<Int>
+{
+    static long get(const FlatPropertyMap::Entry &e) { return e.value.i; }
+    static void set(FlatPropertyMap::Entry &e, long v) { e.value.i = v; }
+};
+
+template <>
+struct FlatPropertyValue<String>
+{
+    static std::string get(const FlatPropertyMap::Entry &e) { return *e.value.s; }
+    static void set(FlatPropertyMap::Entry &e, const std::string &v) { *e.value.s = v; }
+};
+
+template <>
+struct FlatPropertyValue<Bool>
+{
+    static bool get(const FlatPropertyMap::Entry &e) { return e.value.b; }
+    static void set(FlatPropertyMap::Entry &e, bool v) { e.value.b = v; }
+};
+
+template <>
+struct FlatPropertyValue<RealTimeT>
+{
+    static RealTime get(const FlatPropertyMap::Entry &e) {
+        return RealTime(e.value.rt.sec, e.value.rt.nsec);
+    }
+    static void set(FlatPropertyMap::Entry &e, const RealTime &v) {
+        e.value.rt.sec = v.sec;
+        e.value.rt.nsec = v.nsec;
+    }
+};
+
+}
+
+#endif
@@ -45,12 +45,8 @@ public:
 	m_simplicityFactor(13),
 	m_maxTuplet(3),
 	m_articulate(true),
-	m_q(q),
-	m_provisionalBase("notationquantizer-provisionalBase"),
-	m_provisionalAbsTime("notationquantizer-provisionalAbsTime"),
-	m_provisionalDuration("notationquantizer-provisionalDuration"),
-	m_provisionalNoteType("notationquantizer-provisionalNoteType"),
-	m_provisionalScore("notationquantizer-provisionalScore")
+	m_contrapuntal(false),
+	m_q(q)
     { }
 
     Impl(const Impl &i) :
@@ -58,25 +54,65 @@ public:
 	m_simplicityFactor(i.m_simplicityFactor),
 	m_maxTuplet(i.m_maxTuplet),
 	m_articulate(i.m_articulate),
-	m_q(i.m_q),
-	m_provisionalBase(i.m_provisionalBase),
-	m_provisionalAbsTime(i.m_provisionalAbsTime),
-	m_provisionalDuration(i.m_provisionalDuration),
-	m_provisionalNoteType(i.m_provisionalNoteType),
-	m_provisionalScore(i.m_provisionalScore)
+	m_contrapuntal(i.m_contrapuntal),
+	m_q(i.m_q)
     { }
 
+    // The values we work out for each event along the way, before
+    // setting the final ones.  Kept here rather than as properties on
+    // the events, which would mean several property map insertions
+    // and removals for every note.
+    struct Provisional {
+	enum { AbsTime = 1, Duration = 2, Base = 4, NoteType = 8, Score = 16 };
+	Provisional() :
+	    flags(0), absTime(0), duration(0), base(0), noteType(0), score(0) { }
+	int flags;
+	timeT absTime;
+	timeT duration;
+	timeT base;
+	int noteType;
+	long score;
+    };
+
+    // Provisional values for the events in the range being quantized,
+    // in an array parallel to the events in segment order, with an
+    // open-addressed hash table from event to index for looking them
+    // up.  Each call to quantizeRange makes its own and passes it
+    // down to the passes, so that calls may run in several threads.
+    class Scratch {
+    public:
+	Scratch(Segment::iterator from, Segment::iterator to);
+
+	// Returns 0 if the event isn't one of ours
+	Provisional *find(const Event *e);
+
+	void setProvisional(Event *, ValueType value, timeT t);
+	timeT getProvisional(Event *, ValueType value);
+	bool getProvisional(Event *, ValueType value, timeT &t);
+
+    private:
+	size_t slotFor(const Event *e) const {
+	    // Events are heap allocated, so the low bits say little
+	    return ((size_t(e) >> 4) * 2654435761u) & m_mask;
+	}
+
+	std::vector<Provisional> m_values;
+	std::vector<const Event *> m_slots;
+	std::vector<size_t> m_slotIndices;
+	size_t m_mask;
+    };
+
     class ProvisionalQuantizer : public Quantizer {
 	// This class exists only to pick out the provisional abstime
 	// and duration values from half-quantized events, so that we
 	// can treat them using the normal Chord class
     public:
-	ProvisionalQuantizer(Impl *i) : Quantizer("blah", "blahblah"), m_impl(i) { }
+	ProvisionalQuantizer(Scratch *s) : Quantizer("blah", "blahblah"), m_scratch(s) { }
 	virtual timeT getQuantizedDuration(const Event *e) const {
-	    return m_impl->getProvisional((Event *)e, DurationValue);
+	    return m_scratch->getProvisional((Event *)e, DurationValue);
 	}
 	virtual timeT getQuantizedAbsoluteTime(const Event *e) const {
-	    timeT t = m_impl->getProvisional((Event *)e, AbsoluteTimeValue);
+	    timeT t = m_scratch->getProvisional((Event *)e, AbsoluteTimeValue);
 #ifdef DEBUG_NOTATION_QUANTIZER
 	    cout << "ProvisionalQuantizer::getQuantizedAbsoluteTime: returning " << t << endl;
 #endif
@@ -84,37 +120,35 @@ public:
 	}
 
     private:
-	Impl *m_impl;
+	Scratch *m_scratch;
     };
 
     void quantizeRange(Segment *,
 		       Segment::iterator,
 		       Segment::iterator) const;
 
-    void quantizeAbsoluteTime(Segment *, Segment::iterator) const;
-    long scoreAbsoluteTimeForBase(Segment *, const Segment::iterator &,
+    void quantizeAbsoluteTime(Scratch &, Segment *, Segment::iterator) const;
+    long scoreAbsoluteTimeForBase(Scratch &, Segment *,
+                                  const Segment::iterator &,
 				  int depth, timeT base, timeT sigTime,
 				  timeT t, timeT d, int noteType,
 				  const Segment::iterator &,
 				  const Segment::iterator &,
 				  bool &right) const;
-    void quantizeDurationProvisional(Segment *, Segment::iterator) const;
-    void quantizeDuration(Segment *, Chord &) const;
+    void quantizeDurationProvisional(Scratch &, Segment *,
+                                     Segment::iterator) const;
+    void quantizeDuration(Scratch &, Segment *, Chord &) const;
 
-    void scanTupletsInBar(Segment *,
+    void scanTupletsInBar(Scratch &, Segment *,
 			  timeT barStart, timeT barDuration,
 			  timeT wholeStart, timeT wholeDuration,
 			  const std::vector<int> &divisions) const;
-    void scanTupletsAt(Segment *, Segment::iterator, int depth,
+    void scanTupletsAt(Scratch &, Segment *, Segment::iterator, int depth,
 		       timeT base, timeT barStart,
 		       timeT tupletStart, timeT tupletBase) const;
-    bool isValidTupletAt(Segment *, const Segment::iterator &,
+    bool isValidTupletAt(Scratch &, Segment *, const Segment::iterator &,
 			 int depth, timeT base, timeT sigTime,
 			 timeT tupletBase) const;
-    
-    void setProvisional(Event *, ValueType value, timeT t) const;
-    timeT getProvisional(Event *, ValueType value) const;
-    void unsetProvisionalProperties(Event *) const;
 
     timeT m_unit;
     int m_simplicityFactor;
@@ -124,12 +158,6 @@ public:
 
 private:
     NotationQuantizer *const m_q;
-
-    PropertyName m_provisionalBase;
-    PropertyName m_provisionalAbsTime;
-    PropertyName m_provisionalDuration;
-    PropertyName m_provisionalNoteType;
-    PropertyName m_provisionalScore;
 };
 
 NotationQuantizer::NotationQuantizer() :
@@ -218,42 +246,90 @@ NotationQuantizer::getArticulate() const
     return m_impl->m_articulate;
 }
 
+NotationQuantizer::Impl::Scratch::Scratch(Segment::iterator from,
+					   Segment::iterator to)
+{
+    std::vector<const Event *> events;
+    for (Segment::iterator i = from; i != to; ++i) {
+	if ((*i)->isa(Note::EventRestType)) continue; // erased as we go
+	events.push_back(*i);
+    }
+
+    m_values.resize(events.size());
+
+    // At most half full
+    size_t size = 16;
+    while (size < events.size() * 2) size *= 2;
+    m_slots.resize(size, 0);
+    m_slotIndices.resize(size, 0);
+    m_mask = size - 1;
+
+    for (size_t i = 0; i < events.size(); ++i) {
+	size_t slot = slotFor(events[i]);
+	while (m_slots[slot]) slot = (slot + 1) & m_mask;
+	m_slots[slot] = events[i];
+	m_slotIndices[slot] = i;
+    }
+}
+
+NotationQuantizer::Impl::Provisional *
+NotationQuantizer::Impl::Scratch::find(const Event *e)
+{
+    size_t slot = slotFor(e);
+    while (m_slots[slot]) {
+	if (m_slots[slot] == e) return &m_values[m_slotIndices[slot]];
+	slot = (slot + 1) & m_mask;
+    }
+    return 0;
+}
+
 void
-NotationQuantizer::Impl::setProvisional(Event *e, ValueType v, timeT t) const
+NotationQuantizer::Impl::Scratch::setProvisional(Event *e, ValueType v, timeT t)
 {
+    Provisional *p = find(e);
+    if (!p) return;
+
     if (v == AbsoluteTimeValue) {
-	e->setMaybe<Int>(m_provisionalAbsTime, t);
+	p->absTime = t;
+	p->flags |= Provisional::AbsTime;
     } else {
-	e->setMaybe<Int>(m_provisionalDuration, t);
+	p->duration = t;
+	p->flags |= Provisional::Duration;
     }
 }
 
 timeT
-NotationQuantizer::Impl::getProvisional(Event *e, ValueType v) const
+NotationQuantizer::Impl::Scratch::getProvisional(Event *e, ValueType v)
 {
     timeT t;
     if (v == AbsoluteTimeValue) {
 	t = e->getAbsoluteTime();
-	e->get<Int>(m_provisionalAbsTime, t);
     } else {
 	t = e->getDuration();
-	e->get<Int>(m_provisionalDuration, t);
     }
+    getProvisional(e, v, t);
     return t;
 }
 
-void
-NotationQuantizer::Impl::unsetProvisionalProperties(Event *e) const
+bool
+NotationQuantizer::Impl::Scratch::getProvisional(Event *e, ValueType v, timeT &t)
 {
-    e->unset(m_provisionalBase);
-    e->unset(m_provisionalAbsTime);
-    e->unset(m_provisionalDuration);
-    e->unset(m_provisionalNoteType);
-    e->unset(m_provisionalScore);
+    Provisional *p = find(e);
+    if (!p) return false;
+
+    if (v == AbsoluteTimeValue) {
+	if (!(p->flags & Provisional::AbsTime)) return false;
+	t = p->absTime;
+    } else {
+	if (!(p->flags & Provisional::Duration)) return false;
+	t = p->duration;
+    }
+    return true;
 }
 
 void
-NotationQuantizer::Impl::quantizeAbsoluteTime(Segment *s, Segment::iterator i) const
+NotationQuantizer::Impl::quantizeAbsoluteTime(Scratch &scratch, Segment *s,
+					      Segment::iterator i) const
 {
     Profiler profiler("NotationQuantizer::Impl::quantizeAbsoluteTime");
 
@@ -263,9 +339,14 @@ NotationQuantizer::Impl::quantizeAbsoluteTime(Segment *s, Segment::iterator i) c
     timeT t = m_q->getFromSource(*i, AbsoluteTimeValue);
     timeT sigTime = comp->getTimeSignatureAt(t, timeSig);
 
-    timeT d = getProvisional(*i, DurationValue);
+    Provisional *provisional = scratch.find(*i);
+
+    timeT d = scratch.getProvisional(*i, DurationValue);
     int noteType = Note::getNearestNote(d).getNoteType();
-    (*i)->setMaybe<Int>(m_provisionalNoteType, noteType);
+    if (provisional) {
+	provisional->noteType = noteType;
+	provisional->flags |= Provisional::NoteType;
+    }
 
     int maxDepth = 8 - noteType;
     if (maxDepth < 4) maxDepth = 4;
@@ -330,7 +411,7 @@ NotationQuantizer::Impl::quantizeAbsoluteTime(Segment *s, Segment::iterator i) c
 	base /= divisions[depth];
 	if (base < m_unit) break;
 	bool right = false;
-	long score = scoreAbsoluteTimeForBase(s, i, depth, base, sigTime,
+	long score = scoreAbsoluteTimeForBase(scratch, s, i, depth, base, sigTime,
 					      t, d, noteType, n, nprime, right);
 
 	if (depth == 0 || score < bestScore) {
@@ -372,13 +453,17 @@ NotationQuantizer::Impl::quantizeAbsoluteTime(Segment *s, Segment::iterator i) c
 #endif
     }
 
-    setProvisional(*i, AbsoluteTimeValue, t);
-    (*i)->setMaybe<Int>(m_provisionalBase, bestBase);
-    (*i)->setMaybe<Int>(m_provisionalScore, bestScore);
+    scratch.setProvisional(*i, AbsoluteTimeValue, t);
+    if (provisional) {
+	provisional->base = bestBase;
+	provisional->score = bestScore;
+	provisional->flags |= Provisional::Base | Provisional::Score;
+    }
 }
 
 long
-NotationQuantizer::Impl::scoreAbsoluteTimeForBase(Segment *s,
+NotationQuantizer::Impl::scoreAbsoluteTimeForBase(Scratch &scratch,
+						  Segment *s,
 						  const Segment::iterator & /* i */,
 						  int depth,
 						  timeT base,
@@ -438,12 +523,12 @@ NotationQuantizer::Impl::scoreAbsoluteTimeForBase(Segment *s,
 	if (!right) {
 	    if (n != s->end()) {
 		if (n != nprime) {
-		    timeT nt = getProvisional(*n, AbsoluteTimeValue);
+		    timeT nt = scratch.getProvisional(*n, AbsoluteTimeValue);
 		    if (t - distance == nt) penalty2 = penalty2 * 2 / 3;
 		}
 		if (nprime != s->end()) {
-		    timeT npt = getProvisional(*nprime, AbsoluteTimeValue);
-		    timeT npd = getProvisional(*nprime, DurationValue);
+		    timeT npt = scratch.getProvisional(*nprime, AbsoluteTimeValue);
+		    timeT npd = scratch.getProvisional(*nprime, DurationValue);
 		    if (t - distance <= npt) penalty2 *= 4;
 		    else if (t - distance < npt + npd) penalty2 *= 2;
 		    else if (t - distance == npt + npd) penalty2 = penalty2 * 2 / 3;
@@ -478,8 +563,8 @@ NotationQuantizer::Impl::scoreAbsoluteTimeForBase(Segment *s,
 }
     
 void
-NotationQuantizer::Impl::quantizeDurationProvisional(Segment *, Segment::iterator i)
-    const
+NotationQuantizer::Impl::quantizeDurationProvisional(Scratch &scratch, Segment *,
+						     Segment::iterator i) const
 {
     Profiler profiler("NotationQuantizer::Impl::quantizeDurationProvisional");
 
@@ -488,7 +573,7 @@ NotationQuantizer::Impl::quantizeDurationProvisional(Segment *, Segment::iterato
 
     timeT d = m_q->getFromSource(*i, DurationValue);
     if (d == 0) {
-	setProvisional(*i, DurationValue, d);
+	scratch.setProvisional(*i, DurationValue, d);
 	return;
     }
 
@@ -526,7 +611,7 @@ NotationQuantizer::Impl::quantizeDurationProvisional(Segment *, Segment::iterato
 	}
     }
 
-    setProvisional(*i, DurationValue, time);
+    scratch.setProvisional(*i, DurationValue, time);
 
     if ((*i)->has(BEAMED_GROUP_TUPLET_BASE)) {
 	// We're going to recalculate these, and use our own results
@@ -540,10 +625,13 @@ NotationQuantizer::Impl::quantizeDurationProvisional(Segment *, Segment::iterato
 }
 
 void
-NotationQuantizer::Impl::quantizeDuration(Segment *s, Chord &c) const
+NotationQuantizer::Impl::quantizeDuration(Scratch &scratch, Segment *s,
+					  Chord &c) const
 {
+#ifdef DEBUG_NOTATION_QUANTIZER
     static int totalFracCount = 0;
     static float totalFrac = 0;
+#endif
 
     Profiler profiler("NotationQuantizer::Impl::quantizeDuration");
 
@@ -557,7 +645,7 @@ NotationQuantizer::Impl::quantizeDuration(Segment *s, Chord &c) const
 //    timeT t = m_q->getFromSource(*c.getInitialElement(), AbsoluteTimeValue);
 //    timeT sigTime = comp->getTimeSignatureAt(t, timeSig);
 
-    timeT d = getProvisional(*c.getInitialElement(), DurationValue);
+    timeT d = scratch.getProvisional(*c.getInitialElement(), DurationValue);
     int noteType = Note::getNearestNote(d).getNoteType();
     int maxDepth = 8 - noteType;
     if (maxDepth < 4) maxDepth = 4;
@@ -567,7 +655,7 @@ NotationQuantizer::Impl::quantizeDuration(Segment *s, Chord &c) const
     Segment::iterator nextNote = c.getNextNote();
     timeT nextNoteTime =
 	(s->isBeforeEndMarker(nextNote) ?
-	 getProvisional(*nextNote, AbsoluteTimeValue) :
+	 scratch.getProvisional(*nextNote, AbsoluteTimeValue) :
 	 s->getEndMarkerTime());
 
     timeT nonContrapuntalDuration = 0;
@@ -575,7 +663,9 @@ NotationQuantizer::Impl::quantizeDuration(Segment *s, Chord &c) const
     for (Chord::iterator ci = c.begin(); ci != c.end(); ++ci) {
 
 	if (!(**ci)->isa(Note::EventType)) continue;
-	if ((**ci)->has(m_provisionalDuration) &&
+	Provisional *provisional = scratch.find(**ci);
+
+	if (provisional && (provisional->flags & Provisional::Duration) &&
 	    (**ci)->has(BEAMED_GROUP_TUPLET_BASE)) {
 	    // dealt with already in tuplet code, we'd only mess it up here
 #ifdef DEBUG_NOTATION_QUANTIZER
@@ -592,7 +682,7 @@ NotationQuantizer::Impl::quantizeDuration(Segment *s, Chord &c) const
 #ifdef DEBUG_NOTATION_QUANTIZER 
 		cout << "setting duration trivially to " << nonContrapuntalDuration << endl;
 #endif
-		setProvisional(**ci, DurationValue, nonContrapuntalDuration);
+		scratch.setProvisional(**ci, DurationValue, nonContrapuntalDuration);
 		continue;
 	    } else {
 		// establish whose duration to use, then set it at the
@@ -605,7 +695,7 @@ NotationQuantizer::Impl::quantizeDuration(Segment *s, Chord &c) const
 	    ud = m_q->getFromSource(**ci, DurationValue);
 	}
 
-	timeT qt = getProvisional(**ci, AbsoluteTimeValue);
+	timeT qt = scratch.getProvisional(**ci, AbsoluteTimeValue);
 
 #ifdef DEBUG_NOTATION_QUANTIZER
 	cout << "note at time " << (**ci)->getAbsoluteTime() << " (provisional time " << qt << ")" << endl;
@@ -625,15 +715,17 @@ NotationQuantizer::Impl::quantizeDuration(Segment *s, Chord &c) const
 		  << bases.first << " and " << bases.second << endl;
 #endif
 
-	timeT qd = getProvisional(**ci, DurationValue);
+	timeT qd = scratch.getProvisional(**ci, DurationValue);
 
 	timeT spaceAvailable = nextNoteTime - qt;
 	
+#ifdef DEBUG_NOTATION_QUANTIZER
 	if (spaceAvailable > 0) {
 	    float frac = float(ud) / float(spaceAvailable);
 	    totalFrac += frac;
 	    totalFracCount += 1;
 	}
+#endif
 
 	if (!m_contrapuntal && qd > spaceAvailable) {
 
@@ -654,7 +746,9 @@ NotationQuantizer::Impl::quantizeDuration(Segment *s, Chord &c) const
 	    if (bases.first == 0) return;
 	    
 	    timeT absTimeBase = bases.first;
-	    (**ci)->get<Int>(m_provisionalBase, absTimeBase);
+	    if (provisional && (provisional->flags & Provisional::Base)) {
+		absTimeBase = provisional->base;
+	    }
 
 	    spaceAvailable = std::min(spaceAvailable, 
 				      comp->getBarEndForTime(qt) - qt);
@@ -710,7 +804,7 @@ NotationQuantizer::Impl::quantizeDuration(Segment *s, Chord &c) const
 	    }
 	}
 
-	setProvisional(**ci, DurationValue, qd);
+	scratch.setProvisional(**ci, DurationValue, qd);
 	if (!m_contrapuntal) nonContrapuntalDuration = qd;
     }
 
@@ -721,7 +815,7 @@ NotationQuantizer::Impl::quantizeDuration(Segment *s, Chord &c) const
 
 
 void
-NotationQuantizer::Impl::scanTupletsInBar(Segment *s,
+NotationQuantizer::Impl::scanTupletsInBar(Scratch &scratch, Segment *s,
 					  timeT barStart,
 					  timeT barDuration,
 					  timeT wholeStart,
@@ -771,7 +865,7 @@ NotationQuantizer::Impl::scanTupletsInBar(Segment *s,
 
 	    while (s->isBeforeEndMarker(j) &&
 		   (!(*j)->isa(Note::EventType) ||
-		    !(*j)->get<Int>(m_provisionalAbsTime, jTime) ||
+		    !scratch.getProvisional(*j, AbsoluteTimeValue, jTime) ||
 		    jTime < tupletStart)) {
 		if ((*j)->getAbsoluteTime() > tupletEnd + tupletBase / 3) {
 		    break;
@@ -787,7 +881,7 @@ NotationQuantizer::Impl::scanTupletsInBar(Segment *s,
 		continue;
 	    }
 
-	    scanTupletsAt(s, j, depth+1, base, barStart,
+	    scanTupletsAt(scratch, s, j, depth+1, base, barStart,
 			  tupletStart, tupletBase);
 
 	    tupletStart = tupletEnd;
@@ -797,7 +891,7 @@ NotationQuantizer::Impl::scanTupletsInBar(Segment *s,
 	
 
 void
-NotationQuantizer::Impl::scanTupletsAt(Segment *s,
+NotationQuantizer::Impl::scanTupletsAt(Scratch &scratch, Segment *s,
 				       Segment::iterator i,
 				       int depth,
 				       timeT base,
@@ -816,7 +910,7 @@ NotationQuantizer::Impl::scanTupletsAt(Segment *s,
 
     while (s->isBeforeEndMarker(j) &&
 	   ((*j)->isa(Note::EventRestType) ||
-	    ((*j)->get<Int>(m_provisionalAbsTime, jTime) &&
+	    (scratch.getProvisional(*j, AbsoluteTimeValue, jTime) &&
 	     jTime < tupletEnd))) {
 	
 	if (!(*j)->isa(Note::EventType)) { ++j; continue; }
@@ -834,16 +928,16 @@ NotationQuantizer::Impl::scanTupletsAt(Segment *s,
 	    return;
 	}
 
-	timeT originalBase;
+	Provisional *provisional = scratch.find(*j);
 
-	if (!(*j)->get<Int>(m_provisionalBase, originalBase)) {
+	if (!provisional || !(provisional->flags & Provisional::Base)) {
 #ifdef DEBUG_NOTATION_QUANTIZER
 	    cout << "some notes not provisionally quantized, no good" << endl;
 #endif
 	    return;
 	}
 
-	if (originalBase == base) {
+	if (provisional->base == base) {
 #ifdef DEBUG_NOTATION_QUANTIZER
 	    cout << "accepting note at original base" << endl;
 #endif
@@ -860,7 +954,7 @@ NotationQuantizer::Impl::scanTupletsAt(Segment *s,
 	    // anything from that).  Reject the entire group if it fails
 	    // any of the likelihood tests for tuplets.
 
-	    if (!isValidTupletAt(s, j, depth, base, sigTime, tupletBase)) {
+	    if (!isValidTupletAt(scratch, s, j, depth, base, sigTime, tupletBase)) {
 #ifdef DEBUG_NOTATION_QUANTIZER
 		cout << "no good" << endl;
 #endif
@@ -922,8 +1016,8 @@ NotationQuantizer::Impl::scanTupletsAt(Segment *s,
 
 	t += tupletStart;
 
-	setProvisional(*ei, AbsoluteTimeValue, t);
-	setProvisional(*ei, DurationValue, tupletBase);
+	scratch.setProvisional(*ei, AbsoluteTimeValue, t);
+	scratch.setProvisional(*ei, DurationValue, tupletBase);
     }
 
     // fill in with tupleted rests
@@ -949,7 +1043,7 @@ NotationQuantizer::Impl::scanTupletsAt(Segment *s,
 }
 
 bool
-NotationQuantizer::Impl::isValidTupletAt(Segment *s,
+NotationQuantizer::Impl::isValidTupletAt(Scratch &scratch, Segment *s,
 					 const Segment::iterator &i,
 					 int depth,
 					 timeT /* base */,
@@ -983,17 +1077,19 @@ NotationQuantizer::Impl::isValidTupletAt(Segment *s,
 	return false;
     }
 
-    long score = 0;
-    if (!(*i)->get<Int>(m_provisionalScore, score)) return false;
+    Provisional *provisional = scratch.find(*i);
+    if (!provisional || !(provisional->flags & Provisional::Score)) return false;
+    long score = provisional->score;
 
     timeT t = m_q->getFromSource(*i, AbsoluteTimeValue);
-    timeT d = getProvisional(*i, DurationValue);
-    int noteType = (*i)->get<Int>(m_provisionalNoteType);
+    timeT d = scratch.getProvisional(*i, DurationValue);
+    int noteType = provisional->noteType;
 
     //!!! not as complete as the calculation we do in the original scoring
     bool dummy;
     long tupletScore = scoreAbsoluteTimeForBase
-	(s, i, depth, tupletBase, sigTime, t, d, noteType, s->end(), s->end(), dummy);
+	(scratch, s, i, depth, tupletBase, sigTime, t, d, noteType,
+	 s->end(), s->end(), dummy);
 #ifdef DEBUG_NOTATION_QUANTIZER
     cout << "\nNotationQuantizer::isValidTupletAt: score " << score
 	 << " vs tupletScore " << tupletScore << endl;
@@ -1041,10 +1137,11 @@ NotationQuantizer::Impl::quantizeRange(Segment *s,
     // which things are chords.  We need to assign absolute times to
     // all events, but we only need do durations for notes.
 
-    PropertyName provisionalBase("notationquantizer-provisionalBase");
+    Scratch scratch(from, to);
 
     // We don't use setToTarget until we have our final values ready,
-    // as it erases and replaces the events.  Just set the properties.
+    // as it erases and replaces the events.  Just set the provisional
+    // values.
 
     // Set a provisional duration to each note first
 
@@ -1053,7 +1150,7 @@ NotationQuantizer::Impl::quantizeRange(Segment *s,
 	++events;
 	if ((*i)->isa(Note::EventRestType)) continue;
 	if ((*i)->isa(Note::EventType)) ++notes;
-	quantizeDurationProvisional(s, i);
+	quantizeDurationProvisional(scratch, s, i);
     }
     ++passes;
 
@@ -1073,10 +1170,10 @@ NotationQuantizer::Impl::quantizeRange(Segment *s,
 	    continue;
 	}
 
-	quantizeAbsoluteTime(s, i);
+	quantizeAbsoluteTime(scratch, s, i);
 
-	timeT t0 = (*i)->get<Int>(m_provisionalAbsTime);
-	timeT t1 = (*i)->get<Int>(m_provisionalDuration) + t0;
+	timeT t0 = scratch.getProvisional(*i, AbsoluteTimeValue);
+	timeT t1 = scratch.getProvisional(*i, DurationValue) + t0;
 	if (wholeStart == wholeEnd) {
 	    wholeStart = t0;
 	    wholeEnd = t1;
@@ -1101,14 +1198,14 @@ NotationQuantizer::Impl::quantizeRange(Segment *s,
 	    bool isNew = false;
 	    TimeSignature timeSig = comp->getTimeSignatureInBar(barNo, isNew);
 	    if (isNew) timeSig.getDivisions(7, divisions);
-	    scanTupletsInBar(s, comp->getBarStart(barNo),
+	    scanTupletsInBar(scratch, s, comp->getBarStart(barNo),
 			     timeSig.getBarDuration(),
 			     wholeStart, wholeEnd, divisions);
 	}
 	++passes;
     }
     
-    ProvisionalQuantizer provisionalQuantizer((Impl *)this);
+    ProvisionalQuantizer provisionalQuantizer(&scratch);
 
     for (i = from; i != to; ++i) {
 
@@ -1121,7 +1218,7 @@ NotationQuantizer::Impl::quantizeRange(Segment *s,
 //	Chord c(*s, i, m_q);
 	Chord c(*s, i, &provisionalQuantizer);
 
-	quantizeDuration(s, c);
+	quantizeDuration(scratch, s, c);
 
 	bool ended = false;
 	for (Segment::iterator ci = c.getInitialElement();
@@ -1143,7 +1240,7 @@ NotationQuantizer::Impl::quantizeRange(Segment *s,
 
 	    if (!(*i)->isa(Note::EventType)) continue;
 
-	    timeT qd = getProvisional(*i, DurationValue);
+	    timeT qd = scratch.getProvisional(*i, DurationValue);
 	    timeT ud = m_q->getFromSource(*i, DurationValue);
 
 	    if (ud < (qd * 3 / 4) &&
@@ -1164,10 +1261,8 @@ NotationQuantizer::Impl::quantizeRange(Segment *s,
 
 	if ((*i)->isa(Note::EventRestType)) continue;
 
-	timeT t = getProvisional(*i, AbsoluteTimeValue);
-	timeT d = getProvisional(*i, DurationValue);
-
-	unsetProvisionalProperties(*i);
+	timeT t = scratch.getProvisional(*i, AbsoluteTimeValue);
+	timeT d = scratch.getProvisional(*i, DurationValue);
 
 	if ((*i)->getAbsoluteTime() == t &&
 	    (*i)->getDuration() == d) ++setBad;
@@ -1180,6 +1275,7 @@ NotationQuantizer::Impl::quantizeRange(Segment *s,
 	m_q->setToTarget(s, i, t, d);
     }
     ++passes;
+
 /*
     cerr << "NotationQuantizer: " << events << " events ("
 	 << notes << " notes), " << passes << " passes, "
@@ -69,11 +69,9 @@ namespace Accidentals
             NoAccidental, Sharp, Flat, Natural, DoubleSharp, DoubleFlat
         };
 
-        static AccidentalList v;
-        if (v.size() == 0) {
-            for (size_t i = 0; i < sizeof(a)/sizeof(a[0]); ++i)
-                v.push_back(a[i]);
-        }
+        // Filled in as it's initialised, which is thread-safe, as
+        // notation may be prepared on several threads at once
+        static AccidentalList v(a, a + sizeof(a)/sizeof(a[0]));
         return v;
     }
 
@@ -263,11 +261,7 @@ namespace Marks
             MordentLong, MordentLongInverted
         };
 
-        static std::vector<Mark> v;
-        if (v.size() == 0) {
-            for (size_t i = 0; i < sizeof(a)/sizeof(a[0]); ++i)
-                v.push_back(a[i]);
-        }
+        static std::vector<Mark> v(a, a + sizeof(a)/sizeof(a[0]));
         return v;
     }
 
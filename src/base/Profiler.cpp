@@ -4,10 +4,10 @@
     Rosegarden
     A MIDI and audio sequencer and musical notation editor.
     Copyright 2000-2017 the Rosegarden development team.
- 
+
     Other copyrights also apply to some parts of this work.  Please
     see the AUTHORS file and individual file headers for details.
- 
+
     This program is free software; you can redistribute it and/or
     modify it under the terms of the GNU General Public License as
     published by the Free Software Foundation; either version 2 of the
@@ -23,24 +23,269 @@
 #include <set>
 #include <map>
 
+#include <QAtomicPointer>
+#include <QCoreApplication>
+#include <QThread>
+
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 using std::cerr;
 using std::endl;
 
 namespace Rosegarden {
 
-Profiles* Profiles::m_instance = 0;
+namespace
+{
+
+// Latency histogram buckets, in nanoseconds.  Durations under 16ns
+// get a bucket each; above that there are eight buckets for each
+// power of two, so a percentile read from the histogram is within
+// 12.5% of the real one.  The last bucket takes everything from about
+// 18 minutes up.
+enum {
+    LinearBuckets = 16,
+    SubBuckets = 8,
+    BucketCount = LinearBuckets + SubBuckets * 37
+};
+
+int
+bucketFor(qint64 duration)
+{
+    if (duration < LinearBuckets) return duration < 0 ? 0 : int(duration);
+
+    int exponent = 0;
+    for (qint64 d = duration; d > 1; d >>= 1) ++exponent;
+
+    int bucket = LinearBuckets + (exponent - 4) * SubBuckets +
+        int((duration >> (exponent - 3)) & (SubBuckets - 1));
+
+    return std::min(bucket, int(BucketCount) - 1);
+}
+
+/// Upper limit of the durations in a bucket.
+qint64
+bucketLimit(int bucket)
+{
+    if (bucket < LinearBuckets) return bucket;
+
+    int exponent = (bucket - LinearBuckets) / SubBuckets + 4;
+    qint64 sub = (bucket - LinearBuckets) % SubBuckets;
+
+    return ((SubBuckets + sub + 1) << (exponent - 3)) - 1;
+}
+
+// Per-thread capacities
+enum {
+    ScopeCapacity = 512,     // distinct profiling points
+    TraceCapacity = 65536    // calls between writeTrace()s, when tracing
+};
+
+// The most calls Profiles keeps for writeTrace().
+const size_t maxTraceEvents = 1000000;
+
+}
+
+/// Statistics for one profiling point, as called from one thread.
+/**
+ * Only that thread writes them.  The sequence number makes a seqlock
+ * so that Profiles::dump() can read a consistent copy from another
+ * thread: it's odd while an update is in progress.
+ */
+struct ScopeStats
+{
+    ScopeStats(const char *n = 0) :
+        name(n), calls(0), total(0), worst(0)
+    {
+        memset(buckets, 0, sizeof(buckets));
+    }
+
+    void add(qint64 duration)
+    {
+        sequence.fetchAndAddOrdered(1);
+
+        ++calls;
+        total += duration;
+        if (duration > worst) worst = duration;
+        ++buckets[bucketFor(duration)];
+
+        sequence.fetchAndAddRelease(1);
+    }
+
+    void copyTo(ScopeStats &copy) const
+    {
+        for (;;) {
+            int before = atomicLoadAcquire(sequence);
+            if (before & 1) {
+                QThread::yieldCurrentThread();
+                continue;
+            }
+
+            copy.calls = calls;
+            copy.total = total;
+            copy.worst = worst;
+            memcpy(copy.buckets, buckets, sizeof(buckets));
+
+            // A full barrier, so that the reads above can't move past it
+            if (sequence.fetchAndAddOrdered(0) == before) return;
+        }
+    }
+
+    const char *name;
+    mutable QAtomicInt sequence;
+
+    qint64 calls;
+    qint64 total;
+    qint64 worst;
+    unsigned int buckets[BucketCount];
+};
+
+/// Everything one thread has recorded.
+/**
+ * The scopes are in a hash table keyed on the address of the name,
+ * which the owning thread adds to without locking: a slot, once
+ * filled, never changes.  The trace is a single-reader single-writer
+ * ring, written by the owning thread and read by
+ * Profiles::gatherTrace().
+ *
+ * All the memory is allocated up front, so that recording never
+ * allocates.
+ */
+class ThreadProfile
+{
+public:
+    ThreadProfile(int id, const std::string &name, bool tracing) :
+        m_id(id),
+        m_name(name),
+        m_scopePool(new ScopeStats[ScopeCapacity]),
+        m_scopesUsed(0),
+        m_trace(tracing ? new Profiles::TraceEvent[TraceCapacity] : 0),
+        m_traceWriter(0),
+        m_traceReader(0)
+    {
+    }
+
+    int getId() const { return m_id; }
+    const std::string &getName() const { return m_name; }
+
+    /// Owning thread only.  Returns 0 if the table is full.
+    ScopeStats *getScope(const char *name)
+    {
+        size_t slot = (size_t(uintptr_t(name)) >> 2) % ScopeCapacity;
+
+        for (int probe = 0; probe < ScopeCapacity; ++probe) {
+            ScopeStats *stats = atomicLoad(m_scopes[slot]);
+            if (!stats) {
+                // There are as many in the pool as slots in the table
+                stats = &m_scopePool[m_scopesUsed++];
+                stats->name = name;
+                atomicStoreRelease(m_scopes[slot], stats);
+                return stats;
+            }
+            if (stats->name == name) return stats;
+            slot = (slot + 1) % ScopeCapacity;
+        }
+
+        return 0;
+    }
+
+    /// Any thread.
+    ScopeStats *getScopeAt(int slot) const
+    {
+        return atomicLoadAcquire(m_scopes[slot]);
+    }
+
+    /// Owning thread only.  Returns false if the ring is full.
+    bool addTraceEvent(const char *name, qint64 start, qint64 duration)
+    {
+        if (!m_trace) return false;
+
+        int writer = atomicLoad(m_traceWriter);
+        int next = (writer + 1) % TraceCapacity;
+        if (next == atomicLoadAcquire(m_traceReader)) return false;
+
+        m_trace[writer].name = name;
+        m_trace[writer].start = start;
+        m_trace[writer].duration = duration;
+        m_trace[writer].thread = m_id;
+
+        atomicStoreRelease(m_traceWriter, next);
+        return true;
+    }
+
+    /// One thread at a time (see Profiles::m_mutex).
+    void takeTraceEvents(std::vector<Profiles::TraceEvent> &events,
+                         size_t limit)
+    {
+        if (!m_trace) return;
+
+        int reader = atomicLoad(m_traceReader);
+        int writer = atomicLoadAcquire(m_traceWriter);
+
+        while (reader != writer && events.size() < limit) {
+            events.push_back(m_trace[reader]);
+            reader = (reader + 1) % TraceCapacity;
+        }
+
+        // Anything beyond the limit is dropped.
+        atomicStoreRelease(m_traceReader, writer);
+    }
+
+    QAtomicInt droppedScopes;
+    QAtomicInt droppedTraceEvents;
+
+private:
+    int m_id;
+    std::string m_name;
+
+    QAtomicPointer<ScopeStats> m_scopes[ScopeCapacity];
+    ScopeStats *m_scopePool;
+    int m_scopesUsed;
+
+    Profiles::TraceEvent *m_trace;
+    QAtomicInt m_traceWriter;
+    QAtomicInt m_traceReader;
+};
+
+static int
+initialProfilingState()
+{
+    const char *env = getenv("ROSEGARDEN_PROFILE");
+    if (env && *env) return 1;
+
+#if !defined(NDEBUG) || defined(WANT_TIMING)
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static int
+initialTracingState()
+{
+    const char *env = getenv("ROSEGARDEN_PROFILE");
+    return (env && *env && strcmp(env, "1") != 0) ? 1 : 0;
+}
+
+QAtomicInt Profiles::m_enabled(initialProfilingState());
+QAtomicInt Profiles::m_tracing(initialTracingState());
 
 Profiles* Profiles::getInstance()
 {
-    if (!m_instance) m_instance = new Profiles();
-    
-    return m_instance;
+    // Function-local statics are initialised thread-safely.
+    static Profiles *instance = new Profiles();
+
+    return instance;
 }
 
-Profiles::Profiles()
+Profiles::Profiles() :
+    m_droppedTraceEvents(0)
 {
+    if (atomicLoad(m_tracing)) m_traceFile = getenv("ROSEGARDEN_PROFILE");
 }
 
 Profiles::~Profiles()
@@ -48,158 +293,372 @@ Profiles::~Profiles()
     dump();
 }
 
-void Profiles::accumulate(
-#ifndef NO_TIMING
-    const char* id, clock_t time, RealTime rt
-#else
-    const char*, clock_t, RealTime
-#endif
-)
+void
+Profiles::setEnabled(bool enabled)
 {
-#ifndef NO_TIMING    
-    ProfilePair &pair(m_profiles[id]);
-    ++pair.first;
-    pair.second.first += time;
-    pair.second.second = pair.second.second + rt;
+    atomicStore(m_enabled, enabled ? 1 : 0);
+}
 
-    TimePair &lastPair(m_lastCalls[id]);
-    lastPair.first = time;
-    lastPair.second = rt;
+qint64
+Profiles::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
 
-    TimePair &worstPair(m_worstCalls[id]);
-    if (time > worstPair.first) {
-        worstPair.first = time;
+ThreadProfile *
+Profiles::getThreadProfile()
+{
+    ThreadProfileRef &ref = m_threadProfile.localData();
+    if (ref.profile) return ref.profile;
+
+    // A thread that hasn't registered itself
+    std::string name;
+    QThread *thread = QThread::currentThread();
+    if (QCoreApplication::instance() &&
+        thread == QCoreApplication::instance()->thread()) {
+        name = "GUI";
+    } else if (thread && !thread->objectName().isEmpty()) {
+        name = thread->objectName().toStdString();
     }
-    if (rt > worstPair.second) {
-        worstPair.second = rt;
+
+    ref.profile = addThreadProfile(name);
+    return ref.profile;
+}
+
+ThreadProfile *
+Profiles::addThreadProfile(std::string name)
+{
+    QMutexLocker locker(&m_mutex);
+
+    int id = int(m_threads.size()) + 1;
+
+    if (name.empty()) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "Thread %d", id);
+        name = buffer;
     }
-#endif
+
+    // Kept after the thread has gone, for dump()
+    ThreadProfile *profile =
+        new ThreadProfile(id, name, atomicLoad(m_tracing) != 0);
+    m_threads.push_back(profile);
+
+    return profile;
 }
 
-void Profiles::dump() const
+void
+Profiles::registerThread(const std::string &name)
 {
 #ifndef NO_TIMING
+    ThreadProfileRef &ref = m_threadProfile.localData();
+    if (!ref.profile) ref.profile = addThreadProfile(name);
+#else
+    (void)name;
+#endif
+}
 
-    fprintf(stderr, "Profiling points:\n");
+void
+Profiles::accumulate(const char* id, clock_t, RealTime rt)
+{
+    if (!isEnabled()) return;
 
-    fprintf(stderr, "\nBy name:\n");
+    qint64 duration = qint64(rt.sec) * 1000000000 + rt.nsec;
+    record(id, now() - duration, duration);
+}
 
-    typedef std::set<const char *, std::less<std::string> > StringSet;
+void
+Profiles::record(const char *id, qint64 start, qint64 duration)
+{
+    ThreadProfile *profile = getThreadProfile();
 
-    StringSet profileNames;
-    for (ProfileMap::const_iterator i = m_profiles.begin();
-         i != m_profiles.end(); ++i) {
-        profileNames.insert(i->first);
+    ScopeStats *stats = profile->getScope(id);
+    if (stats) stats->add(duration);
+    else profile->droppedScopes.fetchAndAddRelaxed(1);
+
+    if (atomicLoad(m_tracing)) {
+        if (!profile->addTraceEvent(id, start, duration)) {
+            profile->droppedTraceEvents.fetchAndAddRelaxed(1);
+        }
     }
+}
 
-    for (StringSet::const_iterator i = profileNames.begin();
-         i != profileNames.end(); ++i) {
+namespace
+{
 
-        ProfileMap::const_iterator j = m_profiles.find(*i);
+// Statistics for a profiling point, summed over all threads
+struct Totals
+{
+    Totals() : calls(0), total(0), worst(0), buckets(BucketCount, 0) { }
+
+    void add(const ScopeStats &stats)
+    {
+        calls += stats.calls;
+        total += stats.total;
+        worst = std::max(worst, stats.worst);
+        for (int i = 0; i < BucketCount; ++i) buckets[i] += stats.buckets[i];
+    }
 
-        if (j == m_profiles.end()) continue;
+    qint64 percentile(double p) const
+    {
+        qint64 target = qint64(calls * p + 0.5);
+        if (target < 1) target = 1;
+
+        qint64 count = 0;
+        for (int i = 0; i < BucketCount; ++i) {
+            count += buckets[i];
+            if (count >= target) return std::min(bucketLimit(i), worst);
+        }
+        return worst;
+    }
 
-        const ProfilePair &pp(j->second);
+    qint64 calls;
+    qint64 total;
+    qint64 worst;
+    std::vector<qint64> buckets;
+};
 
-        fprintf(stderr, "%s(%d):\n", *i, pp.first);
+typedef std::map<std::string, Totals> TotalsMap;
 
-        fprintf(stderr, "\tCPU:  \t%.9g ms/call \t[%d ms total]\n",
-                (((double)pp.second.first * 1000.0 /
-		  (double)pp.first) / CLOCKS_PER_SEC),
-                int((pp.second.first * 1000.0) / CLOCKS_PER_SEC));
+double
+toMs(qint64 ns)
+{
+    return double(ns) / 1000000.0;
+}
 
-        fprintf(stderr, "\tReal: \t%s ms      \t[%s ms total]\n",
-                ((pp.second.second / pp.first) * 1000).toString().c_str(),
-                (pp.second.second * 1000).toString().c_str());
+// Only for names, which are mostly function names
+std::string
+jsonString(const char *s)
+{
+    std::string result("\"");
+    for (; *s; ++s) {
+        if (*s == '"' || *s == '\\') result += '\\';
+        if ((unsigned char)*s < 0x20) result += ' ';
+        else result += *s;
+    }
+    return result + "\"";
+}
 
-        WorstCallMap::const_iterator k = m_worstCalls.find(*i);
-        if (k == m_worstCalls.end()) continue;
-        
-        const TimePair &wc(k->second);
+}
 
-        fprintf(stderr, "\tWorst:\t%s ms/call \t[%d ms CPU]\n",
-                (wc.second * 1000).toString().c_str(),
-                int((wc.first * 1000.0) / CLOCKS_PER_SEC));
+static void
+getTotals(const std::vector<ThreadProfile *> &threads, TotalsMap &totals,
+          int &droppedScopes)
+{
+    ScopeStats copy("");
+
+    for (size_t t = 0; t < threads.size(); ++t) {
+        for (int slot = 0; slot < ScopeCapacity; ++slot) {
+            ScopeStats *stats = threads[t]->getScopeAt(slot);
+            if (!stats) continue;
+            stats->copyTo(copy);
+            totals[stats->name].add(copy);
+        }
+        droppedScopes += atomicLoad(threads[t]->droppedScopes);
     }
+}
+
+void Profiles::dump()
+{
+#ifndef NO_TIMING
 
-    typedef std::multimap<RealTime, const char *> TimeRMap;
-    typedef std::multimap<int, const char *> IntRMap;
-    
-    TimeRMap totmap, avgmap, worstmap;
-    IntRMap ncallmap;
+    TotalsMap totals;
+    int droppedScopes = 0;
 
-    for (ProfileMap::const_iterator i = m_profiles.begin();
-         i != m_profiles.end(); ++i) {
-        totmap.insert(TimeRMap::value_type(i->second.second.second, i->first));
-        avgmap.insert(TimeRMap::value_type(i->second.second.second /
-                                           i->second.first, i->first));
-        ncallmap.insert(IntRMap::value_type(i->second.first, i->first));
+    {
+        QMutexLocker locker(&m_mutex);
+        getTotals(m_threads, totals, droppedScopes);
     }
 
-    for (WorstCallMap::const_iterator i = m_worstCalls.begin();
-         i != m_worstCalls.end(); ++i) {
-        worstmap.insert(TimeRMap::value_type(i->second.second,
-                                             i->first));
+    if (totals.empty()) return;
+
+    fprintf(stderr, "Profiling points:\n");
+
+    fprintf(stderr, "\nBy name:\n");
+
+    for (TotalsMap::const_iterator i = totals.begin();
+         i != totals.end(); ++i) {
+
+        const Totals &t(i->second);
+
+        fprintf(stderr, "%s(%lld):\n", i->first.c_str(), (long long)t.calls);
+
+        fprintf(stderr, "\tReal: \t%.6f ms      \t[%.3f ms total]\n",
+                toMs(t.total) / t.calls, toMs(t.total));
+
+        fprintf(stderr, "\tLatency: \tp50 %.6f ms, p99 %.6f ms, max %.6f ms\n",
+                toMs(t.percentile(0.5)), toMs(t.percentile(0.99)),
+                toMs(t.worst));
     }
 
+    typedef std::multimap<qint64, std::string> TimeRMap;
+
+    TimeRMap totmap, avgmap, p99map, worstmap, ncallmap;
+
+    for (TotalsMap::const_iterator i = totals.begin();
+         i != totals.end(); ++i) {
+        const Totals &t(i->second);
+        totmap.insert(TimeRMap::value_type(t.total, i->first));
+        avgmap.insert(TimeRMap::value_type(t.total / t.calls, i->first));
+        p99map.insert(TimeRMap::value_type(t.percentile(0.99), i->first));
+        worstmap.insert(TimeRMap::value_type(t.worst, i->first));
+        ncallmap.insert(TimeRMap::value_type(t.calls, i->first));
+    }
 
     fprintf(stderr, "\nBy total:\n");
     for (TimeRMap::const_iterator i = totmap.end(); i != totmap.begin(); ) {
         --i;
-        fprintf(stderr, "%-40s  %s ms\n", i->second,
-                (i->first * 1000).toString().c_str());
+        fprintf(stderr, "%-40s  %.3f ms\n", i->second.c_str(), toMs(i->first));
     }
 
     fprintf(stderr, "\nBy average:\n");
     for (TimeRMap::const_iterator i = avgmap.end(); i != avgmap.begin(); ) {
         --i;
-        fprintf(stderr, "%-40s  %s ms\n", i->second,
-                (i->first * 1000).toString().c_str());
+        fprintf(stderr, "%-40s  %.6f ms\n", i->second.c_str(), toMs(i->first));
+    }
+
+    fprintf(stderr, "\nBy 99th percentile:\n");
+    for (TimeRMap::const_iterator i = p99map.end(); i != p99map.begin(); ) {
+        --i;
+        fprintf(stderr, "%-40s  %.6f ms\n", i->second.c_str(), toMs(i->first));
     }
 
     fprintf(stderr, "\nBy worst case:\n");
     for (TimeRMap::const_iterator i = worstmap.end(); i != worstmap.begin(); ) {
         --i;
-        fprintf(stderr, "%-40s  %s ms\n", i->second,
-                (i->first * 1000).toString().c_str());
+        fprintf(stderr, "%-40s  %.6f ms\n", i->second.c_str(), toMs(i->first));
     }
 
     fprintf(stderr, "\nBy number of calls:\n");
-    for (IntRMap::const_iterator i = ncallmap.end(); i != ncallmap.begin(); ) {
+    for (TimeRMap::const_iterator i = ncallmap.end(); i != ncallmap.begin(); ) {
         --i;
-        fprintf(stderr, "%-40s  %d\n", i->second, i->first);
+        fprintf(stderr, "%-40s  %lld\n", i->second.c_str(), (long long)i->first);
     }
 
+    if (droppedScopes > 0) {
+        fprintf(stderr, "\n(%d calls not recorded: too many profiling points)\n",
+                droppedScopes);
+    }
+
+    if (!m_traceFile.empty()) writeTrace(m_traceFile);
+
 #endif
 }
 
-#ifndef NO_TIMING    
+void
+Profiles::gatherTrace()
+{
+    for (size_t t = 0; t < m_threads.size(); ++t) {
+        m_threads[t]->takeTraceEvents(m_trace, maxTraceEvents);
+        m_droppedTraceEvents +=
+            m_threads[t]->droppedTraceEvents.fetchAndStoreRelaxed(0);
+    }
+}
+
+bool
+Profiles::writeTrace(const std::string &fileName)
+{
+    QMutexLocker locker(&m_mutex);
+
+    gatherTrace();
+
+    TotalsMap totals;
+    int droppedScopes = 0;
+    getTotals(m_threads, totals, droppedScopes);
+
+    FILE *file = fopen(fileName.c_str(), "w");
+    if (!file) {
+        cerr << "Profiles::writeTrace: Failed to open " << fileName << endl;
+        return false;
+    }
+
+    const int pid = int(getpid());
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\n\"traceEvents\":[\n");
+
+    bool first = true;
+
+    for (size_t t = 0; t < m_threads.size(); ++t) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":%s}}",
+                first ? "" : ",\n", pid, m_threads[t]->getId(),
+                jsonString(m_threads[t]->getName().c_str()).c_str());
+        first = false;
+    }
+
+    // Chrome trace times are in microseconds
+    for (size_t i = 0; i < m_trace.size(); ++i) {
+        const TraceEvent &e(m_trace[i]);
+        fprintf(file, "%s{\"name\":%s,\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f}",
+                first ? "" : ",\n", jsonString(e.name).c_str(), pid, e.thread,
+                double(e.start) / 1000.0, double(e.duration) / 1000.0);
+        first = false;
+    }
+
+    fprintf(file, "\n],\n\"otherData\":{\"droppedTraceEvents\":\"%ld\"},\n",
+            m_droppedTraceEvents);
+
+    // Not part of the trace format, so trace viewers ignore it
+    fprintf(file, "\"profiles\":[\n");
+
+    for (TotalsMap::const_iterator i = totals.begin();
+         i != totals.end(); ++i) {
+        const Totals &t(i->second);
+        fprintf(file, "%s{\"name\":%s,\"calls\":%lld,\"totalMs\":%.6f,"
+                "\"meanMs\":%.6f,\"p50Ms\":%.6f,\"p99Ms\":%.6f,"
+                "\"maxMs\":%.6f}",
+                i == totals.begin() ? "" : ",\n",
+                jsonString(i->first.c_str()).c_str(), (long long)t.calls,
+                toMs(t.total), toMs(t.total) / t.calls,
+                toMs(t.percentile(0.5)), toMs(t.percentile(0.99)),
+                toMs(t.worst));
+    }
+
+    fprintf(file, "\n]}\n");
+
+    bool ok = !ferror(file);
+    fclose(file);
+
+    if (!ok) {
+        cerr << "Profiles::writeTrace: Failed to write " << fileName << endl;
+    }
+
+    return ok;
+}
+
+#ifndef NO_TIMING
 
 Profiler::Profiler(const char* c, bool showOnDestruct) :
     m_c(c),
+    m_startCPU(0),
+    m_startTime(0),
     m_showOnDestruct(showOnDestruct),
     m_ended(false)
 {
-    m_startCPU = clock();
+    if (!showOnDestruct && !Profiles::isEnabled()) {
+        m_ended = true;
+        return;
+    }
+
+    if (showOnDestruct) m_startCPU = clock();
 
-    struct timeval tv;
-    (void)gettimeofday(&tv, 0);
-    m_startTime = RealTime::fromTimeval(tv);
+    m_startTime = Profiles::now();
 }
 
 void
 Profiler::update() const
 {
-    clock_t elapsedCPU = clock() - m_startCPU;
+    if (m_ended) return;
 
-    struct timeval tv;
-    (void)gettimeofday(&tv, 0);
-    RealTime elapsedTime = RealTime::fromTimeval(tv) - m_startTime;
+    clock_t elapsedCPU = clock() - m_startCPU;
+    qint64 elapsedTime = Profiles::now() - m_startTime;
 
     cerr << "Profiler : id = " << m_c
 	 << " - elapsed so far = " << ((elapsedCPU * 1000) / CLOCKS_PER_SEC)
-	 << "ms CPU, " << elapsedTime << " real" << endl;
-}    
+	 << "ms CPU, " << double(elapsedTime) / 1000000.0 << "ms real" << endl;
+}
 
 Profiler::~Profiler()
 {
@@ -209,23 +668,25 @@ Profiler::~Profiler()
 void
 Profiler::end()
 {
-    clock_t elapsedCPU = clock() - m_startCPU;
+    if (m_ended) return;
 
-    struct timeval tv;
-    (void)gettimeofday(&tv, 0);
-    RealTime elapsedTime = RealTime::fromTimeval(tv) - m_startTime;
+    qint64 elapsedTime = Profiles::now() - m_startTime;
 
-    Profiles::getInstance()->accumulate(m_c, elapsedCPU, elapsedTime);
+    if (Profiles::isEnabled()) {
+        Profiles::getInstance()->record(m_c, m_startTime, elapsedTime);
+    }
 
-    if (m_showOnDestruct)
+    if (m_showOnDestruct) {
+        clock_t elapsedCPU = clock() - m_startCPU;
         cerr << "Profiler : id = " << m_c
              << " - elapsed = " << ((elapsedCPU * 1000) / CLOCKS_PER_SEC)
-	     << "ms CPU, " << elapsedTime << " real" << endl;
+	     << "ms CPU, " << double(elapsedTime) / 1000000.0 << "ms real"
+             << endl;
+    }
 
     m_ended = true;
 }
- 
+
 #endif
 
 }
-
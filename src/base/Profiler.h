@@ -4,10 +4,10 @@
     Rosegarden
     A MIDI and audio sequencer and musical notation editor.
     Copyright 2000-2017 the Rosegarden development team.
- 
+
     Other copyrights also apply to some parts of this work.  Please
     see the AUTHORS file and individual file headers for details.
- 
+
     This program is free software; you can redistribute it and/or
     modify it under the terms of the GNU General Public License as
     published by the Free Software Foundation; either version 2 of the
@@ -19,23 +19,31 @@
 #define RG_PROFILER_H
 
 #include <ctime>
-#include <sys/time.h>
-#include <map>
+#include <string>
+#include <vector>
 
+#include <QAtomicInt>
+#include <QMutex>
+#include <QThreadStorage>
+#include <QtGlobal>
+
+#include "AtomicCompat.h"
 #include "RealTime.h"
 
+// Profiling points are compiled in unless NO_TIMING is defined (see
+// the DISABLE_PROFILING CMake option).  They record only while
+// Profiles::isEnabled(), which is the default in debug builds (or with
+// WANT_TIMING) and otherwise needs the ROSEGARDEN_PROFILE environment
+// variable (see Profiles).
+
 //#define NO_TIMING 1
 
 //#define WANT_TIMING 1
 
-#ifdef NDEBUG
-#ifndef WANT_TIMING
-#define NO_TIMING 1
-#endif
-#endif
-
 namespace Rosegarden {
 
+class ThreadProfile;
+
 /**
  * Profiling classes
  */
@@ -44,6 +52,21 @@ namespace Rosegarden {
  * The class holding all profiling data
  *
  * This class is a singleton
+ *
+ * Each thread records into buffers of its own (see ThreadProfile in
+ * Profiler.cpp) without taking any locks, so profiling points may be
+ * used in the sequencer and audio threads as well as the GUI, and are
+ * cheap enough to leave in release builds.  dump() and writeTrace()
+ * gather the buffers up.
+ *
+ * A thread's buffers are allocated the first time it records, which
+ * is no good for a realtime thread.  Such threads should call
+ * registerThread() before they start work, and so outside any process
+ * callback.
+ *
+ * Setting the ROSEGARDEN_PROFILE environment variable turns profiling
+ * on.  If it's set to a file name rather than "1", dump() also writes
+ * a Chrome trace (see writeTrace()) to that file.
  */
 class Profiles
 {
@@ -51,22 +74,81 @@ public:
     static Profiles* getInstance();
     ~Profiles();
 
+    /// Whether profiling points are recording.
+    static bool isEnabled() { return atomicLoad(m_enabled) != 0; }
+    static void setEnabled(bool enabled);
+
+    /// Monotonic clock, in nanoseconds.
+    static qint64 now();
+
+    /// Allocate the calling thread's buffers, named for dump().
+    /**
+     * Does nothing if the thread already has them.  Call this from
+     * realtime threads before they do any work, so that they don't
+     * allocate or lock when they first record a call.
+     */
+    void registerThread(const std::string &name);
+
+    /// Record a call that took rt (the CPU time is ignored).
     void accumulate(const char* id, clock_t time, RealTime rt);
-    void dump() const;
+
+    /// Record a call from the calling thread, times in nanoseconds.
+    void record(const char *id, qint64 start, qint64 duration);
+
+    /// Print call counts, totals and latency percentiles to stderr.
+    void dump();
+
+    /// Write the calls recorded so far as Chrome trace event JSON.
+    /**
+     * Only calls made while the trace file was set (see
+     * ROSEGARDEN_PROFILE) are recorded individually: otherwise there
+     * are just the statistics, which are written out too.  Load the
+     * file in chrome://tracing or ui.perfetto.dev.
+     */
+    bool writeTrace(const std::string &fileName);
 
 protected:
+    friend class ThreadProfile;
+
     Profiles();
 
-    typedef std::pair<clock_t, RealTime> TimePair;
-    typedef std::pair<int, TimePair> ProfilePair;
-    typedef std::map<const char *, ProfilePair> ProfileMap;
-    typedef std::map<const char *, TimePair> LastCallMap;
-    typedef std::map<const char *, TimePair> WorstCallMap;
-    ProfileMap m_profiles;
-    LastCallMap m_lastCalls;
-    WorstCallMap m_worstCalls;
+    struct ThreadProfileRef
+    {
+        ThreadProfileRef() : profile(0) { }
+        ThreadProfile *profile;
+    };
+
+    ThreadProfile *getThreadProfile();
+
+    /// Create and list a profile for the calling thread.
+    ThreadProfile *addThreadProfile(std::string name);
+
+    struct TraceEvent
+    {
+        const char *name;
+        qint64 start;
+        qint64 duration;
+        int thread;
+    };
+
+    /// Move the calls each thread has recorded into m_trace.
+    void gatherTrace();
+
+    static QAtomicInt m_enabled;
+    static QAtomicInt m_tracing;
+
+    QThreadStorage<ThreadProfileRef> m_threadProfile;
+
+    /// Guards all of the below.
+    QMutex m_mutex;
+
+    /// All the threads that have ever recorded anything.
+    std::vector<ThreadProfile *> m_threads;
+
+    std::vector<TraceEvent> m_trace;
+    long m_droppedTraceEvents;
 
-    static Profiles* m_instance;
+    std::string m_traceFile;
 };
 
 #ifndef NO_TIMING
@@ -74,9 +156,9 @@ protected:
 /**
  * Profile point instance class.  Construct one of these on the stack
  * at the start of a function, in order to record the time consumed
- * within that function.  The profiler object should be effectively
- * optimised out if NO_TIMING is defined, so any overhead in a release
- * build should be negligible so long as you remember to define that.
+ * within that function.  The profiler object does next to nothing
+ * unless Profiles::isEnabled(), and is optimised out entirely if
+ * NO_TIMING is defined.
  */
 class Profiler
 {
@@ -85,9 +167,9 @@ public:
      * Create a profile point instance that records time consumed
      * against the given profiling point name.  If showOnDestruct is
      * true, the time consumed will be printed to stderr when the
-     * object is destroyed; otherwise, only the accumulated, mean and
-     * worst-case times will be shown when the program exits or
-     * Profiles::dump() is called.
+     * object is destroyed; otherwise, only the accumulated, mean,
+     * percentile and worst-case times will be shown when the program
+     * exits or Profiles::dump() is called.
      */
     Profiler(const char *name, bool showOnDestruct = false);
     ~Profiler();
@@ -98,7 +180,7 @@ public:
 protected:
     const char* m_c;
     clock_t m_startCPU;
-    RealTime m_startTime;
+    qint64 m_startTime;
     bool m_showOnDestruct;
     bool m_ended;
 };
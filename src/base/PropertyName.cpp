@@ -18,8 +18,11 @@
 #include <string>
 
 #include "base/PropertyName.h"
+#include "base/AtomicCompat.h"
 #include "base/Exception.h"
 
+#include <QAtomicPointer>
+#include <QReadWriteLock>
 #include <QtGlobal>
 
 namespace Rosegarden 
@@ -27,46 +30,125 @@ namespace Rosegarden
 using std::string;
 
 PropertyName::intern_map *PropertyName::m_interns = 0;
-PropertyName::intern_reverse_map *PropertyName::m_internsReversed = 0;
 int PropertyName::m_nextValue = 0;
 
+// Names are looked up from the threads that save documents as well as
+// the GUI.  Function-local, because PropertyNames are interned during
+// static initialisation.
+static QReadWriteLock *internLock()
+{
+    static QReadWriteLock lock;
+    return &lock;
+}
+
+namespace
+{
+
+/// The interned names by value, for getName().
+/**
+ * getName() is called for every property of every event saved, so it
+ * doesn't lock: names are only ever added, under the write lock, and
+ * each is published with a release store once it's complete.  The
+ * strings are the keys of m_interns, which never move.
+ */
+class NameTable
+{
+public:
+    enum { ChunkSize = 1024, ChunkCount = 4096 };
+
+    static bool canHold(int value) {
+        return value >= 0 && value < ChunkSize * ChunkCount;
+    }
+
+    /// Any thread.  Returns 0 for a value never interned.
+    const string *get(int value) const {
+        if (!canHold(value)) return 0;
+        Chunk *chunk = atomicLoadAcquire(m_chunks[value / ChunkSize]);
+        if (!chunk) return 0;
+        return atomicLoadAcquire(chunk->names[value % ChunkSize]);
+    }
+
+    /// With the write lock held.
+    void set(int value, const string *name) {
+        QAtomicPointer<Chunk> &slot = m_chunks[value / ChunkSize];
+        Chunk *chunk = atomicLoad(slot);
+        if (!chunk) {
+            chunk = new Chunk;
+            atomicStoreRelease(slot, chunk);
+        }
+        atomicStoreRelease(chunk->names[value % ChunkSize], name);
+    }
+
+private:
+    struct Chunk
+    {
+        QAtomicPointer<const string> names[ChunkSize];
+    };
+
+    QAtomicPointer<Chunk> m_chunks[ChunkCount];
+};
+
+NameTable *nameTable()
+{
+    static NameTable table;
+    return &table;
+}
+
+}
+
 int PropertyName::intern(const string &s)
 {
+    {
+        QReadLocker locker(internLock());
+
+        if (m_interns) {
+            intern_map::iterator i(m_interns->find(s));
+            if (i != m_interns->end()) return i->second;
+        }
+    }
+
+    QWriteLocker locker(internLock());
+
     if (!m_interns) {
         m_interns = new intern_map;
-        m_internsReversed = new intern_reverse_map;
     }
 
+    // Another thread may have got here first
     intern_map::iterator i(m_interns->find(s));
     
     if (i != m_interns->end()) {
         return i->second;
     } else {
-        int nv = ++m_nextValue;
-        m_interns->insert(intern_pair(s, nv));
-        m_internsReversed->insert(intern_reverse_pair(nv, s));
+        int nv = m_nextValue + 1;
+        if (!NameTable::canHold(nv)) {
+            throw Exception("PropertyName::intern: too many property names");
+        }
+        m_nextValue = nv;
+        i = m_interns->insert(intern_pair(s, nv)).first;
+        nameTable()->set(nv, &i->first);
         return nv;
     }
 }
 
 string PropertyName::getName() const
 {
-    intern_reverse_map::iterator i(m_internsReversed->find(m_value));
-    if (i != m_internsReversed->end()) return i->second;
+    const string *name = nameTable()->get(m_value);
+    if (name) return *name;
+
+    QReadLocker locker(internLock());
 
     // dump some informative data, even if we aren't in debug mode,
     // because this really shouldn't be happening
     std::cerr << "ERROR: PropertyName::getName: value corrupted!\n";
     std::cerr << "PropertyName's internal value is " << m_value << std::endl;
-    std::cerr << "Reverse interns are ";
-    i = m_internsReversed->begin();
-    if (i == m_internsReversed->end()) std::cerr << "(none)";
-    else while (i != m_internsReversed->end()) {
-	if (i != m_internsReversed->begin()) {
+    std::cerr << "Interns are ";
+    if (!m_interns || m_interns->empty()) std::cerr << "(none)";
+    else for (intern_map::iterator i = m_interns->begin();
+              i != m_interns->end(); ++i) {
+	if (i != m_interns->begin()) {
 	    std::cerr << ", ";
 	}
-	std::cerr << i->first << "=" << i->second;
-	++i;
+	std::cerr << i->second << "=" << i->first;
     }
     std::cerr << std::endl;
 
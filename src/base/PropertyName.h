@@ -107,11 +107,7 @@ private:
     typedef std::map<std::string, int> intern_map;
     typedef intern_map::value_type intern_pair;
 
-    typedef std::map<int, std::string> intern_reverse_map;
-    typedef intern_reverse_map::value_type intern_reverse_pair;
-
     static intern_map *m_interns;
-    static intern_reverse_map *m_internsReversed;
     static int m_nextValue;
 
     int m_value;
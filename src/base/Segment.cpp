@@ -755,6 +755,11 @@ int Segment::getNextId() const
     return m_id++;
 }
 
+void Segment::reserveIdsBelow(int id)
+{
+    if (m_id < id) m_id = id;
+}
+
 
 void
 Segment::fillWithRests(timeT endTime)
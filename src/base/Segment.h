@@ -219,6 +219,12 @@ public:
      */
     int getNextId() const;
 
+    /**
+     * Make sure getNextId() returns nothing below id from now on, as
+     * when taking on events whose ids another segment gave out
+     */
+    void reserveIdsBelow(int id);
+
     /**
      * Returns a MIDI pitch representing the highest suggested playable note for
      * notation contained in this segment, as a convenience reminder to composers.
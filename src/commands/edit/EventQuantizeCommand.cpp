@@ -133,13 +133,7 @@ EventQuantizeCommand::modifySegment()
 
     if (!m_settingsGroup.isEmpty()) {
         //!!! need way to decide whether to do these even if no settings group (i.e. through args to the command)
-        QSettings settings;
-        settings.beginGroup( m_settingsGroup );
-
-        rebeam = qStrToBool( settings.value("quantizerebeam", "true" ) ) ;
-        makeviable = qStrToBool( settings.value("quantizemakeviable", "false" ) ) ;
-        decounterpoint = qStrToBool( settings.value("quantizedecounterpoint", "false" ) ) ;
-        settings.endGroup();
+        getTidyingOptions(m_settingsGroup, rebeam, makeviable, decounterpoint);
     }
 
     timeT endTime = segment.getEndTime();
@@ -223,9 +217,32 @@ EventQuantizeCommand::modifySegment()
         throw CommandCancelled();
 }
 
+void
+EventQuantizeCommand::getTidyingOptions(QString settingsGroup,
+                                        bool &rebeam,
+                                        bool &makeViable,
+                                        bool &deCounterpoint)
+{
+    QSettings settings;
+    settings.beginGroup( settingsGroup );
+
+    rebeam = qStrToBool( settings.value("quantizerebeam", "true" ) ) ;
+    makeViable = qStrToBool( settings.value("quantizemakeviable", "false" ) ) ;
+    deCounterpoint = qStrToBool( settings.value("quantizedecounterpoint", "false" ) ) ;
+    settings.endGroup();
+}
+
 Quantizer *
 EventQuantizeCommand::makeQuantizer(QString settingsGroup,
                                     QuantizeScope scope)
+{
+    m_quantizer = createQuantizer(settingsGroup, scope);
+    return m_quantizer;
+}
+
+Quantizer *
+EventQuantizeCommand::createQuantizer(QString settingsGroup,
+                                      QuantizeScope scope)
 {
     //!!! Excessive duplication with
     // QuantizeParameters::getQuantizer in widgets.cpp
@@ -260,27 +277,27 @@ EventQuantizeCommand::makeQuantizer(QString settingsGroup,
 
     settings.endGroup();
 
-    m_quantizer = 0;
+    Quantizer *quantizer = 0;
 
     if (type == 0) {
         if (notateOnly) {
-            m_quantizer = new BasicQuantizer
+            quantizer = new BasicQuantizer
                           (Quantizer::RawEventData,
                            Quantizer::NotationPrefix,
                            unit, durations, swing, iterate);
         } else {
-            m_quantizer = new BasicQuantizer
+            quantizer = new BasicQuantizer
                           (Quantizer::RawEventData,
                            Quantizer::RawEventData,
                            unit, durations, swing, iterate);
         }
     } else if (type == 1) {
         if (notateOnly) {
-            m_quantizer = new LegatoQuantizer
+            quantizer = new LegatoQuantizer
                           (Quantizer::RawEventData,
                            Quantizer::NotationPrefix, unit);
         } else {
-            m_quantizer = new LegatoQuantizer
+            quantizer = new LegatoQuantizer
                           (Quantizer::RawEventData,
                            Quantizer::RawEventData, unit);
         }
@@ -302,10 +319,10 @@ EventQuantizeCommand::makeQuantizer(QString settingsGroup,
         nq->setContrapuntal(counterpoint);
         nq->setArticulate(articulate);
 
-        m_quantizer = nq;
+        quantizer = nq;
     }
 
-    return m_quantizer;
+    return quantizer;
 }
 
 }
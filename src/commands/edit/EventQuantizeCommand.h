@@ -73,6 +73,18 @@ public:
     
     static QString getGlobalName(Quantizer *quantizer = 0);
 
+    /// Make a quantizer from the QSettings data in the given group.
+    /// The caller owns it.
+    static Quantizer *createQuantizer(QString settingsGroup,
+                                      QuantizeScope scope);
+
+    /// Read which notation tidying steps follow the quantization
+    /// from the QSettings data in the given group
+    static void getTidyingOptions(QString settingsGroup,
+                                  bool &rebeam,
+                                  bool &makeViable,
+                                  bool &deCounterpoint);
+
     void setProgressDialog(QPointer<QProgressDialog> progressDialog)
             { m_progressDialog = progressDialog; }
     void setProgressTotal(int total, int perCall) { m_progressTotal = total;
@@ -0,0 +1,377 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#define RG_MODULE_STRING "[ParallelQuantizeCommand]"
+
+#include "ParallelQuantizeCommand.h"
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/Profiler.h"
+#include "base/Quantizer.h"
+#include "base/Segment.h"
+#include "base/SegmentNotationHelper.h"
+#include "document/BasicCommand.h"
+#include "misc/Debug.h"
+
+#include <QApplication>
+#include <QProgressDialog>
+#include <QRunnable>
+#include <QThreadPool>
+
+
+namespace Rosegarden
+{
+
+using namespace BaseProperties;
+
+
+// Bring a segment's start forward to t without adding anything to it,
+// as normalizing rests can
+static void
+extendStart(Segment &segment, timeT t)
+{
+    if (t < segment.getStartTime()) segment.fillWithRests(t, t);
+}
+
+// Each segment numbers groups from a counter of its own.  Move to's on
+// past from's, so that the ids one hands out can't clash with the
+// other's.
+static void
+catchUpIds(const Segment &from, Segment &to)
+{
+    to.reserveIdsBelow(from.getNextId());
+}
+
+
+// One segment's share of the work
+struct ParallelQuantizeCommand::Piece
+{
+    Piece() :
+        segment(0), command(0), composition(0), work(0), quantizer(0),
+        startTime(0), endTime(0), done(false)
+    {
+    }
+
+    Segment *segment;         // the real one, left alone until we're done
+    ApplyCommand *command;
+    Composition *composition; // our own, owning work
+    Segment *work;            // copy of the segment, to quantize
+    Quantizer *quantizer;
+    timeT startTime;
+    timeT endTime;
+    bool done;
+};
+
+
+// Puts the quantized events back into the real segment, on the GUI
+// thread
+class ParallelQuantizeCommand::ApplyCommand : public BasicCommand
+{
+public:
+    ApplyCommand(const QString &name, Segment &segment,
+                 timeT startTime, timeT endTime) :
+        BasicCommand(name, segment, startTime, endTime,
+                     true), // bruteForceRedo
+        m_work(0)
+    {
+    }
+
+    void setWork(Segment *work) { m_work = work; }
+
+protected:
+    virtual void modifySegment()
+    {
+        // Only the first time, as we do brute force redo
+        if (!m_work) return;
+
+        Segment &segment = getSegment();
+
+        // The work segment started as a copy of the whole of this one,
+        // so take the whole of it, including any rests the tidying
+        // added outside the range, as quantizing in place would have
+        // left them
+
+        segment.erase(segment.begin(), segment.end());
+
+        for (Segment::iterator i = m_work->begin(); i != m_work->end(); ++i) {
+            Event *e = new Event(**i);
+            e->copyNonPersistentProperties(**i);
+            segment.insert(e);
+        }
+
+        extendStart(segment, m_work->getStartTime());
+        catchUpIds(*m_work, segment);
+
+        // Setting the end time can leave an end marker behind
+        if (segment.getEndMarkerTime(false) !=
+            m_work->getEndMarkerTime(false)) {
+            segment.setEndMarkerTime(m_work->getEndMarkerTime(false));
+        }
+
+        m_work = 0;
+    }
+
+private:
+    Segment *m_work;
+};
+
+
+class ParallelQuantizeCommand::Job : public QRunnable
+{
+public:
+    Job(ParallelQuantizeCommand *command, Piece *piece) :
+        m_command(command),
+        m_piece(piece)
+    {
+    }
+
+    virtual void run()
+    {
+        if (!m_command->m_cancelled.fetchAndAddRelaxed(0)) {
+            m_command->process(m_piece);
+            m_piece->done = true;
+        }
+        m_command->m_finished.release();
+    }
+
+private:
+    ParallelQuantizeCommand *m_command;
+    Piece *m_piece;
+};
+
+
+ParallelQuantizeCommand::ParallelQuantizeCommand
+    (QString name,
+     const std::vector<Segment *> &segments,
+     QString settingsGroup,
+     EventQuantizeCommand::QuantizeScope scope) :
+    MacroCommand(name),
+    m_segments(segments),
+    m_settingsGroup(settingsGroup),
+    m_scope(scope),
+    m_rebeam(false),
+    m_makeViable(false),
+    m_deCounterpoint(false),
+    m_prepared(false),
+    m_finished(0),
+    m_cancelled(0),
+    m_progressStart(0),
+    m_progressEnd(0)
+{
+    // nothing else
+}
+
+void
+ParallelQuantizeCommand::execute()
+{
+    if (m_prepared) {
+        // Redo
+        MacroCommand::execute();
+        return;
+    }
+
+    m_prepared = true;
+    prepare(); // and executes the commands it makes
+}
+
+void
+ParallelQuantizeCommand::prepare()
+{
+    Profiler profiler("ParallelQuantizeCommand::prepare");
+
+    if (!m_settingsGroup.isEmpty()) {
+        EventQuantizeCommand::getTidyingOptions
+            (m_settingsGroup, m_rebeam, m_makeViable, m_deCounterpoint);
+    }
+
+    // Give each segment a composition of its own, with the same time
+    // signatures and markers, for a pool thread to copy the segment
+    // into and work on without touching anything the GUI can see
+
+    for (size_t i = 0; i < m_segments.size(); ++i) {
+
+        Segment &segment = *m_segments[i];
+        const Composition *original = segment.getComposition();
+
+        Piece *piece = new Piece;
+        piece->segment = &segment;
+        piece->quantizer =
+            EventQuantizeCommand::createQuantizer(m_settingsGroup, m_scope);
+        piece->command = new ApplyCommand
+            (EventQuantizeCommand::getGlobalName(piece->quantizer),
+             segment, segment.getStartTime(), segment.getEndMarkerTime());
+
+        // The range as BasicCommand worked it out
+        piece->startTime = piece->command->getStartTime();
+        piece->endTime = piece->command->getEndTime();
+
+        piece->composition = new Composition;
+        if (original) {
+            piece->composition->setStartMarker(original->getStartMarker());
+            piece->composition->setEndMarker(original->getEndMarker());
+            for (int n = 0; n < original->getTimeSignatureCount(); ++n) {
+                std::pair<timeT, TimeSignature> sig =
+                    original->getTimeSignatureChange(n);
+                piece->composition->addTimeSignature(sig.first, sig.second);
+            }
+        }
+
+        piece->work = new Segment(segment.getType(), segment.getStartTime());
+        piece->composition->addSegment(piece->work);
+
+        catchUpIds(segment, *piece->work);
+
+        m_pieces.push_back(piece);
+    }
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+
+    {
+        Profiler threadedProfiler("ParallelQuantizeCommand: threaded");
+
+        for (size_t i = 0; i < m_pieces.size(); ++i) {
+            pool->start(new Job(this, m_pieces[i]));
+        }
+
+        wait();
+    }
+
+    // Apply the finished ones, a segment at a time, here on the GUI thread
+
+    for (size_t i = 0; i < m_pieces.size(); ++i) {
+        Piece *piece = m_pieces[i];
+        if (piece->done) {
+            piece->command->setWork(piece->work);
+            addCommand(piece->command);
+        } else {
+            delete piece->command;
+        }
+    }
+
+    {
+        Profiler applyProfiler("ParallelQuantizeCommand: apply");
+        MacroCommand::execute();
+    }
+
+    // Our copies have served their purpose.  They go here, on the GUI
+    // thread, as the events in them now share data with the real ones.
+
+    for (size_t i = 0; i < m_pieces.size(); ++i) {
+        delete m_pieces[i]->quantizer;
+        delete m_pieces[i]->composition;
+        delete m_pieces[i];
+    }
+    m_pieces.clear();
+
+    RG_DEBUG << "prepare():" << m_segments.size() << "segments,"
+             << m_commands.size() << "done, on"
+             << pool->maxThreadCount() << "threads";
+}
+
+void
+ParallelQuantizeCommand::wait()
+{
+    const int count = int(m_pieces.size());
+    int finished = 0;
+
+    while (finished < count) {
+
+        // Keep the GUI going while we wait
+        if (m_finished.tryAcquire(1, 50)) {
+            ++finished;
+            while (finished < count && m_finished.tryAcquire(1)) ++finished;
+        }
+
+        if (m_progressDialog) {
+            if (m_progressDialog->wasCanceled()) {
+                m_cancelled.fetchAndStoreRelease(1);
+            }
+            m_progressDialog->setValue
+                (m_progressStart +
+                 (m_progressEnd - m_progressStart) * finished / count);
+        }
+
+        qApp->processEvents();
+    }
+}
+
+void
+ParallelQuantizeCommand::process(Piece *piece) const
+{
+    Segment &segment = *piece->work;
+    SegmentNotationHelper helper(segment);
+
+    {
+        Profiler profiler("ParallelQuantizeCommand: copy");
+
+        // The copies share their data with the real events until
+        // they're changed, and the reference counts that keeps aren't
+        // atomic.  That's safe only because nothing else touches the
+        // real segment until all the pool threads are done with it.
+
+        const Segment &original = *piece->segment;
+        for (Segment::const_iterator i = original.begin();
+             i != original.end(); ++i) {
+            Event *e = new Event(**i);
+            e->copyNonPersistentProperties(**i);
+            segment.insert(e);
+        }
+
+        extendStart(segment, original.getStartTime());
+
+        if (segment.getEndMarkerTime(false) !=
+            original.getEndMarkerTime(false)) {
+            segment.setEndMarkerTime(original.getEndMarkerTime(false));
+        }
+    }
+
+    // As EventQuantizeCommand::modifySegment(), with each stage profiled
+
+    {
+        Profiler profiler("ParallelQuantizeCommand: quantize");
+
+        timeT endTime = segment.getEndTime();
+
+        piece->quantizer->quantize(&segment,
+                                   segment.findTime(piece->startTime),
+                                   segment.findTime(piece->endTime));
+
+        if (segment.getEndTime() < endTime) {
+            segment.setEndTime(endTime);
+        }
+    }
+
+    if (m_makeViable) {
+        Profiler profiler("ParallelQuantizeCommand: make viable");
+        helper.makeNotesViable(piece->startTime, piece->endTime, true);
+    }
+
+    if (m_deCounterpoint) {
+        Profiler profiler("ParallelQuantizeCommand: decounterpoint");
+        helper.deCounterpoint(piece->startTime, piece->endTime);
+    }
+
+    if (m_rebeam) {
+        Profiler profiler("ParallelQuantizeCommand: beam");
+        helper.autoBeam(piece->startTime, piece->endTime, GROUP_TYPE_BEAMED);
+        helper.autoSlur(piece->startTime, piece->endTime, true);
+    }
+}
+
+
+}
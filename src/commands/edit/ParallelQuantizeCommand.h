@@ -0,0 +1,116 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_PARALLELQUANTIZECOMMAND_H
+#define RG_PARALLELQUANTIZECOMMAND_H
+
+#include "document/Command.h"
+#include "EventQuantizeCommand.h"
+
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QPointer>
+#include <QSemaphore>
+#include <QString>
+
+#include <vector>
+
+class QProgressDialog;
+
+
+namespace Rosegarden
+{
+
+class Segment;
+
+
+/**
+ * Quantizes whole segments, as an EventQuantizeCommand on each of them
+ * would, but with the segments worked on in parallel on the global
+ * thread pool.  For use when a document arrives with many segments
+ * that all need preparing for notation at once, as on MIDI import.
+ *
+ * Each segment is copied, with the composition's time signatures, into
+ * a composition of its own, where it is quantized and then beamed etc.
+ * as the settings group says, without touching anything the GUI can
+ * see.  Only putting the results back into the real segments, which
+ * notifies their observers, happens on the GUI thread, a segment at a
+ * time.  That's done by a BasicCommand for each segment, so the whole
+ * lot undoes and redoes as one.
+ *
+ * The copies share their event data with the originals until they are
+ * changed, so nothing else may touch the segments while the command is
+ * executing.  It keeps the event loop going as it waits, so give it a
+ * modal progress dialog.
+ *
+ * The work is done the first time the command is executed.  Each stage
+ * is a profiling point, "ParallelQuantizeCommand: quantize" and so on,
+ * so Profiles totals the time it took across the segments and threads.
+ */
+class ParallelQuantizeCommand : public MacroCommand
+{
+    Q_DECLARE_TR_FUNCTIONS(Rosegarden::ParallelQuantizeCommand)
+
+public:
+    ParallelQuantizeCommand(QString name,
+                            const std::vector<Segment *> &segments,
+                            QString settingsGroup,
+                            EventQuantizeCommand::QuantizeScope scope);
+
+    /// Cancelling the dialog leaves the segments not yet started as
+    /// they are.
+    void setProgressDialog(QPointer<QProgressDialog> progressDialog)
+            { m_progressDialog = progressDialog; }
+
+    /// Move the progress dialog from start to end as segments finish
+    void setProgressRange(int start, int end)
+            { m_progressStart = start; m_progressEnd = end; }
+
+    virtual void execute();
+
+private:
+    class ApplyCommand;
+    class Job;
+    struct Piece;
+
+    void prepare();
+    void wait();
+    void process(Piece *piece) const; // on a pool thread
+
+    std::vector<Segment *> m_segments;
+    QString m_settingsGroup;
+    EventQuantizeCommand::QuantizeScope m_scope;
+
+    bool m_rebeam;
+    bool m_makeViable;
+    bool m_deCounterpoint;
+
+    bool m_prepared;
+    std::vector<Piece *> m_pieces;
+
+    QSemaphore m_finished;
+    QAtomicInt m_cancelled;
+
+    QPointer<QProgressDialog> m_progressDialog;
+    int m_progressStart;
+    int m_progressEnd;
+};
+
+
+}
+
+#endif
@@ -0,0 +1,667 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#define RG_MODULE_STRING "[DocumentCache]"
+
+#include "DocumentCache.h"
+
+#include "base/BaseProperties.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include "gui/general/ResourceFinder.h"
+#include "misc/Debug.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+
+#include <climits>
+#include <map>
+
+#include <string.h>
+
+
+namespace Rosegarden
+{
+
+
+const char *const DocumentCache::EventsElement = "cached-events";
+
+namespace
+{
+
+// Bump whenever the layout, or what goes into it, changes
+const quint32 cacheVersion = 1;
+
+const char cacheMagic[8] = { 'R', 'G', 'C', 'A', 'C', 'H', 'E', '\0' };
+
+// Comes out differently if read in another byte order
+const quint32 byteOrderMark = 0x01020304;
+
+// Or'd with the PropertyType in the kind column
+const quint32 persistentFlag = 0x100;
+
+// Size of a SHA-1 hash
+const int hashSize = 20;
+
+bool hashFile(const QString &fileName, QByteArray &hash, qint64 &size)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) return false;
+
+    QCryptographicHash sha1(QCryptographicHash::Sha1);
+    while (!file.atEnd()) {
+        QByteArray chunk = file.read(1 << 20);
+        if (chunk.isEmpty()) break;
+        sha1.addData(chunk);
+    }
+    if (file.error() != QFile::NoError) return false;
+
+    hash = sha1.result();
+    size = file.size();
+    return true;
+}
+
+// Writes to a file, keeping track of where it is and whether it's
+// gone wrong
+class Output
+{
+public:
+    Output(QFile &file) : m_file(file), m_offset(0), m_ok(true) { }
+
+    /// Returns the offset written at.
+    quint64 write(const void *data, quint64 size) {
+        quint64 offset = m_offset;
+        if (size > 0 && m_ok) {
+            m_ok = (m_file.write((const char *)data, size) == qint64(size));
+        }
+        m_offset += size;
+        return offset;
+    }
+
+    /// Pad to a multiple of 8 bytes, so that anything can go next.
+    void align() {
+        static const char zeros[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+        quint64 padding = (8 - m_offset % 8) % 8;
+        write(zeros, padding);
+    }
+
+    template <typename T>
+    quint64 writeColumn(const std::vector<T> &column) {
+        align();
+        return write(column.empty() ? 0 : &column[0],
+                     column.size() * sizeof(T));
+    }
+
+    bool isOk() const { return m_ok; }
+
+private:
+    QFile &m_file;
+    quint64 m_offset;
+    bool m_ok;
+};
+
+// A table of strings is written as the offset of the end of each
+// string, from the start of the first, then the strings themselves
+quint64 writeStrings(Output &out, const std::vector<std::string> &strings)
+{
+    std::vector<quint64> ends;
+    quint64 end = 0;
+    for (size_t i = 0; i < strings.size(); ++i) {
+        end += strings[i].size();
+        ends.push_back(end);
+    }
+
+    quint64 offset = out.writeColumn(ends);
+    for (size_t i = 0; i < strings.size(); ++i) {
+        out.write(strings[i].data(), strings[i].size());
+    }
+    return offset;
+}
+
+class StringTable
+{
+public:
+    quint32 intern(const std::string &s) {
+        std::map<std::string, quint32>::iterator i = m_ids.find(s);
+        if (i != m_ids.end()) return i->second;
+        quint32 id = quint32(m_strings.size());
+        m_ids[s] = id;
+        m_strings.push_back(s);
+        return id;
+    }
+
+    const std::vector<std::string> &getStrings() const { return m_strings; }
+
+private:
+    std::map<std::string, quint32> m_ids;
+    std::vector<std::string> m_strings;
+};
+
+class NameTable
+{
+public:
+    quint32 intern(const PropertyName &name) {
+        std::map<PropertyName, quint32>::iterator i = m_ids.find(name);
+        if (i != m_ids.end()) return i->second;
+        quint32 id = quint32(m_names.size());
+        m_ids[name] = id;
+        m_names.push_back(name.getName());
+        return id;
+    }
+
+    const std::vector<std::string> &getNames() const { return m_names; }
+
+private:
+    std::map<PropertyName, quint32> m_ids;
+    std::vector<std::string> m_names;
+};
+
+}
+
+struct DocumentCache::Header
+{
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+
+    // The .rg file it goes with
+    qint64 fileSize;
+    char fileHash[hashSize];
+    quint32 reserved;
+
+    quint64 skeletonOffset;
+    quint64 skeletonSize;
+
+    // Event types and string property values
+    quint64 stringsOffset;
+    quint64 stringCount;
+
+    quint64 namesOffset;
+    quint64 nameCount;
+
+    quint64 segmentsOffset;
+    quint64 segmentCount;
+};
+
+struct DocumentCache::SegmentRecord
+{
+    quint64 eventCount;
+    quint64 propertyCount;
+
+    // Offsets of columns eventCount long
+    quint64 types;          // quint32, index into the strings
+    quint64 times;          // qint64
+    quint64 durations;      // qint64
+    quint64 subOrderings;   // qint32
+    quint64 propertyEnds;   // quint32, end of each event's properties
+
+    // Offsets of columns propertyCount long
+    quint64 propertyNames;  // quint32, index into the names
+    quint64 propertyKinds;  // quint32, PropertyType | persistentFlag
+    quint64 propertyValues; // qint64, the Int or Bool, or index into
+                            // the strings
+};
+
+DocumentCache::DocumentCache() :
+    m_data(0),
+    m_size(0),
+    m_header(0),
+    m_segments(0)
+{
+}
+
+DocumentCache::~DocumentCache()
+{
+    close();
+}
+
+QString
+DocumentCache::getCachePath(const QString &fileName)
+{
+    QString dir = ResourceFinder().getResourceSaveDir("cache");
+    if (dir.isEmpty()) return QString();
+
+    // Named for the whole path, as for autosaves
+    QString hashed = QString::fromLocal8Bit
+        (QCryptographicHash::hash
+         (QFileInfo(fileName).absoluteFilePath().toLocal8Bit(),
+          QCryptographicHash::Sha1).toHex());
+
+    return dir + "/" + hashed + ".rgcache";
+}
+
+bool
+DocumentCache::open(const QString &fileName)
+{
+    close();
+
+    QString cacheFileName = getCachePath(fileName);
+    if (cacheFileName.isEmpty() || !QFileInfo(cacheFileName).exists())
+        return false;
+
+    m_file.setFileName(cacheFileName);
+    if (!m_file.open(QIODevice::ReadOnly)) return false;
+
+    m_size = m_file.size();
+    m_data = m_file.map(0, m_size);
+
+    if (!m_data) {
+        m_buffer = m_file.readAll();
+        m_data = (const uchar *)m_buffer.constData();
+        m_size = m_buffer.size();
+    }
+
+    if (!validate(fileName)) {
+        RG_DEBUG << "open(): not using" << cacheFileName
+                 << "as it's out of date or damaged";
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void
+DocumentCache::close()
+{
+    if (m_data && m_buffer.isEmpty()) m_file.unmap((uchar *)m_data);
+    m_file.close();
+    m_buffer = QByteArray();
+    m_data = 0;
+    m_size = 0;
+    m_header = 0;
+    m_segments = 0;
+    m_strings.clear();
+    m_propertyNames.clear();
+}
+
+template <typename T>
+const T *
+DocumentCache::column(quint64 offset, quint64 count) const
+{
+    // Everything written is aligned to its own size, or to 8 bytes
+    // for anything bigger
+    const quint64 alignment = (sizeof(T) < 8 ? sizeof(T) : 8);
+    if (offset % alignment != 0) return 0;
+    if (offset > quint64(m_size)) return 0;
+    if (count > (quint64(m_size) - offset) / sizeof(T)) return 0;
+    return (const T *)(m_data + offset);
+}
+
+bool
+DocumentCache::readStrings(quint64 offset, quint64 count,
+                           std::vector<std::string> &strings) const
+{
+    const quint64 *ends = column<quint64>(offset, count);
+    if (!ends) return false;
+
+    const quint64 start = offset + count * sizeof(quint64);
+    quint64 end = 0;
+
+    strings.reserve(count);
+
+    for (quint64 i = 0; i < count; ++i) {
+        if (ends[i] < end) return false;
+        const char *s = column<char>(start + end, ends[i] - end);
+        if (!s) return false;
+        strings.push_back(std::string(s, ends[i] - end));
+        end = ends[i];
+    }
+
+    return true;
+}
+
+bool
+DocumentCache::validate(const QString &fileName)
+{
+    if (!m_data || quint64(m_size) < sizeof(Header)) return false;
+
+    const Header *header = column<Header>(0, 1);
+    if (!header) return false;
+
+    if (memcmp(header->magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+        header->version != cacheVersion ||
+        header->byteOrder != byteOrderMark) {
+        return false;
+    }
+
+    // The cheap checks first: is it the right size, and is everything
+    // where it should be?
+
+    if (QFileInfo(fileName).size() != header->fileSize) return false;
+
+    if (!column<char>(header->skeletonOffset, header->skeletonSize))
+        return false;
+
+    const SegmentRecord *segments =
+        column<SegmentRecord>(header->segmentsOffset, header->segmentCount);
+    if (!segments) return false;
+
+    for (quint64 i = 0; i < header->segmentCount; ++i) {
+        const SegmentRecord &r = segments[i];
+        if (!column<quint32>(r.types, r.eventCount) ||
+            !column<qint64>(r.times, r.eventCount) ||
+            !column<qint64>(r.durations, r.eventCount) ||
+            !column<qint32>(r.subOrderings, r.eventCount) ||
+            !column<quint32>(r.propertyEnds, r.eventCount) ||
+            !column<quint32>(r.propertyNames, r.propertyCount) ||
+            !column<quint32>(r.propertyKinds, r.propertyCount) ||
+            !column<qint64>(r.propertyValues, r.propertyCount)) {
+            return false;
+        }
+    }
+
+    std::vector<std::string> names;
+    if (!readStrings(header->stringsOffset, header->stringCount, m_strings) ||
+        !readStrings(header->namesOffset, header->nameCount, names)) {
+        return false;
+    }
+
+    // Then is it the same file?
+
+    QByteArray hash;
+    qint64 size;
+    if (!hashFile(fileName, hash, size) || size != header->fileSize ||
+        hash.size() != hashSize ||
+        memcmp(hash.constData(), header->fileHash, hashSize) != 0) {
+        return false;
+    }
+
+    m_propertyNames.reserve(names.size());
+    for (size_t i = 0; i < names.size(); ++i) {
+        m_propertyNames.push_back(PropertyName(names[i]));
+    }
+
+    m_header = header;
+    m_segments = segments;
+
+    return true;
+}
+
+QByteArray
+DocumentCache::getSkeleton() const
+{
+    if (!m_header) return QByteArray();
+
+    return QByteArray::fromRawData
+        ((const char *)m_data + m_header->skeletonOffset,
+         int(m_header->skeletonSize));
+}
+
+bool
+DocumentCache::insertEvents(int index, Segment &segment) const
+{
+    using namespace BaseProperties;
+
+    if (!m_header || index < 0 || quint64(index) >= m_header->segmentCount)
+        return false;
+
+    const SegmentRecord &r = m_segments[index];
+
+    const quint32 *types = column<quint32>(r.types, r.eventCount);
+    const qint64 *times = column<qint64>(r.times, r.eventCount);
+    const qint64 *durations = column<qint64>(r.durations, r.eventCount);
+    const qint32 *subOrderings = column<qint32>(r.subOrderings, r.eventCount);
+    const quint32 *propertyEnds = column<quint32>(r.propertyEnds, r.eventCount);
+    const quint32 *names = column<quint32>(r.propertyNames, r.propertyCount);
+    const quint32 *kinds = column<quint32>(r.propertyKinds, r.propertyCount);
+    const qint64 *values = column<qint64>(r.propertyValues, r.propertyCount);
+
+    // As RoseXmlHandler does, give each beamed group a new id from
+    // the segment in place of the stored one
+    std::map<long, long> groupIds;
+
+    quint64 property = 0;
+
+    for (quint64 i = 0; i < r.eventCount; ++i) {
+
+        if (types[i] >= m_strings.size() ||
+            propertyEnds[i] < property || propertyEnds[i] > r.propertyCount) {
+            return false;
+        }
+
+        Event *e = new Event(m_strings[types[i]], times[i], durations[i],
+                             short(subOrderings[i]));
+
+        for ( ; property < propertyEnds[i]; ++property) {
+
+            if (names[property] >= m_propertyNames.size()) {
+                delete e;
+                return false;
+            }
+
+            const PropertyName &name = m_propertyNames[names[property]];
+            const bool persistent = (kinds[property] & persistentFlag);
+            const qint64 value = values[property];
+
+            switch (kinds[property] & ~persistentFlag) {
+            case Int:
+                e->set<Int>(name, long(value), persistent);
+                break;
+            case Bool:
+                e->set<Bool>(name, value != 0, persistent);
+                break;
+            case String:
+                if (value < 0 || quint64(value) >= m_strings.size()) {
+                    delete e;
+                    return false;
+                }
+                e->set<String>(name, m_strings[value], persistent);
+                break;
+            default:
+                delete e;
+                return false;
+            }
+        }
+
+        if (e->has(BEAMED_GROUP_ID)) {
+            long storedId = e->get<Int>(BEAMED_GROUP_ID);
+            if (groupIds.find(storedId) == groupIds.end()) {
+                groupIds[storedId] = segment.getNextId();
+            }
+            e->set<Int>(BEAMED_GROUP_ID, groupIds[storedId]);
+        }
+
+        segment.insert(e);
+    }
+
+    return true;
+}
+
+void
+DocumentCache::Builder::addText(const QByteArray &text)
+{
+    m_skeleton.append(text);
+}
+
+void
+DocumentCache::Builder::addEvents(const std::vector<Event> &events)
+{
+    m_skeleton.append(QString("<%1 index=\"%2\"/>\n")
+                      .arg(EventsElement)
+                      .arg(m_events.size())
+                      .toUtf8());
+    m_events.push_back(&events);
+}
+
+bool
+DocumentCache::Builder::write(const QString &cacheFileName,
+                              const QString &fileName) const
+{
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = cacheVersion;
+    header.byteOrder = byteOrderMark;
+
+    QByteArray hash;
+    qint64 size = 0;
+    if (!hashFile(fileName, hash, size) || hash.size() != hashSize)
+        return false;
+    header.fileSize = size;
+    memcpy(header.fileHash, hash.constData(), hashSize);
+
+    // Written to one side and then moved into place, so that nothing
+    // ever opens half a cache
+    QString tempFileName = cacheFileName + ".tmp";
+    QFile file(tempFileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+
+    Output out(file);
+
+    // Filled in at the end
+    out.write(&header, sizeof(header));
+
+    header.skeletonSize = m_skeleton.size();
+    header.skeletonOffset = out.write(m_skeleton.constData(),
+                                      m_skeleton.size());
+
+    StringTable strings;
+    NameTable names;
+    std::vector<SegmentRecord> records;
+
+    for (size_t s = 0; s < m_events.size(); ++s) {
+
+        const std::vector<Event> &events = *m_events[s];
+
+        std::vector<quint32> types;
+        std::vector<qint64> times;
+        std::vector<qint64> durations;
+        std::vector<qint32> subOrderings;
+        std::vector<quint32> propertyEnds;
+        std::vector<quint32> propertyNames;
+        std::vector<quint32> propertyKinds;
+        std::vector<qint64> propertyValues;
+
+        types.reserve(events.size());
+        times.reserve(events.size());
+        durations.reserve(events.size());
+        subOrderings.reserve(events.size());
+        propertyEnds.reserve(events.size());
+
+        for (size_t i = 0; i < events.size(); ++i) {
+
+            const Event &e = events[i];
+
+            // What follows keeps to what Event::toXmlString() writes
+            // and RoseXmlHandler reads back, so that the cache opens
+            // the same document as the XML would
+
+            timeT duration = e.getDuration();
+            if (e.isa(Note::EventType) && duration < 1 &&
+                !e.has(BaseProperties::IS_GRACE_NOTE)) {
+                duration = 1;
+            }
+
+            types.push_back(strings.intern(e.getType()));
+            times.push_back(e.getAbsoluteTime());
+            durations.push_back(duration);
+            subOrderings.push_back(e.getSubOrdering());
+
+            for (int persistent = 1; persistent >= 0; --persistent) {
+
+                Event::PropertyNames eventNames =
+                    (persistent ? e.getPersistentPropertyNames() :
+                                  e.getNonPersistentPropertyNames());
+
+                for (size_t j = 0; j < eventNames.size(); ++j) {
+
+                    const PropertyName &name = eventNames[j];
+
+                    // View-local, not saved
+                    if (!persistent &&
+                        name.getName().find("::") != std::string::npos) {
+                        continue;
+                    }
+
+                    PropertyType type = e.getPropertyType(name);
+                    qint64 value = 0;
+
+                    switch (type) {
+                    case Int: {
+                        // Read from the XML as an int
+                        long l = e.get<Int>(name);
+                        value = (l < INT_MIN || l > INT_MAX) ? 0 : l;
+                        break;
+                    }
+                    case Bool:
+                        value = e.get<Bool>(name) ? 1 : 0;
+                        break;
+                    case String:
+                        value = strings.intern(e.get<String>(name));
+                        break;
+                    default:
+                        // Not read from the XML either
+                        continue;
+                    }
+
+                    propertyNames.push_back(names.intern(name));
+                    propertyKinds.push_back
+                        (quint32(type) | (persistent ? persistentFlag : 0));
+                    propertyValues.push_back(value);
+                }
+            }
+
+            propertyEnds.push_back(quint32(propertyNames.size()));
+        }
+
+        SegmentRecord record;
+        memset(&record, 0, sizeof(record));
+        record.eventCount = events.size();
+        record.propertyCount = propertyNames.size();
+        record.types = out.writeColumn(types);
+        record.times = out.writeColumn(times);
+        record.durations = out.writeColumn(durations);
+        record.subOrderings = out.writeColumn(subOrderings);
+        record.propertyEnds = out.writeColumn(propertyEnds);
+        record.propertyNames = out.writeColumn(propertyNames);
+        record.propertyKinds = out.writeColumn(propertyKinds);
+        record.propertyValues = out.writeColumn(propertyValues);
+        records.push_back(record);
+    }
+
+    header.stringCount = strings.getStrings().size();
+    header.stringsOffset = writeStrings(out, strings.getStrings());
+
+    header.nameCount = names.getNames().size();
+    header.namesOffset = writeStrings(out, names.getNames());
+
+    header.segmentCount = records.size();
+    header.segmentsOffset = out.writeColumn(records);
+
+    bool ok = out.isOk() && file.seek(0) &&
+        file.write((const char *)&header, sizeof(header)) == sizeof(header);
+
+    file.close();
+    if (file.error() != QFile::NoError) ok = false;
+
+    if (ok) {
+        QFile::remove(cacheFileName);
+        ok = QFile::rename(tempFileName, cacheFileName);
+    }
+
+    if (!ok) {
+        RG_WARNING << "write(): Failed to write" << cacheFileName;
+        QFile::remove(tempFileName);
+    }
+
+    return ok;
+}
+
+
+}
@@ -0,0 +1,161 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_DOCUMENTCACHE_H
+#define RG_DOCUMENTCACHE_H
+
+#include "base/Event.h"
+#include "base/PropertyName.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include <string>
+#include <vector>
+
+
+namespace Rosegarden
+{
+
+
+class Segment;
+
+
+/// A binary copy of a .rg file, for opening it again quickly.
+/**
+ * Most of the time spent opening a large .rg file goes on inflating
+ * and parsing the XML for the events, and on building each event from
+ * its string attributes.  When a document is saved, a cache is written
+ * alongside (in the user's resource directory, not next to the .rg
+ * file) holding the same document as:
+ *
+ *   - the XML for everything but the events, with a
+ *     \<cached-events index="n"/\> element where each segment's
+ *     events were, and
+ *   - the events of each segment as columns of fixed size values,
+ *     with their types, property names and string values interned.
+ *
+ * The file is laid out in native byte order with every column aligned,
+ * so that it can be mapped into memory and read in place.  It records
+ * the size and SHA-1 of the .rg file it was written with, and open()
+ * refuses it unless the .rg file still matches, so the .rg file stays
+ * the one true copy and a stale or damaged cache is never used.
+ *
+ * The events are read back just as RoseXmlHandler would read them from
+ * the XML, so a document opened from its cache is the same as one
+ * opened from the .rg file.  Bump the version in DocumentCache.cpp if
+ * what is written changes.
+ *
+ * @see DocumentWriter, RosegardenDocument::openDocument()
+ */
+class DocumentCache
+{
+public:
+    DocumentCache();
+    ~DocumentCache();
+
+    /// Name of the element standing in for a segment's events.
+    static const char *const EventsElement;
+
+    /// Where the cache for the given .rg file lives.
+    static QString getCachePath(const QString &fileName);
+
+    /// Open the cache for the given .rg file.
+    /**
+     * Returns false if there is none, or it doesn't match the file as
+     * it is now, or it is damaged.
+     */
+    bool open(const QString &fileName);
+
+    /// The document's XML, with the events left out.
+    /**
+     * The data belongs to the cache and is valid while it stays open.
+     */
+    QByteArray getSkeleton() const;
+
+    /// Add the events cached for the given index to segment.
+    /**
+     * Returns false if there are none with that index.
+     */
+    bool insertEvents(int index, Segment &segment) const;
+
+    /// Writes a cache, a piece at a time, in file order.
+    /**
+     * @see DocumentWriter::setCacheFile()
+     */
+    class Builder
+    {
+    public:
+        Builder() { }
+
+        /// Add some XML as it is.
+        void addText(const QByteArray &text);
+
+        /// Add the events of a segment, as DocumentWriter holds them.
+        /**
+         * They aren't copied, and must last until write() is done.
+         */
+        void addEvents(const std::vector<Event> &events);
+
+        /// Write the cache for the .rg file that has just been written.
+        bool write(const QString &cacheFileName,
+                   const QString &fileName) const;
+
+    private:
+        QByteArray m_skeleton;
+        std::vector<const std::vector<Event> *> m_events;
+    };
+
+private:
+    struct Header;
+    struct SegmentRecord;
+
+    /// Check the file is what we wrote and fits the .rg file.
+    bool validate(const QString &fileName);
+
+    /// A column of count values of type T at offset, if it's in the file.
+    template <typename T>
+    const T *column(quint64 offset, quint64 count) const;
+
+    /// Read a table of strings, as written by Builder.
+    bool readStrings(quint64 offset, quint64 count,
+                     std::vector<std::string> &strings) const;
+
+    void close();
+
+    QFile m_file;
+    const uchar *m_data;
+    qint64 m_size;
+
+    // If the file can't be mapped, it's read in
+    QByteArray m_buffer;
+
+    const Header *m_header;
+    const SegmentRecord *m_segments;
+
+    std::vector<std::string> m_strings;
+    std::vector<PropertyName> m_propertyNames;
+
+    DocumentCache(const DocumentCache &);
+    DocumentCache &operator=(const DocumentCache &);
+};
+
+
+}
+
+#endif
@@ -0,0 +1,229 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#define RG_MODULE_STRING "[DocumentWriter]"
+
+#include "DocumentWriter.h"
+#include "DocumentCache.h"
+
+#include "base/Segment.h"
+#include "misc/Debug.h"
+
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+
+#include <algorithm>
+
+#include <zlib.h>
+
+
+namespace Rosegarden
+{
+
+
+// Generates the XML for one segment's events on a pool thread
+class DocumentWriter::EventsJob : public QRunnable
+{
+public:
+    EventsJob(DocumentWriter *writer, Piece *piece) :
+        m_writer(writer),
+        m_piece(piece)
+    {
+    }
+
+    virtual void run()
+    {
+        const std::vector<Event> &events = m_piece->events;
+        QByteArray &text = m_piece->text;
+
+        bool inChord = false;
+        timeT chordStart = 0, chordDuration = 0;
+        timeT expectedTime = m_piece->startTime;
+
+        for (size_t i = 0; i < events.size(); ++i) {
+
+            const Event &event = events[i];
+            timeT absTime = event.getAbsoluteTime();
+
+            const Event *next = (i + 1 < events.size() ? &events[i + 1] : 0);
+
+            if (next &&
+                    next->getAbsoluteTime() == absTime &&
+                    event.getDuration() != 0 &&
+                    !inChord) {
+                text.append("<chord>\n");
+                inChord = true;
+                chordStart = absTime;
+                chordDuration = 0;
+            }
+
+            if (inChord && event.getDuration() > 0)
+                if (chordDuration == 0 || event.getDuration() < chordDuration)
+                    chordDuration = event.getDuration();
+
+            std::string xml = event.toXmlString(expectedTime);
+            text.append('\t');
+            text.append(xml.data(), int(xml.size()));
+            text.append('\n');
+
+            if (next &&
+                    next->getAbsoluteTime() != absTime &&
+                    inChord) {
+                text.append("</chord>\n");
+                inChord = false;
+                expectedTime = chordStart + chordDuration;
+            } else if (inChord) {
+                expectedTime = absTime;
+            } else {
+                expectedTime = absTime + event.getDuration();
+            }
+        }
+
+        if (inChord) {
+            text.append("</chord>\n");
+        }
+
+        m_writer->setReady(m_piece);
+    }
+
+private:
+    DocumentWriter *m_writer;
+    Piece *m_piece;
+};
+
+DocumentWriter::DocumentWriter()
+{
+}
+
+DocumentWriter::~DocumentWriter()
+{
+    for (size_t i = 0; i < m_pieces.size(); ++i) {
+        delete m_pieces[i];
+    }
+}
+
+void
+DocumentWriter::addText(const QString &text)
+{
+    // Run on from the last piece if we can
+    if (m_pieces.empty() || !m_pieces.back()->events.empty()) {
+        m_pieces.push_back(new Piece);
+    }
+
+    m_pieces.back()->text.append(text.toUtf8());
+}
+
+void
+DocumentWriter::addEvents(const Segment &segment)
+{
+    if (segment.empty()) return;
+
+    Piece *piece = new Piece;
+    piece->startTime = segment.getStartTime();
+    piece->ready = false;
+
+    // Reserved so that no copies are made by reallocating, as those
+    // would lose the non-persistent properties.
+    piece->events.reserve(segment.size());
+
+    for (Segment::const_iterator i = segment.begin();
+         i != segment.end(); ++i) {
+        piece->events.push_back(**i);
+        piece->events.back().copyNonPersistentProperties(**i);
+    }
+
+    m_pieces.push_back(piece);
+}
+
+void
+DocumentWriter::waitFor(Piece *piece)
+{
+    QMutexLocker locker(&m_mutex);
+    while (!piece->ready) m_ready.wait(&m_mutex);
+}
+
+void
+DocumentWriter::setReady(Piece *piece)
+{
+    QMutexLocker locker(&m_mutex);
+    piece->ready = true;
+    m_ready.wakeAll();
+}
+
+bool
+DocumentWriter::write(const QString &fileName)
+{
+    gzFile fd = gzopen(fileName.toLocal8Bit().data(), "wb");
+    if (!fd) return false;
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+
+    // How far ahead of the write the pool can get
+    const size_t ahead = 2 * size_t(std::max(pool->maxThreadCount(), 1));
+
+    size_t started = 0;
+    bool ok = true;
+
+    const bool cached = !m_cacheFileName.isEmpty();
+    DocumentCache::Builder cache;
+
+    for (size_t i = 0; i < m_pieces.size(); ++i) {
+
+        while (started < m_pieces.size() && started < i + ahead) {
+            Piece *piece = m_pieces[started++];
+            if (!piece->ready) pool->start(new EventsJob(this, piece));
+        }
+
+        Piece *piece = m_pieces[i];
+        waitFor(piece);
+
+        if (!piece->text.isEmpty()) {
+            int actual = gzwrite(fd, piece->text.constData(),
+                                 piece->text.size());
+            if (actual != piece->text.size()) {
+                RG_WARNING << "write(): Failed to write" << fileName;
+                ok = false;
+                break;
+            }
+        }
+
+        // The cache has the events themselves, not their XML
+        if (cached) {
+            if (piece->events.empty()) cache.addText(piece->text);
+            else cache.addEvents(piece->events);
+        }
+
+        // Written, so we don't need it.  The events have to wait for
+        // the destructor.
+        piece->text = QByteArray();
+    }
+
+    // If that failed, the jobs already started still refer to us
+    for (size_t i = 0; i < started; ++i) {
+        waitFor(m_pieces[i]);
+    }
+
+    if (gzclose(fd) != Z_OK) ok = false;
+
+    if (ok && cached) cache.write(m_cacheFileName, fileName);
+
+    return ok;
+}
+
+
+}
@@ -0,0 +1,113 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_DOCUMENTWRITER_H
+#define RG_DOCUMENTWRITER_H
+
+#include "base/Event.h"
+
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+
+#include <vector>
+
+
+namespace Rosegarden
+{
+
+
+class Segment;
+
+
+/// Writes a gzipped .rg file from a snapshot of the document.
+/**
+ * The document is added a piece at a time, in file order, on the GUI
+ * thread: XML that's ready to write, and the events of each segment.
+ * The events are copied, but the copies share their data with the
+ * originals (see Event), so this is cheap and the originals can go on
+ * being edited.
+ *
+ * write() can then be called on any thread.  It generates the events'
+ * XML on the global QThreadPool, a few segments ahead of the one it's
+ * deflating, so that neither the XML for the whole document nor the
+ * whole file is ever held in memory.
+ *
+ * Since the event copies share data with events being edited in the
+ * GUI thread, a DocumentWriter must be deleted on the GUI thread.
+ *
+ * If asked, write() also writes a DocumentCache for the file from the
+ * same pieces.
+ *
+ * @see RosegardenDocument::saveDocument()
+ */
+class DocumentWriter
+{
+public:
+    DocumentWriter();
+    ~DocumentWriter();
+
+    /// Add some XML as it is.
+    void addText(const QString &text);
+
+    /// Add the XML for the events in an internal segment.
+    void addEvents(const Segment &segment);
+
+    /// Write a DocumentCache as well, once the file is written.
+    /**
+     * Failing to write the cache doesn't make write() fail.
+     */
+    void setCacheFile(const QString &cacheFileName)
+        { m_cacheFileName = cacheFileName; }
+
+    /// Write the whole file.  Call once only.
+    bool write(const QString &fileName);
+
+private:
+    struct Piece
+    {
+        Piece() : startTime(0), ready(true) { }
+
+        QByteArray text;
+
+        std::vector<Event> events;
+        timeT startTime;
+
+        bool ready;
+    };
+
+    class EventsJob;
+
+    void waitFor(Piece *piece);
+    void setReady(Piece *piece);
+
+    std::vector<Piece *> m_pieces;
+
+    QString m_cacheFileName;
+
+    QMutex m_mutex;
+    QWaitCondition m_ready;
+
+    DocumentWriter(const DocumentWriter &);
+    DocumentWriter &operator=(const DocumentWriter &);
+};
+
+
+}
+
+#endif
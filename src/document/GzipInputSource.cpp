@@ -0,0 +1,98 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#define RG_MODULE_STRING "[GzipInputSource]"
+
+#include "GzipInputSource.h"
+
+#include "misc/Debug.h"
+
+#include <QByteArray>
+#include <QFileInfo>
+
+
+namespace Rosegarden
+{
+
+
+// Big enough that the per-chunk overhead is lost in the parsing, small
+// enough to stay in cache.
+static const int chunkSize = 256 * 1024;
+
+GzipInputSource::GzipInputSource(QString file) :
+    QXmlInputSource(),
+    m_file(0),
+    m_fileSize(QFileInfo(file).size()),
+    m_bytesRead(0),
+    m_ok(false)
+{
+    m_file = gzopen(file.toLocal8Bit().data(), "rb");
+    if (!m_file) return;
+
+    gzbuffer(m_file, chunkSize);
+    m_ok = true;
+}
+
+GzipInputSource::~GzipInputSource()
+{
+    if (m_file) gzclose(m_file);
+}
+
+int
+GzipInputSource::getProgress() const
+{
+    if (!m_file || m_fileSize <= 0) return 0;
+
+    // gzoffset() is where zlib has got to in the compressed file
+    qint64 offset = gzoffset(m_file);
+    if (offset >= m_fileSize) return 100;
+    return int(offset * 100 / m_fileSize);
+}
+
+void
+GzipInputSource::fetchData()
+{
+    QByteArray chunk;
+
+    if (m_file && m_ok) {
+        chunk.resize(chunkSize);
+        int got = gzread(m_file, chunk.data(), chunkSize);
+
+        if (got <= 0) {
+            // A truncated file reads as an early end, with the error
+            // (Z_BUF_ERROR) left for gzerror() to report
+            int error = Z_OK;
+            const char *message = gzerror(m_file, &error);
+            if (got < 0  ||  error != Z_OK) {
+                RG_WARNING << "fetchData(): Read failed:" << message;
+                m_ok = false;
+            }
+            got = 0;
+        }
+
+        chunk.resize(got);
+        m_bytesRead += got;
+    }
+
+    // An empty chunk tells the parser that's the end.  fromRawData()
+    // keeps any partial UTF-8 sequence at the end of a chunk for the
+    // next one.
+    setData(fromRawData(chunk));
+}
+
+
+}
@@ -0,0 +1,69 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_GZIPINPUTSOURCE_H
+#define RG_GZIPINPUTSOURCE_H
+
+#include <QString>
+#include <QXmlInputSource>
+
+#include <zlib.h>
+
+
+namespace Rosegarden
+{
+
+
+/**
+ * An XML input source that inflates a gzipped file as the parser asks
+ * for more of it, so that the whole document never has to be held in
+ * memory, compressed or otherwise.
+ *
+ * Pass it to QXmlSimpleReader::parse() as usual.  Files that aren't
+ * compressed are read as they are.
+ *
+ * @see GzipFile
+ */
+class GzipInputSource : public QXmlInputSource
+{
+public:
+    explicit GzipInputSource(QString file);
+    virtual ~GzipInputSource();
+
+    /// False if the file couldn't be opened, or was truncated or corrupt.
+    bool isOk() const { return m_ok; }
+
+    /// Percentage of the (compressed) file read so far.
+    int getProgress() const;
+
+    /// Uncompressed bytes read so far.
+    qint64 getBytesRead() const { return m_bytesRead; }
+
+    /// Inflate the next chunk for the parser.
+    virtual void fetchData();
+
+private:
+    gzFile m_file;
+    qint64 m_fileSize;
+    qint64 m_bytesRead;
+    bool m_ok;
+};
+
+
+}
+
+#endif
@@ -51,6 +51,8 @@
 #include "gui/studio/AudioPlugin.h"
 #include "gui/studio/AudioPluginManager.h"
 #include "RosegardenDocument.h"
+#include "GzipInputSource.h"
+#include "DocumentCache.h"
 #include "sound/AudioFileManager.h"
 #include "XmlStorableEvent.h"
 #include "XmlSubHandler.h"
@@ -201,7 +203,7 @@ ConfigurationXmlSubHandler::endElement(const QString&,
 
 
 RoseXmlHandler::RoseXmlHandler(RosegardenDocument *doc,
-                               unsigned int elementCount,
+                               const GzipInputSource *source,
                                QPointer<QProgressDialog> progressDialog,
                                bool createNewDevicesWhenNeeded) :
     m_doc(doc),
@@ -235,7 +237,8 @@ RoseXmlHandler::RoseXmlHandler(RosegardenDocument *doc,
     m_colourMap(0),
     m_keyMapping(0),
     m_pluginId(0),
-    m_totalElements(elementCount),
+    m_source(source),
+    m_cache(0),
     m_elementsSoFar(0),
     m_subHandler(0),
     m_deprecation(false),
@@ -1081,6 +1084,20 @@ RoseXmlHandler::startElement(const QString& namespaceURI,
                 m_currentSegment->addEventRuler(Controller::EventType, value.toInt());
         }
 
+    } else if (lcName == DocumentCache::EventsElement) {
+
+        if (m_section != InSegment || !m_currentSegment) {
+            m_errorString = "Found cached events outside Segment";
+            return false;
+        }
+
+        if (!m_cache ||
+            !m_cache->insertEvents(atts.value("index").toInt(),
+                                   *m_currentSegment)) {
+            m_errorString = "Cached events not found";
+            return false;
+        }
+
     } else if (lcName == "resync") {
 
         if (!m_deprecation)
@@ -2275,17 +2292,15 @@ RoseXmlHandler::endElement(const QString& namespaceURI,
 
     // Set percentage done
     //
-    if ((m_totalElements > m_elementsSoFar) &&
-        (++m_elementsSoFar % 300 == 0)) {
+    if (++m_elementsSoFar % 300 == 0) {
 
         if (m_progressDialog) {
             // If the user cancelled, bail.
             if (m_progressDialog->wasCanceled())
                 return false;
 
-            m_progressDialog->setValue(static_cast<int>(
-                    static_cast<double>(m_elementsSoFar) /
-                    static_cast<double>(m_totalElements) * 100.0));
+            if (m_source)
+                m_progressDialog->setValue(m_source->getProgress());
         }
 
         // Kick the event loop so that we don't appear to be in
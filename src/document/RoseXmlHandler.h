@@ -42,6 +42,8 @@ namespace Rosegarden
 
 class XmlStorableEvent;
 class XmlSubHandler;
+class GzipInputSource;
+class DocumentCache;
 class Studio;
 class Segment;
 class SegmentLinker;
@@ -79,15 +81,24 @@ public:
 
     /**
      * Construct a new RoseXmlHandler which will put the data extracted
-     * from the XML file into the specified composition
+     * from the XML file into the specified composition.  Progress is
+     * taken from how much of \a source has been read, if given.
      */
     RoseXmlHandler(RosegardenDocument *doc,
-                   unsigned int elementCount,
+                   const GzipInputSource *source,
                    QPointer<QProgressDialog> progressDialog,
                    bool createNewDevicesWhenNeeded);
 
     virtual ~RoseXmlHandler();
 
+    /// Take segments' events from a cache in place of the XML.
+    /**
+     * The source should be the cache's skeleton.
+     *
+     * @see DocumentCache
+     */
+    void setDocumentCache(const DocumentCache *cache) { m_cache = cache; }
+
     /// overloaded handler functions
     virtual bool startDocument();
     virtual bool startElement(const QString& namespaceURI,
@@ -180,7 +191,8 @@ protected:
     MidiKeyMapping                   *m_keyMapping;
     MidiKeyMapping::KeyNameMap        m_keyNameMap;
     unsigned int                      m_pluginId;
-    unsigned int                      m_totalElements;
+    const GzipInputSource            *m_source;
+    const DocumentCache              *m_cache;
     unsigned int                      m_elementsSoFar;
 
     XmlSubHandler                    *m_subHandler;
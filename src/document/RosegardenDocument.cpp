@@ -21,6 +21,9 @@
 #include "CommandHistory.h"
 #include "RoseXmlHandler.h"
 #include "GzipFile.h"
+#include "GzipInputSource.h"
+#include "DocumentCache.h"
+#include "DocumentWriter.h"
 
 #include "base/AudioDevice.h"
 #include "base/AudioPluginInstance.h"
@@ -101,15 +104,28 @@
 #include <QString>
 #include <QStringList>
 #include <QTextStream>
+#include <QThread>
 #include <QWidget>
 #include <QHostInfo>
 
+#include <set>
+
 
 namespace Rosegarden
 {
 
 using namespace BaseProperties;
 
+// Whether to write and read a DocumentCache for each file
+static bool useDocumentCache()
+{
+    QSettings settings;
+    settings.beginGroup(GeneralOptionsConfigGroup);
+    bool use = qStrToBool(settings.value("usedocumentcache", "true"));
+    settings.endGroup();
+    return use;
+}
+
 RosegardenDocument::RosegardenDocument(
         QObject *parent,
         AudioPluginManager *pluginManager,
@@ -119,6 +135,7 @@ RosegardenDocument::RosegardenDocument(
     QObject(parent),
     m_modified(false),
     m_autoSaved(false),
+    m_autoSaveThread(0),
     m_audioPeaksThread(&m_audioFileManager),
     m_seqManager(0),
     m_pluginManager(pluginManager),
@@ -154,6 +171,8 @@ RosegardenDocument::~RosegardenDocument()
     m_audioPeaksThread.finish();
     m_audioPeaksThread.wait();
 
+    finishAutoSave();
+
     deleteEditViews();
 
     //     ControlRulerCanvasRepository::clear();
@@ -313,6 +332,41 @@ QString RosegardenDocument::getAutoSaveFileName()
     return autoSaveFileName;
 }
 
+/// Writes an autosave, so that the GUI doesn't have to wait for it.
+class RosegardenDocument::AutoSaveThread : public QThread
+{
+public:
+    /// Takes ownership of the writer.
+    AutoSaveThread(DocumentWriter *writer, const QString &fileName) :
+        m_writer(writer),
+        m_fileName(fileName),
+        m_ok(false)
+    {
+    }
+
+    /// Must be called on the GUI thread, see DocumentWriter.
+    virtual ~AutoSaveThread()
+    {
+        delete m_writer;
+    }
+
+    bool isOk() const { return m_ok; }
+    QString getErrorMessage() const { return m_errMsg; }
+
+protected:
+    virtual void run()
+    {
+        m_ok = RosegardenDocument::writeDocument(*m_writer, m_fileName,
+                                                 m_errMsg);
+    }
+
+private:
+    DocumentWriter *m_writer;
+    QString m_fileName;
+    QString m_errMsg;
+    bool m_ok;
+};
+
 void RosegardenDocument::slotAutoSave()
 {
     //     RG_DEBUG << "RosegardenDocument::slotAutoSave()";
@@ -320,16 +374,51 @@ void RosegardenDocument::slotAutoSave()
     if (isAutoSaved() || !isModified())
         return ;
 
+    // Still writing the last one
+    if (m_autoSaveThread)
+        return ;
+
     QString autoSaveFileName = getAutoSaveFileName();
 
     RG_DEBUG << "RosegardenDocument::slotAutoSave() - doc modified - saving '"
     << getAbsFilePath() << "' as"
     << autoSaveFileName;
 
-    QString errMsg;
+    DocumentWriter *writer = new DocumentWriter;
+    snapshotDocument(*writer);
 
-    saveDocument(autoSaveFileName, errMsg, true);
+    // Any changes from now on need another autosave
+    setAutoSaved(true);
 
+    m_autoSaveThread = new AutoSaveThread(writer, autoSaveFileName);
+    connect(m_autoSaveThread, SIGNAL(finished()),
+            this, SLOT(slotAutoSaveFinished()));
+    m_autoSaveThread->start(QThread::LowPriority);
+}
+
+void RosegardenDocument::slotAutoSaveFinished()
+{
+    // Unless saveDocument() has already cleared up after it
+    if (m_autoSaveThread && m_autoSaveThread->isFinished())
+        finishAutoSave();
+}
+
+void RosegardenDocument::finishAutoSave()
+{
+    if (!m_autoSaveThread)
+        return ;
+
+    m_autoSaveThread->wait();
+
+    if (!m_autoSaveThread->isOk()) {
+        RG_WARNING << "finishAutoSave(): Autosave failed:"
+                   << m_autoSaveThread->getErrorMessage();
+        // Try again next time
+        setAutoSaved(false);
+    }
+
+    delete m_autoSaveThread;
+    m_autoSaveThread = 0;
 }
 
 bool RosegardenDocument::isRegularDotRGFile() const
@@ -585,22 +674,83 @@ bool RosegardenDocument::openDocument(const QString &filename,
 
     // Load.
 
-    QString fileContents;
-
-    // Unzip
-    bool okay = GzipFile::readFromFile(filename, fileContents);
-    
     QString errMsg;
     bool cancelled = false;
+    bool okay = false;
 
-    if (!okay) {
-        errMsg = tr("Could not open Rosegarden file");
-    } else {
-        // Parse the XML
-        okay = xmlParse(fileContents,
+    // If the file hasn't changed since it was last saved here, its
+    // cache gets the same document without parsing the events' XML
+    DocumentCache cache;
+    bool parsed = false;
+
+    if (useDocumentCache()  &&  cache.open(filename)) {
+
+        RG_DEBUG << "openDocument(): reading events from the cache";
+
+        // The devices there are before reading, so that any the cache
+        // adds can go again if it can't be read
+        std::set<DeviceId> devices;
+        for (DeviceListConstIterator i = m_studio.begin();
+             i != m_studio.end(); ++i) {
+            devices.insert((*i)->getId());
+        }
+
+        QXmlInputSource source;
+        source.setData(cache.getSkeleton());
+
+        okay = xmlParse(source, 0, &cache,
                         errMsg,
                         permanent,
                         cancelled);
+
+        if (okay) {
+            parsed = true;
+        } else {
+            RG_WARNING << "openDocument(): could not read the cache:"
+                       << errMsg << "- reading the file instead";
+
+            // Next time, use the file
+            QFile::remove(DocumentCache::getCachePath(filename));
+
+            // Drop whatever the cache got as far as loading.  Reading
+            // the file adds the devices again, and clears or sets the
+            // rest of the studio as it goes.
+            m_composition.clear();
+            m_audioFileManager.clear();
+            std::vector<DeviceId> added;
+            for (DeviceListConstIterator i = m_studio.begin();
+                 i != m_studio.end(); ++i) {
+                if (devices.find((*i)->getId()) == devices.end())
+                    added.push_back((*i)->getId());
+            }
+            for (size_t i = 0; i < added.size(); ++i) {
+                m_studio.removeDevice(added[i]);
+            }
+            errMsg = QString();
+        }
+    }
+
+    if (!parsed) {
+
+        // Unzip as we parse, so that the whole file is never in memory
+        GzipInputSource source(filename);
+
+        okay = source.isOk();
+
+        if (!okay) {
+            errMsg = tr("Could not open Rosegarden file");
+        } else {
+            // Parse the XML
+            okay = xmlParse(source, &source, 0,
+                            errMsg,
+                            permanent,
+                            cancelled);
+
+            if (okay && !cancelled && !source.isOk()) {
+                okay = false;
+                errMsg = tr("Could not read the whole of the Rosegarden file");
+            }
+        }
     }
 
     if (!okay) {
@@ -1160,11 +1310,50 @@ int RosegardenDocument::FILE_FORMAT_VERSION_POINT = 3;
 bool RosegardenDocument::saveDocument(const QString& filename,
                                     QString& errMsg,
                                     bool autosave)
+{
+    Profiler profiler("RosegardenDocument::saveDocument");
+    RG_DEBUG << "RosegardenDocument::saveDocument(" << filename << ")";
+
+    // Otherwise an autosave could finish after this, and look newer.
+    finishAutoSave();
+
+    DocumentWriter writer;
+    snapshotDocument(writer);
+
+    // Not for autosaves, which are only ever opened to recover them
+    if (!autosave  &&  useDocumentCache())
+        writer.setCacheFile(DocumentCache::getCachePath(filename));
+
+    if (!writeDocument(writer, filename, errMsg)) {
+        // errMsg should be already set
+        return false;
+    }
+
+    RG_DEBUG << "RosegardenDocument::saveDocument() finished";
+
+    if (!autosave) {
+        emit documentModified(false);
+        setModified(false);
+        CommandHistory::getInstance()->documentSaved();
+    }
+
+    setAutoSaved(true);
+
+    return true;
+}
+
+bool RosegardenDocument::writeDocument(DocumentWriter &writer,
+                                       const QString& filename,
+                                       QString& errMsg)
 {
     QFileInfo fileInfo(filename);
 
     if (!fileInfo.exists()) { // safe to write directly
-        return saveDocumentActual(filename, errMsg, autosave);
+        if (!writer.write(filename)) {
+            errMsg = tr("Error while writing on '%1'").arg(filename);
+            return false;
+        }
+        return true;
     }
 
     if (fileInfo.exists()  &&  !fileInfo.isWritable()) {
@@ -1196,10 +1385,8 @@ bool RosegardenDocument::saveDocument(const QString& filename,
         return false;
     }
 
-    bool success = saveDocumentActual(tempFileName, errMsg, autosave);
-
-    if (!success) {
-        // errMsg should be already set
+    if (!writer.write(tempFileName)) {
+        errMsg = tr("Error while writing on '%1'").arg(tempFileName);
         return false;
     }
 
@@ -1217,12 +1404,9 @@ bool RosegardenDocument::saveDocument(const QString& filename,
 }
 
 
-bool RosegardenDocument::saveDocumentActual(const QString& filename,
-                                          QString& errMsg,
-                                          bool autosave)
+void RosegardenDocument::snapshotDocument(DocumentWriter &writer)
 {
-    Profiler profiler("RosegardenDocument::saveDocumentActual");
-    RG_DEBUG << "RosegardenDocument::saveDocumentActual(" << filename << ")";
+    Profiler profiler("RosegardenDocument::snapshotDocument");
 
     QString outText;
     QTextStream outStream(&outText, QIODevice::WriteOnly);
@@ -1255,27 +1439,16 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
     outStream << strtoqstr(getConfiguration().toXmlString())
               << endl << endl;
 
-    long totalEvents = 0;
-    for (Composition::iterator segitr = m_composition.begin();
-         segitr != m_composition.end(); ++segitr) {
-        totalEvents += (long)(*segitr)->size();
-    }
+    // Put a break in the file
+    //
+    outStream << endl << endl;
 
-    for (Composition::triggersegmentcontaineriterator ci =
-             m_composition.getTriggerSegments().begin();
-         ci != m_composition.getTriggerSegments().end(); ++ci) {
-        totalEvents += (long)(*ci)->getSegment()->size();
-    }
+    outStream.flush();
+    writer.addText(outText);
 
     // output all elements
     //
     // Iterate on segments
-    long eventCount = 0;
-
-    // Put a break in the file
-    //
-    outStream << endl << endl;
-
     for (Composition::iterator segitr = m_composition.begin();
          segitr != m_composition.end(); ++segitr) {
 
@@ -1299,17 +1472,16 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
               .arg(segment->getLinkTransposeParams().m_transposeSegmentBack
                                                          ? "true" : "false");
 
-            saveSegment(outStream, segment, totalEvents,
-                                            eventCount, linkedSegAtts);
+            saveSegment(writer, segment, linkedSegAtts);
         } else {
-            saveSegment(outStream, segment, totalEvents, eventCount);
+            saveSegment(writer, segment);
         }
 
     }
 
     // Put a break in the file
     //
-    outStream << endl << endl;
+    writer.addText("\n\n");
 
     for (Composition::triggersegmentcontaineriterator ci =
                 m_composition.getTriggerSegments().begin();
@@ -1324,44 +1496,33 @@ bool RosegardenDocument::saveDocumentActual(const QString& filename,
                               .arg(strtoqstr((*ci)->getDefaultTimeAdjust()));
 
         Segment *segment = (*ci)->getSegment();
-        saveSegment(outStream, segment, totalEvents, eventCount, triggerAtts);
+        saveSegment(writer, segment, triggerAtts);
     }
 
+    QString endText;
+    QTextStream endStream(&endText, QIODevice::WriteOnly);
+    endStream.setCodec("UTF-8");
+
     // Put a break in the file
     //
-    outStream << endl << endl;
+    endStream << endl << endl;
 
     // Send out the studio - a self contained command
     //
-    outStream << strtoqstr(m_studio.toXmlString()) << endl << endl;
+    endStream << strtoqstr(m_studio.toXmlString()) << endl << endl;
 
     // Send out the appearance data
-    outStream << "<appearance>" << endl;
-    outStream << strtoqstr(getComposition().getSegmentColourMap().toXmlString("segmentmap"));
-    outStream << strtoqstr(getComposition().getGeneralColourMap().toXmlString("generalmap"));
-    outStream << "</appearance>" << endl << endl << endl;
+    endStream << "<appearance>" << endl;
+    endStream << strtoqstr(getComposition().getSegmentColourMap().toXmlString("segmentmap"));
+    endStream << strtoqstr(getComposition().getGeneralColourMap().toXmlString("generalmap"));
+    endStream << "</appearance>" << endl << endl << endl;
 
     // close the top-level XML tag
     //
-    outStream << "</rosegarden-data>\n";
-
-    bool okay = GzipFile::writeToFile(filename, outText);
-    if (!okay) {
-        errMsg = tr("Error while writing on '%1'").arg(filename);
-        return false;
-    }
-
-    RG_DEBUG << "RosegardenDocument::saveDocument() finished";
-
-    if (!autosave) {
-        emit documentModified(false);
-        setModified(false);
-        CommandHistory::getInstance()->documentSaved();
-    }
+    endStream << "</rosegarden-data>\n";
 
-    setAutoSaved(true);
-
-    return true;
+    endStream.flush();
+    writer.addText(endText);
 }
 
 bool RosegardenDocument::exportStudio(const QString& filename,
@@ -1400,12 +1561,17 @@ bool RosegardenDocument::exportStudio(const QString& filename,
     return true;
 }
 
-void RosegardenDocument::saveSegment(QTextStream& outStream, Segment *segment,
-                                   long /*totalEvents*/, long &/*count*/,
+void RosegardenDocument::saveSegment(DocumentWriter &writer, Segment *segment,
                                    QString extraAttributes)
 {
     QString time;
 
+    QString outText;
+    QTextStream outStream(&outText, QIODevice::WriteOnly);
+    outStream.setCodec("UTF-8");
+
+    int eventsAt = -1;
+
     outStream << QString("<%1 track=\"%2\" start=\"%3\" ")
     .arg(segment->getXmlElementName())
     .arg(segment->getTrack())
@@ -1505,55 +1671,10 @@ void RosegardenDocument::saveSegment(QTextStream& outStream, Segment *segment,
     {
         outStream << "\">\n";
 
-        bool inChord = false;
-        timeT chordStart = 0, chordDuration = 0;
-        timeT expectedTime = segment->getStartTime();
-
-        for (Segment::iterator i = segment->begin();
-                i != segment->end(); ++i) {
-
-            timeT absTime = (*i)->getAbsoluteTime();
-
-            Segment::iterator nextEl = i;
-            ++nextEl;
-
-            if (nextEl != segment->end() &&
-                    (*nextEl)->getAbsoluteTime() == absTime &&
-                    (*i)->getDuration() != 0 &&
-                    !inChord) {
-                outStream << "<chord>" << endl;
-                inChord = true;
-                chordStart = absTime;
-                chordDuration = 0;
-            }
-
-            if (inChord && (*i)->getDuration() > 0)
-                if (chordDuration == 0 || (*i)->getDuration() < chordDuration)
-                    chordDuration = (*i)->getDuration();
-
-            outStream << '\t'
-            << strtoqstr((*i)->toXmlString(expectedTime)) << endl;
-
-            if (nextEl != segment->end() &&
-                    (*nextEl)->getAbsoluteTime() != absTime &&
-                    inChord) {
-                outStream << "</chord>\n";
-                inChord = false;
-                expectedTime = chordStart + chordDuration;
-            } else if (inChord) {
-                expectedTime = absTime;
-            } else {
-                expectedTime = absTime + (*i)->getDuration();
-            }
-
-//            if ((++count % 500 == 0) && progress) {
-//                progress->setValue(count * 100 / totalEvents);
-//            }
-        }
-
-        if (inChord) {
-            outStream << "</chord>\n";
-        }
+        // The events go here.  Their XML is generated when the writer
+        // gets to them.
+        outStream.flush();
+        eventsAt = outText.length();
 
         // Add EventRulers to segment - we call them controllers because of
         // a historical mistake in naming them.  My bad.  RWB.
@@ -1580,6 +1701,15 @@ void RosegardenDocument::saveSegment(QTextStream& outStream, Segment *segment,
 
     outStream << QString("</%1>\n").arg(segment->getXmlElementName()); //-------------------------
 
+    outStream.flush();
+
+    if (eventsAt < 0) {
+        writer.addText(outText);
+    } else {
+        writer.addText(outText.left(eventsAt));
+        writer.addEvents(*segment);
+        writer.addText(outText.mid(eventsAt));
+    }
 }
 
 bool RosegardenDocument::saveAs(const QString &newName, QString &errMsg)
@@ -1632,27 +1762,22 @@ bool RosegardenDocument::isSoundEnabled() const
 }
 
 bool
-RosegardenDocument::xmlParse(QString fileContents, QString &errMsg,
-                           bool permanent,
-                           bool &cancelled)
+RosegardenDocument::xmlParse(QXmlInputSource &source,
+                             const GzipInputSource *gzipSource,
+                             const DocumentCache *cache,
+                             QString &errMsg,
+                             bool permanent,
+                             bool &cancelled)
 {
     Profiler profiler("RosegardenDocument::xmlParse");
 
     cancelled = false;
 
-    unsigned int elementCount = 0;
-    for (int i = 0; i < fileContents.length() - 1; ++i) {
-        if (fileContents[i] == '<' && fileContents[i+1] != '/') {
-            ++elementCount;
-        }
-    }
-
     if (permanent && m_soundEnabled) RosegardenSequencer::getInstance()->removeAllDevices();
 
-    RoseXmlHandler handler(this, elementCount, m_progressDialog, permanent);
+    RoseXmlHandler handler(this, gzipSource, m_progressDialog, permanent);
+    handler.setDocumentCache(cache);
 
-    QXmlInputSource source;
-    source.setData(fileContents);
     QXmlSimpleReader reader;
     reader.setContentHandler(&handler);
     reader.setErrorHandler(&handler);
@@ -39,7 +39,7 @@
 #include <vector>
 
 class QWidget;
-class QTextStream;
+class QXmlInputSource;
 class NoteOnRecSet;
 
 
@@ -52,6 +52,9 @@ class MappedEventList;
 class Event;
 class EditViewBase;
 class AudioPluginManager;
+class GzipInputSource;
+class DocumentCache;
+class DocumentWriter;
 
 
 static const int MERGE_AT_END           = (1 << 0);
@@ -473,7 +476,8 @@ public slots:
     void slotDocumentRestored();
 
     /**
-     * saves the document to a suitably-named backup file
+     * saves the document to a suitably-named backup file, in the
+     * background
      */
     void slotAutoSave();
 
@@ -483,6 +487,9 @@ public slots:
 
     void slotDocColoursChanged();
 
+private slots:
+    void slotAutoSaveFinished();
+
 signals:
     /**
      * Emitted when document is modified or saved
@@ -548,7 +555,10 @@ private:
     void performAutoload();
 
     /**
-     * Parse the Rosegarden file in \a file
+     * Parse the Rosegarden file read from \a source
+     *
+     * Progress is taken from \a gzipSource, if given.  If \a cache
+     * is given, \a source is its skeleton and the events come from it.
      *
      * \a errMsg will contains the error messages
      * if parsing failed.
@@ -556,7 +566,10 @@ private:
      * @return false if parsing failed
      * @see RoseXmlHandler
      */
-    bool xmlParse(QString fileContents, QString &errMsg,
+    bool xmlParse(QXmlInputSource &source,
+                  const GzipInputSource *gzipSource,
+                  const DocumentCache *cache,
+                  QString &errMsg,
                   bool permanent,
                   bool &cancelled);
 
@@ -578,22 +591,31 @@ private:
     QString getAutoSaveFileName();
 
     /**
-     * Save document to the given file.  This function does the actual
-     * save of the file to the given filename; saveDocument() wraps
-     * this, saving to a temporary file and then renaming to the
-     * required file, so as not to lose the original if a failure
-     * occurs during overwriting.
+     * Add everything saveDocument() writes to \a writer.  The
+     * document can go on being edited while it's written.
+     */
+    void snapshotDocument(DocumentWriter &writer);
+
+    /**
+     * Write the document in \a writer to the given file.  This
+     * writes to a temporary file and then renames it to the required
+     * file, so as not to lose the original if a failure occurs during
+     * overwriting.  Can be called from any thread.
      */
-    bool saveDocumentActual(const QString &filename, QString& errMsg,
-                            bool autosave = false);
+    static bool writeDocument(DocumentWriter &writer,
+                              const QString &filename, QString &errMsg);
 
     /**
-     * Save one segment to the given text stream
+     * Add one segment to the given writer
      */
-    void saveSegment(QTextStream&, Segment*,
-                     long totalNbOfEvents, long &count,
+    void saveSegment(DocumentWriter &writer, Segment *segment,
                      QString extraAttributes = QString::null);
 
+    /**
+     * Wait for any autosave that's being written in the background
+     */
+    void finishAutoSave();
+
     /// Identifies a specific event within a specific segment.
     /**
      * A struct formed by a Segment pointer and an iterator into the same
@@ -669,6 +691,13 @@ private:
      */
     bool m_autoSaved;
 
+    class AutoSaveThread;
+
+    /**
+     * writes an autosave in the background, if one is under way
+     */
+    AutoSaveThread *m_autoSaveThread;
+
     /**
      * the title of the current document
      */
@@ -46,6 +46,7 @@
 #include "commands/edit/CopyCommand.h"
 #include "commands/edit/CutCommand.h"
 #include "commands/edit/EventQuantizeCommand.h"
+#include "commands/edit/ParallelQuantizeCommand.h"
 #include "commands/edit/PasteSegmentsCommand.h"
 #include "commands/edit/TransposeCommand.h"
 #include "commands/edit/AddMarkerCommand.h"
@@ -4132,39 +4133,15 @@ RosegardenMainWindow::createDocumentFromMIDIFile(QString file)
 
     progressDialog.setValue(20);
 
-    int segmentCount = 1;
-    const int nbSegments = comp->getNbSegments();
+    // Quantize all the segments for notation at once, on as many
+    // threads as we have
+    std::vector<Segment *> segments(comp->begin(), comp->end());
 
-    double progressPerSegment = 80;
-    if (nbSegments > 0)
-        progressPerSegment = 80.0 / nbSegments;
-
-    MacroCommand *command = new MacroCommand(tr("Calculate Notation"));
-
-    // For each segment in the composition.
-    for (Composition::iterator i = comp->begin(); i != comp->end(); ++i) {
-        Segment &segment = **i;
-
-        timeT startTime(segment.getStartTime());
-        timeT endTime(segment.getEndMarkerTime());
-
-        //RG_DEBUG << "segment: start time " << segment.getStartTime() << ", end time " << segment.getEndTime() << ", end marker time " << segment.getEndMarkerTime() << ", events " << segment.size();
-
-        EventQuantizeCommand *subCommand = new EventQuantizeCommand
-            (segment, startTime, endTime, NotationOptionsConfigGroup,
-             EventQuantizeCommand::QUANTIZE_NOTATION_ONLY);
-        subCommand->setProgressDialog(&progressDialog);
-
-        // Compute progress so far.
-        double totalProgress = 20 + segmentCount * progressPerSegment;
-        ++segmentCount;
-
-        //RG_DEBUG << "createDocumentFromMIDIFile() totalProgress: " << totalProgress;
-
-        subCommand->setProgressTotal(totalProgress, progressPerSegment + 1);
-
-        command->addCommand(subCommand);
-    }
+    ParallelQuantizeCommand *command = new ParallelQuantizeCommand
+        (tr("Calculate Notation"), segments, NotationOptionsConfigGroup,
+         EventQuantizeCommand::QUANTIZE_NOTATION_ONLY);
+    command->setProgressDialog(&progressDialog);
+    command->setProgressRange(20, 100);
 
     CommandHistory::getInstance()->addCommand(command);
 
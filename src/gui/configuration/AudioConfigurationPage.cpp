@@ -143,6 +143,21 @@ AudioConfigurationPage::AudioConfigurationPage(
 
     settings.endGroup();
 
+    settings.beginGroup( SequencerOptionsConfigGroup );
+
+    layout->addWidget(new QLabel(tr("Memory for cached audio files (MB)"),
+                                 frame), row, 0);
+
+    m_smallFileCacheBudget = new QSpinBox(frame);
+    connect(m_smallFileCacheBudget, SIGNAL(valueChanged(int)), this, SLOT(slotModified()));
+    m_smallFileCacheBudget->setMinimum(0);
+    m_smallFileCacheBudget->setMaximum(4096);
+    m_smallFileCacheBudget->setValue(settings.value("smallfilecachebudget", 64).toInt());
+    layout->addWidget(m_smallFileCacheBudget, row, 1, row- row+1, 2);
+    ++row;
+
+    settings.endGroup();
+
     layout->addWidget(new QLabel(tr("Create JACK outputs"), frame),
                       row, 0);
 //    ++row;
@@ -217,6 +232,8 @@ AudioConfigurationPage::apply()
     QSettings settings;
     settings.beginGroup( SequencerOptionsConfigGroup );
 
+    settings.setValue("smallfilecachebudget", m_smallFileCacheBudget->value());
+
 #ifdef HAVE_LIBJACK
     // Jack audio inputs
     //
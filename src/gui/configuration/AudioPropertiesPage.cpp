@@ -80,7 +80,18 @@ AudioPropertiesPage::AudioPropertiesPage(RosegardenDocument *doc,  QWidget *pare
 
     layout->addWidget(m_minutesAtStereo, 2, 1, Qt::AlignCenter);
 
-    layout->setRowStretch(3, 2);
+    AudioCache::Statistics cache =
+        RosegardenSequencer::getInstance()->getSmallFileCacheStatistics();
+    layout->addWidget(new QLabel(tr("Cached audio files:"), frame), 3, 0);
+    layout->addWidget(
+        new QLabel(tr("%1 kB of %2 kB (%3 hits, %4 misses, %5 evictions)")
+                   .arg(cache.bytesResident / 1024)
+                   .arg(cache.memoryBudget / 1024)
+                   .arg(cache.hits)
+                   .arg(cache.misses)
+                   .arg(cache.evictions), frame), 3, 1);
+
+    layout->setRowStretch(4, 2);
     frame->setLayout(layout);
 
     calculateStats();
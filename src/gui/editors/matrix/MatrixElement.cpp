@@ -18,41 +18,56 @@
 
 #include "MatrixElement.h"
 #include "MatrixScene.h"
+#include "MatrixSegmentItem.h"
 #include "misc/Debug.h"
 #include "base/RulerScale.h"
 
-#include <QGraphicsRectItem>
-#include <QGraphicsPolygonItem>
-#include <QBrush>
 #include <QColor>
 
 #include "base/Event.h"
 #include "base/NotationTypes.h"
 #include "base/BaseProperties.h"
-#include "gui/general/GUIPalette.h"
 #include "gui/rulers/DefaultVelocityColour.h"
 
+#include <cmath>
+
 
 namespace Rosegarden
 {
 
-static const int MatrixElementData = 2;
-
 MatrixElement::MatrixElement(MatrixScene *scene, Event *event,
-                             bool drum, long pitchOffset) :
+                             bool drum, long pitchOffset,
+                             MatrixSegmentItem *item) :
     ViewElement(event),
     m_scene(scene),
     m_drum(drum),
     m_current(true),
-    m_item(0),
+    m_selected(false),
+    m_segmentItem(0),
+    m_ownSegmentItem(false),
+    m_sequence(0),
+    m_brushStyle(Qt::SolidPattern),
     m_pitchOffset(pitchOffset)
 {
     reconfigure();
+
+    if (!item) {
+        // Shown above the segments' own items
+        item = new MatrixSegmentItem;
+        item->setZValue(2);
+        m_scene->addItem(item);
+        m_ownSegmentItem = true;
+    }
+
+    m_segmentItem = item;
+    m_segmentItem->addElement(this);
 }
 
 MatrixElement::~MatrixElement()
 {
-    delete m_item;
+    if (!m_segmentItem) return;
+    m_segmentItem->removeElement(this);
+    if (m_ownSegmentItem) delete m_segmentItem;
 }
 
 void
@@ -121,86 +136,75 @@ MatrixElement::reconfigure(timeT time, timeT duration, int pitch, int velocity)
     }
     colour.setAlpha(160);
 
-    double fres(resolution);
+    m_colour = colour;
+    m_brushStyle = brushPattern;
+
+    // set the Y position taking m_pitchOffset into account, subtracting the
+    // opposite of whatever the originating segment transpose was
+
+//    std::cout << "TRANSPOSITION TEST: event pitch: "
+//              << (pitch ) << " m_pitchOffset: " << m_pitchOffset
+//              << std::endl;
+
+    double y = (127 - pitch - m_pitchOffset) * (resolution + 1);
+
+    QRectF oldRect = m_rect;
 
     if (m_drum) {
-        fres = resolution + 1;
-        QGraphicsPolygonItem *item = dynamic_cast<QGraphicsPolygonItem *>(m_item);
-        if (!item) {
-            delete m_item;
-            item = new QGraphicsPolygonItem;
-            m_item = item;
-            m_scene->addItem(m_item);
-        }
-        QPolygonF polygon;
-        polygon << QPointF(0, 0)
-                << QPointF(fres/2, fres/2)
-                << QPointF(0, fres)
-                << QPointF(-fres/2, fres/2)
-                << QPointF(0, 0);
-        item->setPolygon(polygon);
-        item->setPen
-            (QPen(GUIPalette::getColour(GUIPalette::MatrixElementBorder), 0));
-        item->setBrush(QBrush(colour, brushPattern));
+        // a diamond centred on the note's start
+        double fres = resolution + 1;
+        m_rect = QRectF(x0 - fres/2, y, fres, fres);
     } else {
-        QGraphicsRectItem *item = dynamic_cast<QGraphicsRectItem *>(m_item);
-        if (!item) {
-            delete m_item;
-            item = new QGraphicsRectItem;
-            m_item = item;
-            m_scene->addItem(m_item);
-        }
-        float width = m_width;
+        double width = m_width;
         if (width < 1) {
             x0 = std::max(0.0, x1 - 1);
             width = 1;
         }
-        QRectF rect(0, 0, width, fres + 1);
-        item->setRect(rect);
-        item->setPen
-            (QPen(GUIPalette::getColour(GUIPalette::MatrixElementBorder), 0));
-        item->setBrush(QBrush(colour, brushPattern));
+        m_rect = QRectF(x0, y, width, resolution + 1);
     }
 
     setLayoutX(x0);
 
-    m_item->setData(MatrixElementData, QVariant::fromValue((void *)this));
-
-    // set the Y position taking m_pitchOffset into account, subtracting the
-    // opposite of whatever the originating segment transpose was
+    if (m_segmentItem) m_segmentItem->moveElement(this, oldRect);
+}
 
-//    std::cout << "TRANSPOSITION TEST: event pitch: "
-//              << (pitch ) << " m_pitchOffset: " << m_pitchOffset
-//              << std::endl;
+bool
+MatrixElement::isNote() const
+{
+    return event()->isa(Note::EventType);
+}
 
-    m_item->setPos(x0, (127 - pitch - m_pitchOffset) * (resolution + 1));
+bool
+MatrixElement::contains(const QPointF &pos) const
+{
+    if (!m_rect.contains(pos)) return false;
+    if (!m_drum) return true;
 
-    // set a tooltip explaining why this event is drawn in a different pattern
-    if (tiedNote) m_item->setToolTip(QObject::tr("This event is tied to another event."));
+    // within the diamond
+    double dx = fabs(pos.x() - m_rect.center().x()) / (m_rect.width() / 2);
+    double dy = fabs(pos.y() - m_rect.center().y()) / (m_rect.height() / 2);
+    return dx + dy <= 1.0;
 }
 
 bool
-MatrixElement::isNote() const
+MatrixElement::intersects(const QRectF &rect) const
 {
-    return event()->isa(Note::EventType);
+    if (!m_rect.intersects(rect)) return false;
+    if (!m_drum) return true;
+
+    // The diamond meets the rect if the point of the rect nearest to
+    // its centre is within it
+    QPointF centre = m_rect.center();
+    return contains(QPointF(qBound(rect.left(), centre.x(), rect.right()),
+                            qBound(rect.top(), centre.y(), rect.bottom())));
 }
 
 void
 MatrixElement::setSelected(bool selected)
 {
-    QAbstractGraphicsShapeItem *item =
-        dynamic_cast<QAbstractGraphicsShapeItem *>(m_item);
-    if (!item) return;
-
-    if (selected) {
-        QPen pen(GUIPalette::getColour(GUIPalette::SelectedElement), 2,
-                 Qt::SolidLine, Qt::SquareCap, Qt::MiterJoin);
-        pen.setCosmetic(!m_drum);
-        item->setPen(pen);
-    } else {
-        item->setPen
-            (QPen(GUIPalette::getColour(GUIPalette::MatrixElementBorder), 0));
-    }
+    if (m_selected == selected) return;
+    m_selected = selected;
+    if (m_segmentItem) m_segmentItem->updateElement(this);
 }
 
 void
@@ -208,44 +212,22 @@ MatrixElement::setCurrent(bool current)
 {
     if (m_current == current) return;
 
-    QAbstractGraphicsShapeItem *item =
-        dynamic_cast<QAbstractGraphicsShapeItem *>(m_item);
-    if (!item) return;
-
-    QColor colour;
-    
     if (!current) {
-        colour = QColor(200, 200, 200);
+        m_colour = QColor(200, 200, 200);
     } else {
         if (event()->has(BaseProperties::TRIGGER_SEGMENT_ID)) {
-            colour = Qt::gray;
+            m_colour = Qt::gray;
         } else {
             long velocity = 100;
             event()->get<Int>(BaseProperties::VELOCITY, velocity);
-            colour = DefaultVelocityColour::getInstance()->getColour(velocity);
+            m_colour = DefaultVelocityColour::getInstance()->getColour(velocity);
         }
     }
-
-    item->setBrush(colour);
-    item->setZValue(current ? 1 : 0);
-
-    if (current) {
-        item->setPen
-            (QPen(GUIPalette::getColour(GUIPalette::MatrixElementBorder), 0));
-    } else {
-        item->setPen
-            (QPen(GUIPalette::getColour(GUIPalette::MatrixElementLightBorder), 0));
-    }
+    m_brushStyle = Qt::SolidPattern;
 
     m_current = current;
-}
 
-MatrixElement *
-MatrixElement::getMatrixElement(QGraphicsItem *item)
-{
-    QVariant v = item->data(MatrixElementData);
-    if (v.isNull()) return 0;
-    return (MatrixElement *)v.value<void *>();
+    if (m_segmentItem) m_segmentItem->updateElement(this);
 }
 
 
@@ -20,22 +20,31 @@
 
 #include "base/ViewElement.h"
 
-class QColor;
-class QGraphicsItem;
+#include <QColor>
+#include <QRectF>
 
 namespace Rosegarden
 {
 
 class MatrixScene;
+class MatrixSegmentItem;
 class Event;
 
+/// A note in the matrix, drawn by a MatrixSegmentItem.
+/**
+ * The element holds the geometry and colours of its note, which the
+ * item draws along with the rest of its segment.  Given no item, as
+ * for the previews made by the tools, the element makes one of its
+ * own.
+ */
 class MatrixElement : public ViewElement
 {
 public:
     MatrixElement(MatrixScene *scene,
                   Event *event,
                   bool drum,
-                  long pitchOffset);
+                  long pitchOffset,
+                  MatrixSegmentItem *item = 0);
     virtual ~MatrixElement();
 
     /// Returns true if the wrapped event is a note
@@ -50,8 +59,24 @@ public:
     double getElementVelocity() { return m_velocity; }
 
     void setSelected(bool selected);
+    bool isSelected() const { return m_selected; }
 
     void setCurrent(bool current);
+    bool isCurrent() const { return m_current; }
+
+    bool isDrum() const { return m_drum; }
+
+    /// The area of the note block (or drum diamond) in the scene
+    const QRectF &getSceneRect() const { return m_rect; }
+
+    /// Whether the note's shape contains the given scene point
+    bool contains(const QPointF &) const;
+
+    /// Whether the note's shape meets the given scene rect
+    bool intersects(const QRectF &) const;
+
+    const QColor &getColour() const { return m_colour; }
+    Qt::BrushStyle getBrushStyle() const { return m_brushStyle; }
 
     /// Adjust the item to reflect the values of our event
     void reconfigure();
@@ -68,13 +93,19 @@ public:
     /// Adjust the item to reflect the given values, not those of our event
     void reconfigure(timeT time, timeT duration, int pitch, int velocity);
 
-    static MatrixElement *getMatrixElement(QGraphicsItem *);
-
 protected:
+    friend class MatrixSegmentItem;
+
     MatrixScene *m_scene;
     bool m_drum;
     bool m_current;
-    QGraphicsItem *m_item;
+    bool m_selected;
+    MatrixSegmentItem *m_segmentItem;
+    bool m_ownSegmentItem;
+    unsigned long m_sequence; // drawing order, set by m_segmentItem
+    QRectF m_rect;
+    QColor m_colour;
+    Qt::BrushStyle m_brushStyle;
     double m_width;
     double m_velocity;
 
@@ -23,12 +23,14 @@
 #include "MatrixViewSegment.h"
 #include "MatrixWidget.h"
 #include "MatrixElement.h"
+#include "MatrixSegmentItem.h"
 
 #include "document/RosegardenDocument.h"
 #include "document/CommandHistory.h"
 #include "misc/ConfigGroups.h"
 
 #include "misc/Debug.h"
+#include "base/Profiler.h"
 #include "base/RulerScale.h"
 #include "base/SnapGrid.h"
 
@@ -40,11 +42,15 @@
 #include "gui/studio/StudioControl.h"
 
 #include <QGraphicsSceneMouseEvent>
-#include <QGraphicsLineItem>
+#include <QGraphicsSceneHelpEvent>
+#include <QPainter>
 #include <QSettings>
+#include <QToolTip>
 #include <QPointF>
 #include <QRectF>
 
+#include <algorithm>
+
 //#define DEBUG_MOUSE
 
 namespace Rosegarden
@@ -61,7 +67,9 @@ MatrixScene::MatrixScene() :
     m_snapGrid(0),
     m_resolution(8),
     m_selection(0),
-    m_currentSegmentIndex(0)
+    m_currentSegmentIndex(0),
+    m_gridStart(0),
+    m_gridEnd(0)
 {
     connect(CommandHistory::getInstance(), SIGNAL(commandExecuted()),
             this, SLOT(slotCommandExecuted()));
@@ -263,38 +271,12 @@ MatrixScene::recreateLines()
         }
     }
 
-    // Pen Width?
-    double pw = 0;
-
     double startPos = m_scale->getXForTime(start);
     double endPos = m_scale->getXForTime(end);
 
-    // Draw horizontal lines
-    int i = 0; 	   	 
-    while (i < 127) { 	 
-         int y = (i + 1) * (m_resolution + 1); 	 
-         QGraphicsLineItem *line; 	 
-         if (i < (int)m_horizontals.size()) { 	 
-             line = m_horizontals[i]; 	 
-         } else { 	 
-             line = new QGraphicsLineItem; 	 
-             line->setZValue(-9); 	 
-             line->setPen(QPen(GUIPalette::getColour 	 
-                               (GUIPalette::MatrixHorizontalLine), pw)); 	 
-             addItem(line); 	 
-             m_horizontals.push_back(line); 	 
-         } 	 
-         line->setLine(startPos, y, endPos, y); 	 
-         line->show(); 	 
-         ++i; 	 
-     } 	 
-
-
-     // Hide the other lines, if there are any.  Just a double check.
-     while (i < (int)m_horizontals.size()) { 	 
-         m_horizontals[i]->hide(); 	 
-         ++i; 	 
-    }
+    // Horizontal lines are drawn for every pitch across this range
+    m_gridStart = startPos;
+    m_gridEnd = endPos;
 
     setSceneRect(QRectF(startPos, 0, endPos - startPos, 128 * (m_resolution + 1)));
 
@@ -302,8 +284,8 @@ MatrixScene::recreateLines()
 
     int firstbar = c->getBarNumber(start), lastbar = c->getBarNumber(end);
 
-    // Draw Vertical Lines
-    i = 0;
+    // Vertical Lines
+    m_verticals.clear();
     for (int bar = firstbar; bar <= lastbar; ++bar) {
 
         std::pair<timeT, timeT> range = c->getBarRange(bar);
@@ -342,44 +324,84 @@ MatrixScene::recreateLines()
                 break;
             }
 
-            QGraphicsLineItem *line;
-
-            if (i < (int)m_verticals.size()) {
-                line = m_verticals[i];
-            } else {
-                line = new QGraphicsLineItem;
-                addItem(line);
-                m_verticals.push_back(line);
-            }
-
-            if (index == 0) {
-              // index 0 is the bar line
-                line->setPen(QPen(GUIPalette::getColour(GUIPalette::MatrixBarLine), pw));
-            } else {
-                line->setPen(QPen(GUIPalette::getColour(GUIPalette::BeatLine), pw));
-            }
+            // index 0 is the bar line
+            VerticalLine line;
+            line.x = x;
+            line.bar = (index == 0);
+            m_verticals.push_back(line);
 
-            line->setZValue(index > 0 ? -10 : -8);
-            line->setLine(x, 0, x, 128 * (m_resolution + 1));
-            
-            line->show();
             x += dx;
-            ++i;
         }
     }
 
-    // Hide the other lines. We are not using them right now.
-    while (i < (int)m_verticals.size()) {
-        m_verticals[i]->hide();
-        ++i;
-    }
-
     recreatePitchHighlights();
     
     // Force update so all vertical lines are drawn correctly
     update();
 }
 
+bool
+MatrixScene::isLineBefore(const VerticalLine &line, double x)
+{
+    return line.x < x;
+}
+
+void
+MatrixScene::drawBackground(QPainter *painter, const QRectF &rect)
+{
+    Profiler profiler("MatrixScene::drawBackground");
+
+    QGraphicsScene::drawBackground(painter, rect);
+
+    painter->save();
+
+    // Pitch highlights first, then beat lines, horizontal lines and
+    // bar lines on top
+
+    painter->setPen(Qt::NoPen);
+    for (size_t i = 0; i < m_highlights.size(); ++i) {
+        const PitchHighlight &highlight = m_highlights[i];
+        if (!highlight.rect.intersects(rect)) continue;
+        painter->setBrush(GUIPalette::getColour
+                          (highlight.tonic ?
+                           GUIPalette::MatrixTonicHighlight :
+                           GUIPalette::MatrixPitchHighlight));
+        painter->drawRect(highlight.rect);
+    }
+
+    double height = 128 * (m_resolution + 1);
+
+    std::vector<VerticalLine>::const_iterator first =
+        std::lower_bound(m_verticals.begin(), m_verticals.end(),
+                         rect.left(), isLineBefore);
+
+    painter->setPen(QPen(GUIPalette::getColour(GUIPalette::BeatLine), 0));
+    for (std::vector<VerticalLine>::const_iterator i = first;
+         i != m_verticals.end() && i->x <= rect.right(); ++i) {
+        if (!i->bar) painter->drawLine(QPointF(i->x, 0), QPointF(i->x, height));
+    }
+
+    double x0 = std::max(m_gridStart, rect.left());
+    double x1 = std::min(m_gridEnd, rect.right());
+    if (x0 < x1) {
+        painter->setPen(QPen(GUIPalette::getColour
+                             (GUIPalette::MatrixHorizontalLine), 0));
+        for (int i = 0; i < 127; ++i) {
+            double y = (i + 1) * (m_resolution + 1);
+            if (y < rect.top() || y > rect.bottom()) continue;
+            painter->drawLine(QPointF(x0, y), QPointF(x1, y));
+        }
+    }
+
+    painter->setPen(QPen(GUIPalette::getColour(GUIPalette::MatrixBarLine), 0));
+    for (std::vector<VerticalLine>::const_iterator i = first;
+         i != m_verticals.end() && i->x <= rect.right(); ++i) {
+        if (i->bar) painter->drawLine(QPointF(i->x, 0), QPointF(i->x, height));
+    }
+
+    painter->restore();
+}
+
 void
 MatrixScene::recreatePitchHighlights()
 {
@@ -389,7 +411,7 @@ MatrixScene::recreatePitchHighlights()
     timeT k0 = segment->getClippedStartTime();
     timeT k1 = segment->getClippedStartTime();
 
-    int i = 0;
+    m_highlights.clear();
 
     while (k0 < segment->getEndMarkerTime()) {
 
@@ -439,43 +461,20 @@ MatrixScene::recreatePitchHighlights()
             int pitch = hsteps[j];
             while (pitch < 128) {
 
-                QGraphicsRectItem *rect;
-
-                if (i < (int)m_highlights.size()) {
-                    rect = m_highlights[i];
-                } else {
-                    rect = new QGraphicsRectItem;
-                    rect->setZValue(-11);
-                    rect->setPen(Qt::NoPen);
-                    addItem(rect);
-                    m_highlights.push_back(rect);
-                }
-
-                if (j == 0) {
-                    rect->setBrush(GUIPalette::getColour
-                                   (GUIPalette::MatrixTonicHighlight));
-                } else {
-                    rect->setBrush(GUIPalette::getColour
-                                   (GUIPalette::MatrixPitchHighlight));
-                }
-
-//                rect->setRect(0.5, 0.5, x1 - x0, m_resolution + 1);
-                rect->setRect(0, 0, x1 - x0, m_resolution + 1);
-                rect->setPos(x0, (127 - pitch) * (m_resolution + 1));
-                rect->show();
+                PitchHighlight highlight;
+                highlight.tonic = (j == 0);
+                highlight.rect = QRectF(x0, (127 - pitch) * (m_resolution + 1),
+                                        x1 - x0, m_resolution + 1);
+                m_highlights.push_back(highlight);
 
                 pitch += 12;
-
-                ++i;
             }
         }
 
         k0 = k1;
     }
-    while (i < (int)m_highlights.size()) {
-        m_highlights[i]->hide();
-        ++i;
-    }
+
+    update();
 }
 
 void
@@ -493,18 +492,7 @@ MatrixScene::setupMouseEvent(QGraphicsSceneMouseEvent *e,
     mme.modifiers = e->modifiers();
     mme.buttons = e->buttons();
 
-    mme.element = 0;
-
-    QList<QGraphicsItem *> l = items(e->scenePos());
-//    MATRIX_DEBUG << "Found " << l.size() << " items at " << e->scenePos();
-    for (int i = 0; i < l.size(); ++i) {
-        MatrixElement *element = MatrixElement::getMatrixElement(l[i]);
-        if (element) {
-            // items are in z-order from top, so this is most salient
-            mme.element = element;
-            break;
-        }
-    }
+    mme.element = getElementAt(e->scenePos());
 
     mme.viewSegment = m_viewSegments[m_currentSegmentIndex];
 
@@ -548,6 +536,27 @@ MatrixScene::setupMouseEvent(QGraphicsSceneMouseEvent *e,
 #endif
 }
 
+MatrixElement *
+MatrixScene::getElementAt(const QPointF &scenePos) const
+{
+    // The current segment is drawn above the others, so it is most salient
+    int current = m_currentSegmentIndex;
+    if (current < int(m_viewSegments.size())) {
+        MatrixElement *element =
+            m_viewSegments[current]->getSegmentItem()->getElementAt(scenePos);
+        if (element) return element;
+    }
+
+    for (int i = 0; i < int(m_viewSegments.size()); ++i) {
+        if (i == current) continue;
+        MatrixElement *element =
+            m_viewSegments[i]->getSegmentItem()->getElementAt(scenePos);
+        if (element) return element;
+    }
+
+    return 0;
+}
+
 int MatrixScene::calculatePitchFromY(int y) const {
     int pitch = 127 - (y / (m_resolution + 1));
     if (pitch < 0) pitch = 0;
@@ -587,6 +596,23 @@ MatrixScene::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *e)
     emit mouseDoubleClicked(&nme);
 }
 
+void
+MatrixScene::helpEvent(QGraphicsSceneHelpEvent *e)
+{
+    // explain why a tied event is drawn in a different pattern
+    MatrixElement *element = getElementAt(e->scenePos());
+    if (element &&
+        (element->event()->has(BaseProperties::TIED_FORWARD) ||
+         element->event()->has(BaseProperties::TIED_BACKWARD))) {
+        QToolTip::showText(e->screenPos(),
+                           QObject::tr("This event is tied to another event."));
+        e->accept();
+        return;
+    }
+
+    QGraphicsScene::helpEvent(e);
+}
+
 void
 MatrixScene::slotCommandExecuted()
 {
@@ -822,6 +848,7 @@ MatrixScene::updateCurrentSegment()
             if (!mel) continue;
             mel->setCurrent(current);
         }
+        m_viewSegments[i]->getSegmentItem()->setZValue(current ? 1 : 0);
         if (current) emit currentViewSegmentChanged(m_viewSegments[i]);
     }
 
@@ -19,12 +19,11 @@
 #define RG_MATRIXSCENE_H
 
 #include <QGraphicsScene>
+#include <QRectF>
 
 #include "base/Composition.h"
 #include "gui/general/SelectionManager.h"
 
-class QGraphicsLineItem;
-
 namespace Rosegarden
 {
 
@@ -42,10 +41,11 @@ class ZoomableRulerScale;
 class SnapGrid;
 
 /**
- * Specialised graphics scene for matrix elements.  The note blocks and
- * horizontal and vertical grid lines are all represented by graphics items
- * owned by this scene.  This scene also owns the MatrixViewSegment classes
- * which track segment contents in view objects.
+ * Specialised graphics scene for matrix elements.  The note blocks of each
+ * segment are drawn by a single graphics item (see MatrixSegmentItem), and
+ * the horizontal and vertical grid lines are drawn in the scene background.
+ * This scene also owns the MatrixViewSegment classes which track segment
+ * contents in view objects.
  *
  * The scene works with MatrixViewSegment, MatrixViewElement, MatrixPainter,
  * and MatrixMover to support the new "concert pitch matrix" concept.  All
@@ -121,6 +121,9 @@ public:
 
     bool constrainToSegmentArea(QPointF &scenePos);
 
+    /// The topmost note at the given scene point, in any segment, or 0
+    MatrixElement *getElementAt(const QPointF &scenePos) const;
+
     void playNote(Segment &segment, int pitch, int velocity = -1);
 
     // SegmentObserver method forwarded from MatrixViewSegment
@@ -151,6 +154,9 @@ protected:
     void mouseMoveEvent(QGraphicsSceneMouseEvent *);
     void mouseReleaseEvent(QGraphicsSceneMouseEvent *);
     void mouseDoubleClickEvent(QGraphicsSceneMouseEvent *);
+    void helpEvent(QGraphicsSceneHelpEvent *);
+
+    void drawBackground(QPainter *, const QRectF &);
 
     void segmentRemoved(const Composition *, Segment *); // CompositionObserver
     void timeSignatureChanged(const Composition *); // CompositionObserver
@@ -174,11 +180,24 @@ private:
 
     int m_currentSegmentIndex;
 
-    // These are the background items -- the grid lines and the shadings
-    // used to highlight the first, third and fifth in the current key
-    std::vector<QGraphicsLineItem *> m_horizontals;
-    std::vector<QGraphicsLineItem *> m_verticals;
-    std::vector<QGraphicsRectItem *> m_highlights;
+    // These make up the background -- the grid lines and the shadings
+    // used to highlight the first, third and fifth in the current key.
+    // Horizontal lines run across [m_gridStart, m_gridEnd] for every
+    // pitch; vertical lines are in order of x.
+    struct VerticalLine {
+        double x;
+        bool bar;
+    };
+    struct PitchHighlight {
+        QRectF rect;
+        bool tonic;
+    };
+    double m_gridStart;
+    double m_gridEnd;
+    std::vector<VerticalLine> m_verticals;
+    std::vector<PitchHighlight> m_highlights;
+
+    static bool isLineBefore(const VerticalLine &, double x);
 
     void setupMouseEvent(QGraphicsSceneMouseEvent *, MatrixMouseEvent &) const;
     void recreateLines();
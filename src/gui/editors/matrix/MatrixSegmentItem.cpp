@@ -0,0 +1,279 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "MatrixSegmentItem.h"
+#include "MatrixElement.h"
+
+#include "base/Profiler.h"
+#include "gui/general/GUIPalette.h"
+
+#include <QBrush>
+#include <QPainter>
+#include <QPen>
+#include <QStyleOptionGraphicsItem>
+
+#include <algorithm>
+#include <cmath>
+
+namespace Rosegarden
+{
+
+// Scene pixels per bucket.  A bar is typically a few hundred pixels
+// wide at the default zoom.
+static const double bucketWidth = 256.0;
+
+// The selected border is 2 pixels wide
+static const double borderMargin = 2.0;
+
+MatrixSegmentItem::MatrixSegmentItem() :
+    m_count(0),
+    m_nextSequence(0)
+{
+    // We need exposedRect to find what to draw
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption, true);
+}
+
+MatrixSegmentItem::~MatrixSegmentItem()
+{
+    for (BucketMap::iterator i = m_buckets.begin(); i != m_buckets.end(); ++i) {
+        for (Bucket::iterator j = i->second.begin(); j != i->second.end(); ++j) {
+            (*j)->m_segmentItem = 0;
+        }
+    }
+}
+
+int
+MatrixSegmentItem::getBucket(double x)
+{
+    return int(floor(x / bucketWidth));
+}
+
+bool
+MatrixSegmentItem::isDrawnBefore(const MatrixElement *a, const MatrixElement *b)
+{
+    return a->m_sequence < b->m_sequence;
+}
+
+QRectF
+MatrixSegmentItem::getPaintedRect(const QRectF &rect)
+{
+    return rect.adjusted(-borderMargin, -borderMargin,
+                         borderMargin, borderMargin);
+}
+
+void
+MatrixSegmentItem::index(MatrixElement *element, const QRectF &rect)
+{
+    int last = getBucket(rect.right());
+    for (int b = getBucket(rect.left()); b <= last; ++b) {
+        Bucket &bucket = m_buckets[b];
+        // Usually the newest element, so at the end
+        bucket.insert(std::upper_bound(bucket.begin(), bucket.end(),
+                                       element, isDrawnBefore),
+                      element);
+    }
+}
+
+void
+MatrixSegmentItem::unindex(MatrixElement *element, const QRectF &rect)
+{
+    int last = getBucket(rect.right());
+    for (int b = getBucket(rect.left()); b <= last; ++b) {
+        BucketMap::iterator i = m_buckets.find(b);
+        if (i == m_buckets.end()) continue;
+        Bucket &bucket = i->second;
+        Bucket::iterator j = std::lower_bound(bucket.begin(), bucket.end(),
+                                              element, isDrawnBefore);
+        if (j != bucket.end() && *j == element) bucket.erase(j);
+        if (bucket.empty()) m_buckets.erase(i);
+    }
+}
+
+void
+MatrixSegmentItem::growBounds(const QRectF &rect)
+{
+    if (m_bounds.contains(rect)) return;
+
+    // Each change of bounds makes the scene reindex the item, so grow
+    // in large steps rather than note by note as a segment is loaded
+    QRectF bounds = m_bounds.isNull() ? rect : (m_bounds | rect);
+    double step = std::max(bounds.width(), bucketWidth);
+    if (rect.left() < m_bounds.left()) bounds.setLeft(bounds.left() - step);
+    if (rect.right() > m_bounds.right()) bounds.setRight(bounds.right() + step);
+
+    prepareGeometryChange();
+    m_bounds = bounds;
+}
+
+void
+MatrixSegmentItem::addElement(MatrixElement *element)
+{
+    element->m_sequence = m_nextSequence++;
+    QRectF rect = element->getSceneRect();
+    index(element, rect);
+    ++m_count;
+    growBounds(getPaintedRect(rect));
+    update(getPaintedRect(rect));
+}
+
+void
+MatrixSegmentItem::removeElement(MatrixElement *element)
+{
+    QRectF rect = element->getSceneRect();
+    unindex(element, rect);
+    --m_count;
+    update(getPaintedRect(rect));
+}
+
+void
+MatrixSegmentItem::moveElement(MatrixElement *element, const QRectF &oldRect)
+{
+    QRectF rect = element->getSceneRect();
+    if (getBucket(rect.left()) != getBucket(oldRect.left()) ||
+        getBucket(rect.right()) != getBucket(oldRect.right())) {
+        unindex(element, oldRect);
+        index(element, rect);
+    }
+    growBounds(getPaintedRect(rect));
+    update(getPaintedRect(oldRect));
+    update(getPaintedRect(rect));
+}
+
+void
+MatrixSegmentItem::updateElement(MatrixElement *element)
+{
+    update(getPaintedRect(element->getSceneRect()));
+}
+
+MatrixElement *
+MatrixSegmentItem::getElementAt(const QPointF &pos) const
+{
+    BucketMap::const_iterator i = m_buckets.find(getBucket(pos.x()));
+    if (i == m_buckets.end()) return 0;
+
+    // Later elements are drawn over earlier ones, and the bucket is in
+    // drawing order
+    const Bucket &bucket = i->second;
+    for (Bucket::const_reverse_iterator j = bucket.rbegin();
+         j != bucket.rend(); ++j) {
+        if ((*j)->contains(pos)) return *j;
+    }
+    return 0;
+}
+
+void
+MatrixSegmentItem::getElementsIn(const QRectF &rect,
+                                 std::vector<MatrixElement *> &elements) const
+{
+    int first = getBucket(rect.left());
+    int last = getBucket(rect.right());
+    size_t start = elements.size();
+
+    for (BucketMap::const_iterator i = m_buckets.lower_bound(first);
+         i != m_buckets.end() && i->first <= last; ++i) {
+
+        const Bucket &bucket = i->second;
+
+        for (Bucket::const_iterator j = bucket.begin(); j != bucket.end(); ++j) {
+
+            const QRectF &elementRect = (*j)->getSceneRect();
+
+            // An element spanning several buckets is reported from
+            // the first of them that the rect reaches
+            if (i->first > first &&
+                getBucket(elementRect.left()) < i->first) continue;
+
+            if (elementRect.intersects(rect)) elements.push_back(*j);
+        }
+    }
+
+    // Each bucket is in order, but an element from one bucket may
+    // need to be drawn under one from an earlier bucket
+    std::sort(elements.begin() + start, elements.end(), isDrawnBefore);
+}
+
+QRectF
+MatrixSegmentItem::boundingRect() const
+{
+    return m_bounds;
+}
+
+void
+MatrixSegmentItem::paint(QPainter *painter,
+                         const QStyleOptionGraphicsItem *option,
+                         QWidget *)
+{
+    Profiler profiler("MatrixSegmentItem::paint");
+
+    std::vector<MatrixElement *> elements;
+    getElementsIn(getPaintedRect(option->exposedRect), elements);
+    if (elements.empty()) return;
+
+    QPen border(GUIPalette::getColour(GUIPalette::MatrixElementBorder), 0);
+    QPen lightBorder
+        (GUIPalette::getColour(GUIPalette::MatrixElementLightBorder), 0);
+    QPen selectedDrum(GUIPalette::getColour(GUIPalette::SelectedElement), 2,
+                      Qt::SolidLine, Qt::SquareCap, Qt::MiterJoin);
+    QPen selected(selectedDrum);
+    selected.setCosmetic(true);
+
+    // Only change the pen and brush when they differ from the last
+    // element's, as most neighbouring notes look alike
+    const QPen *pen = 0;
+    QColor colour;
+    Qt::BrushStyle style = Qt::NoBrush;
+
+    for (size_t i = 0; i < elements.size(); ++i) {
+
+        const MatrixElement *element = elements[i];
+
+        const QPen *elementPen = &border;
+        if (element->isSelected()) {
+            elementPen = element->isDrum() ? &selectedDrum : &selected;
+        } else if (!element->isCurrent()) {
+            elementPen = &lightBorder;
+        }
+        if (elementPen != pen) {
+            pen = elementPen;
+            painter->setPen(*pen);
+        }
+
+        if (i == 0 ||
+            element->getColour() != colour ||
+            element->getBrushStyle() != style) {
+            colour = element->getColour();
+            style = element->getBrushStyle();
+            painter->setBrush(QBrush(colour, style));
+        }
+
+        const QRectF &rect = element->getSceneRect();
+
+        if (element->isDrum()) {
+            QPointF diamond[4] = {
+                QPointF(rect.center().x(), rect.top()),
+                QPointF(rect.right(), rect.center().y()),
+                QPointF(rect.center().x(), rect.bottom()),
+                QPointF(rect.left(), rect.center().y())
+            };
+            painter->drawConvexPolygon(diamond, 4);
+        } else {
+            painter->drawRect(rect);
+        }
+    }
+}
+
+}
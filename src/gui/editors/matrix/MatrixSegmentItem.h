@@ -0,0 +1,110 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_MATRIXSEGMENTITEM_H
+#define RG_MATRIXSEGMENTITEM_H
+
+#include <QGraphicsItem>
+#include <QRectF>
+
+#include <map>
+#include <vector>
+
+namespace Rosegarden
+{
+
+class MatrixElement;
+
+/// The single graphics item that draws all the notes of a MatrixViewSegment.
+/**
+ * A segment may hold hundreds of thousands of notes, and a graphics
+ * item for each one makes the scene too slow to scroll or zoom.  This
+ * item draws them all instead, finding those in the exposed area
+ * through an index of fixed-width buckets of scene x: each note is
+ * listed in every bucket that it spans.  Hit-testing and rubber-band
+ * selection use the same index, so the cost of either depends on the
+ * number of notes nearby rather than in the whole segment.
+ *
+ * Elements are drawn in the order in which they were added, however
+ * they have moved since, as separate graphics items would be stacked.
+ *
+ * The MatrixElements keep their own geometry and colours, and tell
+ * the item when these change.  Elements made outside any
+ * MatrixViewSegment (the previews drawn by some of the tools) have an
+ * item of their own.
+ */
+class MatrixSegmentItem : public QGraphicsItem
+{
+public:
+    MatrixSegmentItem();
+
+    /// Detaches any elements still in the item.
+    virtual ~MatrixSegmentItem();
+
+    /// Index an element and draw it.  Its scene rect must be set.
+    void addElement(MatrixElement *);
+
+    /// Unindex an element and clear the area where it was drawn.
+    void removeElement(MatrixElement *);
+
+    /// Reindex an element whose scene rect has changed from oldRect.
+    void moveElement(MatrixElement *, const QRectF &oldRect);
+
+    /// Redraw an element whose colours have changed.
+    void updateElement(MatrixElement *);
+
+    /// The topmost element containing the given scene point, or 0.
+    MatrixElement *getElementAt(const QPointF &) const;
+
+    /// Append the elements whose scene rects intersect the given
+    /// scene rect, in the order in which they are drawn.
+    void getElementsIn(const QRectF &, std::vector<MatrixElement *> &) const;
+
+    size_t getElementCount() const { return m_count; }
+
+    virtual QRectF boundingRect() const;
+    virtual void paint(QPainter *, const QStyleOptionGraphicsItem *,
+                       QWidget *);
+
+private:
+    typedef std::vector<MatrixElement *> Bucket;
+    typedef std::map<int, Bucket> BucketMap;
+
+    BucketMap m_buckets;
+    QRectF m_bounds;
+    size_t m_count;
+    unsigned long m_nextSequence;
+
+    static int getBucket(double x);
+
+    /// Whether a is drawn before b.  Buckets are kept in this order.
+    static bool isDrawnBefore(const MatrixElement *a, const MatrixElement *b);
+
+    /// The scene rect an element may touch, including its border.
+    static QRectF getPaintedRect(const QRectF &);
+
+    void index(MatrixElement *, const QRectF &);
+    void unindex(MatrixElement *, const QRectF &);
+    void growBounds(const QRectF &);
+
+    MatrixSegmentItem(const MatrixSegmentItem &);
+    MatrixSegmentItem &operator=(const MatrixSegmentItem &);
+};
+
+}
+
+#endif
@@ -34,6 +34,7 @@
 #include "MatrixMover.h"
 #include "MatrixPainter.h"
 #include "MatrixResizer.h"
+#include "MatrixSegmentItem.h"
 #include "MatrixViewSegment.h"
 #include "MatrixTool.h"
 #include "MatrixToolBox.h"
@@ -486,45 +487,28 @@ MatrixSelector::getSelection(EventSelection *&selection)
 {
     if (!m_selectionRect || !m_selectionRect->isVisible()) return 0;
 
+    // get the notes of the current segment that the rect touches,
+    // taking in the width of its border
+    QRectF rect = m_selectionRect->sceneBoundingRect();
+    std::vector<MatrixElement *> candidates;
+    m_currentViewSegment->getSegmentItem()->getElementsIn(rect, candidates);
+
+    // A drum's diamond may not reach the corner of its box that the
+    // rect does
+    std::vector<MatrixElement *> elements;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (candidates[i]->intersects(rect)) elements.push_back(candidates[i]);
+    }
+
+    // Avoid re-creating the selection if the notes we span are unchanged
+    if (elements == m_previousCollisions) return false;
+    m_previousCollisions = elements;
+
     Segment& originalSegment = m_currentViewSegment->getSegment();
     selection = new EventSelection(originalSegment);
 
-    // get the selections
-    //
-    QList<QGraphicsItem *> l = m_selectionRect->collidingItems
-        (Qt::IntersectsItemShape);
-
-    // This is a nasty optimisation, just to avoid re-creating the
-    // selection if the items we span are unchanged.  It's not very
-    // effective, either, because the colliding items returned
-    // includes things like the horizontal and vertical background
-    // lines -- and so it changes often: every time we cross a line.
-    // More thought needed.
-
-    // It might be better to use the event properties (i.e. time and
-    // pitch) to calculate this "from first principles" rather than
-    // doing it graphically.  That might also be helpful to avoid us
-    // dragging off the logical edges of the scene.
-
-    // (Come to think of it, though, that would be troublesome just
-    // because of the requirement to use all events that have any part
-    // inside the selection.  Quickly finding all events that start
-    // within a time range is trivial, finding all events that
-    // intersect one is more of a pain.)
-    if (l == m_previousCollisions) return false;
-    m_previousCollisions = l;
-
-    if (!l.empty()) {
-        for (int i = 0; i < l.size(); ++i) {
-            QGraphicsItem *item = l[i];
-            MatrixElement *element = MatrixElement::getMatrixElement(item);
-            if (element) {
-                //!!! NB. In principle, this element might not come
-                //!!! from the right segment (in practice we only have
-                //!!! one segment, but that may change)
-                selection->addEvent(element->event());
-            }
-        }
+    for (size_t i = 0; i < elements.size(); ++i) {
+        selection->addEvent(elements[i]->event());
     }
 
     if (selection->getAddedEvents() == 0) {
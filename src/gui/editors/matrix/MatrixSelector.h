@@ -21,7 +21,7 @@
 #include <QGraphicsRectItem>
 #include "MatrixTool.h"
 #include <QString>
-#include <QList>
+#include <vector>
 #include "base/Event.h"
 
 
@@ -120,7 +120,7 @@ protected:
 
     EventSelection *m_selectionToMerge;
 
-    QList<QGraphicsItem *> m_previousCollisions;
+    std::vector<MatrixElement *> m_previousCollisions;
 };
 
 
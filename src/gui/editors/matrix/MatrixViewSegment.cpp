@@ -19,6 +19,7 @@
 
 #include "MatrixScene.h"
 #include "MatrixElement.h"
+#include "MatrixSegmentItem.h"
 
 #include "base/NotationTypes.h"
 #include "base/SnapGrid.h"
@@ -37,12 +38,16 @@ MatrixViewSegment::MatrixViewSegment(MatrixScene *scene,
     ViewSegment(*segment),
     m_scene(scene),
     m_drum(drum),
-    m_refreshStatusId(segment->getNewRefreshStatusId())
+    m_refreshStatusId(segment->getNewRefreshStatusId()),
+    m_segmentItem(new MatrixSegmentItem)
 {
+    m_scene->addItem(m_segmentItem);
 }
 
 MatrixViewSegment::~MatrixViewSegment()
 {
+    // Detaches the elements, which our base class deletes after this
+    delete m_segmentItem;
 }
 
 SegmentRefreshStatus &
@@ -90,7 +95,8 @@ MatrixViewSegment::makeViewElement(Event* e)
 
 //    std::cout << "I am segment \"" << getSegment().getLabel() << "\"" << std::endl;
 
-    return new MatrixElement(m_scene, e, m_drum, pitchOffset);
+    return new MatrixElement(m_scene, e, m_drum, pitchOffset,
+                             m_segmentItem);
 }
 
 void
@@ -26,6 +26,7 @@ namespace Rosegarden
 class MatrixScene;
 class Segment;
 class MatrixElement;
+class MatrixSegmentItem;
 class MidiKeyMapping;
 
 class MatrixViewSegment : public ViewSegment
@@ -43,6 +44,9 @@ public:
 
     void updateElements(timeT from, timeT to);
 
+    /// The item that draws this segment's notes
+    MatrixSegmentItem *getSegmentItem() const { return m_segmentItem; }
+
 protected:
 //!!!    const MidiKeyMapping *getKeyMapping() const;
 
@@ -68,6 +72,7 @@ protected:
     MatrixScene *m_scene;
     bool m_drum;
     unsigned int m_refreshStatusId;
+    MatrixSegmentItem *m_segmentItem;
 };
 
 }
@@ -67,6 +67,14 @@ public:
 
     void setSegments(NotationScene *scene);
 
+    /**
+     * Bring the context up to date with any changes to the segments,
+     * which the lookups below would otherwise do the first time they
+     * are called.  Call this before looking things up from more than
+     * one thread at once.
+     */
+    void update();
+
     /**
      * Returns the clef which should be in used on given track at given time
      * without looking at possible clef event on this precise place.
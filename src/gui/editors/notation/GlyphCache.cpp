@@ -0,0 +1,249 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "GlyphCache.h"
+
+#include <QMutexLocker>
+
+
+namespace Rosegarden
+{
+
+
+// Room for several thousand characters at the usual sizes
+static const size_t defaultMaxBytes = 32 * 1024 * 1024;
+
+GlyphCache *
+GlyphCache::getInstance()
+{
+    static GlyphCache *instance = 0;
+    if (!instance) instance = new GlyphCache(defaultMaxBytes);
+    return instance;
+}
+
+GlyphCache::GlyphCache(size_t maxBytes) :
+    m_maxBytes(maxBytes),
+    m_bytes(0),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0)
+{
+}
+
+GlyphCache::Key::Key(const QString &afont, int asize, const CharName &aname,
+                     bool ainverted) :
+    font(afont),
+    size(asize),
+    name(aname),
+    inverted(ainverted),
+    colourType(Plain),
+    hue(0),
+    minimum(0),
+    saturation(0)
+{
+}
+
+GlyphCache::Key::Key(const QString &afont, int asize, const CharName &aname,
+                     bool ainverted, int ahue, int aminimum, int asaturation) :
+    font(afont),
+    size(asize),
+    name(aname),
+    inverted(ainverted),
+    colourType(Coloured),
+    hue(ahue),
+    minimum(aminimum),
+    saturation(asaturation)
+{
+}
+
+GlyphCache::Key
+GlyphCache::Key::shaded(const QString &font, int size, const CharName &name,
+                        bool inverted)
+{
+    Key key(font, size, name, inverted);
+    key.colourType = Shaded;
+    return key;
+}
+
+bool
+GlyphCache::Key::operator<(const Key &other) const
+{
+    // Cheapest comparisons first
+    if (size != other.size) return size < other.size;
+    if (inverted != other.inverted) return inverted < other.inverted;
+    if (colourType != other.colourType) return colourType < other.colourType;
+    if (hue != other.hue) return hue < other.hue;
+    if (minimum != other.minimum) return minimum < other.minimum;
+    if (saturation != other.saturation) return saturation < other.saturation;
+    if (name != other.name) return name < other.name;
+    return font < other.font;
+}
+
+size_t
+GlyphCache::getBytes(const QPixmap &pixmap)
+{
+    if (pixmap.isNull()) return 0;
+    return size_t(pixmap.width()) * pixmap.height() * pixmap.depth() / 8;
+}
+
+bool
+GlyphCache::lookup(const Key &key, QPixmap &pixmap)
+{
+    QMutexLocker locker(&m_mutex);
+
+    EntryMap::iterator i = m_entries.find(key);
+    if (i == m_entries.end()) {
+        ++m_misses;
+        return false;
+    }
+
+    ++m_hits;
+    m_usage.splice(m_usage.begin(), m_usage, i->second.usage);
+    pixmap = i->second.pixmap;
+    return true;
+}
+
+void
+GlyphCache::add(const Key &key, const QPixmap &pixmap)
+{
+    QMutexLocker locker(&m_mutex);
+
+    EntryMap::iterator i = m_entries.find(key);
+
+    if (i != m_entries.end()) {
+        m_bytes -= i->second.bytes;
+        m_usage.splice(m_usage.begin(), m_usage, i->second.usage);
+    } else {
+        m_usage.push_front(key);
+        i = m_entries.insert(EntryMap::value_type(key, Entry())).first;
+        i->second.usage = m_usage.begin();
+    }
+
+    i->second.pixmap = pixmap;
+    i->second.bytes = getBytes(pixmap);
+    m_bytes += i->second.bytes;
+
+    evict(m_maxBytes);
+}
+
+void
+GlyphCache::evict(size_t maxBytes)
+{
+    while (m_bytes > maxBytes && !m_usage.empty()) {
+        EntryMap::iterator i = m_entries.find(m_usage.back());
+        m_bytes -= i->second.bytes;
+        m_entries.erase(i);
+        m_usage.pop_back();
+        ++m_evictions;
+    }
+}
+
+void
+GlyphCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    m_entries.clear();
+    m_usage.clear();
+    m_bytes = 0;
+}
+
+void
+GlyphCache::setMaxBytes(size_t maxBytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maxBytes = maxBytes;
+    evict(m_maxBytes);
+}
+
+size_t
+GlyphCache::getMaxBytes() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_maxBytes;
+}
+
+size_t
+GlyphCache::getBytes() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_bytes;
+}
+
+size_t
+GlyphCache::getCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.size();
+}
+
+unsigned long
+GlyphCache::getHits() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_hits;
+}
+
+unsigned long
+GlyphCache::getMisses() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_misses;
+}
+
+unsigned long
+GlyphCache::getEvictions() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_evictions;
+}
+
+double
+GlyphCache::getHitRate() const
+{
+    QMutexLocker locker(&m_mutex);
+    unsigned long lookups = m_hits + m_misses;
+    if (lookups == 0) return 0.0;
+    return double(m_hits) / double(lookups);
+}
+
+void
+GlyphCache::resetStats()
+{
+    QMutexLocker locker(&m_mutex);
+    m_hits = 0;
+    m_misses = 0;
+    m_evictions = 0;
+}
+
+void
+GlyphCache::dumpStats(std::ostream &s) const
+{
+    QMutexLocker locker(&m_mutex);
+
+    unsigned long lookups = m_hits + m_misses;
+
+    s << "GlyphCache: " << m_entries.size() << " characters in "
+      << m_bytes / 1024 << "K of " << m_maxBytes / 1024 << "K; "
+      << m_hits << " hits, " << m_misses << " misses";
+    if (lookups > 0) {
+        s << " (" << (m_hits * 100 / lookups) << "% hit)";
+    }
+    s << ", " << m_evictions << " evicted" << std::endl;
+}
+
+
+}
@@ -0,0 +1,159 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_GLYPHCACHE_H
+#define RG_GLYPHCACHE_H
+
+#include "gui/editors/notation/NoteCharacterNames.h"
+
+#include <QMutex>
+#include <QPixmap>
+#include <QString>
+
+#include <list>
+#include <map>
+#include <ostream>
+
+
+namespace Rosegarden
+{
+
+
+/// The pixmaps drawn for note font characters, shared by every NoteFont.
+/**
+ * A character is drawn once for each font and size it is used in, and
+ * once more for each colour it is shown in (selected, shaded, or in a
+ * colour of its own).  The cache holds them all up to a limit on the
+ * bytes of pixmap data, beyond which it drops those that were used
+ * least recently.  It counts its hits and misses, so that the limit
+ * can be checked against real use (see dumpStats()).
+ *
+ * Characters that the font doesn't have are cached too, as null
+ * pixmaps, so that they aren't looked for again.
+ *
+ * The point lists that NoteFont makes from these pixmaps for printing
+ * (its DrawRepMap, under the same keys) are not part of the cache and
+ * are still kept for good, as NoteCharacters hold on to them.  They
+ * are only made when printing, so there are seldom many.
+ */
+class GlyphCache
+{
+public:
+    /// The cache used by NoteFont.
+    static GlyphCache *getInstance();
+
+    explicit GlyphCache(size_t maxBytes);
+
+    enum ColourType { Plain, Coloured, Shaded };
+
+    struct Key
+    {
+        /// A character as drawn by the font.
+        Key(const QString &font, int size, const CharName &name,
+            bool inverted);
+
+        /// A character coloured by PixmapFunctions::colourPixmap().
+        Key(const QString &font, int size, const CharName &name,
+            bool inverted, int hue, int minimum, int saturation);
+
+        /// A character shaded by PixmapFunctions::shadePixmap().
+        static Key shaded(const QString &font, int size,
+                          const CharName &name, bool inverted);
+
+        bool operator<(const Key &other) const;
+
+        QString font;
+        int size;
+        CharName name;
+        bool inverted;
+        ColourType colourType;
+        int hue;
+        int minimum;
+        int saturation;
+    };
+
+    /// Find a character.
+    /**
+     * Returns false if it isn't cached.  If it's cached as missing
+     * from the font, returns true with a null pixmap.
+     */
+    bool lookup(const Key &key, QPixmap &pixmap);
+
+    /// Cache a character, or a null pixmap if the font doesn't have it.
+    void add(const Key &key, const QPixmap &pixmap);
+
+    /// Drop everything.  The statistics are kept.
+    void clear();
+
+    void setMaxBytes(size_t maxBytes);
+    size_t getMaxBytes() const;
+
+    /// Bytes of pixmap data held now.
+    size_t getBytes() const;
+
+    /// Characters held now, including those cached as missing.
+    size_t getCount() const;
+
+    unsigned long getHits() const;
+    unsigned long getMisses() const;
+    unsigned long getEvictions() const;
+
+    /// Hits as a fraction of all lookups, or 0 if there have been none.
+    double getHitRate() const;
+
+    void resetStats();
+
+    void dumpStats(std::ostream &) const;
+
+private:
+    // Most recently used at the front
+    typedef std::list<Key> UsageList;
+
+    struct Entry
+    {
+        QPixmap pixmap;
+        size_t bytes;
+        UsageList::iterator usage;
+    };
+
+    typedef std::map<Key, Entry> EntryMap;
+
+    static size_t getBytes(const QPixmap &pixmap);
+
+    /// Drop the least recently used until within maxBytes.  Locked.
+    void evict(size_t maxBytes);
+
+    EntryMap m_entries;
+    UsageList m_usage;
+
+    size_t m_maxBytes;
+    size_t m_bytes;
+
+    unsigned long m_hits;
+    unsigned long m_misses;
+    unsigned long m_evictions;
+
+    mutable QMutex m_mutex;
+
+    GlyphCache(const GlyphCache &);
+    GlyphCache &operator=(const GlyphCache &);
+};
+
+
+}
+
+#endif
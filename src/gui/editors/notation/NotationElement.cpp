@@ -38,6 +38,7 @@ NotationElement::NotationElement(Event *event) :
     ViewElement(event),
     m_recentlyRegenerated(false),
     m_isColliding(false),
+    m_offscreen(false),
     m_item(0),
     m_extraItems(0)
 {
@@ -151,6 +152,7 @@ NotationElement::removeItem()
     Profiler p("NotationElement::removeItem");
 
     m_recentlyRegenerated = false;
+    m_offscreen = false;
 
 //    NOTATION_DEBUG << "NotationElement::removeItem";
 
@@ -168,6 +170,13 @@ NotationElement::removeItem()
     }
 }
 
+void
+NotationElement::setOffscreen()
+{
+    removeItem();
+    m_offscreen = true;
+}
+
 void
 NotationElement::reposition(double sceneX, double sceneY)
 {
@@ -144,6 +144,19 @@ public:
      */
     void removeItem();
 
+    /**
+     * Remove the scene items of an element that is too far from the
+     * visible part of the scene to be worth drawing.  It keeps its
+     * layout, and is drawn again when the view comes near it.
+     */
+    void setOffscreen();
+
+    /**
+     * Return true if the element has no scene item only because it
+     * is offscreen, not because it isn't shown at all.
+     */
+    bool isOffscreen() const { return m_offscreen; }
+
     /**
      * Reset the position of the scene item (which is assumed to
      * exist already).
@@ -182,6 +195,7 @@ protected:
     double m_airWidth;
     bool m_recentlyRegenerated;
     bool m_isColliding;
+    bool m_offscreen;
 
     /**
      * The graphical representation of the event
@@ -45,11 +45,13 @@
 #include "misc/ConfigGroups.h"
 
 #include <QApplication>
+#include <QMutexLocker>
 #include <QSettings>
 #include <QObject>
 
 #include <cmath>
 #include <limits>
+#include <sstream>
 
 namespace Rosegarden
 {
@@ -126,6 +128,8 @@ NotationHLayout::getAvailableProportions()
 NotationHLayout::BarDataList &
 NotationHLayout::getBarData(ViewSegment &staff)
 {
+    QMutexLocker locker(&m_staffDataMutex);
+
     BarDataMap::iterator i = m_barData.find(&staff);
     if (i == m_barData.end()) {
         m_barData[&staff] = BarDataList();
@@ -214,14 +218,23 @@ NotationHLayout::scanViewSegment(ViewSegment &staff, timeT startTime,
         --endBarNo;
         }
     */
+    int *staffNameWidth;
+    bool *haveOttava;
+    {
+        // Other staffs may be being scanned at the same time
+        QMutexLocker locker(&m_staffDataMutex);
+        staffNameWidth = &m_staffNameWidths[&staff];
+        haveOttava = &m_haveOttavaSomewhere[&staff];
+    }
+
     TrackId trackId = segment.getTrack();
     std::string name =
         segment.getComposition()->getTrackById(trackId)->getLabel();
-    m_staffNameWidths[&staff] =
+    *staffNameWidth =
         npf->getNoteBodyWidth() * 2 +
         npf->getTextWidth(Text(name, Text::StaffName));
 
-    RG_DEBUG << "scanViewSegment: full scan " << full << ", times " << startTime << "->" << endTime << ", bars " << startBarNo << "->" << endBarNo << ", staff name \"" << segment.getLabel() << "\", width " << m_staffNameWidths[&staff];
+    RG_DEBUG << "scanViewSegment: full scan " << full << ", times " << startTime << "->" << endTime << ", bars " << startBarNo << "->" << endBarNo << ", staff name \"" << segment.getLabel() << "\", width " << *staffNameWidth;
 
     SegmentNotationHelper helper(segment);
     if (full) {
@@ -245,9 +258,9 @@ NotationHLayout::scanViewSegment(ViewSegment &staff, timeT startTime,
 
         RG_DEBUG << "full scan: setting haveOttava false";
 
-        m_haveOttavaSomewhere[&staff] = false;
+        *haveOttava = false;
 
-    } else if (m_haveOttavaSomewhere[&staff]) {
+    } else if (*haveOttava) {
 
         RG_DEBUG << "not full scan but ottava is listed";
 
@@ -471,7 +484,7 @@ NotationHLayout::scanViewSegment(ViewSegment &staff, timeT startTime,
                         ottavaShift = indication.getOttavaShift();
                         ottavaEnd = el->event()->getAbsoluteTime() +
                                     indication.getIndicationDuration();
-                        m_haveOttavaSomewhere[&staff] = true;
+                        *haveOttava = true;
                     }
                 } catch (...) {
                     RG_DEBUG << "Bad indication!";
@@ -518,7 +531,7 @@ NotationHLayout::scanViewSegment(ViewSegment &staff, timeT startTime,
 void
 NotationHLayout::clearBarList(ViewSegment &staff)
 {
-    BarDataList &bdl = m_barData[&staff];
+    BarDataList &bdl(getBarData(staff));
     bdl.clear();
 }
 
@@ -535,7 +548,7 @@ NotationHLayout::setBarBasicData(ViewSegment &staff,
 {
     //    RG_DEBUG << "setBarBasicData for " << barNo;
 
-    BarDataList &bdl(m_barData[&staff]);
+    BarDataList &bdl(getBarData(staff));
 
     BarDataList::iterator i(bdl.find(barNo));
     if (i == bdl.end()) {
@@ -562,7 +575,7 @@ NotationHLayout::setBarSizeData(ViewSegment &staff,
 {
     //    RG_DEBUG << "setBarSizeData for " << barNo;
 
-    BarDataList &bdl(m_barData[&staff]);
+    BarDataList &bdl(getBarData(staff));
 
     BarDataList::iterator i(bdl.find(barNo));
     if (i == bdl.end()) {
@@ -2180,7 +2193,7 @@ NotationHLayout::getXForTimeByEvent(timeT time) const
                 if (vli == staff->getViewElementList()->end())
                     break;
                 NotationElement *element = static_cast<NotationElement *>(*vli);
-                if (element->getItem()) {
+                if (element->getItem() || element->isOffscreen()) {
                     x = element->getLayoutX();
                     double temp;
                     element->getLayoutAirspace(temp, dx);
@@ -2195,10 +2208,15 @@ NotationHLayout::getXForTimeByEvent(timeT time) const
             if (found) {
                 if (time > t) {
 
-                    while (vli != staff->getViewElementList()->end() &&
-                            ((*vli)->event()->getNotationAbsoluteTime() < time ||
-                             !((static_cast<NotationElement *>(*vli))->getItem())))
+                    while (vli != staff->getViewElementList()->end()) {
+                        NotationElement *element =
+                            static_cast<NotationElement *>(*vli);
+                        if (element->event()->getNotationAbsoluteTime() >= time &&
+                            (element->getItem() || element->isOffscreen())) {
+                            break;
+                        }
                         ++vli;
+                    }
 
                     if (vli != staff->getViewElementList()->end()) {
                         NotationElement *element = static_cast<NotationElement *>(*vli);
@@ -2276,4 +2294,56 @@ NotationHLayout::dumpBarDataMap()
     }
 }
 
+std::string
+NotationHLayout::getScanDescription(ViewSegment &staff) const
+{
+    std::ostringstream out;
+
+    ViewSegmentIntMap::const_iterator w = m_staffNameWidths.find(&staff);
+    out << "nameWidth=" << (w == m_staffNameWidths.end() ? -1 : w->second)
+        << "\n";
+
+    BarDataMap::const_iterator i = m_barData.find(&staff);
+    if (i == m_barData.end()) return out.str();
+
+    NotationElementList *elements = staff.getViewElementList();
+
+    for (BarDataList::const_iterator j = i->second.begin();
+         j != i->second.end(); ++j) {
+
+        const BarData &bar = j->second;
+
+        out << "bar " << j->first << ": start=";
+        if (bar.basicData.start == elements->end()) out << "end";
+        else out << (*bar.basicData.start)->getViewAbsoluteTime();
+
+        out << " correct=" << bar.basicData.correct
+            << " timeSig=" << bar.basicData.timeSignature.getNumerator()
+            << "/" << bar.basicData.timeSignature.getDenominator()
+            << " newTimeSig=" << bar.basicData.newTimeSig
+            << " delayInBar=" << bar.basicData.delayInBar
+            << " trackId=" << bar.basicData.trackId
+            << " ideal=" << bar.sizeData.idealWidth
+            << " reconciled=" << bar.sizeData.reconciledWidth
+            << " fixed=" << bar.sizeData.fixedWidth
+            << " timeSigFixed=" << bar.sizeData.timeSigFixedWidth
+            << " clefKey=" << bar.sizeData.clefKeyWidth
+            << " duration=" << bar.sizeData.actualDuration
+            << " needsLayout=" << bar.layoutData.needsLayout
+            << " x=" << bar.layoutData.x
+            << " timeSigX=" << bar.layoutData.timeSigX << "\n";
+
+        for (ChunkList::const_iterator k = bar.chunks.begin();
+             k != bar.chunks.end(); ++k) {
+            out << "  chunk duration=" << k->duration
+                << " subord=" << k->subordering
+                << " fixed=" << k->fixed
+                << " stretchy=" << k->stretchy
+                << " x=" << k->x << "\n";
+        }
+    }
+
+    return out.str();
+}
+
 }
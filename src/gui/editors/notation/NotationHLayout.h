@@ -25,6 +25,8 @@
 #include <vector>
 #include "base/Event.h"
 
+#include <QMutex>
+
 
 class TieMap;
 class QObject;
@@ -73,6 +75,12 @@ public:
      * the entire map is then used by reconcileBars() and layout().
      * The map should be cleared (by calling reset()) before a full
      * set of staffs is preparsed.
+     *
+     * Different staffs may be scanned from different threads at once,
+     * provided that nothing else uses the layout meanwhile (see
+     * NotationScene::layout()).  Each scan writes only to its own
+     * staff's entries, so finishLayout() sees the same data whatever
+     * order they ran in.
      */
     virtual void scanViewSegment(ViewSegment &staff,
                                  timeT startTime,
@@ -229,6 +237,10 @@ public:
     /// YG: Only for debug
     void dumpBarDataMap();
 
+    /// The bar data and staff name width from the scan of a staff,
+    /// as text.  For comparing layouts in tests.
+    std::string getScanDescription(ViewSegment &staff) const;
+
 protected:
 
     struct Chunk {
@@ -363,7 +375,8 @@ protected:
 
     /**
      * Returns the bar positions for a given staff, provided that
-     * staff has been preparsed since the last reset
+     * staff has been preparsed since the last reset.  Safe to call
+     * while other staffs are being scanned.
      */
     BarDataList& getBarData(ViewSegment &staff);
     const BarDataList& getBarData(ViewSegment &staff) const;
@@ -464,6 +477,11 @@ protected:
 
     int m_timePerProgressIncrement;
     std::map<ViewSegment *, bool> m_haveOttavaSomewhere;
+
+    // Guards the staff-keyed maps above while staffs are being
+    // scanned in parallel: entries are looked up and added under it,
+    // and then used without it by the one scan that owns them
+    QMutex m_staffDataMutex;
     int m_staffCount; // purely for value() reporting
 
     NotationScene *m_scene;
@@ -45,7 +45,11 @@
 #include "sound/MappedEvent.h"
 
 #include <QApplication>
+#include <QRunnable>
+#include <QSemaphore>
 #include <QSettings>
+#include <QThreadPool>
+#include <QTimer>
 #include <QGraphicsSceneMouseEvent>
 #include <QKeyEvent>
 
@@ -78,6 +82,7 @@ NotationScene::NotationScene() :
     m_compositionRefreshStatusId(0),
     m_timeSignatureChanged(false),
     m_updatesSuspended(false),
+    m_renderPending(false),
     m_minTrack(0),
     m_maxTrack(0),
     m_finished(false),
@@ -452,6 +457,55 @@ NotationScene::resumeLayoutUpdates()
     initCurrentStaffIndex();
 }
 
+QRectF
+NotationScene::getRenderRectFor(const QRectF &visible)
+{
+    if (visible.isNull()) return visible;
+
+    // A screenful either side, and half a screenful above and below
+    return visible.adjusted(-visible.width(), -visible.height() / 2,
+                            visible.width(), visible.height() / 2);
+}
+
+void
+NotationScene::slotSetVisibleRect(QRectF rect)
+{
+    m_visibleRect = rect;
+
+    // Before there are any staffs, just remember where to draw them
+    if (m_staffs.empty()) {
+        m_renderRect = getRenderRectFor(rect);
+        return;
+    }
+
+    if (!rect.isNull() && !m_renderRect.isNull() &&
+        m_renderRect.contains(rect)) {
+        return;
+    }
+
+    // This may arrive while the view is painting, so leave changing
+    // the scene until afterwards
+    if (!m_renderPending) {
+        m_renderPending = true;
+        QTimer::singleShot(0, this, SLOT(slotRenderVisibleRect()));
+    }
+}
+
+void
+NotationScene::slotRenderVisibleRect()
+{
+    m_renderPending = false;
+    if (m_finished) return;
+
+    Profiler profiler("NotationScene::slotRenderVisibleRect", true);
+
+    m_renderRect = getRenderRectFor(m_visibleRect);
+
+    for (unsigned int i = 0; i < m_staffs.size(); ++i) {
+        m_staffs[i]->renderVisibleElements();
+    }
+}
+
 NotationStaff *
 NotationScene::getStaffForSceneCoords(double x, int y) const
 {
@@ -1682,6 +1736,115 @@ NotationScene::layoutAll()
     layout(0, 0, 0);
 }
 
+// Scans one staff for both layouts, on a pool thread
+class LayoutScanJob : public QRunnable
+{
+public:
+    LayoutScanJob(NotationHLayout *hlayout, NotationVLayout *vlayout,
+                  NotationStaff *staff, timeT startTime, timeT endTime,
+                  bool full, QSemaphore *finished) :
+        m_hlayout(hlayout),
+        m_vlayout(vlayout),
+        m_staff(staff),
+        m_startTime(startTime),
+        m_endTime(endTime),
+        m_full(full),
+        m_finished(finished),
+        m_failed(false)
+    {
+        setAutoDelete(false);
+    }
+
+    virtual void run()
+    {
+        try {
+            m_hlayout->scanViewSegment(*m_staff, m_startTime, m_endTime,
+                                       m_full);
+            m_vlayout->scanViewSegment(*m_staff, m_startTime, m_endTime,
+                                       m_full);
+        } catch (...) {
+            // Nothing may be thrown out of a pool thread, so note it
+            // and let the caller scan again to throw it from there
+            m_failed = true;
+        }
+        m_finished->release();
+    }
+
+    NotationStaff *getStaff() const { return m_staff; }
+    bool failed() const { return m_failed; }
+
+private:
+    NotationHLayout *m_hlayout;
+    NotationVLayout *m_vlayout;
+    NotationStaff *m_staff;
+    timeT m_startTime;
+    timeT m_endTime;
+    bool m_full;
+    QSemaphore *m_finished;
+    bool m_failed;
+};
+
+void
+NotationScene::scanStaffs(NotationStaff *singleStaff,
+                          timeT startTime, timeT endTime, bool full)
+{
+    std::vector<NotationStaff *> staffs;
+
+    for (unsigned int i = 0; i < m_staffs.size(); ++i) {
+        if (singleStaff && m_staffs[i] != singleStaff) continue;
+        staffs.push_back(m_staffs[i]);
+    }
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+
+    if (staffs.size() < 2 || pool->maxThreadCount() < 2) {
+        for (unsigned int i = 0; i < staffs.size(); ++i) {
+            m_hlayout->scanViewSegment(*staffs[i], startTime, endTime, full);
+            m_vlayout->scanViewSegment(*staffs[i], startTime, endTime, full);
+        }
+        return;
+    }
+
+    // The staffs are scanned independently, but some of what they
+    // share is only worked out the first time it's asked for.  Do that
+    // here first: the composition's bar positions, the clef and key
+    // context, and the dimensions of the glyphs, which can only be
+    // rendered on this thread.
+    {
+        Profiler profiler("NotationScene::scanStaffs: prepare", true);
+
+        (void)m_document->getComposition().getNbBars();
+        m_clefKeyContext->update();
+        m_notePixmapFactory->cacheDimensions();
+        m_notePixmapFactorySmall->cacheDimensions();
+    }
+
+    QSemaphore finished;
+    std::vector<LayoutScanJob *> jobs;
+
+    for (unsigned int i = 0; i < staffs.size(); ++i) {
+        LayoutScanJob *job = new LayoutScanJob(m_hlayout, m_vlayout,
+                                               staffs[i], startTime, endTime,
+                                               full, &finished);
+        jobs.push_back(job);
+        pool->start(job);
+    }
+
+    finished.acquire(int(jobs.size()));
+
+    std::vector<NotationStaff *> failed;
+
+    for (unsigned int i = 0; i < jobs.size(); ++i) {
+        if (jobs[i]->failed()) failed.push_back(jobs[i]->getStaff());
+        delete jobs[i];
+    }
+
+    for (unsigned int i = 0; i < failed.size(); ++i) {
+        m_hlayout->scanViewSegment(*failed[i], startTime, endTime, full);
+        m_vlayout->scanViewSegment(*failed[i], startTime, endTime, full);
+    }
+}
+
 void
 NotationScene::layout(NotationStaff *singleStaff,
                       timeT startTime, timeT endTime)
@@ -1722,15 +1885,7 @@ NotationScene::layout(NotationStaff *singleStaff,
 
     {
         Profiler profiler("NotationScene::layout: Scan layouts", true);
-    for (unsigned int i = 0; i < m_staffs.size(); ++i) {
-
-        NotationStaff *staff = m_staffs[i];
-
-        if (singleStaff && staff != singleStaff) continue;
-
-        m_hlayout->scanViewSegment(*staff, startTime, endTime, full);
-        m_vlayout->scanViewSegment(*staff, startTime, endTime, full);
-    }
+        scanStaffs(singleStaff, startTime, endTime, full);
     }
 
     m_hlayout->finishLayout(startTime, endTime, full);
@@ -151,6 +151,14 @@ public:
     void suspendLayoutUpdates();
     void resumeLayoutUpdates();
 
+    /**
+     * Return the part of the scene in which elements are drawn: the
+     * visible part, with a margin around it so that a short scroll
+     * finds them ready.  Elements further away have no scene items.
+     * A null rect means the whole scene.
+     */
+    QRectF getRenderRect() const { return m_renderRect; }
+
     /**
      * Show and sound the given note.  The height is used for display,
      * the pitch for performance, so the two need not correspond (e.g.
@@ -255,9 +263,19 @@ signals:
      */
     void hoveredOverAbsoluteTimeChanged(unsigned int time);
 
+public slots:
+    /**
+     * Tell the scene which part of it the view shows.  The elements
+     * around it are drawn soon after, if they aren't already.
+     */
+    void slotSetVisibleRect(QRectF);
+
 protected slots:
     void slotCommandExecuted();
 
+    /// Draw the elements near the visible rect, and drop the rest
+    void slotRenderVisibleRect();
+
 protected:
     void mousePressEvent(QGraphicsSceneMouseEvent *);
     void mouseMoveEvent(QGraphicsSceneMouseEvent *);
@@ -328,6 +346,13 @@ private:
 
     bool m_updatesSuspended;
 
+    QRectF m_visibleRect;
+    QRectF m_renderRect;
+    bool m_renderPending;
+
+    /// Return the render rect for the given visible rect
+    static QRectF getRenderRectFor(const QRectF &visible);
+
     /// Returns the page width according to the layout mode (page/linear)
     int getPageWidth();
 
@@ -348,6 +373,10 @@ private:
     void layoutAll();
     void layout(NotationStaff *singleStaff, timeT start, timeT end);
 
+    /// Scan the staffs for both layouts, across the thread pool
+    void scanStaffs(NotationStaff *singleStaff, timeT start, timeT end,
+                    bool full);
+
     NotationStaff *setSelectionElementStatus(EventSelection *, bool set);
     void previewSelection(EventSelection *, EventSelection *oldSelection);
 
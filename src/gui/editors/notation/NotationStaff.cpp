@@ -65,7 +65,9 @@
 #include <QPoint>
 #include <QRect>
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 
 
 namespace Rosegarden
@@ -522,6 +524,11 @@ NotationStaff::renderElements(NotationElementList::iterator from,
             continue;
         }
 
+        if (!isInRenderRange(static_cast<NotationElement *>(*it))) {
+            // left until the view comes near it
+            continue;
+        }
+
         bool selected = isSelected(it);
         //      RG_DEBUG << "Rendering at " << (*it)->getAbsoluteTime()
         //                           << " (selected = " << selected << ")";
@@ -684,6 +691,7 @@ NotationStaff::positionElements(timeT from, timeT to)
 
     int elementsPositioned = 0;
     int elementsRendered = 0; // diagnostic
+    int elementsOffscreen = 0; // diagnostic
 
     Composition *composition = getSegment().getComposition();
 
@@ -701,6 +709,10 @@ NotationStaff::positionElements(timeT from, timeT to)
 
     truncateClefsAndKeysAt(static_cast<int>((*beginAt)->getLayoutX()));
 
+    // Only the elements near the view get items; the layout may have
+    // moved them in or out of range
+    getRenderRanges(m_renderRanges);
+
     Clef currentClef; // used for rendering key sigs
     bool haveCurrentClef = false;
 
@@ -749,6 +761,18 @@ NotationStaff::positionElements(timeT from, timeT to)
             continue;
         }
 
+        if (!isInRenderRange(el)) {
+
+            // too far from the view to be worth drawing for now
+            if (!el->isOffscreen()) el->setOffscreen();
+            ++elementsOffscreen;
+
+            if (el->event()->isa(::Rosegarden::Key::EventType)) {
+                currentKey = ::Rosegarden::Key(*el->event());
+            }
+            continue;
+        }
+
         bool selected = isSelected(it);
         bool needNewItem = elementNeedsRegenerating(it);
 
@@ -782,12 +806,183 @@ NotationStaff::positionElements(timeT from, timeT to)
     RG_DEBUG << "NotationStaff " << this << "::positionElements "
              << from << " -> " << to << ": "
              << elementsPositioned << " elements positioned, "
-             << elementsRendered << " re-rendered"
+             << elementsRendered << " re-rendered, "
+             << elementsOffscreen << " offscreen"
             ;
 
     NotePixmapFactory::dumpStats(std::cerr);
 }
 
+void
+NotationStaff::renderVisibleElements()
+{
+    Profiler profiler("NotationStaff::renderVisibleElements", true);
+
+    TimeRangeList oldRanges(m_renderRanges);
+    getRenderRanges(m_renderRanges);
+    if (m_renderRanges == oldRanges) return;
+
+    int elementsDropped = 0;
+    int elementsRendered = 0;
+
+    // Remove the items of elements that have gone out of range...
+
+    for (TimeRangeList::const_iterator i = oldRanges.begin();
+         i != oldRanges.end(); ++i) {
+
+        NotationElementList::iterator it =
+            getViewElementList()->findTime(i->first);
+        NotationElementList::iterator endAt =
+            getViewElementList()->findTime(i->second);
+
+        for ( ; it != endAt; ++it) {
+            NotationElement *el = static_cast<NotationElement *>(*it);
+            if (el->getItem() && !isInRenderRange(el)) {
+                el->setOffscreen();
+                ++elementsDropped;
+            }
+        }
+    }
+
+    // ...and draw the ones that have come into it
+
+    for (TimeRangeList::const_iterator i = m_renderRanges.begin();
+         i != m_renderRanges.end(); ++i) {
+
+        elementsRendered += renderOffscreenElements
+            (getViewElementList()->findTime(i->first),
+             getViewElementList()->findTime(i->second));
+    }
+
+    RG_DEBUG << "NotationStaff " << this << "::renderVisibleElements: "
+             << elementsRendered << " elements rendered, "
+             << elementsDropped << " dropped";
+}
+
+void
+NotationStaff::getRenderRanges(TimeRangeList &ranges)
+{
+    ranges.clear();
+
+    QRectF rect = m_notationScene->getRenderRect();
+
+    if (rect.isNull()) {
+        ranges.push_back(TimeRange(std::numeric_limits<timeT>::min(),
+                                   std::numeric_limits<timeT>::max()));
+        return;
+    }
+
+    Composition *composition = getSegment().getComposition();
+    RulerScale *rulerScale = m_notationScene->getHLayout();
+
+    for (int row = getRowForLayoutX(m_startLayoutX);
+         row <= getRowForLayoutX(m_endLayoutX); ++row) {
+
+        double left = getSceneXForLeftOfRow(row);
+        double right = getSceneXForRightOfRow(row);
+        double top = getSceneYForTopOfStaff(row);
+
+        if (!rect.intersects(QRectF(left, top,
+                                    right - left, getHeightOfRow()))) {
+            continue;
+        }
+
+        // The layout x coordinate runs on from one row to the next
+        double rowX = row * m_pageWidth - left;
+        double fromX = std::max(rect.left(), left) + rowX;
+        double toX = std::min(rect.right(), right) + rowX;
+
+        timeT from = composition->getBarStartForTime
+            (rulerScale->getTimeForX(fromX));
+        timeT to = composition->getBarEndForTime
+            (rulerScale->getTimeForX(toX));
+
+        if (!ranges.empty() && ranges.back().second >= from) {
+            if (to > ranges.back().second) ranges.back().second = to;
+        } else {
+            ranges.push_back(TimeRange(from, to));
+        }
+    }
+}
+
+bool
+NotationStaff::isInRenderRange(NotationElement *el) const
+{
+    // Indications may reach a long way from where they start, and
+    // there are few of them, so they're always drawn
+    if (el->event()->isa(Indication::EventType)) return true;
+
+    timeT t = el->getViewAbsoluteTime();
+
+    for (TimeRangeList::const_iterator i = m_renderRanges.begin();
+         i != m_renderRanges.end(); ++i) {
+        if (t < i->first) return false;
+        if (t < i->second) return true;
+    }
+
+    return false;
+}
+
+int
+NotationStaff::renderOffscreenElements(NotationElementList::iterator from,
+                                       NotationElementList::iterator to)
+{
+    int elementsRendered = 0;
+
+    // As in positionElements
+    Clef currentClef;
+    bool haveCurrentClef = false;
+
+    ::Rosegarden::Key currentKey;
+    bool haveCurrentKey = false;
+
+    for (NotationElementList::iterator it = from, nextIt = from;
+         it != to; it = nextIt) {
+
+        NotationElement *el = static_cast<NotationElement *>(*it);
+
+        ++nextIt;
+
+        if (el->event()->isa(Clef::EventType)) {
+
+            currentClef = Clef(*el->event());
+            haveCurrentClef = true;
+
+        } else if (el->event()->isa(::Rosegarden::Key::EventType)) {
+
+            if (!haveCurrentClef) {
+                currentClef = getSegment().getClefAtTime
+                              (el->event()->getAbsoluteTime());
+                haveCurrentClef = true;
+            }
+
+            if (!haveCurrentKey) {
+                currentKey = m_notationScene->getClefKeyContext()->
+                    getKeyFromContext(getSegment().getTrack(),
+                                      el->event()->getAbsoluteTime() - 1);
+                haveCurrentKey = true;
+            }
+
+        } else if (isDirectlyPrintable(el)) {
+            continue;
+        }
+
+        if (el->isOffscreen()) {
+            // clear the offscreen flag, in case the element turns out
+            // not to be shown at all
+            el->removeItem();
+            renderSingleElement(it, currentClef, currentKey, isSelected(it));
+            ++elementsRendered;
+        }
+
+        if (el->event()->isa(::Rosegarden::Key::EventType)) {
+            currentKey = ::Rosegarden::Key(*el->event());
+        }
+    }
+
+    return elementsRendered;
+}
+
 void
 NotationStaff::truncateClefsAndKeysAt(int x)
 {
@@ -25,6 +25,7 @@
 #include <set>
 #include <string>
 #include <utility>
+#include <vector>
 #include "base/Event.h"
 #include "NotationElement.h"
 
@@ -144,10 +145,22 @@ public:
      * Call this after renderElements, or after changing the selection,
      * passing from and to arguments corresponding to the times of those
      * passed to renderElements.
+     *
+     * Elements that lie outside the scene's render rect are left
+     * without items, as are those in renderElements.
      */
     virtual void positionElements(timeT from,
                                   timeT to);
 
+    /**
+     * Draw the elements that have come near the visible part of the
+     * scene (see NotationScene::getRenderRect()), and remove the
+     * items of those that have moved away from it.  Call this when
+     * the view has scrolled; the layout must be unchanged since the
+     * last positionElements call.
+     */
+    void renderVisibleElements();
+
     /**
      * Set a painter as the printer output.  If this painter is
      * non-null, subsequent renderElements calls will only render
@@ -382,6 +395,28 @@ protected:
 
     void truncateClefsAndKeysAt(int);
 
+    typedef std::pair<timeT, timeT> TimeRange;
+    typedef std::vector<TimeRange> TimeRangeList;
+
+    /**
+     * Find the bars of the staff that lie at least partly within the
+     * scene's render rect, as time ranges in order.
+     */
+    void getRenderRanges(TimeRangeList &ranges);
+
+    /**
+     * Return true if the element lies within the ranges found by the
+     * last getRenderRanges call, and so should have a scene item.
+     */
+    bool isInRenderRange(NotationElement *) const;
+
+    /**
+     * Draw the elements between from and to that were left without
+     * an item for being offscreen.  Return how many were drawn.
+     */
+    int renderOffscreenElements(NotationElementList::iterator from,
+                                NotationElementList::iterator to);
+
     /**
      * Verify that a possible Clef or Key in bar is already inserted
      * in m_clefChange or m_keyChange.
@@ -407,6 +442,8 @@ protected:
 
     QPainter *m_printPainter;
 
+    TimeRangeList m_renderRanges;
+
     unsigned int m_refreshStatusId;
 };
 
@@ -36,6 +36,7 @@
 #include "NotationStaff.h"
 #include "NotePixmapFactory.h"
 #include <QMessageBox>
+#include <QMutexLocker>
 #include <QObject>
 #include <QSettings>
 #include <QString>
@@ -73,6 +74,8 @@ NotationVLayout::~NotationVLayout()
 NotationVLayout::SlurList &
 NotationVLayout::getSlurList(ViewSegment &staff)
 {
+    QMutexLocker locker(&m_slursMutex);
+
     SlurListMap::iterator i = m_slurs.find(&staff);
     if (i == m_slurs.end()) {
         m_slurs[&staff] = SlurList();
@@ -26,6 +26,8 @@
 
 #include "NotationElement.h"
 
+#include <QMutex>
+
 
 class SlurList;
 class QObject;
@@ -70,7 +72,8 @@ public:
     virtual void reset();
 
     /**
-     * Lay out a single staff.
+     * Lay out a single staff.  Different staffs may be laid out from
+     * different threads at once.
      */
     virtual void scanViewSegment(ViewSegment &,
 				 timeT startTime,
@@ -97,6 +100,7 @@ private:
 
     SlurListMap m_slurs;
     SlurList &getSlurList(ViewSegment &);
+    QMutex m_slursMutex; // for adding staffs to m_slurs during a scan
 
     Composition *m_composition;
     NotePixmapFactory *m_npf;
@@ -75,6 +75,7 @@
 #include "misc/ConfigGroups.h"
 
 #include <QApplication>
+#include <QDesktopWidget>
 #include <QGraphicsView>
 #include <QGridLayout>
 #include <QBoxLayout>
@@ -426,6 +427,19 @@ NotationWidget::setSegments(RosegardenDocument *document,
     if (m_updatesSuspended) m_scene->suspendLayoutUpdates();
 
     m_scene->setLeftGutter(m_leftGutter);
+
+    // Only the part of the scene around the view gets drawn.  Until
+    // the view has been shown, allow for it filling the screen.
+    QRect viewRect = m_view->viewport()->rect();
+    if (!m_view->isVisible()) {
+        viewRect.setSize
+            (QApplication::desktop()->availableGeometry(m_view).size());
+    }
+    m_scene->slotSetVisibleRect(m_view->mapToScene(viewRect).boundingRect());
+
+    connect(m_view, SIGNAL(pannedRectChanged(QRectF)),
+            m_scene, SLOT(slotSetVisibleRect(QRectF)));
+
     m_scene->setStaffs(document, segments);
 
     m_referenceScale = new ZoomableRulerScale(m_scene->getRulerScale());
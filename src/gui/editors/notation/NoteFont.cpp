@@ -28,6 +28,7 @@
 #include "SystemFont.h"
 #include <QBitmap>
 #include <QImage>
+#include <QMutexLocker>
 #include <QPainter>
 #include <QPixmap>
 #include <QPoint>
@@ -38,14 +39,15 @@
 namespace Rosegarden
 {
 
-NoteFont::FontPixmapMap *NoteFont::m_fontPixmapMap = 0;
-
 NoteFont::DrawRepMap *NoteFont::m_drawRepMap = 0;
 QPixmap *NoteFont::m_blankPixmap = 0;
 
+static const int blankSize = 10;
+
 
 NoteFont::NoteFont(QString fontName, int size) :
-    m_fontMap(fontName)
+    m_fontMap(fontName),
+    m_allDimensionsCached(false)
 {
     // Do the size checks first, to avoid doing the extra work if they fail
 
@@ -65,29 +67,12 @@ NoteFont::NoteFont(QString fontName, int size) :
         }
     }
 
-    // Create the global font map and blank pixmap if necessary
-
-    if (m_fontPixmapMap == 0) {
-        m_fontPixmapMap = new FontPixmapMap();
-    }
+    // Create the blank pixmap if necessary
 
     if (m_blankPixmap == 0) {
-        m_blankPixmap = new QPixmap(10, 10);
+        m_blankPixmap = new QPixmap(blankSize, blankSize);
         m_blankPixmap->fill(Qt::transparent);
     }
-
-    // Locate our font's pixmap map in the font map, create if necessary
-
-    QString fontKey = QString("__%1__%2__")
-        .arg(m_fontMap.getName())
-        .arg(m_size);
-
-    FontPixmapMap::iterator i = m_fontPixmapMap->find(fontKey);
-    if (i == m_fontPixmapMap->end()) {
-        (*m_fontPixmapMap)[fontKey] = new PixmapMap();
-    }
-
-    m_map = (*m_fontPixmapMap)[fontKey];
 }
 
 NoteFont::~NoteFont()
@@ -138,61 +123,38 @@ NoteFont::getLegerLineThickness(unsigned int &thickness) const
     return m_fontMap.getLegerLineThickness(m_size, thickness);
 }
 
+GlyphCache::Key
+NoteFont::getKey(CharName charName, bool inverted) const
+{
+    return GlyphCache::Key(m_fontMap.getName(), m_size, charName, inverted);
+}
+
 bool
-NoteFont::lookup(CharName charName, bool inverted, QPixmap *&pixmap) const
+NoteFont::lookup(const GlyphCache::Key &key, QPixmap &pixmap) const
 {
-    PixmapMap::iterator i = m_map->find(charName);
-    if (i != m_map->end()) {
-        if (inverted) {
-            pixmap = i->second.second;
-            if (!pixmap && i->second.first)
-                return false;
-        } else {
-            pixmap = i->second.first;
-            if (!pixmap && i->second.second)
-                return false;
-        }
-        return true;
-    }
-    pixmap = 0;
-    return false;
+    return GlyphCache::getInstance()->lookup(key, pixmap);
 }
 
 void
-NoteFont::add
-(CharName charName, bool inverted, QPixmap *pixmap) const
+NoteFont::add(const GlyphCache::Key &key, const QPixmap &pixmap) const
 {
-    PixmapMap::iterator i = m_map->find(charName);
-    if (i != m_map->end()) {
-        if (inverted) {
-            delete i->second.second;
-            i->second.second = pixmap;
-        } else {
-            delete i->second.first;
-            i->second.first = pixmap;
-        }
-    } else {
-        if (inverted) {
-            (*m_map)[charName] = PixmapPair(0, pixmap);
-        } else {
-            (*m_map)[charName] = PixmapPair(pixmap, 0);
-        }
-    }
+    GlyphCache::getInstance()->add(key, pixmap);
 }
-    
+
 NoteCharacterDrawRep *
-NoteFont::lookupDrawRep(QPixmap *pixmap) const
+NoteFont::lookupDrawRep(const GlyphCache::Key &key,
+                        const QPixmap &pixmap) const
 {
     if (!m_drawRepMap)
         m_drawRepMap = new DrawRepMap();
 
-    if (m_drawRepMap->find(pixmap) != m_drawRepMap->end()) {
+    if (m_drawRepMap->find(key) != m_drawRepMap->end()) {
 
-        return (*m_drawRepMap)[pixmap];
+        return (*m_drawRepMap)[key];
 
     } else {
 
-        QImage image = pixmap->toImage();
+        QImage image = pixmap.toImage();
         if (image.isNull())
             return 0;
 
@@ -234,7 +196,7 @@ NoteFont::lookupDrawRep(QPixmap *pixmap) const
             }
         }
 
-        (*m_drawRepMap)[pixmap] = a;
+        (*m_drawRepMap)[key] = a;
         return a;
     }
 }
@@ -242,30 +204,25 @@ NoteFont::lookupDrawRep(QPixmap *pixmap) const
 bool
 NoteFont::getPixmap(CharName charName, QPixmap &pixmap, bool inverted) const
 {
-    QPixmap *found = 0;
-    bool ok = lookup(charName, inverted, found);
-    if (ok) {
-        if (found) {
-            pixmap = *found;
-            return true;
-        } else {
-            pixmap = *m_blankPixmap;
-            return false;
-        }
+    GlyphCache::Key key(getKey(charName, inverted));
+
+    if (lookup(key, pixmap)) {
+        if (!pixmap.isNull()) return true;
+        pixmap = *m_blankPixmap;
+        return false;
     }
 
     if (inverted && !m_fontMap.hasInversion(m_size, charName)) {
         if (!getPixmap(charName, pixmap, !inverted)) return false;
-        found = new QPixmap(PixmapFunctions::flipVertical(pixmap));
-        add(charName, inverted, found);
-        pixmap = *found;
+        pixmap = PixmapFunctions::flipVertical(pixmap);
+        add(key, pixmap);
         return true;
     }
 
     Profiler profiler("NoteFont::getPixmap: cache miss");
 
     QString src;
-    ok = false;
+    bool ok = false;
 
     if (!inverted) ok = m_fontMap.getSrc(m_size, charName, src);
     else ok = m_fontMap.getInversionSrc(m_size, charName, src);
@@ -273,11 +230,11 @@ NoteFont::getPixmap(CharName charName, QPixmap &pixmap, bool inverted) const
     if (ok) {
         NOTATION_DEBUG << "NoteFont::getPixmap: Loading \"" << src << "\"";
 
-        found = new QPixmap(src);
+        QPixmap found(src);
 
-        if (!found->isNull()) {
-            add(charName, inverted, found);
-            pixmap = *found;
+        if (!found.isNull()) {
+            add(key, found);
+            pixmap = found;
             return true;
         }
 
@@ -296,7 +253,7 @@ NoteFont::getPixmap(CharName charName, QPixmap &pixmap, bool inverted) const
             std::cerr << "NoteFont::getPixmap: Warning: No pixmap, code, or glyph for character \""
                       << charName << "\"" << (inverted ? " (inverted)" : "")
                       << " in font \"" << m_fontMap.getName() << "\"" << std::endl;
-            add(charName, inverted, 0);
+            add(key, QPixmap());
             pixmap = *m_blankPixmap;
             return false;
         }
@@ -309,9 +266,8 @@ NoteFont::getPixmap(CharName charName, QPixmap &pixmap, bool inverted) const
             if (!inverted && m_fontMap.hasInversion(m_size, charName)) {
                 if (!getPixmap(charName, pixmap, !inverted))
                     return false;
-                found = new QPixmap(PixmapFunctions::flipVertical(pixmap));
-                add(charName, inverted, found);
-                pixmap = *found;
+                pixmap = PixmapFunctions::flipVertical(pixmap);
+                add(key, pixmap);
                 return true;
             }
 
@@ -319,7 +275,7 @@ NoteFont::getPixmap(CharName charName, QPixmap &pixmap, bool inverted) const
                       << charName << "\"" << (inverted ? " (inverted)" : "")
                       << " in font \"" << m_fontMap.getName() << "\"" << std::endl;
 
-            add(charName, inverted, 0);
+            add(key, QPixmap());
             pixmap = *m_blankPixmap;
             return false;
         }
@@ -328,24 +284,24 @@ NoteFont::getPixmap(CharName charName, QPixmap &pixmap, bool inverted) const
             m_fontMap.getStrategy(m_size, charName);
 
         bool success;
-        found = new QPixmap(systemFont->renderChar(charName,
-                                                   glyph,
-                                                   code + charBase,
-                                                   strategy,
-                                                   success));
+        QPixmap found(systemFont->renderChar(charName,
+                                             glyph,
+                                             code + charBase,
+                                             strategy,
+                                             success));
 
         if (success) {
-            add(charName, inverted, found);
-            pixmap = *found;
+            add(key, found);
+            pixmap = found;
             return true;
         } else {
-            add(charName, inverted, 0);
+            add(key, QPixmap());
             pixmap = *m_blankPixmap;
             return false;
         }
     }
 
-    add(charName, inverted, 0);
+    add(key, QPixmap());
     pixmap = *m_blankPixmap;
     return false;
 }
@@ -354,33 +310,26 @@ bool
 NoteFont::getColouredPixmap(CharName baseCharName, QPixmap &pixmap,
                             int hue, int minimum, bool inverted, int saturation) const
 {
-    CharName charName(getNameWithColour(baseCharName, hue));
+    GlyphCache::Key key(m_fontMap.getName(), m_size, baseCharName, inverted,
+                        hue, minimum, saturation);
 
-    QPixmap *found = 0;
-    bool ok = lookup(charName, inverted, found);
-    if (ok) {
-        if (found) {
-            pixmap = *found;
-            return true;
-        } else {
-            pixmap = *m_blankPixmap;
-            return false;
-        }
+    if (lookup(key, pixmap)) {
+        if (!pixmap.isNull()) return true;
+        pixmap = *m_blankPixmap;
+        return false;
     }
 
     QPixmap basePixmap;
-    ok = getPixmap(baseCharName, basePixmap, inverted);
+    bool ok = getPixmap(baseCharName, basePixmap, inverted);
 
     if (!ok) {
-        add(charName, inverted, 0);
+        add(key, QPixmap());
         pixmap = *m_blankPixmap;
         return false;
     }
 
-    found = new QPixmap
-        (PixmapFunctions::colourPixmap(basePixmap, hue, minimum, saturation));
-    add(charName, inverted, found);
-    pixmap = *found;
+    pixmap = PixmapFunctions::colourPixmap(basePixmap, hue, minimum, saturation);
+    add(key, pixmap);
     return ok;
 }
 
@@ -388,57 +337,85 @@ bool
 NoteFont::getShadedPixmap(CharName baseCharName, QPixmap &pixmap,
                           bool inverted) const
 {
-    CharName charName(getNameShaded(baseCharName));
+    GlyphCache::Key key(GlyphCache::Key::shaded(m_fontMap.getName(), m_size,
+                                                baseCharName, inverted));
 
-    QPixmap *found = 0;
-    bool ok = lookup(charName, inverted, found);
-    if (ok) {
-        if (found) {
-            pixmap = *found;
-            return true;
-        } else {
-            pixmap = *m_blankPixmap;
-            return false;
-        }
+    if (lookup(key, pixmap)) {
+        if (!pixmap.isNull()) return true;
+        pixmap = *m_blankPixmap;
+        return false;
     }
 
     QPixmap basePixmap;
-    ok = getPixmap(baseCharName, basePixmap, inverted);
+    bool ok = getPixmap(baseCharName, basePixmap, inverted);
 
     if (!ok) {
-        add(charName, inverted, 0);
+        add(key, QPixmap());
         pixmap = *m_blankPixmap;
         return false;
     }
 
-    found = new QPixmap(PixmapFunctions::shadePixmap(basePixmap));
-    add(charName, inverted, found);
-    pixmap = *found;
+    pixmap = PixmapFunctions::shadePixmap(basePixmap);
+    add(key, pixmap);
     return ok;
 }
 
-CharName
-NoteFont::getNameWithColour(CharName base, int hue) const
-{
-    return QString("%1__%2").arg(hue).arg(base);
-}
-
-CharName
-NoteFont::getNameShaded(CharName base) const
-{
-    return QString("shaded__%1").arg(base);
-}
-
 bool
 NoteFont::getDimensions(CharName charName, int &x, int &y, bool inverted) const
 {
+    DimensionMap::key_type key(charName, inverted);
+
+    {
+        QMutexLocker locker(&m_dimensionsMutex);
+
+        DimensionMap::const_iterator i = m_dimensions.find(key);
+        if (i != m_dimensions.end()) {
+            x = i->second.x;
+            y = i->second.y;
+            return i->second.ok;
+        }
+
+        if (m_allDimensionsCached) {
+            // Not in the font map at all, so getPixmap() would only
+            // find the blank pixmap
+            x = y = blankSize;
+            return false;
+        }
+    }
+
     QPixmap pixmap;
     bool ok = getPixmap(charName, pixmap, inverted);
     x = pixmap.width();
     y = pixmap.height();
+
+    QMutexLocker locker(&m_dimensionsMutex);
+    m_dimensions[key] = Dimensions(x, y, ok);
     return ok;
 }
 
+void
+NoteFont::cacheDimensions() const
+{
+    {
+        QMutexLocker locker(&m_dimensionsMutex);
+        if (m_allDimensionsCached) return;
+    }
+
+    Profiler profiler("NoteFont::cacheDimensions");
+
+    std::set<CharName> names = m_fontMap.getCharNames();
+    int x, y;
+
+    for (std::set<CharName>::const_iterator i = names.begin();
+         i != names.end(); ++i) {
+        (void)getDimensions(*i, x, y, false);
+        (void)getDimensions(*i, x, y, true);
+    }
+
+    QMutexLocker locker(&m_dimensionsMutex);
+    m_allDimensionsCached = true;
+}
+
 int
 NoteFont::getWidth(CharName charName) const
 {
@@ -500,15 +477,8 @@ NoteFont::getCharacter(CharName charName,
                                   0);
     } else {
 
-        // Get the pointer direct from cache (depends on earlier call
-        // to getPixmap to put it in the cache if available)
-
-        QPixmap *pmapptr = 0;
-        bool found = lookup(charName, inverted, pmapptr);
-
-        NoteCharacterDrawRep *rep = 0;
-        if (found && pmapptr)
-            rep = lookupDrawRep(pmapptr);
+        NoteCharacterDrawRep *rep =
+            lookupDrawRep(getKey(charName, inverted), pixmap);
 
         character = NoteCharacter(pixmap,
                                   getHotspot(charName, inverted),
@@ -549,16 +519,10 @@ NoteFont::getCharacterColoured(CharName charName,
 
     } else {
 
-        // Get the pointer direct from cache (depends on earlier call
-        // to getPixmap to put it in the cache if available)
-
-        QPixmap *pmapptr = 0;
-        CharName cCharName(getNameWithColour(charName, hue));
-        bool found = lookup(cCharName, inverted, pmapptr);
-
-        NoteCharacterDrawRep *rep = 0;
-        if (found && pmapptr)
-            rep = lookupDrawRep(pmapptr);
+        NoteCharacterDrawRep *rep = lookupDrawRep
+            (GlyphCache::Key(m_fontMap.getName(), m_size, charName, inverted,
+                             hue, minimum, saturation),
+             pixmap);
 
         character = NoteCharacter(pixmap,
                                   getHotspot(charName, inverted),
@@ -22,9 +22,11 @@
 #include <map>
 #include "NoteCharacter.h"
 #include "NoteFontMap.h"
+#include "GlyphCache.h"
 #include <set>
 #include <QString>
 #include <QPoint>
+#include <QMutex>
 #include <utility>
 #include "gui/editors/notation/NoteCharacterNames.h"
 #include "gui/general/PixmapFunctions.h"
@@ -36,12 +38,10 @@ class QPixmap;
 namespace Rosegarden
 {
 
-class PixmapMap;
 class NoteCharacterDrawRep;
-class FontPixmapMap;
-class DrawRepMap;
 
-// Encapsulates NoteFontMap, and loads pixmaps etc on demand
+// Encapsulates NoteFontMap, and loads pixmaps etc on demand, keeping
+// them in the GlyphCache
 
 class NoteFont
 {
@@ -128,6 +128,15 @@ public:
     /// Ignores problems, returns centre-left of pixmap if necessary
     QPoint getHotspot(CharName charName, bool inverted = false) const;
 
+    /// Find the dimensions of every character in the font, both ways up
+    /**
+     * getDimensions() and the functions above that use it remember
+     * what they find, but have to render the pixmap the first time.
+     * Once this has been called (on the GUI thread) they never need
+     * to, so they may then be called from any thread.
+     */
+    void cacheDimensions() const;
+
 private:
     /// Returns false + blank pixmap if it can't find the right one
     bool getPixmap(CharName charName, QPixmap &pixmap,
@@ -147,28 +156,37 @@ private:
     NoteFont(QString fontName, int size = 0);
     std::set<int> getSizes() const { return m_fontMap.getSizes(); }
 
-    bool lookup(CharName charName, bool inverted, QPixmap *&pixmap) const;
-    void add(CharName charName, bool inverted, QPixmap *pixmap) const;
+    GlyphCache::Key getKey(CharName charName, bool inverted) const;
 
-    NoteCharacterDrawRep *lookupDrawRep(QPixmap *pixmap) const;
+    /// Returns false if not cached, true + null pixmap if cached as missing
+    bool lookup(const GlyphCache::Key &key, QPixmap &pixmap) const;
+    void add(const GlyphCache::Key &key, const QPixmap &pixmap) const;
 
-    CharName getNameWithColour(CharName origName, int hue) const;
-    CharName getNameShaded(CharName origName) const;
+    NoteCharacterDrawRep *lookupDrawRep(const GlyphCache::Key &key,
+                                        const QPixmap &pixmap) const;
 
-    typedef std::pair<QPixmap *, QPixmap *>    PixmapPair;
-    typedef std::map<CharName, PixmapPair>     PixmapMap;
-    typedef std::map<QString, PixmapMap *> FontPixmapMap;
+    // Never trimmed: NoteCharacters keep pointers to the entries
+    typedef std::map<GlyphCache::Key, NoteCharacterDrawRep *> DrawRepMap;
 
-    typedef std::map<QPixmap *, NoteCharacterDrawRep *> DrawRepMap;
+    struct Dimensions
+    {
+        Dimensions() : x(0), y(0), ok(false) { }
+        Dimensions(int ax, int ay, bool aok) : x(ax), y(ay), ok(aok) { }
+        int x;
+        int y;
+        bool ok;
+    };
+    typedef std::map<std::pair<CharName, bool>, Dimensions> DimensionMap;
 
     //--------------- Data members ---------------------------------
 
     int m_size;
     NoteFontMap m_fontMap;
 
-    mutable PixmapMap *m_map; // pointer at a member of m_fontPixmapMap
+    mutable DimensionMap m_dimensions;
+    mutable bool m_allDimensionsCached;
+    mutable QMutex m_dimensionsMutex;
 
-    static FontPixmapMap *m_fontPixmapMap;
     static DrawRepMap *m_drawRepMap;
 
     static QPixmap *m_blankPixmap;
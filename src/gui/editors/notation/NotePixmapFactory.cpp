@@ -38,6 +38,7 @@
 #include "gui/general/ResourceFinder.h"
 #include "gui/general/IconLoader.h"
 #include "gui/widgets/StartupLogo.h"
+#include "GlyphCache.h"
 #include "NotationStrings.h"
 #include "NotationView.h"
 #include "NoteCharacter.h"
@@ -58,6 +59,8 @@
 #include <QFont>
 #include <QFontMetrics>
 #include <QImage>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QPainter>
 #include <QPen>
 #include <QPixmap>
@@ -75,6 +78,10 @@ namespace Rosegarden
 
 using namespace Accidentals;
 
+// The layout scan measures text from more than one thread at once, and
+// fonts and font metrics can't be used from two threads together
+static QMutex fontMutex;
+
 //static clock_t drawBeamsTime = 0;
 //static clock_t makeNotesTime = 0;
 static int makeNotesCount = 0;
@@ -272,7 +279,9 @@ NotePixmapFactory::~NotePixmapFactory()
 {
     NOTATION_DEBUG << "NotePixmapFactory::~NotePixmapFactory:"
               << " makeNotesCount = " << makeNotesCount
-              << ", makeRestsCount = " << makeRestsCount;
+              << ", makeRestsCount = " << makeRestsCount
+              << ", glyph cache hit rate = "
+              << GlyphCache::getInstance()->getHitRate();
 
     delete m_p;
 }
@@ -293,6 +302,7 @@ void
 NotePixmapFactory::dumpStats(std::ostream &s)
 {
 #ifdef DUMP_STATS
+    GlyphCache::getInstance()->dumpStats(s);
 /*
   s << "NotePixmapFactory: total times since last stats dump:\n"
   << "makeNotePixmap: "
@@ -3238,6 +3248,8 @@ NotePixmapFactory::makeTimeSig(const TimeSignature& sig)
 
 int NotePixmapFactory::getTimeSigWidth(const TimeSignature &sig) const
 {
+    QMutexLocker locker(&fontMutex);
+
     if (sig.isCommon()) {
 
         QRect r(m_bigTimeSigFontMetrics.boundingRect("c"));
@@ -3264,6 +3276,8 @@ int NotePixmapFactory::getTimeSigWidth(const TimeSignature &sig) const
 QFont
 NotePixmapFactory::getTextFont(const Text &text) const
 {
+    QMutexLocker locker(&fontMutex);
+
     std::string type(text.getTextType());
     TextFontCache::iterator i = m_textFontCache.find(type.c_str());
     if (i != m_textFontCache.end())
@@ -3868,33 +3882,39 @@ int NotePixmapFactory::getKeyWidth(const Key &key,
     else
         keyCharName = NoteCharacterNames::FLAT;
 
-    NoteCharacter keyCharacter;
-    NoteCharacter cancelCharacter;
-
-    keyCharacter = m_font->getCharacter(keyCharName);
-    if (cancelCount > 0) {
-        cancelCharacter = m_font->getCharacter(NoteCharacterNames::NATURAL);
-    }
+    // Just the dimensions, rather than whole characters, so as not to
+    // render anything
+    int keyWidth = m_font->getWidth(keyCharName);
 
     //int x = 0;
     //int lw = getLineSpacing();
-    int keyDelta = keyCharacter.getWidth() - keyCharacter.getHotspot().x();
+    int keyDelta = keyWidth - m_font->getHotspot(keyCharName).x();
 
     int cancelDelta = 0;
     int between = 0;
     if (cancelCount > 0) {
-        cancelDelta = cancelCharacter.getWidth() + cancelCharacter.getWidth() / 3;
-        between = cancelCharacter.getWidth();
+        int cancelWidth = m_font->getWidth(NoteCharacterNames::NATURAL);
+        cancelDelta = cancelWidth + cancelWidth / 3;
+        between = cancelWidth;
     }
 
     return (keyDelta * ah1.size() + cancelDelta * cancelCount + between +
-            keyCharacter.getWidth() / 4);
+            keyWidth / 4);
 }
 
 int NotePixmapFactory::getTextWidth(const Text &text) const
 {
-    QFontMetrics metrics(getTextFont(text));
+    QFont font(getTextFont(text));
+
+    QMutexLocker locker(&fontMutex);
+    QFontMetrics metrics(font);
     return metrics.boundingRect(strtoqstr(text.getText())).width() + 4;
 }
 
+void NotePixmapFactory::cacheDimensions() const
+{
+    m_font->cacheDimensions();
+    if (m_graceFont != m_font) m_graceFont->cacheDimensions();
+}
+
 }
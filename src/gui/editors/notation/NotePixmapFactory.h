@@ -230,6 +230,14 @@ public:
                     Key previousKey = Key::DefaultKey) const;
     int getTextWidth(const Text &text) const;
 
+    /**
+     * Measure every glyph of the fonts up front, on the GUI thread,
+     * so that the geometry methods above need not render anything.
+     * They may then be called from other threads, as the layout scan
+     * does (see NoteFont::cacheDimensions()).
+     */
+    void cacheDimensions() const;
+
     /**
      * Returns the width of clef and key signature drawn in a track header.
      */
@@ -29,6 +29,8 @@
 #include "gui/general/ResourceFinder.h"
 #include <QDir>
 #include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QString>
 #include <QStringList>
 
@@ -61,9 +63,15 @@ NoteStyleFactory::getAvailableStyleNames()
     return names;
 }
 
+// Layout asks for styles from more than one thread.  Recursive,
+// because reading a style gets its base style from here too.
+static QMutex stylesMutex(QMutex::Recursive);
+
 NoteStyle *
 NoteStyleFactory::getStyle(NoteStyleName name)
 {
+    QMutexLocker locker(&stylesMutex);
+
     StyleMap::iterator i = m_styles.find(name);
 
     if (i == m_styles.end()) {
@@ -22,6 +22,7 @@
 #include "base/Composition.h"
 #include "base/Segment.h"
 #include "document/RosegardenDocument.h"
+#include "gui/seqmanager/InternalSegmentMapper.h"
 #include "gui/seqmanager/MappedEventBuffer.h"
 #include "gui/seqmanager/SegmentMapper.h"
 
@@ -74,7 +75,196 @@ CompositionMapper::segmentModified(Segment *segment)
     SEQMAN_DEBUG << "CompositionMapper::segmentModified(" << segment << ") - mapper = "
                  << mapper << endl;
 
-    return mapper->refresh();
+    return refreshMapper(mapper, segment, false, 0, 0);
+}
+
+bool
+CompositionMapper::segmentModified(Segment *segment, timeT from, timeT to)
+{
+    if (m_segmentMappers.find(segment) == m_segmentMappers.end()) return false;
+
+    SegmentMapper *mapper = m_segmentMappers[segment];
+
+    if (!mapper) return false;
+
+    SEQMAN_DEBUG << "CompositionMapper::segmentModified(" << segment << ", "
+                 << from << ", " << to << ") - mapper = " << mapper;
+
+    return refreshMapper(mapper, segment, true, from, to);
+}
+
+bool
+CompositionMapper::refreshMapper(SegmentMapper *mapper, Segment *segment,
+                                 bool range, timeT from, timeT to)
+{
+    InternalSegmentMapper *internal =
+        dynamic_cast<InternalSegmentMapper *>(mapper);
+
+    if (!internal)
+        return range ? mapper->refresh(from, to) : mapper->refresh();
+
+    // An edit to part of a segment that is neither linked nor sharing
+    // takes the quicker path of re-mapping just that part.  Working out
+    // the content key would mean going over the whole segment, so its
+    // events aren't offered for sharing again until a full refresh.
+    if (range  &&  !segment->isLinked()  &&
+        !internal->getSharedSource()  &&  !internal->isShared()) {
+        forgetSource(internal);
+        internal->setMappedContentKey(false, 0);
+        return internal->refresh(from, to);
+    }
+
+    quint64 key = 0;
+    const bool shareable = getContentKey(segment, key);
+
+    InternalSegmentMapper *source =
+        dynamic_cast<InternalSegmentMapper *>(internal->getSharedSource());
+
+    // A mapper with events of its own has only the key to go on, as
+    // what they were mapped from is gone.  One that follows another
+    // can check.
+    quint64 mappedKey;
+    if (shareable  &&  internal->getMappedContentKey(mappedKey)  &&
+        mappedKey == key  &&
+        (!source  ||  canFollow(segment, key, source))) {
+        // Same events.  The segment may have moved, been transposed or
+        // changed track.
+        internal->updatePlacement();
+        return false;
+    }
+
+    // Its events are out of date, and shared events mustn't change
+    if (!internal->getSharedSource()) {
+        handOver(internal);
+        forgetSource(internal);
+    }
+
+    if (shareable) {
+        EventSources::iterator i = m_eventSources.find(key);
+        if (i != m_eventSources.end()  &&
+            canFollow(segment, key, i->second)) {
+            internal->followEvents(i->second, key);
+            return false;
+        }
+    }
+
+    return mapOwnEvents(internal, shareable, key, range, from, to);
+}
+
+bool
+CompositionMapper::mapOwnEvents(InternalSegmentMapper *mapper,
+                                bool shareable, quint64 key,
+                                bool range, timeT from, timeT to)
+{
+    bool resized;
+
+    if (mapper->getSharedSource()) {
+        mapper->mapOwnEvents();
+        resized = true;
+    } else {
+        resized = range ? mapper->refresh(from, to) : mapper->refresh();
+    }
+
+    mapper->setMappedContentKey(shareable, key);
+
+    if (shareable  &&  m_eventSources.find(key) == m_eventSources.end())
+        m_eventSources[key] = mapper;
+
+    return resized;
+}
+
+void
+CompositionMapper::handOver(InternalSegmentMapper *source)
+{
+    if (!source->isShared()) return;
+
+    forgetSource(source);
+
+    for (SegmentMappers::iterator i = m_segmentMappers.begin();
+         i != m_segmentMappers.end(); ++i) {
+
+        InternalSegmentMapper *follower =
+            dynamic_cast<InternalSegmentMapper *>(i->second);
+        if (!follower  ||  follower->getSharedSource() != source)
+            continue;
+
+        // Its own segment may have changed too, e.g. if it's linked
+        quint64 key = 0;
+        const bool shareable = getContentKey(i->first, key);
+
+        EventSources::iterator j = shareable ?
+            m_eventSources.find(key) : m_eventSources.end();
+
+        // The first one takes over as the source for the rest
+        if (j != m_eventSources.end()  &&
+            canFollow(i->first, key, j->second))
+            follower->followEvents(j->second, key);
+        else
+            mapOwnEvents(follower, shareable, key, false, 0, 0);
+    }
+}
+
+void
+CompositionMapper::forgetSource(InternalSegmentMapper *mapper)
+{
+    quint64 key;
+    if (!mapper->getMappedContentKey(key)) return;
+
+    EventSources::iterator i = m_eventSources.find(key);
+    if (i != m_eventSources.end()  &&  i->second == mapper)
+        m_eventSources.erase(i);
+}
+
+bool
+CompositionMapper::getContentKey(Segment *segment, quint64 &key)
+{
+    EventsKeys::iterator i = m_eventsKeys.find(segment);
+
+    if (i == m_eventsKeys.end()) {
+        EventsKey eventsKey;
+        eventsKey.refreshStatusId = segment->getNewRefreshStatusId();
+        i = m_eventsKeys.insert(EventsKeys::value_type(segment, eventsKey)).first;
+        segment->getRefreshStatus(i->second.refreshStatusId).
+            setNeedsRefresh(true);
+    }
+
+    EventsKey &eventsKey = i->second;
+    SegmentRefreshStatus &status =
+        segment->getRefreshStatus(eventsKey.refreshStatusId);
+
+    // Moving the segment changes its events, if not relative to its
+    // start.  Moving the end marker of the composition can change
+    // where the segment's events end without changing them.
+    if (status.needsRefresh()  ||
+        eventsKey.startTime != segment->getStartTime()  ||
+        eventsKey.endMarkerTime != segment->getEndMarkerTime()) {
+        eventsKey.startTime = segment->getStartTime();
+        eventsKey.endMarkerTime = segment->getEndMarkerTime();
+        eventsKey.shareable =
+            InternalSegmentMapper::getEventsKey(segment, eventsKey.key);
+        status.setNeedsRefresh(false);
+    }
+
+    if (!eventsKey.shareable) return false;
+
+    key = InternalSegmentMapper::getContentKey(segment, eventsKey.key);
+    return true;
+}
+
+bool
+CompositionMapper::canFollow(Segment *segment, quint64 key,
+                             InternalSegmentMapper *source)
+{
+    Segment *sourceSegment = source->getSegment();
+    if (sourceSegment == segment) return false;
+
+    // The source's events are those of its segment only if that
+    // hasn't changed since they were mapped
+    quint64 sourceKey;
+    if (!getContentKey(sourceSegment, sourceKey)  ||  sourceKey != key)
+        return false;
+
+    return InternalSegmentMapper::haveSameContent(segment, sourceSegment);
 }
 
 void
@@ -106,6 +296,18 @@ CompositionMapper::segmentDeleted(Segment *segment)
     // "segment" is used here as an index into m_segmentMappers.  It is not
     // dereferenced.
     m_segmentMappers.erase(segment);
+    // "segment" is used here as an index into m_eventsKeys.  It is not
+    // dereferenced.
+    m_eventsKeys.erase(segment);
+
+    // Anything following it goes elsewhere.  This uses the segments of
+    // the followers, not this one.
+    InternalSegmentMapper *internal =
+        dynamic_cast<InternalSegmentMapper *>(mapper);
+    if (internal) {
+        handOver(internal);
+        forgetSource(internal);
+    }
 
     // Given that mapper has a pointer to the deleted segment, this line is
     // suspect.  However, I believe there is no operator<< for SegmentMapper.
@@ -127,15 +329,43 @@ CompositionMapper::mapSegment(Segment *segment)
 
     // If it already exists, don't add it but do refresh it.
     if (itMapper != m_segmentMappers.end()) {
-        itMapper->second->refresh();
+        refreshMapper(itMapper->second, segment, false, 0, 0);
         return;
     }
+
+    quint64 key = 0;
+    const bool shareable = (segment->getType() == Segment::Internal  &&
+                            getContentKey(segment, key));
+
+    // If another segment has the same events, there's no need to map
+    // them again
+    if (shareable) {
+        EventSources::iterator i = m_eventSources.find(key);
+        if (i != m_eventSources.end()  &&
+            canFollow(segment, key, i->second)) {
+            InternalSegmentMapper *mapper =
+                new InternalSegmentMapper(m_doc, segment);
+            mapper->followEvents(i->second, key);
+            m_segmentMappers[segment] = mapper;
+            mapper->addOwner();
+            return;
+        }
+    }
+
     SegmentMapper *mapper =
         SegmentMapper::makeMapperForSegment(m_doc, segment);
 
     if (mapper) {
         m_segmentMappers[segment] = mapper;
         mapper->addOwner();
+
+        InternalSegmentMapper *internal =
+            dynamic_cast<InternalSegmentMapper *>(mapper);
+        if (internal  &&  shareable) {
+            internal->setMappedContentKey(true, key);
+            if (m_eventSources.find(key) == m_eventSources.end())
+                m_eventSources[key] = internal;
+        }
     }
 }
 
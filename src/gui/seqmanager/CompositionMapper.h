@@ -18,12 +18,17 @@
 #ifndef RG_COMPOSITIONMAPPER_H
 #define RG_COMPOSITIONMAPPER_H
 
+#include "base/TimeT.h"
+
+#include <QtGlobal>
+
 #include <map>
 
 namespace Rosegarden
 {
 
 class SegmentMapper;
+class InternalSegmentMapper;
 class MappedEventBuffer;
 class Segment;
 class RosegardenDocument;
@@ -33,6 +38,14 @@ class RosegardenDocument;
  * Keeps a set of SegmentMapper objects in sync with the Segments in the
  * Composition.
  *
+ * Segments that would map to the same events apart from their start
+ * time, delay, transposition and track (linked segments, and any others
+ * that happen to be identical) share the events of one of their
+ * mappers, which is mapped once.  The others follow it (see
+ * InternalSegmentMapper::followEvents()).  When the segment of a mapper
+ * that others follow changes or goes away, its followers are handed
+ * over to another source first, so that shared events never change.
+ *
  * A single instance of this is owned by SequenceManager.  See
  * SequenceManager::m_compositionMapper.  SequenceManager is the
  * only user of this class.
@@ -47,6 +60,8 @@ public:
     MappedEventBuffer *getMappedEventBuffer(Segment *);
 
     bool segmentModified(Segment *);
+    /// Only the events between from and to have changed.
+    bool segmentModified(Segment *, timeT from, timeT to);
     void segmentAdded(Segment *);
     void segmentDeleted(Segment *);
 
@@ -68,6 +83,62 @@ private:
     /// Creates a SegmentMapper and adds it to the container.
     void mapSegment(Segment *);
 
+    /// Bring a mapper up to date with its segment.
+    /**
+     * If range is set, only the events between from and to have
+     * changed.  Returns true if the buffer size changed.
+     */
+    bool refreshMapper(SegmentMapper *mapper, Segment *segment,
+                       bool range, timeT from, timeT to);
+
+    /// Map a mapper's own events and, if shareable, offer them for sharing.
+    bool mapOwnEvents(InternalSegmentMapper *mapper,
+                      bool shareable, quint64 key,
+                      bool range, timeT from, timeT to);
+
+    /// Find other sources for everything following source.
+    void handOver(InternalSegmentMapper *source);
+
+    /// Stop offering a mapper's events for sharing.
+    void forgetSource(InternalSegmentMapper *mapper);
+
+    /// Work out a segment's content key.
+    /**
+     * Returns false if its events can't be shared.  Only goes over the
+     * events again if they've changed since the last time.
+     *
+     * See InternalSegmentMapper::getContentKey().
+     */
+    bool getContentKey(Segment *segment, quint64 &key);
+
+    /// Whether a segment whose content key is key can play source's events.
+    /**
+     * Keys are only hashes, so this compares the segments themselves.
+     */
+    bool canFollow(Segment *segment, quint64 key,
+                   InternalSegmentMapper *source);
+
+    /// Mappers whose events can be shared, by content key.
+    typedef std::map<quint64, InternalSegmentMapper *> EventSources;
+    EventSources m_eventSources;
+
+    /// The part of a segment's content key that comes from its events.
+    /**
+     * See InternalSegmentMapper::getEventsKey().  It stays good until
+     * the segment's refresh status for us says its events have changed,
+     * or its events are cut off at a different place.
+     */
+    struct EventsKey
+    {
+        unsigned int refreshStatusId;
+        timeT startTime;
+        timeT endMarkerTime;
+        bool shareable;
+        quint64 key;
+    };
+    typedef std::map<Segment *, EventsKey> EventsKeys;
+    EventsKeys m_eventsKeys;
+
     /// Passed to the SegmentMapper objects that are created.
     RosegardenDocument *m_doc;
 
@@ -48,24 +48,31 @@ InternalSegmentMapper::InternalSegmentMapper(RosegardenDocument *doc,
                                              Segment *segment)
     : SegmentMapper(doc, segment),
       m_channelManager(doc->getInstrument(segment)),
-      m_triggeredEvents(new Segment)
-{}
-
-InternalSegmentMapper::
-~InternalSegmentMapper(void)
+      m_triggeredEvents(new Segment),
+      m_canRefillRange(false),
+      m_lastMappedTime(0),
+      m_filledStartTime(0),
+      m_filledEndTime(0),
+      m_filledRepeatEndTime(0),
+      m_filledRepeatCount(0),
+      m_filledTranspose(0),
+      m_rangeEvents(0),
+      m_rangeMusicalTimes(0),
+      m_haveContentKey(false),
+      m_contentKey(0)
 {
-    if(m_triggeredEvents) { delete m_triggeredEvents; }
+    // Events are mapped in musical time and resolved against the
+    // TempoMapCache as they are played, so that tempo changes don't
+    // require a refill.
+    m_tempoIndependent = true;
 }
 
-RealTime
 InternalSegmentMapper::
-toRealTime(Composition &comp, timeT t)
+~InternalSegmentMapper(void)
 {
-    return 
-        comp.getElapsedRealTime(t) + m_segment->getRealTimeDelay();
+    if(m_triggeredEvents) { delete m_triggeredEvents; }
 }
 
-
 void InternalSegmentMapper::fillBuffer()
 {
     Composition &comp = m_doc->getComposition();
@@ -87,8 +94,14 @@ void InternalSegmentMapper::fillBuffer()
     if (repeatCount > 0)
         repeatEndTime = m_segment->getRepeatEndTime();
 
+    // We map our own events from here on, if we were following another
+    // mapper's.
+    unshareEvents();
+
     resize(0);
 
+    m_realTimeOffset = m_segment->getRealTimeDelay();
+
 #ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
     SEQMAN_DEBUG
         << "InternalSegmentMapper::fillBuffer"
@@ -105,6 +118,11 @@ void InternalSegmentMapper::fillBuffer()
     m_controllerCache.clear();
     m_noteOffs = NoteoffContainer();
 
+    // refillRange() relies on the buffer being in time order, which
+    // a delay would upset (see haveEarlierNoteoff()).
+    m_canRefillRange = (m_segment->getDelay() == 0);
+    m_lastMappedTime = std::numeric_limits<int>::min();
+
     for (int repeatNo = 0; repeatNo <= repeatCount; ++repeatNo) {
 
         // For triggered segments.  We write their notes into
@@ -211,70 +229,11 @@ void InternalSegmentMapper::fillBuffer()
             // Ignore rests
             //
             if (!(**k)->isa(Note::EventRestType)) {
-
-                SegmentPerformanceHelper helper
-                (usingImplied ? *m_triggeredEvents : *m_segment);
-
-                timeT playTime =
-                    helper.getSoundingAbsoluteTime(*k) + timeForRepeats;
-                if (playTime >= repeatEndTime) break;
-
-                timeT playDuration = helper.getSoundingDuration(*k);
-
-                // Ignore notes without duration -- they're probably in a tied
-                // series but not as first note
-                //
-                if (playDuration > 0 || !(**k)->isa(Note::EventType)) {
-
-                    if (playTime + playDuration > repeatEndTime)
-                        playDuration = repeatEndTime - playTime;
-
-                    playTime = playTime + m_segment->getDelay();
-                    const RealTime eventTime = toRealTime(comp, playTime);
-
-                    // slightly quicker than calling helper.getRealSoundingDuration()
-                    RealTime endTime =
-                        toRealTime(comp, playTime + playDuration);
-                    const RealTime duration = endTime - eventTime;
-
-                    try {
-                        // Create mapped event and put it in buffer.
-                        // The instrument will be set later by
-                        // ChannelManager, so we set it to zero here.
-                        MappedEvent e(0,
-                                      ***k,  // three stars! what an accolade
-                                      eventTime,
-                                      duration);
-
-                        // Somewhat hacky: The MappedEvent ctor makes
-                        // events that needn't be inserted invalid.
-                        if (e.isValid()) {
-                            e.setTrackId(track->getId());
-
-                            if ((**k)->isa(Controller::EventType) ||
-                                (**k)->isa(PitchBend::EventType)) {
-                                m_controllerCache.storeLatestValue((**k));
-                            }
-                            
-                            if ((**k)->isa(Note::EventType)) {
-                                if (m_segment->getTranspose() != 0) {
-                                    e.setPitch(e.getPitch() +
-                                               m_segment->getTranspose());
-                                }
-                                if (e.getType() != MappedEvent::MidiNoteOneShot) {
-                                    enqueueNoteoff(playTime + playDuration,
-                                                   e.getPitch());
-                                }
-                            }
-                            mapAnEvent(&e); 
-                        } else {}
-                        
-                    } catch (...) {
-#ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
-                        SEQMAN_DEBUG << "SegmentMapper::fillBuffer - caught exception while trying to create MappedEvent\n";
-#endif
-                    }
-                }
+                if (!mapSegmentEvent(usingImplied ?
+                                         *m_triggeredEvents : *m_segment,
+                                     *k, timeForRepeats, repeatEndTime,
+                                     track->getId()))
+                    break;
             }
 
             ++*k; // increment either i or j, whichever one we just used
@@ -286,27 +245,660 @@ void InternalSegmentMapper::fillBuffer()
         popInsertNoteoff(track->getId(), comp);
     }
 
-    bool anything = (size() != 0);
+    // Triggered events aren't in the segment's own time order, so a
+    // range of the segment doesn't map to a range of the buffer.
+    if (!m_triggeredEvents->empty())
+        m_canRefillRange = false;
 
-    RealTime minRealTime;
-    RealTime maxRealTime;
-    if (anything) {
-        minRealTime = getBuffer()[0].getEventTime();
-        maxRealTime = getBuffer()[size() - 1].getEventTime();
+    // Remember what the repeats looked like, for refillRange().
+    m_filledStartTime = segmentStartTime;
+    m_filledEndTime = segmentEndTime;
+    m_filledRepeatEndTime = repeatEndTime;
+    m_filledRepeatCount = repeatCount;
+    m_filledTranspose = m_segment->getTranspose();
+
+    m_mappedPlacement = getSegmentPlacement();
+    m_placement = m_mappedPlacement;
+
+    updateStartEnd();
+    allocateChannelInterval();
+}
+
+static const quint64 hashOffsetBasis = Q_UINT64_C(14695981039346656037);
+static const quint64 hashPrime = Q_UINT64_C(1099511628211);
+
+// FNV-1a
+static void
+hashValue(quint64 &hash, long value)
+{
+    unsigned long v = (unsigned long)value;
+    for (size_t i = 0; i < sizeof(v); ++i) {
+        hash ^= (v & 0xff);
+        hash *= hashPrime;
+        v >>= 8;
+    }
+}
+
+static void
+hashString(quint64 &hash, const std::string &s)
+{
+    hashValue(hash, long(s.size()));
+    for (size_t i = 0; i < s.size(); ++i) {
+        hash ^= (unsigned char)s[i];
+        hash *= hashPrime;
+    }
+}
+
+quint64
+InternalSegmentMapper::getContentKey(Segment *segment, quint64 eventsKey)
+{
+    const timeT startTime = segment->getStartTime();
+
+    quint64 hash = eventsKey;
+
+    // Enough to lay out the repeats as fillBuffer() does
+    hashValue(hash, segment->getEndMarkerTime() - startTime);
+    hashValue(hash, segment->isRepeating() ?
+                        segment->getRepeatEndTime() - startTime : -1);
+
+    return hash;
+}
+
+// The events fillBuffer() maps, one after another
+static bool
+nextMappedEvent(Segment *segment, Segment::iterator &i)
+{
+    while (segment->isBeforeEndMarker(i)  &&
+           (*i)->isa(Note::EventRestType))
+        ++i;
+    return segment->isBeforeEndMarker(i);
+}
+
+bool
+InternalSegmentMapper::getEventsKey(Segment *segment, quint64 &key)
+{
+    const timeT startTime = segment->getStartTime();
+
+    quint64 hash = hashOffsetBasis;
+
+    for (Segment::iterator i = segment->begin();
+         nextMappedEvent(segment, i); ++i) {
+
+        const Event *e = *i;
+
+        if (e->has(BaseProperties::TRIGGER_SEGMENT_ID))
+            return false;
+
+        hashValue(hash, e->getAbsoluteTime() - startTime);
+        hashValue(hash, e->getDuration());
+        hashValue(hash, e->getSubOrdering());
+        hashString(hash, e->getType());
+
+        const Event::PropertyNames names = e->getPersistentPropertyNames();
+        for (size_t j = 0; j < names.size(); ++j) {
+            const PropertyName &name = names[j];
+            hashValue(hash, name.getValue());
+            switch (e->getPropertyType(name)) {
+            case Int:
+                hashValue(hash, e->get<Int>(name));
+                break;
+            case Bool:
+                hashValue(hash, e->get<Bool>(name) ? 1 : 0);
+                break;
+            case String:
+                hashString(hash, e->get<String>(name));
+                break;
+            case RealTimeT: {
+                RealTime t = e->get<RealTimeT>(name);
+                hashValue(hash, t.sec);
+                hashValue(hash, t.nsec);
+                break;
+            }
+            }
+        }
+    }
+
+    key = hash;
+    return true;
+}
+
+bool
+InternalSegmentMapper::haveSameContent(Segment *a, Segment *b)
+{
+    const timeT startA = a->getStartTime();
+    const timeT startB = b->getStartTime();
+
+    if (a->getEndMarkerTime() - startA != b->getEndMarkerTime() - startB)
+        return false;
+    if (a->isRepeating() != b->isRepeating())
+        return false;
+    if (a->isRepeating()  &&
+        a->getRepeatEndTime() - startA != b->getRepeatEndTime() - startB)
+        return false;
+
+    Segment::iterator i = a->begin();
+    Segment::iterator j = b->begin();
+
+    for ( ; ; ++i, ++j) {
+
+        const bool moreA = nextMappedEvent(a, i);
+        const bool moreB = nextMappedEvent(b, j);
+        if (!moreA  ||  !moreB)
+            return moreA == moreB;
+
+        const Event *ea = *i;
+        const Event *eb = *j;
+
+        if (ea->getAbsoluteTime() - startA != eb->getAbsoluteTime() - startB  ||
+            ea->getDuration() != eb->getDuration()  ||
+            ea->getSubOrdering() != eb->getSubOrdering()  ||
+            ea->getType() != eb->getType())
+            return false;
+
+        const Event::PropertyNames names = ea->getPersistentPropertyNames();
+        if (names.size() != eb->getPersistentPropertyNames().size())
+            return false;
+
+        for (size_t k = 0; k < names.size(); ++k) {
+            const PropertyName &name = names[k];
+            if (!eb->has(name)  ||
+                ea->getPropertyType(name) != eb->getPropertyType(name))
+                return false;
+            bool same = true;
+            switch (ea->getPropertyType(name)) {
+            case Int:
+                same = (eb->isPersistent<Int>(name)  &&
+                        ea->get<Int>(name) == eb->get<Int>(name));
+                break;
+            case Bool:
+                same = (eb->isPersistent<Bool>(name)  &&
+                        ea->get<Bool>(name) == eb->get<Bool>(name));
+                break;
+            case String:
+                same = (eb->isPersistent<String>(name)  &&
+                        ea->get<String>(name) == eb->get<String>(name));
+                break;
+            case RealTimeT:
+                same = (eb->isPersistent<RealTimeT>(name)  &&
+                        ea->get<RealTimeT>(name) == eb->get<RealTimeT>(name));
+                break;
+            }
+            if (!same)
+                return false;
+        }
+    }
+}
+
+void
+InternalSegmentMapper::followEvents(InternalSegmentMapper *source,
+                                    quint64 key)
+{
+    shareEvents(source);
+
+    m_triggeredEvents->clear();
+    m_noteOffs = NoteoffContainer();
+    m_canRefillRange = false;
+    setMappedContentKey(true, key);
+
+    updatePlacement();
+}
+
+void
+InternalSegmentMapper::mapOwnEvents()
+{
+    unshareEvents();
+    refresh();
+}
+
+void
+InternalSegmentMapper::updatePlacement()
+{
+    m_placement = getSegmentPlacement();
+    m_realTimeOffset = m_segment->getRealTimeDelay();
+
+    // The cached controllers are at the segment's own times
+    cacheControllers();
+
+    updateStartEnd();
+    allocateChannelInterval();
+}
+
+MappedEventBuffer::Placement
+InternalSegmentMapper::getSegmentPlacement() const
+{
+    Placement placement;
+    placement.origin = m_segment->getStartTime() + m_segment->getDelay();
+    placement.transpose = m_segment->getTranspose();
+    placement.trackId = m_segment->getTrack();
+    return placement;
+}
+
+void
+InternalSegmentMapper::cacheControllers()
+{
+    m_controllerCache.clear();
+    for (Segment::iterator i = m_segment->begin();
+         m_segment->isBeforeEndMarker(i); ++i) {
+        if ((*i)->isa(Controller::EventType) ||
+            (*i)->isa(PitchBend::EventType)) {
+            m_controllerCache.storeLatestValue(*i);
+        }
+    }
+}
+
+void
+InternalSegmentMapper::updateStartEnd()
+{
+    timeT first;
+    timeT last;
 
+    if (getMusicalRange(first, last)) {
         // Fix for bug #1378.  Start slightly before the first note so
         // that program etc is sent then.  We'll allow it to be before
         // zeroTime, since MappedBufMetaIterator can handle early
         // start-times.
         static const RealTime preparationTime = RealTime::fromSeconds(0.5);
-        minRealTime = minRealTime - preparationTime;
+        setMusicalStartEnd(first, last, preparationTime);
+    } else {
+        RealTime zero = RealTime::zeroTime;
+        setStartEnd(zero, zero);
+    }
+}
+
+bool
+InternalSegmentMapper::
+mapSegmentEvent(Segment &segment, Segment::iterator i,
+                timeT timeForRepeats, timeT repeatEndTime, TrackId trackId)
+{
+    SegmentPerformanceHelper helper(segment);
+
+    timeT playTime =
+        helper.getSoundingAbsoluteTime(i) + timeForRepeats;
+    if (playTime >= repeatEndTime) return false;
+
+    timeT playDuration = helper.getSoundingDuration(i);
+
+    // Ignore notes without duration -- they're probably in a tied
+    // series but not as first note
+    //
+    if (playDuration > 0 || !(*i)->isa(Note::EventType)) {
+
+        if (playTime + playDuration > repeatEndTime)
+            playDuration = repeatEndTime - playTime;
+
+        playTime = playTime + m_segment->getDelay();
+        const RealTime eventTime = toRealTime(playTime);
+
+        // slightly quicker than calling helper.getRealSoundingDuration()
+        RealTime endTime = toRealTime(playTime + playDuration);
+        const RealTime duration = endTime - eventTime;
+
+        try {
+            // Create mapped event and put it in buffer.
+            // The instrument will be set later by
+            // ChannelManager, so we set it to zero here.
+            MappedEvent e(0,
+                          **i,
+                          eventTime,
+                          duration);
+
+            // Somewhat hacky: The MappedEvent ctor makes
+            // events that needn't be inserted invalid.
+            if (e.isValid()) {
+                e.setTrackId(trackId);
+
+                if ((*i)->isa(Controller::EventType) ||
+                    (*i)->isa(PitchBend::EventType)) {
+                    m_controllerCache.storeLatestValue(*i);
+                }
+
+                if ((*i)->isa(Note::EventType)) {
+                    if (m_segment->getTranspose() != 0) {
+                        e.setPitch(e.getPitch() +
+                                   m_segment->getTranspose());
+                    }
+                    if (e.getType() != MappedEvent::MidiNoteOneShot) {
+                        enqueueNoteoff(playTime + playDuration,
+                                       e.getPitch());
+                    }
+                }
+                addMappedEvent(&e, playTime, playTime + playDuration);
+            } else {}
+
+        } catch (...) {
+#ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
+            SEQMAN_DEBUG << "SegmentMapper::fillBuffer - caught exception while trying to create MappedEvent\n";
+#endif
+        }
+    }
+
+    return true;
+}
+
+void
+InternalSegmentMapper::
+addMappedEvent(MappedEvent *e, timeT time, timeT endTime)
+{
+    // A grace note, say, can put the buffer out of order.
+    if (time < m_lastMappedTime)
+        m_canRefillRange = false;
+    m_lastMappedTime = time;
+
+    if (m_rangeEvents) {
+        MusicalTime musicalTime;
+        musicalTime.time = time;
+        musicalTime.endTime = endTime;
+        m_rangeEvents->push_back(*e);
+        m_rangeMusicalTimes->push_back(musicalTime);
     } else {
-        minRealTime = maxRealTime = RealTime::zeroTime;
+        mapAnEvent(e, time, endTime);
+    }
+}
+
+bool
+InternalSegmentMapper::refillRange(timeT from, timeT to)
+{
+    if (!m_canRefillRange) return false;
+
+    Composition &comp = m_doc->getComposition();
+    Track* track = comp.getTrackById(m_segment->getTrack());
+    if (!track) return false;
+
+    timeT segmentStartTime = m_segment->getStartTime();
+    timeT segmentEndTime = m_segment->getEndMarkerTime();
+    timeT segmentDuration = segmentEndTime - segmentStartTime;
+    timeT repeatEndTime = segmentEndTime;
+
+    int repeatCount = getSegmentRepeatCount();
+
+    if (repeatCount > 0)
+        repeatEndTime = m_segment->getRepeatEndTime();
+
+    // If the repeats have moved, every event has.
+    if (segmentStartTime != m_filledStartTime  ||
+        segmentEndTime != m_filledEndTime  ||
+        repeatEndTime != m_filledRepeatEndTime  ||
+        repeatCount != m_filledRepeatCount  ||
+        m_segment->getDelay() != 0  ||
+        m_segment->getTranspose() != m_filledTranspose  ||
+        m_segment->getRealTimeDelay() != m_realTimeOffset)
+        return false;
+
+    // Zero-duration events (e.g. controllers) report an empty range.
+    if (to <= from) to = from + 1;
+
+    from = std::max(from, segmentStartTime);
+    to = std::min(to, segmentEndTime);
+
+    // Nothing that gets played has changed.
+    if (from >= to) return true;
+
+    if (!findQuietRange(from, to, segmentEndTime, repeatCount > 0))
+        return false;
+
+#ifdef DEBUG_INTERNAL_SEGMENT_MAPPER
+    SEQMAN_DEBUG << "InternalSegmentMapper::refillRange" << (void *)this
+                 << "from" << from << "to" << to;
+#endif
+
+    std::vector<MappedEvent> events;
+    std::vector<MusicalTime> musicalTimes;
+    m_rangeEvents = &events;
+    m_rangeMusicalTimes = &musicalTimes;
+
+    bool controllersChanged = false;
+
+    // Work backwards thru the repeats so that the buffer indices of
+    // the earlier ones aren't moved by replaceEvents().
+    for (int repeatNo = repeatCount; repeatNo >= 0; --repeatNo) {
+
+        timeT timeForRepeats = repeatNo * segmentDuration;
+
+        // Nothing in this repeat is played from here on.
+        if (from + timeForRepeats >= repeatEndTime) continue;
+
+        events.clear();
+        musicalTimes.clear();
+        m_noteOffs = NoteoffContainer();
+        m_lastMappedTime = from + timeForRepeats;
+
+        // Same as the loop in fillBuffer(), without triggered events.
+        Segment::iterator i = m_segment->findTime(from);
+        while (m_segment->isBeforeEndMarker(i)  &&
+               (*i)->getAbsoluteTime() < to) {
+
+            if (haveEarlierNoteoff((*i)->getAbsoluteTime() +
+                                   timeForRepeats)) {
+                popInsertNoteoff(track->getId(), comp);
+                continue;
+            }
+
+            if (!(*i)->isa(Note::EventRestType)) {
+                if (!mapSegmentEvent(*m_segment, i, timeForRepeats,
+                                     repeatEndTime, track->getId()))
+                    break;
+            }
+
+            ++i;
+        }
+
+        while (!m_noteOffs.empty()) {
+            popInsertNoteoff(track->getId(), comp);
+        }
+
+        if (!m_canRefillRange) {
+            // Out of order.  fillBuffer() will sort it out.
+            m_rangeEvents = 0;
+            m_rangeMusicalTimes = 0;
+            return false;
+        }
+
+        int first;
+        int last;
+        findBufferRange(from + timeForRepeats, to + timeForRepeats,
+                        first, last);
+
+        for (int j = first; j < last; ++j) {
+            if (isControllerEvent(m_buffer[j]))
+                controllersChanged = true;
+        }
+        for (size_t j = 0; j < events.size(); ++j) {
+            if (isControllerEvent(events[j]))
+                controllersChanged = true;
+        }
+
+        replaceEvents(first, last, events, musicalTimes);
+    }
+
+    m_rangeEvents = 0;
+    m_rangeMusicalTimes = 0;
+
+    // The controller cache holds the segment's last value of each
+    // controller, which may have been in the range.
+    if (controllersChanged)
+        cacheControllers();
+
+    updateStartEnd();
+    allocateChannelInterval();
+
+    return true;
+}
+
+bool
+InternalSegmentMapper::
+findQuietRange(timeT &from, timeT &to, timeT segmentEndTime, bool repeating)
+{
+    // Widen [from, to) until no note sounds across either end, either
+    // in the buffer as it stands (which has any notes that have just
+    // been erased) or in the segment as it is now (which has any that
+    // have just been added).  Then the noteoffs in the buffer match
+    // the notes, and nothing outside the range needs to change.
+    //
+    // Only the first time thru the buffer is needed, and its notes are
+    // in order of start time, so this is a matter of merging
+    // overlapping intervals.
+
+    const int count = size();
+    int i = 0;
+
+    // A note in one repeat that sounds into the next one would overlap
+    // the range there.
+    if (repeating) {
+        for (i = 0; i < count; ++i) {
+            const MusicalTime &musicalTime = m_musicalTimes[i];
+            if (musicalTime.time >= segmentEndTime) break;
+            if (isNoteOn(i)  &&  musicalTime.endTime > segmentEndTime)
+                return false;
+        }
+    }
+
+    // Notes that start before the range.  Follow the group of
+    // overlapping notes that the last of them belongs to: only that
+    // one can reach into the range.
+    timeT groupStart = from;
+    timeT groupEnd = std::numeric_limits<timeT>::min();
+    for (i = 0; i < count; ++i) {
+        const MusicalTime &musicalTime = m_musicalTimes[i];
+        if (musicalTime.time >= from) break;
+        if (!isNoteOn(i)) continue;
+        if (musicalTime.time >= groupEnd) {
+            groupStart = musicalTime.time;
+            groupEnd = musicalTime.endTime;
+        } else {
+            groupEnd = std::max(groupEnd, musicalTime.endTime);
+        }
+    }
+
+    // Notes in the segment before the old start of the range haven't
+    // changed, so the buffer has already told us about them.
+    Segment::iterator j = m_segment->findTime(from);
+
+    if (groupEnd > from) {
+        from = groupStart;
+        to = std::max(to, groupEnd);
+    }
+
+    // Notes that start in the range extend it.
+    bool extended = true;
+    while (extended) {
+        extended = false;
+
+        for ( ; i < count; ++i) {
+            const MusicalTime &musicalTime = m_musicalTimes[i];
+            if (musicalTime.time >= to  ||
+                musicalTime.time >= segmentEndTime)
+                break;
+            if (isNoteOn(i)  &&  musicalTime.endTime > to) {
+                to = musicalTime.endTime;
+                extended = true;
+            }
+        }
+
+        for ( ; m_segment->isBeforeEndMarker(j)  &&
+                (*j)->getAbsoluteTime() < to;
+              ++j) {
+            // These are mapped at other times than their own (see
+            // SegmentPerformanceHelper) or not at all.
+            if ((*j)->has(BaseProperties::TRIGGER_SEGMENT_ID)  ||
+                (*j)->has(BaseProperties::TIED_BACKWARD)  ||
+                (*j)->has(BaseProperties::TIED_FORWARD)  ||
+                (*j)->has(BaseProperties::IS_GRACE_NOTE)  ||
+                (*j)->has(BaseProperties::MAY_HAVE_GRACE_NOTES))
+                return false;
+
+            if ((*j)->isa(Note::EventType)) {
+                timeT endTime =
+                    (*j)->getAbsoluteTime() + (*j)->getDuration();
+                if (endTime > to) {
+                    to = endTime;
+                    extended = true;
+                }
+            }
+        }
+    }
+
+    return (from >= m_segment->getStartTime()  &&  to <= segmentEndTime);
+}
+
+void
+InternalSegmentMapper::
+findBufferRange(timeT from, timeT to, int &first, int &last)
+{
+    // The noteoffs at from are for notes before the range, and those
+    // at to are for notes in it.  Noteoffs come before anything else
+    // at the same time.
+
+    const int count = size();
+
+    first = lowerBound(from);
+    while (first < count  &&
+           m_musicalTimes[first].time == from  &&  isNoteOff(first))
+        ++first;
+
+    last = lowerBound(to);
+    while (last < count  &&
+           m_musicalTimes[last].time == to  &&  isNoteOff(last))
+        ++last;
+}
+
+int
+InternalSegmentMapper::lowerBound(timeT t) const
+{
+    int lo = 0;
+    int hi = size();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (m_musicalTimes[mid].time < t) lo = mid + 1;
+        else hi = mid;
     }
+    return lo;
+}
+
+bool
+InternalSegmentMapper::isNoteOn(int i) const
+{
+    // Notes always have a duration, noteoffs never do.
+    return m_buffer[i].getType() == MappedEvent::MidiNote  &&
+        m_musicalTimes[i].endTime > m_musicalTimes[i].time;
+}
+
+bool
+InternalSegmentMapper::isNoteOff(int i) const
+{
+    return m_buffer[i].getType() == MappedEvent::MidiNote  &&
+        m_musicalTimes[i].endTime == m_musicalTimes[i].time;
+}
+
+bool
+InternalSegmentMapper::isControllerEvent(const MappedEvent &e)
+{
+    return e.getType() == MappedEvent::MidiController  ||
+        e.getType() == MappedEvent::MidiPitchBend;
+}
+
+void
+InternalSegmentMapper::tempoChanged()
+{
+    // The buffer is in musical time, so only the channel interval,
+    // which is in performance time, needs to follow the tempo.
+    allocateChannelInterval();
+}
+
+void
+InternalSegmentMapper::allocateChannelInterval()
+{
+    Composition &comp = m_doc->getComposition();
+    Track* track = comp.getTrackById(m_segment->getTrack());
+
+    RealTime minRealTime;
+    RealTime maxRealTime;
+    getStartEnd(minRealTime, maxRealTime);
 
     m_channelManager.setRequiredInterval(minRealTime, maxRealTime,
                                          RealTime::zeroTime, RealTime(1,0));
 
+    if (!track) return;
+
     // If the track is making sound
     if (!ControlBlock::getInstance()->isTrackMuted(track->getId())  &&
         !ControlBlock::getInstance()->isTrackArchived(track->getId())) {
@@ -326,7 +918,6 @@ void InternalSegmentMapper::fillBuffer()
     // length is the same, the current controllers for a given time
     // may have changed.
     m_channelManager.setDirty();
-    setStartEnd(minRealTime, maxRealTime);
 }
 
     /** Functions about the noteoff queue **/
@@ -362,7 +953,7 @@ enqueueNoteoff(timeT time, int pitch)
 
 void
 InternalSegmentMapper::
-popInsertNoteoff(int trackid, Composition &comp)
+popInsertNoteoff(int trackid, Composition & /*comp*/)
 {
     // Look at top element
     timeT internalTime = m_noteOffs.begin()->first;
@@ -372,9 +963,9 @@ popInsertNoteoff(int trackid, Composition &comp)
     // Our noteoffs already have performance pitch, so
     // don't add segment's transpose.
     MappedEvent event(0, MappedEvent::MidiNote, pitch, 0);
-    event.setEventTime(toRealTime(comp, internalTime));
+    event.setEventTime(toRealTime(internalTime));
     event.setTrackId(trackid);
-    mapAnEvent(&event);
+    addMappedEvent(&event, internalTime, internalTime);
 
     // pop
     m_noteOffs.erase(m_noteOffs.begin());
@@ -19,11 +19,15 @@
 #define RG_INTERNALSEGMENTMAPPER_H
 
 #include "base/ControllerContext.h"
+#include "base/Segment.h"
 #include "gui/seqmanager/MappedEventBuffer.h"
 #include "gui/seqmanager/SegmentMapper.h"
 #include "gui/seqmanager/ChannelManager.h"
 
+#include <QtGlobal>
+
 #include <set>
+#include <vector>
 
 namespace Rosegarden
 {
@@ -54,12 +58,76 @@ class RealTime;
  * This is the first part of a two-part process to convert the Event objects
  * in a Composition into MappedEvent objects that can be sent to ALSA.  For
  * the second part of this conversion, see MappedBufMetaIterator.
+ *
+ * Segments whose events would map the same apart from where they are,
+ * such as linked segments, can share one mapper's events: see
+ * getContentKey() and followEvents().  CompositionMapper arranges that.
  */
 class InternalSegmentMapper : public SegmentMapper
 {
 public:
     InternalSegmentMapper(RosegardenDocument *doc, Segment *segment);
 
+    /// Identify what the segment's events would map to.
+    /**
+     * Segments with the same key should map to the same events, apart
+     * from their start time, delay, transposition and track, which can
+     * be applied as the events are read (see
+     * MappedEventBuffer::Placement).  The key is a hash of the events,
+     * relative to the segment's start, and of the repeats.  Being a
+     * hash, it can only rule sharing out: check haveSameContent()
+     * before sharing.
+     *
+     * Going over the events is the expensive part, so it's done
+     * separately, by getEventsKey(), for the caller to keep for as
+     * long as the events don't change.
+     */
+    static quint64 getContentKey(Segment *segment, quint64 eventsKey);
+
+    /// The part of the content key that comes from the events.
+    /**
+     * Returns false if the segment's events can't be shared, e.g. if
+     * it has triggered segments, whose expansion depends on more than
+     * the segment.
+     */
+    static bool getEventsKey(Segment *segment, quint64 &key);
+
+    /// Whether two segments would map to the same events.
+    /**
+     * Compares what getContentKey() hashes.
+     */
+    static bool haveSameContent(Segment *a, Segment *b);
+
+    /// The segment we map.
+    Segment *getSegment() const  { return m_segment; }
+
+    /// Play source's events, placed for our own segment.
+    /**
+     * key is the content key of both segments.
+     */
+    void followEvents(InternalSegmentMapper *source, quint64 key);
+
+    /// Stop following another mapper and map our own segment.
+    void mapOwnEvents();
+
+    /// The segment has moved, been transposed etc. but its events haven't
+    /// changed.
+    /**
+     * Places the events we play for where the segment now is, without
+     * mapping them again.
+     */
+    void updatePlacement();
+
+    /// The content key of the events we play, if known.
+    bool getMappedContentKey(quint64 &key) const {
+        key = m_contentKey;
+        return m_haveContentKey;
+    }
+    void setMappedContentKey(bool haveKey, quint64 key) {
+        m_haveContentKey = haveKey;
+        m_contentKey = key;
+    }
+
 private:
     friend class ControllerSearch;
     friend class ControllerContextMap;
@@ -115,6 +183,52 @@ private:
     /// dump all segment data in the file
     virtual void fillBuffer();
 
+    /// Re-map the events in [from, to) and its repeats.
+    /**
+     * The range is widened until no note sounds across its ends.  Gives
+     * up (so that the caller falls back to fillBuffer()) if that
+     * doesn't work out or if the segment has anything that isn't mapped
+     * in time order, e.g. ties, grace notes or triggered segments.
+     */
+    virtual bool refillRange(timeT from, timeT to);
+
+    virtual void tempoChanged();
+
+    /// Set the start and end times from the first and last events.
+    void updateStartEnd();
+
+    /// Where the segment's events go, as things stand.
+    Placement getSegmentPlacement() const;
+
+    /// Refill m_controllerCache from the segment.
+    void cacheControllers();
+
+    /// Get a channel interval covering the current start and end times.
+    void allocateChannelInterval();
+
+    /// Map the event at i, queueing a noteoff for it if needed.
+    /**
+     * Returns false if the event starts at or after repeatEndTime.
+     */
+    bool mapSegmentEvent(Segment &segment, Segment::iterator i,
+                         timeT timeForRepeats, timeT repeatEndTime,
+                         TrackId trackId);
+
+    /// Add an event to the buffer, or to m_rangeEvents in refillRange().
+    void addMappedEvent(MappedEvent *e, timeT time, timeT endTime);
+
+    /// Widen a range for refillRange().  Returns false if it can't be done.
+    bool findQuietRange(timeT &from, timeT &to, timeT segmentEndTime,
+                        bool repeating);
+    /// Find the buffer indices of the events mapped from [from, to).
+    void findBufferRange(timeT from, timeT to, int &first, int &last);
+    /// Index of the first event in the buffer at or after t.
+    int lowerBound(timeT t) const;
+
+    bool isNoteOn(int i) const;
+    bool isNoteOff(int i) const;
+    static bool isControllerEvent(const MappedEvent &e);
+
     Instrument *getInstrument(void) const
     { return m_channelManager.getInstrument(); }
 
@@ -122,7 +236,6 @@ private:
     void enqueueNoteoff(timeT time, int pitch);
 
     bool haveEarlierNoteoff(timeT t);
-    RealTime toRealTime(Composition &comp, timeT t);
     int getControllerValue(timeT searchTime,
                            const std::string eventType,
                            int controllerId);
@@ -140,6 +253,26 @@ private:
 
     // Queue of noteoffs.
     NoteoffContainer       m_noteOffs;
+
+    // Whether the buffer is in time order and refillRange() may be
+    // used on it.
+    bool                   m_canRefillRange;
+    timeT                  m_lastMappedTime;
+
+    // How the repeats were laid out at the last fillBuffer().
+    timeT                  m_filledStartTime;
+    timeT                  m_filledEndTime;
+    timeT                  m_filledRepeatEndTime;
+    int                    m_filledRepeatCount;
+    int                    m_filledTranspose;
+
+    // Where addMappedEvent() puts events during refillRange().
+    std::vector<MappedEvent> *m_rangeEvents;
+    std::vector<MusicalTime> *m_rangeMusicalTimes;
+
+    // See getMappedContentKey().
+    bool                   m_haveContentKey;
+    quint64                m_contentKey;
 };
   
 }
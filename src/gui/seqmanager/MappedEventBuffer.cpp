@@ -17,11 +17,15 @@
 
 #include "MappedEventBuffer.h"
 
+#include "TempoMapCache.h"
+
 #include "document/RosegardenDocument.h"
 #include "misc/Debug.h"
 #include "sound/MappedEvent.h"
 #include "sound/MappedInserterBase.h"
 
+#include <algorithm>
+
 // #define DEBUG_MAPPED_EVENT_BUFFER 1
 
 namespace Rosegarden
@@ -29,12 +33,23 @@ namespace Rosegarden
 
 MappedEventBuffer::MappedEventBuffer(RosegardenDocument *doc) :
     m_buffer(0),
+    m_musicalTimes(0),
     m_capacity(0),
     m_size(0),
     m_doc(doc),
     m_start(RealTime::zeroTime),
     m_end(RealTime::beforeMaxTime),
-    m_refCount(0)
+    m_tempoIndependent(false),
+    m_realTimeOffset(RealTime::zeroTime),
+    m_haveMusicalStartEnd(false),
+    m_musicalStart(0),
+    m_musicalEnd(0),
+    m_startPreroll(RealTime::zeroTime),
+    m_refCount(0),
+    //m_placement
+    //m_mappedPlacement
+    m_source(0),
+    m_sharedCount(0)
 {
 }
 
@@ -42,6 +57,12 @@ MappedEventBuffer::~MappedEventBuffer()
 {
     // Safe even if NULL.
     delete[] m_buffer;
+    delete[] m_musicalTimes;
+
+    if (m_source) {
+        --m_source->m_sharedCount;
+        m_source->removeOwner();
+    }
 }
 
 void
@@ -90,6 +111,18 @@ MappedEventBuffer::refresh()
     return resized;
 }
 
+bool
+MappedEventBuffer::refresh(timeT from, timeT to)
+{
+    int oldSize = capacity();
+
+    // Ask the deriver to re-map just the modified part, if it can
+    if (refillRange(from, to))
+        return (capacity() != oldSize);
+
+    return refresh();
+}
+
 int
 MappedEventBuffer::capacity() const
 {
@@ -109,16 +142,20 @@ MappedEventBuffer::reserve(int newSize)
 
     MappedEvent *oldBuffer = m_buffer;
     MappedEvent *newBuffer = new MappedEvent[newSize];
+    MusicalTime *oldMusicalTimes = m_musicalTimes;
+    MusicalTime *newMusicalTimes = new MusicalTime[newSize];
 
     if (oldBuffer) {
         for (int i = 0; i < m_size.fetchAndAddRelaxed(0); ++i) {
             newBuffer[i] = m_buffer[i];
+            newMusicalTimes[i] = m_musicalTimes[i];
         }
     }
 
     {
         QWriteLocker locker(&m_lock);
         m_buffer = newBuffer;
+        m_musicalTimes = newMusicalTimes;
         m_capacity.fetchAndStoreRelease(newSize);
     }
 
@@ -127,6 +164,7 @@ MappedEventBuffer::reserve(int newSize)
 #endif
 
     delete[] oldBuffer;
+    delete[] oldMusicalTimes;
 }
 
 void
@@ -154,6 +192,138 @@ mapAnEvent(MappedEvent *e)
     resize(size() + 1);
 }
 
+void
+MappedEventBuffer::
+mapAnEvent(MappedEvent *e, timeT time, timeT endTime)
+{
+    // Store the musical times first: once the event is counted by
+    // mapAnEvent() the sequencer thread may read it.
+    if (size() >= capacity()) {
+        int newSize = 1 + float(capacity()) * 1.5;
+        reserve(newSize);
+    }
+
+    MusicalTime &musicalTime = m_musicalTimes[size()];
+    musicalTime.time = time;
+    musicalTime.endTime = endTime;
+
+    mapAnEvent(e);
+}
+
+void
+MappedEventBuffer::
+replaceEvents(int first, int last,
+              const std::vector<MappedEvent> &events,
+              const std::vector<MusicalTime> &musicalTimes)
+{
+    const int oldFill = size();
+    const int count = int(events.size());
+    const int newFill = oldFill - (last - first) + count;
+
+    if (newFill > capacity())
+        reserve(newFill);
+
+    QWriteLocker locker(&m_lock);
+
+    // Move the events after the range to their new place.
+    if (count < last - first) {
+        std::copy(m_buffer + last, m_buffer + oldFill,
+                  m_buffer + first + count);
+        std::copy(m_musicalTimes + last, m_musicalTimes + oldFill,
+                  m_musicalTimes + first + count);
+    } else if (count > last - first) {
+        std::copy_backward(m_buffer + last, m_buffer + oldFill,
+                           m_buffer + newFill);
+        std::copy_backward(m_musicalTimes + last, m_musicalTimes + oldFill,
+                           m_musicalTimes + newFill);
+    }
+
+    std::copy(events.begin(), events.end(), m_buffer + first);
+    std::copy(musicalTimes.begin(), musicalTimes.end(),
+              m_musicalTimes + first);
+
+    resize(newFill);
+}
+
+void
+MappedEventBuffer::shareEvents(MappedEventBuffer *source)
+{
+    if (source == m_source)  return;
+
+    source->addOwner();
+    ++source->m_sharedCount;
+
+    MappedEventBuffer *oldSource = m_source;
+    MappedEvent *oldBuffer = m_buffer;
+    MusicalTime *oldMusicalTimes = m_musicalTimes;
+
+    {
+        // The sequencer thread reads thru m_source under our lock
+        QWriteLocker locker(&m_lock);
+        m_source = source;
+        m_buffer = 0;
+        m_musicalTimes = 0;
+        m_capacity.fetchAndStoreRelease(0);
+        m_size.fetchAndStoreRelease(0);
+    }
+
+    delete[] oldBuffer;
+    delete[] oldMusicalTimes;
+
+    if (oldSource) {
+        --oldSource->m_sharedCount;
+        oldSource->removeOwner();
+    }
+}
+
+void
+MappedEventBuffer::unshareEvents()
+{
+    if (!m_source)  return;
+
+    MappedEventBuffer *oldSource = m_source;
+
+    {
+        QWriteLocker locker(&m_lock);
+        m_source = 0;
+    }
+
+    --oldSource->m_sharedCount;
+    oldSource->removeOwner();
+}
+
+bool
+MappedEventBuffer::getMusicalRange(timeT &first, timeT &last) const
+{
+    const MappedEventBuffer *events = getEvents();
+    const int count = events->size();
+    if (count == 0)  return false;
+
+    const timeT offset = m_placement.origin - events->m_mappedPlacement.origin;
+    first = events->m_musicalTimes[0].time + offset;
+    last = events->m_musicalTimes[count - 1].time + offset;
+    return true;
+}
+
+RealTime
+MappedEventBuffer::toRealTime(timeT t) const
+{
+    return TempoMapCache::getInstance()->getElapsedRealTime(t) +
+        m_realTimeOffset;
+}
+
+void
+MappedEventBuffer::getStartEnd(RealTime &start, RealTime &end) const
+{
+    if (m_haveMusicalStartEnd) {
+        start = toRealTime(m_musicalStart) - m_startPreroll;
+        end   = toRealTime(m_musicalEnd);
+    } else {
+        start = m_start;
+        end   = m_end;
+    }
+}
+
 void
 MappedEventBuffer::
 doInsert(MappedInserterBase &inserter, MappedEvent &evt,
@@ -206,6 +376,7 @@ MappedEventBuffer::iterator::iterator(MappedEventBuffer *s) :
     m_ready(false),
     m_active(false)
     //m_currentTime
+    //m_resolvedEvent
 {
     s->addOwner();
 }
@@ -216,7 +387,8 @@ MappedEventBuffer::iterator::iterator(const iterator &i) :
     m_index(i.m_index),
     m_ready(i.m_ready),
     m_active(i.m_active),
-    m_currentTime(i.m_currentTime)
+    m_currentTime(i.m_currentTime),
+    m_resolvedEvent(i.m_resolvedEvent)
 {
     // Add a reference count for this
     m_s->addOwner();
@@ -243,6 +415,7 @@ MappedEventBuffer::iterator::operator=(const iterator& rhs)
     m_ready = rhs.m_ready;
     m_active = rhs.m_active;
     m_currentTime = rhs.m_currentTime;
+    m_resolvedEvent = rhs.m_resolvedEvent;
 
     // Adjust reference count
     m_s->addOwner();
@@ -254,7 +427,7 @@ MappedEventBuffer::iterator::operator=(const iterator& rhs)
 MappedEventBuffer::iterator &
 MappedEventBuffer::iterator::operator++()
 {
-    int fill = m_s->size();
+    int fill = m_s->getEvents()->size();
     if (m_index < fill)  ++m_index;
     return *this;
 }
@@ -265,7 +438,7 @@ MappedEventBuffer::iterator::operator++(int)
 {
     // This line is the main reason we need a copy ctor.
     iterator r = *this;
-    int fill = m_s->size();
+    int fill = m_s->getEvents()->size();
     if (m_index < fill)  ++m_index;
     return r;
 }
@@ -273,7 +446,7 @@ MappedEventBuffer::iterator::operator++(int)
 MappedEventBuffer::iterator &
 MappedEventBuffer::iterator::operator+=(int offset)
 {
-    int fill = m_s->size();
+    int fill = m_s->getEvents()->size();
     if (m_index + offset <= fill) {
         m_index += offset;
     } else {
@@ -306,7 +479,7 @@ void MappedEventBuffer::iterator::reset()
 MappedEvent
 MappedEventBuffer::iterator::operator*()
 {
-    const MappedEvent *e = peek();
+    const MappedEvent *e = peekResolved();
 
     if (e)
         return *e;
@@ -319,18 +492,54 @@ MappedEventBuffer::iterator::peek() const
 {
     // The lock formerly here has moved out to callers.
 
+    const MappedEventBuffer *events = m_s->getEvents();
+
     // If we're at the end, return NULL
-    if (m_index >= m_s->size())
+    if (m_index >= events->size())
         return 0;
 
     // Otherwise return a pointer into the buffer.
-    return &m_s->m_buffer[m_index];
+    return &events->m_buffer[m_index];
+}
+
+MappedEvent *
+MappedEventBuffer::iterator::peekResolved()
+{
+    MappedEvent *event = peek();
+
+    if (!event  ||  !m_s->m_tempoIndependent)
+        return event;
+
+    const MappedEventBuffer *events = m_s->getEvents();
+    const MusicalTime &musicalTime = events->m_musicalTimes[m_index];
+    const Placement &mapped = events->m_mappedPlacement;
+    const Placement &placement = m_s->m_placement;
+
+    m_resolvedEvent = *event;
+
+    const timeT offset = placement.origin - mapped.origin;
+    const RealTime time = m_s->toRealTime(musicalTime.time + offset);
+    m_resolvedEvent.setEventTime(time);
+    m_resolvedEvent.setDuration(
+            m_s->toRealTime(musicalTime.endTime + offset) - time);
+
+    if (placement.transpose != mapped.transpose  &&
+        (event->getType() == MappedEvent::MidiNote  ||
+         event->getType() == MappedEvent::MidiNoteOneShot)) {
+        m_resolvedEvent.setPitch(event->getPitch() +
+                                 placement.transpose - mapped.transpose);
+    }
+
+    if (placement.trackId != mapped.trackId)
+        m_resolvedEvent.setTrackId(placement.trackId);
+
+    return &m_resolvedEvent;
 }
 
 bool
 MappedEventBuffer::iterator::atEnd() const
 {
-    int size = m_s->size();
+    int size = m_s->getEvents()->size();
     return (m_index >= size);
 }
 
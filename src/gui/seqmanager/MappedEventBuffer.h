@@ -19,15 +19,18 @@
 #define RG_MAPPEDEVENTBUFFER_H
 
 #include "base/RealTime.h"
+#include "base/TimeT.h"
 #include "base/Track.h"
+#include "sound/MappedEvent.h"
 
 #include <QReadWriteLock>
 #include <QAtomicInt>
 
+#include <vector>
+
 namespace Rosegarden
 {
 
-class MappedEvent;
 class MappedInserterBase;
 class RosegardenDocument;
 
@@ -59,6 +62,19 @@ class RosegardenDocument;
  * the user jumps around in time, it shouldn't change.  For the
  * current state of performance, see MappedEventBuffer::iterator.
  *
+ * A deriver may instead keep its events in musical time (see
+ * mapAnEvent(MappedEvent *, timeT, timeT)).  The RealTime of each event
+ * is then only worked out as the sequencer reads it, through the
+ * TempoMapCache, so a tempo change doesn't require the buffer to be
+ * refilled.  See isTempoIndependent() and iterator::peekResolved().
+ *
+ * A tempo-independent buffer may also play another buffer's events
+ * instead of keeping its own (see shareEvents()), so that segments
+ * with the same contents, such as linked segments, are mapped only
+ * once.  Each buffer has a Placement saying where its events go, and
+ * the events it plays are moved from where they were mapped to there
+ * as they are read.
+ *
  * A MappedEventBuffer-derived object is jointly owned by one or more
  * metaiterators (MappedBufMetaIterator?) and by ChannelManager and deletes
  * itself when the last owner is removed.  See addOwner() and removeOwner().
@@ -128,6 +144,17 @@ public:
      */
     bool refresh();
 
+    /// Refresh the events in part of the segment
+    /**
+     * Called after the segment has been modified between from and to
+     * only, as reported by its SegmentRefreshStatus.  Derivers that can
+     * re-map just that span (and its repeats) do so in refillRange().
+     * Otherwise this is the same as refresh().
+     *
+     * Returns true if buffer size changed.
+     */
+    bool refresh(timeT from, timeT to);
+
     /* Virtual functions */
 
     /**
@@ -159,6 +186,25 @@ public:
      */
     virtual void fillBuffer() = 0;
 
+    /// Re-map only the events the segment has in [from, to).
+    /**
+     * Returns false if the deriver can't do that for the buffer as it
+     * stands, in which case refresh(timeT, timeT) calls fillBuffer()
+     * instead.
+     */
+    virtual bool refillRange(timeT /* from */, timeT /* to */)
+        { return false; }
+
+    /// The tempo map has changed.
+    /**
+     * Only called for tempo-independent buffers, instead of a refill.
+     * Derivers override this to update anything that they keep in
+     * performance time.  The TempoMapCache has already been updated.
+     *
+     * @see isTempoIndependent()
+     */
+    virtual void tempoChanged()  { }
+
     /// Insert a MappedEvent with appropriate setup for channel.
     /**
      * InternalSegmentMapper and MetronomeMapper override this to bring
@@ -231,10 +277,44 @@ public:
      *
      * @see setStartEnd()
      */
-    void getStartEnd(RealTime &start, RealTime &end) const {
-        start = m_start;
-        end   = m_end;
-    }
+    void getStartEnd(RealTime &start, RealTime &end) const;
+
+    /// Whether the events are stored in musical time.
+    /**
+     * If so, the RealTimes stored in the buffered MappedEvent objects
+     * are only those that applied when the buffer was filled.  Use
+     * iterator::peekResolved() to get the current ones.
+     */
+    bool isTempoIndependent() const  { return m_tempoIndependent; }
+
+    /// Play source's events instead of our own.
+    /**
+     * Our own events are thrown away.  The source's events are placed
+     * according to our Placement as they are read.  The source must
+     * be tempo-independent, as must we, and its events must not be
+     * changed while anything is sharing them (see isShared()).  We
+     * are an owner of the source until unshareEvents() or our
+     * destruction.
+     */
+    void shareEvents(MappedEventBuffer *source);
+
+    /// Stop playing another buffer's events.
+    /**
+     * We are left empty, for the caller to fill.
+     */
+    void unshareEvents();
+
+    /// The buffer whose events we are playing, or 0 if our own.
+    MappedEventBuffer *getSharedSource() const  { return m_source; }
+
+    /// Whether any other buffer is playing our events.
+    bool isShared() const  { return m_sharedCount > 0; }
+
+    /// Convert a musical time to performance time for this buffer.
+    /**
+     * Uses the TempoMapCache, so this is safe from the sequencer thread.
+     */
+    RealTime toRealTime(timeT t) const;
 
     virtual TrackId getTrackID() const  { return UINT_MAX; }
     virtual void insertChannelSetup(MappedInserterBase &)  { }
@@ -329,6 +409,20 @@ public:
          */
         MappedEvent *peek() const;
 
+        /// Dereference function with up-to-date timing
+        /**
+         * Like peek(), but for a tempo-independent buffer the returned
+         * event has had its time and duration worked out from the
+         * current tempo map, and has been moved to the buffer's
+         * Placement.  In that case the pointer is to a copy held by
+         * this iterator, valid until the next call.
+         *
+         * Callers should lock getLock() as for peek().
+         *
+         * @see isTempoIndependent()
+         */
+        MappedEvent *peekResolved();
+
         /// Access to the segment the iterator is connected to.
         MappedEventBuffer *getSegment() { return m_s; }
         /// Access to the segment the iterator is connected to.
@@ -434,6 +528,12 @@ public:
          */
         RealTime m_currentTime;
 
+        /// Copy of the current event with resolved timing.
+        /**
+         * @see peekResolved()
+         */
+        MappedEvent m_resolvedEvent;
+
         // !!! WARNING !!!
         // If any member objects are added to this class, the ctor, copy ctor,
         // and op= must be updated.
@@ -447,6 +547,20 @@ protected:
     /// The Mapped Event Buffer
     MappedEvent *m_buffer;
 
+    /// Musical start and end times of an event in the buffer.
+    struct MusicalTime
+    {
+        timeT time;
+        timeT endTime;
+    };
+
+    /// Musical times of the events in m_buffer, index for index.
+    /**
+     * Only meaningful if m_tempoIndependent.  Reallocated along with
+     * m_buffer in reserve().
+     */
+    MusicalTime *m_musicalTimes;
+
     /// Capacity of the buffer.
     mutable QAtomicInt m_capacity;
 
@@ -491,6 +605,31 @@ protected:
      */
     RealTime m_end;
 
+    /// Whether events are stored in musical time.
+    /**
+     * Set by derivers that use mapAnEvent(MappedEvent *, timeT, timeT)
+     * and setMusicalStartEnd().
+     *
+     * @see isTempoIndependent()
+     */
+    bool m_tempoIndependent;
+
+    /// Added to the real time of every event.  See toRealTime().
+    /**
+     * E.g. the Segment's real-time delay.
+     */
+    RealTime m_realTimeOffset;
+
+    /// Whether m_start and m_end are given in musical time instead.
+    bool m_haveMusicalStartEnd;
+
+    /// Musical equivalents of m_start and m_end.
+    timeT m_musicalStart;
+    timeT m_musicalEnd;
+
+    /// Subtracted from the resolved start time.  See setMusicalStartEnd().
+    RealTime m_startPreroll;
+
     /// How many metaiterators share this mapper.
     /**
      * We won't delete while it has any owner.  This is changed just in
@@ -498,9 +637,74 @@ protected:
      */
     int m_refCount;
 
+    /// Where the events in a buffer are to be played.
+    /**
+     * Events mapped for one placement can be played at another by
+     * moving them by the difference in origin, transposing their notes
+     * by the difference in transposition and giving them the other
+     * track.
+     */
+    struct Placement
+    {
+        Placement() : origin(0), transpose(0), trackId(UINT_MAX) { }
+
+        /// The musical time that the events' times are relative to.
+        timeT origin;
+        int transpose;
+        TrackId trackId;
+
+        bool operator==(const Placement &p) const {
+            return origin == p.origin  &&  transpose == p.transpose  &&
+                trackId == p.trackId;
+        }
+        bool operator!=(const Placement &p) const { return !operator==(p); }
+    };
+
+    /// Where this buffer's events are to be played.
+    Placement m_placement;
+
+    /// Where the events in m_buffer were mapped for.
+    /**
+     * When this differs from m_placement (or from that of a buffer
+     * sharing these events) the events are moved as they are read.
+     */
+    Placement m_mappedPlacement;
+
+    /// The buffer whose events we play instead of our own, if any.
+    MappedEventBuffer *m_source;
+
+    /// How many other buffers are playing our events.
+    int m_sharedCount;
+
+    /// The buffer whose events we play: m_source, or this.
+    const MappedEventBuffer *getEvents() const
+        { return m_source ? m_source : this; }
+
+    /// Musical times of the first and last events we play, as placed.
+    /**
+     * Returns false if there are no events.
+     */
+    bool getMusicalRange(timeT &first, timeT &last) const;
+
     /// Add an event to the buffer.
     void mapAnEvent(MappedEvent *e);
 
+    /// Replace the events at [first, last) with the given ones.
+    /**
+     * For refillRange().  The events after last are moved up or down to
+     * make room.  The sequencer thread is locked out while they move.
+     */
+    void replaceEvents(int first, int last,
+                       const std::vector<MappedEvent> &events,
+                       const std::vector<MusicalTime> &musicalTimes);
+
+    /// Add an event to the buffer along with its musical times.
+    /**
+     * For tempo-independent derivers.  The RealTimes in e are kept only
+     * for reference.
+     */
+    void mapAnEvent(MappedEvent *e, timeT time, timeT endTime);
+
     /// Set the sounding times (m_start, m_end).
     /**
      * InternalSegmentMapper::fillBuffer() keeps this updated.
@@ -510,6 +714,21 @@ protected:
     void setStartEnd(RealTime &start, RealTime &end) {
         m_start = start;
         m_end   = end;
+        m_haveMusicalStartEnd = false;
+    }
+
+    /// Set the sounding times (m_start, m_end) in musical time.
+    /**
+     * The start is resolved to performance time and then moved earlier
+     * by preroll.
+     *
+     * @see getStartEnd()
+     */
+    void setMusicalStartEnd(timeT start, timeT end, RealTime preroll) {
+        m_musicalStart = start;
+        m_musicalEnd = end;
+        m_startPreroll = preroll;
+        m_haveMusicalStartEnd = true;
     }
 
 private:
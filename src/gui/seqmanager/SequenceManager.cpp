@@ -52,6 +52,7 @@
 #include "sequencer/RosegardenSequencer.h"
 #include "MarkerMapper.h"
 #include "MetronomeMapper.h"
+#include "TempoMapCache.h"
 #include "TempoSegmentMapper.h"
 #include "TimeSigSegmentMapper.h"
 #include "sound/AudioFile.h"
@@ -259,6 +260,9 @@ SequenceManager::play()
         m_lastLowLatencySwitchSent = lowLat;
     }
 
+    RosegardenSequencer::getInstance()->setSmallFileCacheBudget(
+            settings.value("smallfilecachebudget", 64).toInt() * 1024);
+
     RealTime readAhead, audioMix, audioRead, audioWrite;
     long smallFileSize;
 
@@ -709,6 +713,11 @@ punchin:
         bool lowLat = qStrToBool( settings.value("audiolowlatencymonitoring", "true" ) ) ;
         settings.endGroup();
 
+        settings.beginGroup( SequencerOptionsConfigGroup );
+        RosegardenSequencer::getInstance()->setSmallFileCacheBudget(
+                settings.value("smallfilecachebudget", 64).toInt() * 1024);
+        settings.endGroup();
+
         if (lowLat != m_lastLowLatencySwitchSent) {
             RosegardenSequencer::getInstance()->setLowLatencyMode(lowLat);
             m_lastLowLatencySwitchSent = lowLat;
@@ -1432,6 +1441,7 @@ void SequenceManager::resetCompositionMapper()
     RosegardenSequencer::getInstance()->compositionAboutToBeDeleted();
 
     delete m_compositionMapper;
+    TempoMapCache::getInstance()->update(m_doc->getComposition());
     m_compositionMapper = new CompositionMapper(m_doc);
 
     resetMetronomeMapper();
@@ -1594,10 +1604,16 @@ void SequenceManager::checkRefreshStatus()
     // then the ones which are still there
     for (SegmentRefreshMap::iterator i = m_segments.begin();
             i != m_segments.end(); ++i) {
-        if (i->first->getRefreshStatus(i->second).needsRefresh() ||
-                ridset.find(i->first->getRuntimeId()) != ridset.end()) {
+        SegmentRefreshStatus &status = i->first->getRefreshStatus(i->second);
+        if (ridset.find(i->first->getRuntimeId()) != ridset.end()) {
+            // A trigger segment it uses has changed, so it could be
+            // anywhere.
             segmentModified(i->first);
-            i->first->getRefreshStatus(i->second).setNeedsRefresh(false);
+            status.setNeedsRefresh(false);
+        } else if (status.needsRefresh()) {
+            // Just re-map what the edit touched.
+            segmentModified(i->first, status.from(), status.to());
+            status.setNeedsRefresh(false);
         }
     }
 
@@ -1622,6 +1638,18 @@ SequenceManager::segmentModified(Segment* s)
         (m_compositionMapper->getMappedEventBuffer(s));
 }
 
+void
+SequenceManager::segmentModified(Segment* s, timeT from, timeT to)
+{
+    SEQMAN_DEBUG << "SequenceManager::segmentModified(" << s << ", "
+                 << from << ", " << to << ")";
+
+    m_compositionMapper->segmentModified(s, from, to);
+
+    RosegardenSequencer::getInstance()->segmentModified
+        (m_compositionMapper->getMappedEventBuffer(s));
+}
+
 void SequenceManager::segmentAdded(const Composition*, Segment* s)
 {
     SEQMAN_DEBUG << "SequenceManager::segmentAdded(" << s
@@ -1884,11 +1912,25 @@ void SequenceManager::selectedTrackChanged(const Composition *composition)
 void SequenceManager::tempoChanged(const Composition *c)
 {
     SEQMAN_DEBUG << "SequenceManager::tempoChanged()";
-    // Refresh all segments
+
+    // Most segment mappers keep their events in musical time, so
+    // updating the tempo map they read from is enough.  Only refill
+    // the ones that don't (e.g. audio segments).
     //
+    TempoMapCache::getInstance()->update(*c);
+
     for (SegmentRefreshMap::iterator i = m_segments.begin();
          i != m_segments.end(); ++i) {
-        segmentModified(i->first);
+        MappedEventBuffer *mapper =
+            m_compositionMapper->getMappedEventBuffer(i->first);
+        if (mapper  &&  mapper->isTempoIndependent()) {
+            mapper->tempoChanged();
+            // The sequencer's position is in real time, so its
+            // iterator needs to find its place again.
+            RosegardenSequencer::getInstance()->segmentModified(mapper);
+        } else {
+            segmentModified(i->first);
+        }
     }
 
     // and metronome, time sig and tempo
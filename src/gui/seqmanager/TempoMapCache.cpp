@@ -0,0 +1,109 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "TempoMapCache.h"
+
+namespace Rosegarden
+{
+
+
+TempoMapCache *
+TempoMapCache::getInstance()
+{
+    static TempoMapCache *instance = 0;
+    if (!instance) instance = new TempoMapCache();
+    return instance;
+}
+
+TempoMapCache::TempoMapCache() :
+    m_defaultTempo(Composition::getTempoForQpm(120.0))
+{
+}
+
+void
+TempoMapCache::update(const Composition &composition)
+{
+    // Build the new table outside the lock so the sequencer thread is
+    // held up only for the swap.
+
+    TempoChanges changes;
+    const int count = composition.getTempoChangeCount();
+    changes.reserve(count);
+
+    for (int n = 0; n < count; ++n) {
+
+        std::pair<timeT, tempoT> change = composition.getTempoChange(n);
+
+        TempoChange c;
+        c.time = change.first;
+        c.tempo = change.second;
+        c.realTime = composition.getElapsedRealTime(c.time);
+        c.target = -1;
+        c.rampDuration = 0;
+
+        tempoT target;
+        timeT targetTime;
+        if (composition.getTempoTarget(n, target, targetTime)) {
+            c.target = target;
+            c.rampDuration = targetTime - c.time;
+        }
+
+        changes.push_back(c);
+    }
+
+    {
+        QWriteLocker locker(&m_lock);
+        m_changes.swap(changes);
+        m_defaultTempo = composition.getCompositionDefaultTempo();
+    }
+}
+
+RealTime
+TempoMapCache::getElapsedRealTime(timeT t) const
+{
+    QReadLocker locker(&m_lock);
+
+    // Find the last tempo change at or before t.
+    int lo = 0;
+    int hi = int(m_changes.size());
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (m_changes[mid].time <= t) lo = mid + 1;
+        else hi = mid;
+    }
+    int index = lo - 1;
+
+    if (index < 0) {
+        if (t >= 0 || m_changes.empty() || m_changes[0].time > 0) {
+            return Composition::time2RealTime(t, m_defaultTempo);
+        }
+        index = 0;
+    }
+
+    const TempoChange &c = m_changes[index];
+
+    if (c.target > 0) {
+        return c.realTime +
+            Composition::time2RealTime(t - c.time, c.tempo,
+                                       c.rampDuration, c.target);
+    } else {
+        return c.realTime + Composition::time2RealTime(t - c.time, c.tempo);
+    }
+}
+
+
+}
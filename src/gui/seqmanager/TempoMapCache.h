@@ -0,0 +1,87 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    Other copyrights also apply to some parts of this work.  Please
+    see the AUTHORS file and individual file headers for details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_TEMPOMAPCACHE_H
+#define RG_TEMPOMAPCACHE_H
+
+#include "base/Composition.h"
+#include "base/RealTime.h"
+
+#include <QReadWriteLock>
+
+#include <vector>
+
+namespace Rosegarden
+{
+
+
+/// Thread-safe snapshot of the Composition's tempo map.
+/**
+ * Segment mappers (see InternalSegmentMapper) keep their events in
+ * musical time (timeT) and leave the conversion to RealTime until the
+ * sequencer thread actually plays them (see MappedEventBuffer::iterator::
+ * peekResolved()).  That conversion can't go through the Composition,
+ * which belongs to the GUI thread, so it goes through this snapshot
+ * instead.
+ *
+ * SequenceManager calls update() whenever the tempo map changes.  That
+ * is the only thing a tempo edit invalidates: the mapped buffers
+ * themselves don't need to be refilled.
+ *
+ * The ramps and the arithmetic come from the Composition itself
+ * (Composition::getTempoTarget() and Composition::time2RealTime()), so
+ * the conversion gives the same results as
+ * Composition::getElapsedRealTime().
+ */
+class TempoMapCache
+{
+public:
+    static TempoMapCache *getInstance();
+
+    /// Rebuild the snapshot from the Composition.  GUI thread only.
+    void update(const Composition &composition);
+
+    /// Musical time to elapsed real time.  Safe from any thread.
+    RealTime getElapsedRealTime(timeT t) const;
+
+private:
+    // Singleton.  Use getInstance().
+    TempoMapCache();
+
+    struct TempoChange
+    {
+        timeT time;
+        RealTime realTime;
+        tempoT tempo;
+        /// Ramp target, or -1 if the tempo is constant until the next change.
+        tempoT target;
+        /// End of the ramp, relative to time.
+        timeT rampDuration;
+    };
+
+    typedef std::vector<TempoChange> TempoChanges;
+    TempoChanges m_changes;
+
+    tempoT m_defaultTempo;
+
+    mutable QReadWriteLock m_lock;
+};
+
+
+}
+
+#endif
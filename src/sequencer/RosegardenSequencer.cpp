@@ -28,6 +28,9 @@
 
 #include <QVector>
 
+#include <algorithm>
+#include <time.h>
+
 #include "misc/Debug.h"
 #include "misc/Strings.h"
 #include "sound/ControlBlock.h"
@@ -35,6 +38,7 @@
 #include "sound/SoundDriverFactory.h"
 #include "sound/MappedInstrument.h"
 #include "sound/MappedEventInserter.h"
+#include "sound/PlayableAudioFile.h"
 #include "base/Profiler.h"
 #include "sound/PluginFactory.h"
 
@@ -77,7 +81,9 @@ RosegardenSequencer::RosegardenSequencer() :
     m_studio(new MappedStudio()),
     m_transportToken(1),
     m_isEndOfCompReached(false),
-    m_mutex(QMutex::Recursive) // recursive
+    m_mutex(QMutex::Recursive), // recursive
+    m_wakePending(false),
+    m_wakeCount(0)
 {
     // Initialise the MappedStudio
     //
@@ -157,6 +163,7 @@ RosegardenSequencer::quit()
 #endif
     // and break out of the loop next time around
     m_transportStatus = QUIT;
+    wakeUp();
 }
 
 
@@ -223,6 +230,8 @@ RosegardenSequencer::play(const RealTime &time,
 //!!!
 //    dumpFirstSegment();
 
+    wakeUp();
+
     // keep it simple
     return true;
 }
@@ -324,6 +333,7 @@ RosegardenSequencer::record(const RealTime &time,
     //
     //
     m_transportStatus = localRecordMode;
+    wakeUp();
 
     if (localRecordMode == RECORDING) { // punch in
         return true;
@@ -367,6 +377,8 @@ RosegardenSequencer::stop()
     Profiles::getInstance()->dump();
 
     incrementTransportToken();
+
+    wakeUp();
 }
 
 bool
@@ -379,6 +391,7 @@ RosegardenSequencer::punchOut()
     if (m_transportStatus == RECORDING) {
         m_driver->punchOut();
         m_transportStatus = PLAYING;
+        wakeUp();
         return true;
     }
     return false;
@@ -507,10 +520,14 @@ RosegardenSequencer::setMappedInstrument(int type, unsigned int id)
 void
 RosegardenSequencer::processMappedEvent(MappedEvent mE)
 {
-    QMutexLocker locker(&m_asyncQueueMutex);
-    m_asyncOutQueue.push_back(new MappedEvent(mE));
+    {
+        QMutexLocker locker(&m_asyncQueueMutex);
+        m_asyncOutQueue.push_back(new MappedEvent(mE));
 //    SEQUENCER_DEBUG << "processMappedEvent: Have " << m_asyncOutQueue.size()
 //                    << " events in async out queue" << endl;
+    }
+
+    wakeUp();
 }
 
 int
@@ -650,6 +667,19 @@ RosegardenSequencer::setLowLatencyMode(bool ll)
     m_driver->setLowLatencyMode(ll);
 }
 
+void
+RosegardenSequencer::setSmallFileCacheBudget(long kB)
+{
+    // The cache does its own locking
+    PlayableAudioFile::setSmallFileCacheBudget(size_t(kB) * 1024);
+}
+
+AudioCache::Statistics
+RosegardenSequencer::getSmallFileCacheStatistics() const
+{
+    return PlayableAudioFile::getSmallFileCacheStatistics();
+}
+
 RealTime
 RosegardenSequencer::getAudioPlayLatency()
 {
@@ -1009,7 +1039,18 @@ RosegardenSequencer::getStatusLog()
 {
     LOCKED;
 
-    return m_driver->getStatusLog();
+    QString log = m_driver->getStatusLog();
+
+    if (m_wakeCount > 0) {
+        log += QString("\nSequencer wakeup-to-dispatch latency: "
+                       "mean %1 ms, worst %2 ms over %3 wakeups\n")
+            .arg((m_wakeLatencyTotal / int(m_wakeCount)) /
+                 RealTime::fromMilliseconds(1))
+            .arg(m_wakeLatencyWorst / RealTime::fromMilliseconds(1))
+            .arg(m_wakeCount);
+    }
+
+    return log;
 }
 
 
@@ -1344,6 +1385,90 @@ RosegardenSequencer::sleep(const RealTime &rt)
     m_driver->sleep(rt);
 }
 
+RealTime
+RosegardenSequencer::getSleepTime()
+{
+    // Stopped: nothing to do until someone calls wakeUp(), MIDI
+    // comes in, or a note-off is due.  The limit is just for the odd
+    // bits of housekeeping (SoundDriver::runTasks()).
+    RealTime sleepTime(0, 100000000);
+
+    if (m_transportStatus == PLAYING ||
+        m_transportStatus == RECORDING) {
+
+        // Top up the read-ahead when half of what we've fetched has
+        // played, but update the position pointer (and go round the
+        // loop) at least every 20ms.
+        sleepTime = std::min((m_lastFetchSongPosition - m_songPosition) / 2,
+                             RealTime(0, 20000000));
+
+        if (isLooping())
+            sleepTime = std::min(sleepTime, m_loopEnd - m_songPosition);
+    }
+
+    RealTime pending;
+    if (m_driver->getTimeToNextPending(pending))
+        sleepTime = std::min(sleepTime, pending);
+
+    // Don't spin.
+    return std::max(sleepTime, RealTime(0, 1000000));
+}
+
+static RealTime
+getMonotonicTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return RealTime(ts.tv_sec, ts.tv_nsec);
+}
+
+void
+RosegardenSequencer::wakeUp()
+{
+    if (!m_driver) return;
+
+    {
+        QMutexLocker locker(&m_wakeMutex);
+
+        // Measure from the first request the main loop hasn't seen yet.
+        if (!m_wakePending) {
+            m_wakePending = true;
+            m_wakeRequestTime = getMonotonicTime();
+        }
+    }
+
+    m_driver->wake();
+}
+
+bool
+RosegardenSequencer::takeWakeRequest(RealTime &requestTime)
+{
+    QMutexLocker locker(&m_wakeMutex);
+
+    if (!m_wakePending) return false;
+
+    m_wakePending = false;
+    requestTime = m_wakeRequestTime;
+    return true;
+}
+
+void
+RosegardenSequencer::wakeDispatched(const RealTime &requestTime)
+{
+    RealTime latency = getMonotonicTime() - requestTime;
+
+    ++m_wakeCount;
+    m_wakeLatencyTotal = m_wakeLatencyTotal + latency;
+    if (latency > m_wakeLatencyWorst) m_wakeLatencyWorst = latency;
+
+    Profiles::getInstance()->accumulate("SequencerThread wakeup latency",
+                                        0, latency);
+
+#ifdef DEBUG_ROSEGARDEN_SEQUENCER
+    SEQUENCER_DEBUG << "RosegardenSequencer::wakeDispatched: latency " << latency;
+#endif
+}
+
 void
 RosegardenSequencer::processRecordedMidi()
 {
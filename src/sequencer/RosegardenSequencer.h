@@ -17,6 +17,7 @@
 
 #include "gui/application/TransportStatus.h"
 
+#include "sound/AudioCache.h"
 #include "sound/MappedEventList.h"
 #include "sound/MappedStudio.h"
 #include "sound/ExternalTransport.h"
@@ -250,6 +251,12 @@ public:
 
     void setLowLatencyMode(bool);
 
+    /// Memory budget for decoded small audio files, in kB.
+    void setSmallFileCacheBudget(long kB);
+
+    /// Hits, misses, evictions and memory use of that cache.
+    AudioCache::Statistics getSmallFileCacheStatistics() const;
+
     RealTime getAudioPlayLatency();
     RealTime getAudioRecordLatency();
 
@@ -401,11 +408,32 @@ public:
     /**
      * Called from the main loop in order to lighten CPU load (i.e. the
      * timing quality of the sequencer does not depend on this being
-     * accurate).  A good implementation of this call would return right
-     * away when an incoming MIDI event needed to be handled.
+     * accurate).  Returns right away when an incoming MIDI event needs
+     * to be handled or when something calls wakeUp().
      */
     void sleep(const RealTime &rt);
 
+    /// How long the main loop can sleep() before there is work to do.
+    /**
+     * When playing, that's when the read-ahead needs topping up.  When
+     * stopped, it's when the next pending note-off is due, if there is
+     * one.  Anything else wakes the loop up (see wakeUp()).
+     */
+    RealTime getSleepTime();
+
+    /// Whether wakeUp() was called since the last time, and when.
+    /**
+     * The main loop calls this before it does its work and then passes
+     * the time to wakeDispatched() afterwards.
+     */
+    bool takeWakeRequest(RealTime &requestTime);
+
+    /// Record the wakeup-to-dispatch latency of a wakeUp().
+    /**
+     * See getStatusLog() for the statistics.
+     */
+    void wakeDispatched(const RealTime &requestTime);
+
     /// Removes events not matching a MidiFilter from a MappedEventsList.
     /**
      * From the menu, Studio > Modify MIDI Filters... allows the user to
@@ -473,6 +501,13 @@ protected:
     void rationalisePlayingAudio();
     void incrementTransportToken();
 
+    /// Have the main loop do its work now instead of finishing its sleep().
+    /**
+     * Called whenever the GUI changes the transport status or queues
+     * an event for processAsynchronousEvents().
+     */
+    void wakeUp();
+
     //--------------- Data members ---------------------------------
 
     SoundDriver *m_driver;
@@ -533,6 +568,16 @@ protected:
     QMutex m_transportRequestMutex;
     QMutex m_asyncQueueMutex;
 
+    // Pending wakeUp(), for the latency statistics
+    QMutex m_wakeMutex;
+    bool m_wakePending;
+    RealTime m_wakeRequestTime;
+
+    // Wakeup-to-dispatch latency statistics.  Sequencer thread only.
+    unsigned int m_wakeCount;
+    RealTime m_wakeLatencyTotal;
+    RealTime m_wakeLatencyWorst;
+
     static RosegardenSequencer *m_instance;
     static QMutex m_instanceMutex;
 };
@@ -34,12 +34,12 @@ SequencerThread::run()
 {
     SEQUENCER_DEBUG << "SequencerThread::run()";
 
+    Profiles::getInstance()->registerThread("Sequencer");
+
     RosegardenSequencer &seq = *RosegardenSequencer::getInstance();
 
     TransportStatus lastSeqStatus = seq.getStatus();
 
-    RealTime sleepTime = RealTime(0, 10000000);
-
     QTime timer;
     timer.start();
 
@@ -51,6 +51,12 @@ SequencerThread::run()
 
         bool atLeisure = true;
 
+        // If we were woken up (e.g. by a transport change or an
+        // async event from the GUI), find out when, so that we can
+        // report how long it took to get round to it.
+        RealTime wakeRequestTime;
+        bool woken = seq.takeWakeRequest(wakeRequestTime);
+
         //SEQUENCER_DEBUG << "Sequencer status is " << seq.getStatus();
 
         switch (seq.getStatus()) {
@@ -147,6 +153,9 @@ SequencerThread::run()
         //
         seq.updateClocks();
 
+        if (woken)
+            seq.wakeDispatched(wakeRequestTime);
+
         if (lastSeqStatus != seq.getStatus()) {
             SEQUENCER_DEBUG << "Sequencer status changed from " << lastSeqStatus << " to " << seq.getStatus();
             lastSeqStatus = seq.getStatus();
@@ -158,6 +167,10 @@ SequencerThread::run()
             timer.restart();
         }
 
+        // Sleep until there's something to do: the sleep ends early
+        // on MIDI input or a call to RosegardenSequencer::wakeUp().
+        RealTime sleepTime = seq.getSleepTime();
+
         seq.unlock();
 
         // permitting synchronised calls from the gui or wherever to
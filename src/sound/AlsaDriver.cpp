@@ -56,6 +56,8 @@
 #include <pthread.h>
 #include <math.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
 
 
 // #define DEBUG_ALSA 1
@@ -113,10 +115,13 @@ AlsaDriver::AlsaDriver(MappedStudio *studio):
     m_loopEndTime(0, 0),
     m_eat_mtc(0),
     m_looping(false),
-    m_haveShutdown(false)
+    m_haveShutdown(false),
+    m_wakeFd(-1)
 #ifdef HAVE_LIBJACK
     , m_jackDriver(0)
 #endif
+    , m_haveSoftSynthEvents(false)
+    , m_haveImmediateSoftSynthEvents(false)
     , m_queueRunning(false)
     , m_portCheckNeeded(false),
     m_needJackStart(NeedNoJackStart),
@@ -129,6 +134,12 @@ AlsaDriver::AlsaDriver(MappedStudio *studio):
     Audit audit;
     audit << "Rosegarden " << VERSION << " - AlsaDriver " << m_name << std::endl;
     m_pendSysExcMap = new DeviceEventMap();
+
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeFd < 0) {
+        std::cerr << "AlsaDriver::AlsaDriver: eventfd failed, wake() will have to wait for sleep() to time out" << std::endl;
+    }
+
     std::cerr << "AlsaDriver::AlsaDriver [begin]" << std::endl;
 
 #ifndef NDEBUG
@@ -154,6 +165,8 @@ AlsaDriver::~AlsaDriver()
     clearPendSysExcMap();
 
     delete m_pendSysExcMap;
+
+    if (m_wakeFd >= 0) close(m_wakeFd);
 }
 
 int
@@ -2390,7 +2403,10 @@ AlsaDriver::processNotesOff(const RealTime &time, bool now, bool everything)
     }
 
     // We don't flush the queue here, as this is called nested from
-    // processMidiOut, which does the flushing
+    // processMidiOut, which does the flushing.  The soft synths get
+    // theirs now, though, as we aren't always called from there.
+
+    flushSoftSynthEvents();
 
 #ifdef DEBUG_PROCESS_MIDI_OUT
     std::cerr << "AlsaDriver::processNotesOff - "
@@ -4012,6 +4028,8 @@ AlsaDriver::processMidiOut(const MappedEventList &mC,
 
     processNotesOff(sliceEnd - m_playStartPosition + m_alsaPlayStartTime, now);
 
+    flushSoftSynthEvents();
+
     if (getMTCStatus() == TRANSPORT_MASTER) {
         insertMTCQFrames(sliceStart, sliceEnd);
     }
@@ -4046,31 +4064,70 @@ AlsaDriver::processSoftSynthEventOut(InstrumentId id, const snd_seq_event_t *ev,
 
     if (!m_jackDriver)
         return ;
-    RunnablePluginInstance *synthPlugin = m_jackDriver->getSynthPlugin(id);
-
-    if (synthPlugin) {
 
-        RealTime t(ev->time.time.tv_sec, ev->time.time.tv_nsec);
+    RealTime t(ev->time.time.tv_sec, ev->time.time.tv_nsec);
 
-        if (now)
-            t = RealTime::zeroTime;
-        else
-            t = t + m_playStartPosition - m_alsaPlayStartTime;
+    if (now)
+        t = RealTime::zeroTime;
+    else
+        t = t + m_playStartPosition - m_alsaPlayStartTime;
 
 #ifdef DEBUG_PROCESS_SOFT_SYNTH_OUT
 
-        std::cerr << "AlsaDriver::processSoftSynthEventOut: event time " << t << std::endl;
+    std::cerr << "AlsaDriver::processSoftSynthEventOut: event time " << t << std::endl;
 #endif
 
-        synthPlugin->sendEvent(t, ev);
+    // Held until flushSoftSynthEvents(), so that each synth gets all
+    // of its events for the slice at once
+
+    snd_seq_event_t event(*ev);
+    event.time.time.tv_sec = t.sec;
+    event.time.time.tv_nsec = t.nsec;
+
+    m_softSynthEvents[id].push_back(event);
+    m_haveSoftSynthEvents = true;
+
+    if (now) m_haveImmediateSoftSynthEvents = true;
+#endif
+}
+
+void
+AlsaDriver::flushSoftSynthEvents()
+{
+#ifdef HAVE_LIBJACK
+
+    if (!m_haveSoftSynthEvents) return;
+
+    for (SoftSynthEventMap::iterator i = m_softSynthEvents.begin();
+         i != m_softSynthEvents.end(); ++i) {
+
+        std::vector<snd_seq_event_t> &events = i->second;
+        if (events.empty()) continue;
+
+        RunnablePluginInstance *synthPlugin =
+            m_jackDriver ? m_jackDriver->getSynthPlugin(i->first) : 0;
 
-        if (now) {
 #ifdef DEBUG_PROCESS_SOFT_SYNTH_OUT
-            std::cerr << "AlsaDriver::processSoftSynthEventOut: setting haveAsyncAudioEvent" << std::endl;
+        std::cerr << "AlsaDriver::flushSoftSynthEvents: " << events.size()
+                  << " events for instrument " << i->first << std::endl;
 #endif
 
-            m_jackDriver->setHaveAsyncAudioEvent();
+        if (synthPlugin) {
+            synthPlugin->sendEvents(&events[0], events.size());
         }
+
+        events.clear(); // keeping the capacity
+    }
+
+    m_haveSoftSynthEvents = false;
+
+    if (m_haveImmediateSoftSynthEvents) {
+#ifdef DEBUG_PROCESS_SOFT_SYNTH_OUT
+        std::cerr << "AlsaDriver::flushSoftSynthEvents: setting haveAsyncAudioEvent" << std::endl;
+#endif
+
+        if (m_jackDriver) m_jackDriver->setHaveAsyncAudioEvent();
+        m_haveImmediateSoftSynthEvents = false;
     }
 #endif
 }
@@ -5283,16 +5340,64 @@ AlsaDriver::scavengePlugins()
 QString
 AlsaDriver::getStatusLog()
 {
-    return strtoqstr(Audit::getAudit());
+    QString log = strtoqstr(Audit::getAudit());
+
+#ifdef HAVE_LIBJACK
+    if (m_jackDriver) log += m_jackDriver->getStatusLog();
+#endif
+
+    return log;
 }
 
 void
 AlsaDriver::sleep(const RealTime &rt)
 {
+    // Wait for MIDI input, a wake() or the timeout, whichever comes
+    // first.
+
     int npfd = snd_seq_poll_descriptors_count(m_midiHandle, POLLIN);
-    struct pollfd *pfd = (struct pollfd *)alloca(npfd * sizeof(struct pollfd));
+    struct pollfd *pfd =
+        (struct pollfd *)alloca((npfd + 1) * sizeof(struct pollfd));
     snd_seq_poll_descriptors(m_midiHandle, pfd, npfd, POLLIN);
-    poll(pfd, npfd, rt.sec * 1000 + rt.msec());
+
+    if (m_wakeFd < 0) {
+        poll(pfd, npfd, rt.sec * 1000 + rt.msec());
+        return;
+    }
+
+    pfd[npfd].fd = m_wakeFd;
+    pfd[npfd].events = POLLIN;
+    pfd[npfd].revents = 0;
+
+    poll(pfd, npfd + 1, rt.sec * 1000 + rt.msec());
+
+    // Reset the eventfd.  It's nonblocking, so if nobody woke us this
+    // just fails with EAGAIN.
+    uint64_t count;
+    ssize_t result = read(m_wakeFd, &count, sizeof(count));
+    (void)result;
+}
+
+void
+AlsaDriver::wake()
+{
+    if (m_wakeFd < 0) return;
+
+    uint64_t one = 1;
+    if (write(m_wakeFd, &one, sizeof(one)) < 0) {
+        std::cerr << "AlsaDriver::wake: write to eventfd failed" << std::endl;
+    }
+}
+
+bool
+AlsaDriver::getTimeToNextPending(RealTime &delay)
+{
+    // Note-offs are only sent from processPending() when we're stopped.
+    // When playing they go into the ALSA queue ahead of time.
+    if (m_playing || m_noteOffQueue.empty()) return false;
+
+    delay = (*m_noteOffQueue.begin())->getRealTime() - getAlsaTime();
+    return true;
 }
 
 void
@@ -280,6 +280,8 @@ public:
     virtual void setLoop(const RealTime &loopStart, const RealTime &loopEnd);
 
     virtual void sleep(const RealTime &);
+    virtual void wake();
+    virtual bool getTimeToNextPending(RealTime &delay);
 
     // ----------------------- End of Virtuals ----------------------
 
@@ -445,6 +447,12 @@ protected:
                                           const snd_seq_event_t *event,
                                           bool now);
 
+    /**
+     * Send the soft synth events gathered by processSoftSynthEventOut()
+     * since the last call, a batch per synth.
+     */
+    void flushSoftSynthEvents();
+
     virtual bool isRecording(AlsaPortDescription *port);
 
     virtual void processAudioQueue(bool /* now */) { }
@@ -521,6 +529,10 @@ private:
 
     bool                         m_haveShutdown;
 
+    // eventfd that wake() writes to, so that sleep() can poll it
+    // along with the MIDI input.
+    int                          m_wakeFd;
+
     // Track System Exclusive Event across several ALSA messages
     // ALSA may break long system exclusive messages into chunks.
     typedef std::map<unsigned int,
@@ -581,6 +593,15 @@ private:
     // added to the ALSA queue recently.
     //
     NoteOffQueue m_recentNoteOffs;
+
+    // Soft synth events waiting for flushSoftSynthEvents(), with
+    // their times already set.  The vectors are kept, to be reused.
+    typedef std::map<InstrumentId, std::vector<snd_seq_event_t> >
+        SoftSynthEventMap;
+    SoftSynthEventMap m_softSynthEvents;
+    bool m_haveSoftSynthEvents;
+    bool m_haveImmediateSoftSynthEvents;
+
     void pushRecentNoteOffs(); // move from recent to normal queue after reset
     void cropRecentNoteOffs(const RealTime &t); // remove old note offs
     void weedRecentNoteOffs(unsigned int pitch, MidiByte channel,
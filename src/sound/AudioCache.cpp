@@ -18,28 +18,112 @@
 #include "AudioCache.h"
 #include "misc/Debug.h"
 
+#include <QMutexLocker>
+
 //#define DEBUG_AUDIO_CACHE 1
 
 namespace Rosegarden
 {
 
+AudioCache::AudioCache() :
+    m_memoryBudget(DefaultMemoryBudget),
+    m_bytes(0),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0)
+{
+}
+
 AudioCache::~AudioCache()
 {
+#ifdef DEBUG_AUDIO_CACHE
+    Statistics stats = getStatistics();
+    RG_DEBUG << "AudioCache::~AudioCache: " << stats.hits << " hits, "
+             << stats.misses << " misses, " << stats.evictions
+             << " evictions, " << stats.bytesResident << " bytes resident";
+#endif
+
     clear();
 }
 
+void
+AudioCache::setMemoryBudget(size_t bytes)
+{
+    std::vector<CacheRec *> evicted;
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_memoryBudget = bytes;
+        evict(evicted);
+    }
+
+    for (size_t i = 0; i < evicted.size(); ++i) delete evicted[i];
+}
+
+size_t
+AudioCache::getMemoryBudget() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_memoryBudget;
+}
+
+AudioCache::Statistics
+AudioCache::getStatistics() const
+{
+    QMutexLocker locker(&m_mutex);
+
+    Statistics stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.evictions = m_evictions;
+    stats.entries = m_cache.size();
+    stats.bytesResident = m_bytes;
+    stats.memoryBudget = m_memoryBudget;
+    return stats;
+}
+
 bool
 AudioCache::has(void *index)
 {
+    QMutexLocker locker(&m_mutex);
     return m_cache.find(index) != m_cache.end();
 }
 
+bool
+AudioCache::acquire(void *index)
+{
+    QMutexLocker locker(&m_mutex);
+
+    CacheMap::iterator i = m_cache.find(index);
+
+    if (i == m_cache.end()) {
+        ++m_misses;
+        return false;
+    }
+
+    ++m_hits;
+
+    if (i->second->refCount == 0) {
+        m_unreferenced.erase(i->second->lruPosition);
+    }
+    ++i->second->refCount;
+
+#ifdef DEBUG_AUDIO_CACHE
+    RG_DEBUG << "AudioCache::acquire(" << index << ") [to " << i->second->refCount << "]";
+#endif
+
+    return true;
+}
+
 float **
 AudioCache::getData(void *index, size_t &channels, size_t &frames)
 {
-    if (m_cache.find(index) == m_cache.end())
+    QMutexLocker locker(&m_mutex);
+
+    CacheMap::iterator i = m_cache.find(index);
+    if (i == m_cache.end())
         return 0;
-    CacheRec *rec = m_cache[index];
+    CacheRec *rec = i->second;
     channels = rec->channels;
     frames = rec->nframes;
     return rec->data;
@@ -52,54 +136,155 @@ AudioCache::addData(void *index, size_t channels, size_t nframes, float **data)
     RG_DEBUG << "AudioCache::addData(" << index << ")";
 #endif
 
-    if (m_cache.find(index) != m_cache.end()) {
-        RG_WARNING << "WARNING: AudioCache::addData(" << index << ", "
-        << channels << ", " << nframes
-        << ": already cached";
-        return ;
+    std::vector<CacheRec *> evicted;
+
+    {
+        QMutexLocker locker(&m_mutex);
+
+        if (m_cache.find(index) != m_cache.end()) {
+            RG_WARNING << "WARNING: AudioCache::addData(" << index << ", "
+            << channels << ", " << nframes
+            << ": already cached";
+            return ;
+        }
+
+        CacheRec *rec = new CacheRec(data, channels, nframes);
+        m_cache[index] = rec;
+        m_bytes += rec->getBytes();
+
+        evict(evicted);
     }
 
-    m_cache[index] = new CacheRec(data, channels, nframes);
+    for (size_t i = 0; i < evicted.size(); ++i) delete evicted[i];
 }
 
 void
 AudioCache::incrementReference(void *index)
 {
-    if (m_cache.find(index) == m_cache.end()) {
+    QMutexLocker locker(&m_mutex);
+
+    CacheMap::iterator i = m_cache.find(index);
+
+    if (i == m_cache.end()) {
         RG_WARNING << "WARNING: AudioCache::incrementReference(" << index
         << "): not found";
         return ;
     }
-    ++m_cache[index]->refCount;
+
+    if (i->second->refCount == 0) {
+        m_unreferenced.erase(i->second->lruPosition);
+    }
+    ++i->second->refCount;
 
 #ifdef DEBUG_AUDIO_CACHE
-    RG_DEBUG << "AudioCache::incrementReference(" << index << ") [to " << (m_cache[index]->refCount) << "]";
+    RG_DEBUG << "AudioCache::incrementReference(" << index << ") [to " << (i->second->refCount) << "]";
 #endif
 }
 
 void
 AudioCache::decrementReference(void *index)
 {
-    std::map<void *, CacheRec *>::iterator i = m_cache.find(index);
+    std::vector<CacheRec *> evicted;
 
-    if (i == m_cache.end()) {
-        RG_WARNING << "WARNING: AudioCache::decrementReference(" << index
-        << "): not found";
-        return ;
-    }
-    if (i->second->refCount <= 1) {
-        delete i->second;
-        m_cache.erase(i);
+    {
+        QMutexLocker locker(&m_mutex);
+
+        CacheMap::iterator i = m_cache.find(index);
+
+        if (i == m_cache.end() || i->second->refCount == 0) {
+            RG_WARNING << "WARNING: AudioCache::decrementReference(" << index
+            << "): not found";
+            return ;
+        }
+
+        if (--i->second->refCount > 0) {
 #ifdef DEBUG_AUDIO_CACHE
-        RG_DEBUG << "AudioCache::decrementReference(" << index << ") [deleting]";
+            RG_DEBUG << "AudioCache::decrementReference(" << index << ") [to " << (i->second->refCount) << "]";
 #endif
+            return ;
+        }
 
-    } else {
-        --i->second->refCount;
+        if (i->second->retain) {
+            // Most recently used goes at the back
+            i->second->lruPosition =
+                m_unreferenced.insert(m_unreferenced.end(), index);
+            evict(evicted);
+#ifdef DEBUG_AUDIO_CACHE
+            RG_DEBUG << "AudioCache::decrementReference(" << index << ") [unreferenced]";
+#endif
+        } else {
+            evicted.push_back(take(i));
 #ifdef DEBUG_AUDIO_CACHE
-        RG_DEBUG << "AudioCache::decrementReference(" << index << ") [to " << (m_cache[index]->refCount) << "]";
+            RG_DEBUG << "AudioCache::decrementReference(" << index << ") [deleting]";
 #endif
+        }
+    }
+
+    for (size_t i = 0; i < evicted.size(); ++i) delete evicted[i];
+}
+
+void
+AudioCache::remove(void *index)
+{
+    CacheRec *removed = 0;
+
+    {
+        QMutexLocker locker(&m_mutex);
+
+        CacheMap::iterator i = m_cache.find(index);
+        if (i == m_cache.end())
+            return ;
+
+        if (i->second->refCount > 0) {
+            i->second->retain = false;
+        } else {
+            removed = take(i);
+        }
+    }
+
+    delete removed;
+}
+
+void
+AudioCache::purge()
+{
+    std::vector<CacheRec *> purged;
+
+    {
+        QMutexLocker locker(&m_mutex);
+
+        while (!m_unreferenced.empty()) {
+            purged.push_back(take(m_cache.find(m_unreferenced.front())));
+        }
+    }
+
+    for (size_t i = 0; i < purged.size(); ++i) delete purged[i];
+}
 
+AudioCache::CacheRec *
+AudioCache::take(CacheMap::iterator i)
+{
+    CacheRec *rec = i->second;
+
+    // Only retained entries go on the unreferenced list
+    if (rec->refCount == 0 && rec->retain) {
+        m_unreferenced.erase(rec->lruPosition);
+    }
+    m_bytes -= rec->getBytes();
+    m_cache.erase(i);
+
+    return rec;
+}
+
+void
+AudioCache::evict(std::vector<CacheRec *> &evicted)
+{
+    while (m_bytes > m_memoryBudget && !m_unreferenced.empty()) {
+#ifdef DEBUG_AUDIO_CACHE
+        RG_DEBUG << "AudioCache::evict: evicting " << m_unreferenced.front();
+#endif
+        evicted.push_back(take(m_cache.find(m_unreferenced.front())));
+        ++m_evictions;
     }
 }
 
@@ -110,13 +295,17 @@ AudioCache::clear()
     RG_DEBUG << "AudioCache::clear()";
 #endif
 
-    for (std::map<void *, CacheRec *>::iterator i = m_cache.begin();
-            i != m_cache.end(); ++i) {
+    QMutexLocker locker(&m_mutex);
+
+    for (CacheMap::iterator i = m_cache.begin(); i != m_cache.end(); ++i) {
         if (i->second->refCount > 0) {
             RG_WARNING << "WARNING: AudioCache::clear: deleting cached data with refCount " << i->second->refCount;
         }
+        delete i->second;
     }
     m_cache.clear();
+    m_unreferenced.clear();
+    m_bytes = 0;
 }
 
 AudioCache::CacheRec::~CacheRec()
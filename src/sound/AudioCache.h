@@ -16,9 +16,13 @@
 #ifndef RG_AUDIO_CACHE_H
 #define RG_AUDIO_CACHE_H
 
+#include <list>
 #include <map>
+#include <vector>
 #include <stddef.h>
 
+#include <QMutex>
+
 namespace Rosegarden
 {
 
@@ -26,20 +30,67 @@ namespace Rosegarden
  * A simple cache for smallish bits of audio data, indexed by some
  * opaque pointer type.  (The PlayableAudioFile uses this with an
  * AudioFile* index type, for example.)  With reference counting.
+ *
+ * Data whose reference count drops to zero stays in the cache, so
+ * that playing the same file again doesn't mean decoding it again,
+ * until the cache grows beyond its memory budget.  Then unreferenced
+ * data is deleted, least recently used first.  Referenced data is
+ * never deleted, so the cache can be over budget while it's all in
+ * use.
+ *
+ * All methods are thread-safe.
  */
 
 class AudioCache
 {
 public:
-    AudioCache() { }
+    /// The default memory budget, in bytes.
+    static const size_t DefaultMemoryBudget = 64 * 1024 * 1024;
+
+    AudioCache();
     virtual ~AudioCache();
 
+    /**
+     * Set the number of bytes of sample data to keep at most (other
+     * than data that is still referenced), evicting data if the cache
+     * is over the new budget.
+     */
+    void setMemoryBudget(size_t bytes);
+    size_t getMemoryBudget() const;
+
+    struct Statistics {
+        Statistics() :
+            hits(0), misses(0), evictions(0),
+            entries(0), bytesResident(0), memoryBudget(0) { }
+
+        /// acquire() calls that found the data in the cache
+        size_t hits;
+        /// acquire() calls that didn't
+        size_t misses;
+        /// Unreferenced data deleted to stay within the budget
+        size_t evictions;
+
+        size_t entries;
+        size_t bytesResident;
+        size_t memoryBudget;
+    };
+
+    Statistics getStatistics() const;
+
     /**
      * Look some audio data up in the cache and report whether it
      * exists.
      */
     bool has(void *index);
 
+    /**
+     * If some audio data is in the cache, increment its reference
+     * count and return true.  Otherwise return false, in which case
+     * the caller will usually go on to addData().  Counts a hit or a
+     * miss accordingly.
+     */
+    bool acquire(void *index);
+
     /**
      * Look some audio data up in the cache and return it if it
      * exists, returning the number of channels in channels, the frame
@@ -65,27 +116,70 @@ public:
     void incrementReference(void *index);
 
     /**
-     * Decrement the reference count for a given piece of data,
-     * and delete the data from the cache if the reference count has
-     * reached zero.
+     * Decrement the reference count for a given piece of data.  Data
+     * whose reference count has reached zero is kept until it is
+     * evicted to make room, or removed.
      */
     void decrementReference(void *index);
 
+    /**
+     * Forget the data for an index that is about to become invalid
+     * (e.g. because the AudioFile it points to is being deleted).  If
+     * the data is still referenced, it is deleted when the last
+     * reference goes instead of being kept.
+     */
+    void remove(void *index);
+
+    /**
+     * Delete all the data that isn't referenced.
+     */
+    void purge();
+
 protected:
     void clear();
 
     struct CacheRec {
-        CacheRec() : data(0), channels(0), nframes(0), refCount(0) { }
+        CacheRec() :
+            data(0), channels(0), nframes(0), refCount(0), retain(true) { }
         CacheRec(float **d, size_t c, size_t n) :
-            data(d), channels(c), nframes(n), refCount(1) { }
+            data(d), channels(c), nframes(n), refCount(1), retain(true) { }
         ~CacheRec();
+        size_t getBytes() const { return channels * nframes * sizeof(float); }
         float **data;
         size_t channels;
         size_t nframes;
         int refCount;
+        /// Keep once unreferenced (cleared by remove())
+        bool retain;
+        /// Position in m_unreferenced, if refCount is 0 and retain is set
+        std::list<void *>::iterator lruPosition;
     };
 
-    std::map<void *, CacheRec *> m_cache;
+    typedef std::map<void *, CacheRec *> CacheMap;
+
+    /// Take an entry out of m_cache (and m_unreferenced) and
+    /// subtract it from m_bytes.  Caller deletes it.
+    CacheRec *take(CacheMap::iterator i);
+
+    /// Take least recently used unreferenced entries until we're
+    /// within budget.  Delete them after unlocking.
+    void evict(std::vector<CacheRec *> &evicted);
+
+    CacheMap m_cache;
+
+    /// Indices of the entries with no references, least recently
+    /// used first.
+    std::list<void *> m_unreferenced;
+
+    size_t m_memoryBudget;
+    size_t m_bytes;
+
+    size_t m_hits;
+    size_t m_misses;
+    size_t m_evictions;
+
+    /// Guards all of the above.
+    mutable QMutex m_mutex;
 };
 
 }
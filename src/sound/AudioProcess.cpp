@@ -24,6 +24,7 @@
 #include "base/AudioLevel.h"
 #include "AudioPlayQueue.h"
 #include "PluginFactory.h"
+#include "MixKernels.h"
 
 #include "misc/Strings.h"
 #include <sys/time.h>
@@ -206,6 +207,8 @@ AudioThread::staticThreadRun(void *arg)
 
     pthread_cleanup_push(staticThreadCleanup, arg);
 
+    Profiles::getInstance()->registerThread(inst->m_name);
+
     inst->getLock();
     inst->m_exiting = false;
     inst->threadRun();
@@ -386,6 +389,10 @@ AudioBussMixer::generateBuffers()
             (void)mbuss->getProperty(MappedAudioBuss::Pan, pan);
 
             setBussLevels(i + 1, level, pan);
+
+            // A new buss starts at its levels rather than ramping to them
+            rec.lastGainLeft = rec.gainLeft;
+            rec.lastGainRight = rec.gainRight;
         }
     }
 
@@ -426,10 +433,13 @@ AudioBussMixer::emptyBuffers()
     generateBuffers();
 
     for (int i = 0; i < m_bussCount; ++i) {
-        m_bufferMap[i].dormant = true;
+        BufferRec &rec = m_bufferMap[i];
+        rec.dormant = true;
+        rec.lastGainLeft = rec.gainLeft;
+        rec.lastGainRight = rec.gainRight;
         for (int ch = 0; ch < 2; ++ch) {
-            if (int(m_bufferMap[i].buffers.size()) > ch) {
-                m_bufferMap[i].buffers[ch]->reset();
+            if (int(rec.buffers.size()) > ch) {
+                rec.buffers[ch]->reset();
             }
         }
     }
@@ -698,10 +708,32 @@ AudioBussMixer::processBlocks()
                         RingBuffer<sample_t, 2> *rb =
                             m_instrumentMixer->getRingBuffer(id, ch);
 
-                        if (rb)
-                            rb->readAdding(m_processBuffers[ch],
-                                           m_blockSize,
-                                           1);
+                        if (!rb)
+                            continue;
+
+                        // Mix straight from the ring buffer's storage
+                        const sample_t *first = 0, *second = 0;
+                        size_t firstCount = 0, secondCount = 0;
+                        size_t n = rb->getReadSpans(first, firstCount,
+                                                    second, secondCount,
+                                                    1);
+                        if (n > m_blockSize) {
+                            n = m_blockSize;
+                        }
+                        if (firstCount > n) {
+                            firstCount = n;
+                        }
+                        secondCount = n - firstCount;
+
+                        MixKernels::mixAdd(m_processBuffers[ch], first,
+                                           firstCount, 1.0f, 1.0f);
+                        if (secondCount > 0) {
+                            MixKernels::mixAdd(m_processBuffers[ch] + firstCount,
+                                               second, secondCount,
+                                               1.0f, 1.0f);
+                        }
+
+                        rb->skip(n, 1);
                     }
                 }
             }
@@ -764,17 +796,23 @@ AudioBussMixer::processBlocks()
                 }
             }
 
+            float lastGain[2];
+            lastGain[0] = rec.lastGainLeft;
+            lastGain[1] = rec.lastGainRight;
+
             for (int ch = 0; ch < 2; ++ch) {
                 if (dormant) {
                     rec.buffers[ch]->zero(m_blockSize);
                 } else {
-                    for (size_t j = 0; j < m_blockSize; ++j) {
-                        m_processBuffers[ch][j] *= gain[ch];
-                    }
+                    MixKernels::applyGain(m_processBuffers[ch], m_blockSize,
+                                          lastGain[ch], gain[ch]);
                     rec.buffers[ch]->write(m_processBuffers[ch], m_blockSize);
                 }
             }
 
+            rec.lastGainLeft = gain[0];
+            rec.lastGainRight = gain[1];
+
             rec.dormant = dormant;
 
 #ifdef DEBUG_BUSS_MIXER
@@ -853,37 +891,50 @@ AudioInstrumentMixer::AudioInstrumentMixer(SoundDriver *driver,
         AudioThread("AudioInstrumentMixer", driver, sampleRate),
         m_fileReader(fileReader),
         m_bussMixer(0),
-        m_blockSize(blockSize)
+        m_blockSize(blockSize),
+        m_pluginCommands(1023),
+        m_unwantedPlugins(2047),
+        m_pluginCommandHighWater(0),
+        m_pluginCommandBlocksDeferred(0),
+        m_pluginCommandOverflows(0)
 {
-    // Pregenerate empty plugin slots
+    pthread_mutex_init(&m_pluginCommandWriteLock, NULL);
+    pthread_mutex_init(&m_unwantedPluginLock, NULL);
 
-    InstrumentId audioInstrumentBase;
-    int audioInstruments;
-    m_driver->getAudioInstrumentNumbers(audioInstrumentBase, audioInstruments);
+    // Pregenerate empty plugin slots and buffer records
 
-    InstrumentId synthInstrumentBase;
-    int synthInstruments;
-    m_driver->getSoftSynthInstrumentNumbers(synthInstrumentBase, synthInstruments);
+    m_driver->getAudioInstrumentNumbers(m_audioInstrumentBase,
+                                        m_audioInstruments);
+    m_driver->getSoftSynthInstrumentNumbers(m_synthInstrumentBase,
+                                            m_synthInstruments);
 
-    for (int i = 0; i < audioInstruments + synthInstruments; ++i) {
+    m_bufferRecCount = m_audioInstruments + m_synthInstruments;
+    m_bufferRecs = new BufferRec[m_bufferRecCount];
+
+    for (int i = 0; i < m_bufferRecCount; ++i) {
 
         InstrumentId id;
-        if (i < audioInstruments)
-            id = audioInstrumentBase + i;
+        if (i < m_audioInstruments)
+            id = m_audioInstrumentBase + i;
         else
-            id = synthInstrumentBase + (i - audioInstruments);
+            id = m_synthInstrumentBase + (i - m_audioInstruments);
 
         PluginList &list = m_plugins[id];
         for (int j = 0; j < int(Instrument::PLUGIN_COUNT); ++j) {
             list.push_back(0);
         }
 
-        if (i >= audioInstruments) {
+        BufferRec &rec = m_bufferRecs[i];
+        rec.id = id;
+        rec.plugins = &list;
+
+        if (i >= m_audioInstruments) {
             m_synths[id] = 0;
+            rec.synth = &m_synths[id];
         }
     }
 
-    // Leave the buffer map and process buffer list empty for now.
+    // Leave the ring buffers and process buffer list empty for now.
     // The buffer length can change between plays, so we always
     // examine the buffers in fillBuffers and are prepared to
     // regenerate from scratch if necessary.  Don't like it though.
@@ -892,15 +943,20 @@ AudioInstrumentMixer::AudioInstrumentMixer(SoundDriver *driver,
 AudioInstrumentMixer::~AudioInstrumentMixer()
 {
     std::cerr << "AudioInstrumentMixer::~AudioInstrumentMixer" << std::endl;
-    // BufferRec dtor will handle the BufferMap
 
     removeAllPlugins();
 
+    // BufferRec dtor will handle the ring buffers
+    delete[] m_bufferRecs;
+
     for (std::vector<sample_t *>::iterator i = m_processBuffers.begin();
             i != m_processBuffers.end(); ++i) {
         delete[] *i;
     }
 
+    pthread_mutex_destroy(&m_pluginCommandWriteLock);
+    pthread_mutex_destroy(&m_unwantedPluginLock);
+
     std::cerr << "AudioInstrumentMixer::~AudioInstrumentMixer exiting" << std::endl;
 }
 
@@ -919,8 +975,8 @@ AudioInstrumentMixer::setPlugin(InstrumentId id, int position, QString identifie
     std::cerr << "AudioInstrumentMixer::setPlugin(" << id << ", " << position << ", " << identifier << ")" << std::endl;
 
     int channels = 2;
-    if (m_bufferMap.find(id) != m_bufferMap.end()) {
-        channels = m_bufferMap[id].channels;
+    if (BufferRec *rec = getBufferRec(id)) {
+        channels = rec->channels;
     }
 
     RunnablePluginInstance *instance = 0;
@@ -944,33 +1000,23 @@ AudioInstrumentMixer::setPlugin(InstrumentId id, int position, QString identifie
                   << identifier << std::endl;
     }
 
-    RunnablePluginInstance *oldInstance = 0;
-
-    if (position == int(Instrument::SYNTH_PLUGIN_POSITION)) {
-
-        oldInstance = m_synths[id];
-        m_synths[id] = instance;
-
-    } else {
-
-        PluginList &list = m_plugins[id];
+    RunnablePluginInstance **slot = getPluginSlot(id, position);
 
-        if (position < int(Instrument::PLUGIN_COUNT)) {
-            while (position >= (int)list.size()) {
-                list.push_back(0);
-            }
-            oldInstance = list[position];
-            list[position] = instance;
-        } else {
-            std::cerr << "AudioInstrumentMixer::setPlugin: No position "
-            << position << " for instrument " << id << std::endl;
-            delete instance;
-        }
+    if (!slot) {
+        std::cerr << "AudioInstrumentMixer::setPlugin: No position "
+        << position << " for instrument " << id << std::endl;
+        delete instance;
+        return;
     }
 
-    if (oldInstance) {
-        m_driver->claimUnwantedPlugin(oldInstance);
-    }
+    // The mixer swaps it in between blocks, and hands the old one
+    // back to be given to the driver's scavenger
+
+    PluginCommand command;
+    command.type = PluginCommand::SetInstance;
+    command.slot = slot;
+    command.instance = instance;
+    queuePluginCommand(command);
 }
 
 void
@@ -980,27 +1026,14 @@ AudioInstrumentMixer::removePlugin(InstrumentId id, int position)
 
     std::cerr << "AudioInstrumentMixer::removePlugin(" << id << ", " << position << ")" << std::endl;
 
-    RunnablePluginInstance *oldInstance = 0;
+    RunnablePluginInstance **slot = getPluginSlot(id, position);
+    if (!slot) return;
 
-    if (position == int(Instrument::SYNTH_PLUGIN_POSITION)) {
-
-        if (m_synths[id]) {
-            oldInstance = m_synths[id];
-            m_synths[id] = 0;
-        }
-
-    } else {
-
-        PluginList &list = m_plugins[id];
-        if (position < (int)list.size()) {
-            oldInstance = list[position];
-            list[position] = 0;
-        }
-    }
-
-    if (oldInstance) {
-        m_driver->claimUnwantedPlugin(oldInstance);
-    }
+    PluginCommand command;
+    command.type = PluginCommand::SetInstance;
+    command.slot = slot;
+    command.instance = 0;
+    queuePluginCommand(command);
 }
 
 void
@@ -1010,6 +1043,10 @@ AudioInstrumentMixer::removeAllPlugins()
 
     std::cerr << "AudioInstrumentMixer::removeAllPlugins" << std::endl;
 
+    // Let anything queued go first, so nothing it sets is left behind
+    flushPluginCommands();
+    disposeUnwantedPlugins();
+
     for (SynthPluginMap::iterator i = m_synths.begin();
             i != m_synths.end(); ++i) {
         if (i->second) {
@@ -1038,6 +1075,9 @@ AudioInstrumentMixer::getPluginInstance(InstrumentId id, int position)
 {
     // Not RT safe
 
+    // Anything queued for this plugin has to have reached it first
+    flushPluginCommands();
+
     if (position == int(Instrument::SYNTH_PLUGIN_POSITION)) {
         return m_synths[id];
     } else {
@@ -1049,19 +1089,159 @@ AudioInstrumentMixer::getPluginInstance(InstrumentId id, int position)
 }
 
 
+RunnablePluginInstance **
+AudioInstrumentMixer::getPluginSlot(InstrumentId id, int position)
+{
+    // Not RT safe
+
+    if (position == int(Instrument::SYNTH_PLUGIN_POSITION)) {
+        return &m_synths[id];
+    }
+
+    if (position < 0 || position >= int(Instrument::PLUGIN_COUNT)) {
+        return 0;
+    }
+
+    // Size the list fully now, so that it never moves once a command
+    // has a pointer into it
+    PluginList &list = m_plugins[id];
+    while (list.size() < size_t(Instrument::PLUGIN_COUNT)) {
+        list.push_back(0);
+    }
+    return &list[position];
+}
+
 void
-AudioInstrumentMixer::setPluginPortValue(InstrumentId id, int position,
-        unsigned int port, float value)
+AudioInstrumentMixer::queuePluginCommand(const PluginCommand &command)
 {
     // Not RT safe
 
-    RunnablePluginInstance *instance = getPluginInstance(id, position);
+    pthread_mutex_lock(&m_pluginCommandWriteLock);
 
-    if (instance) {
-        instance->setPortValue(port, value);
+    // Make room for anything this command swaps out
+    disposeUnwantedPlugins();
+
+    if (m_pluginCommands.getWriteSpace() == 0) {
+        // The mixer isn't keeping up (or isn't running).  Make room
+        // the slow way.
+        m_pluginCommandOverflows.fetchAndAddRelaxed(1);
+        flushPluginCommands();
+    }
+
+    m_pluginCommands.write(&command, 1);
+
+    // Only ever raise it
+    int pending = int(m_pluginCommands.getReadSpace());
+    for (;;) {
+        int highWater = atomicLoad(m_pluginCommandHighWater);
+        if (pending <= highWater) break;
+        if (m_pluginCommandHighWater.testAndSetOrdered(highWater, pending)) {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&m_pluginCommandWriteLock);
+
+    // If we're not playing, nothing may be processing blocks to pick
+    // it up, and there's no harm in taking the lock to do it now
+    if (!m_driver->isPlaying()) {
+        flushPluginCommands();
+        disposeUnwantedPlugins();
     }
 }
 
+void
+AudioInstrumentMixer::applyPluginCommands(size_t max)
+{
+    // Needs to be RT safe
+
+    size_t n = 0;
+
+    while (m_pluginCommands.getReadSpace() > 0) {
+
+        if (n == max) {
+            m_pluginCommandBlocksDeferred.fetchAndAddRelaxed(1);
+            break;
+        }
+
+        PluginCommand command;
+        m_pluginCommands.read(&command, 1);
+        ++n;
+
+        RunnablePluginInstance *instance = *command.slot;
+
+        switch (command.type) {
+
+        case PluginCommand::SetPortValue:
+            if (instance) instance->setPortValue(command.port, command.value);
+            break;
+
+        case PluginCommand::SetBypass:
+            if (instance) instance->setBypassed(command.bypass);
+            break;
+
+        case PluginCommand::SetInstance:
+            *command.slot = command.instance;
+            if (instance) {
+                if (m_unwantedPlugins.getWriteSpace() > 0) {
+                    m_unwantedPlugins.write(&instance, 1);
+                } else {
+                    // Can't happen, as the writers empty this before
+                    // each command they queue.  But better to take
+                    // the scavenger's lock than to leak.
+                    m_driver->claimUnwantedPlugin(instance);
+                }
+            }
+            break;
+        }
+    }
+}
+
+void
+AudioInstrumentMixer::disposeUnwantedPlugins()
+{
+    // Not RT safe
+
+    pthread_mutex_lock(&m_unwantedPluginLock);
+
+    while (m_unwantedPlugins.getReadSpace() > 0) {
+        RunnablePluginInstance *instance = 0;
+        m_unwantedPlugins.read(&instance, 1);
+        m_driver->claimUnwantedPlugin(instance);
+    }
+
+    pthread_mutex_unlock(&m_unwantedPluginLock);
+}
+
+void
+AudioInstrumentMixer::flushPluginCommands()
+{
+    // Not RT safe
+
+    if (m_pluginCommands.getReadSpace() == 0) return;
+
+    getLock();
+    applyPluginCommands(m_pluginCommands.getSize());
+    releaseLock();
+}
+
+void
+AudioInstrumentMixer::setPluginPortValue(InstrumentId id, int position,
+        unsigned int port, float value)
+{
+    // Not RT safe, but doesn't wait for the mixer
+
+    RunnablePluginInstance **slot = getPluginSlot(id, position);
+    if (!slot) return;
+
+    PluginCommand command;
+    command.type = PluginCommand::SetPortValue;
+    command.slot = slot;
+    command.port = port;
+    command.value = value;
+    queuePluginCommand(command);
+}
+
 float
 AudioInstrumentMixer::getPluginPortValue(InstrumentId id, int position,
         unsigned int port)
@@ -1080,11 +1260,16 @@ AudioInstrumentMixer::getPluginPortValue(InstrumentId id, int position,
 void
 AudioInstrumentMixer::setPluginBypass(InstrumentId id, int position, bool bypass)
 {
-    // Not RT safe
+    // Not RT safe, but doesn't wait for the mixer
 
-    RunnablePluginInstance *instance = getPluginInstance(id, position);
-    if (instance)
-        instance->setBypassed(bypass);
+    RunnablePluginInstance **slot = getPluginSlot(id, position);
+    if (!slot) return;
+
+    PluginCommand command;
+    command.type = PluginCommand::SetBypass;
+    command.slot = slot;
+    command.bypass = bypass;
+    queuePluginCommand(command);
 }
 
 QStringList
@@ -1163,6 +1348,8 @@ AudioInstrumentMixer::discardPluginEvents()
     getLock();
     if (m_bussMixer) m_bussMixer->getLock();
 
+    applyPluginCommands(m_pluginCommands.getSize());
+
     for (SynthPluginMap::iterator j = m_synths.begin();
             j != m_synths.end(); ++j) {
 
@@ -1204,14 +1391,16 @@ AudioInstrumentMixer::resetAllPlugins(bool discardEvents)
     if (m_bussMixer)
         m_bussMixer->getLock();
 
+    applyPluginCommands(m_pluginCommands.getSize());
+
     for (SynthPluginMap::iterator j = m_synths.begin();
             j != m_synths.end(); ++j) {
 
         InstrumentId id = j->first;
 
         int channels = 2;
-        if (m_bufferMap.find(id) != m_bufferMap.end()) {
-            channels = m_bufferMap[id].channels;
+        if (BufferRec *rec = getBufferRec(id)) {
+            channels = rec->channels;
         }
 
         RunnablePluginInstance *instance = j->second;
@@ -1233,8 +1422,8 @@ AudioInstrumentMixer::resetAllPlugins(bool discardEvents)
         InstrumentId id = j->first;
 
         int channels = 2;
-        if (m_bufferMap.find(id) != m_bufferMap.end()) {
-            channels = m_bufferMap[id].channels;
+        if (BufferRec *rec = getBufferRec(id)) {
+            channels = rec->channels;
         }
 
         for (PluginList::iterator i = m_plugins[id].begin();
@@ -1268,6 +1457,10 @@ AudioInstrumentMixer::destroyAllPlugins()
     if (m_bussMixer)
         m_bussMixer->getLock();
 
+    // Anything queued swaps in first, so the scavenger gets what it
+    // swaps out
+    applyPluginCommands(m_pluginCommands.getSize());
+
     // Delete immediately, as we're probably exiting here -- don't use
     // the scavenger.
 
@@ -1295,6 +1488,7 @@ AudioInstrumentMixer::destroyAllPlugins()
     }
 
     // and tell the driver to get rid of anything already scavenged.
+    disposeUnwantedPlugins();
     m_driver->scavengePlugins();
 
     if (m_bussMixer)
@@ -1375,7 +1569,7 @@ AudioInstrumentMixer::generateBuffers()
         (void)fader->getProperty(MappedAudioFader::Channels, fch);
         unsigned int channels = (unsigned int)fch;
 
-        BufferRec &rec = m_bufferMap[id];
+        BufferRec &rec = m_bufferRecs[i];
 
         rec.channels = channels;
 
@@ -1504,29 +1698,24 @@ AudioInstrumentMixer::emptyBuffers(RealTime currentTime)
 
     generateBuffers();
 
-    InstrumentId audioInstrumentBase;
-    int audioInstruments;
-    m_driver->getAudioInstrumentNumbers(audioInstrumentBase, audioInstruments);
-
-    InstrumentId synthInstrumentBase;
-    int synthInstruments;
-    m_driver->getSoftSynthInstrumentNumbers(synthInstrumentBase, synthInstruments);
+    for (int i = 0; i < m_bufferRecCount; ++i) {
 
-    for (int i = 0; i < audioInstruments + synthInstruments; ++i) {
+        BufferRec &rec = m_bufferRecs[i];
 
-        InstrumentId id;
-        if (i < audioInstruments)
-            id = audioInstrumentBase + i;
-        else
-            id = synthInstrumentBase + (i - audioInstruments);
+        rec.dormant = true;
+        rec.muted = false;
+        rec.zeroFrames = 0;
+        rec.filledFrom = currentTime;
+        rec.filledFrames = 0;
+        rec.filledTo = currentTime;
 
-        m_bufferMap[id].dormant = true;
-        m_bufferMap[id].muted = false;
-        m_bufferMap[id].zeroFrames = 0;
-        m_bufferMap[id].filledTo = currentTime;
+        // Start at the current levels rather than ramping to them
+        rec.lastGainLeft = rec.gainLeft;
+        rec.lastGainRight = rec.gainRight;
+        rec.lastVolume = rec.volume;
 
-        for (size_t i = 0; i < m_bufferMap[id].buffers.size(); ++i) {
-            m_bufferMap[id].buffers[i]->reset();
+        for (size_t j = 0; j < rec.buffers.size(); ++j) {
+            rec.buffers[j]->reset();
         }
     }
 
@@ -1538,7 +1727,11 @@ AudioInstrumentMixer::setInstrumentLevels(InstrumentId id, float dB, float pan)
 {
     // No requirement to be RT safe
 
-    BufferRec &rec = m_bufferMap[id];
+    BufferRec *recp = getBufferRec(id);
+    if (!recp)
+        return;
+
+    BufferRec &rec = *recp;
 
     float volume = AudioLevel::dB_to_multiplier(dB);
 
@@ -1556,11 +1749,10 @@ AudioInstrumentMixer::updateInstrumentMuteStates()
 {
     ControlBlock *cb = ControlBlock::getInstance();
 
-    for (BufferMap::iterator i = m_bufferMap.begin();
-	 i != m_bufferMap.end(); ++i) {
+    for (int i = 0; i < m_bufferRecCount; ++i) {
 
-	InstrumentId id = i->first;
-	BufferRec &rec = i->second;
+	BufferRec &rec = m_bufferRecs[i];
+	InstrumentId id = rec.id;
 	
 	if (id >= SoftSynthInstrumentBase) {
 	    rec.muted = cb->isInstrumentMuted(id);
@@ -1582,13 +1774,15 @@ AudioInstrumentMixer::processBlocks(bool &readSomething)
 
     //    Profiler profiler("processBlocks", true);
 
+    // This is the block boundary: bring the plugins up to date
+    applyPluginCommands(MAX_PLUGIN_COMMANDS_PER_BLOCK);
+
     const AudioPlayQueue *queue = m_driver->getAudioQueue();
 
-    for (BufferMap::iterator i = m_bufferMap.begin();
-            i != m_bufferMap.end(); ++i) {
+    for (int i = 0; i < m_bufferRecCount; ++i) {
 
-        InstrumentId id = i->first;
-        BufferRec &rec = i->second;
+        BufferRec &rec = m_bufferRecs[i];
+        InstrumentId id = rec.id;
 
         // This "muted" flag actually only strictly means muted when
         // applied to synth instruments.  For audio instruments it's
@@ -1603,15 +1797,15 @@ AudioInstrumentMixer::processBlocks(bool &readSomething)
         if (rec.muted) {
             empty = true;
         } else {
-            if (id >= SoftSynthInstrumentBase) {
-                empty = (!m_synths[id] || m_synths[id]->isBypassed());
+            if (rec.synth) {
+                empty = (!*rec.synth || (*rec.synth)->isBypassed());
             } else {
                 empty = !queue->haveFilesForInstrument(id);
             }
 
             if (empty) {
-                for (PluginList::iterator j = m_plugins[id].begin();
-                        j != m_plugins[id].end(); ++j) {
+                for (PluginList::iterator j = rec.plugins->begin();
+                        j != rec.plugins->end(); ++j) {
                     if (*j != 0) {
                         empty = false;
                         break;
@@ -1626,15 +1820,16 @@ AudioInstrumentMixer::processBlocks(bool &readSomething)
             // to set its filledTo field to match that of an existing
             // non-empty instrument, if we can find one.
 
-            for (BufferMap::iterator j = m_bufferMap.begin();
-                    j != m_bufferMap.end(); ++j) {
+            for (int j = 0; j < m_bufferRecCount; ++j) {
 
-                if (j->first == i->first)
+                if (j == i)
                     continue;
-                if (j->second.empty)
+                if (m_bufferRecs[j].empty)
                     continue;
 
-                rec.filledTo = j->second.filledTo;
+                rec.filledFrom = m_bufferRecs[j].filledFrom;
+                rec.filledFrames = m_bufferRecs[j].filledFrames;
+                rec.filledTo = m_bufferRecs[j].filledTo;
                 break;
             }
         }
@@ -1658,11 +1853,9 @@ AudioInstrumentMixer::processBlocks(bool &readSomething)
 
         more = false;
 
-        for (BufferMap::iterator i = m_bufferMap.begin();
-                i != m_bufferMap.end(); ++i) {
+        for (int i = 0; i < m_bufferRecCount; ++i) {
 
-            InstrumentId id = i->first;
-            BufferRec &rec = i->second;
+            BufferRec &rec = m_bufferRecs[i];
 
             if (rec.empty) {
                 rec.dormant = true;
@@ -1671,15 +1864,15 @@ AudioInstrumentMixer::processBlocks(bool &readSomething)
 
             size_t playCount = MAX_FILES_PER_INSTRUMENT;
 
-            if (id >= SoftSynthInstrumentBase)
+            if (rec.synth)
                 playCount = 0;
             else {
                 queue->getPlayingFilesForInstrument(rec.filledTo,
-                                                    blockDuration, id,
+                                                    blockDuration, rec.id,
                                                     playing, playCount);
             }
 
-            if (processBlock(id, playing, playCount, readSomething)) {
+            if (processBlock(rec, playing, playCount, readSomething)) {
                 more = true;
             }
         }
@@ -1688,7 +1881,7 @@ AudioInstrumentMixer::processBlocks(bool &readSomething)
 
 
 bool
-AudioInstrumentMixer::processBlock(InstrumentId id,
+AudioInstrumentMixer::processBlock(BufferRec &rec,
                                    PlayableAudioFile **playing,
                                    size_t playCount,
                                    bool &readSomething)
@@ -1697,7 +1890,7 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
 
     //    Profiler profiler("processBlock", true);
 
-    BufferRec &rec = m_bufferMap[id];
+    const InstrumentId id = rec.id;
     RealTime bufferTime = rec.filledTo;
 
 #ifdef DEBUG_MIXER 
@@ -1743,7 +1936,7 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
         }
     }
 
-    PluginList &plugins = m_plugins[id];
+    PluginList &plugins = *rec.plugins;
 
 #ifdef DEBUG_MIXER
 
@@ -1834,7 +2027,7 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
         memset(m_processBuffers[ch], 0, sizeof(sample_t) * m_blockSize);
     }
 
-    RunnablePluginInstance *synth = m_synths[id];
+    RunnablePluginInstance *synth = rec.synth ? *rec.synth : 0;
 
     if (synth && !synth->isBypassed()) {
 
@@ -1960,22 +2153,25 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
         }
     }
 
-    // special handling for pan on mono tracks
+    // Handle volume and pan, ramping from the levels the last block
+    // ended at in case they've changed since.  Take a copy of the new
+    // levels first, as they may be changed under us.
+
+    const float gainLeft = rec.gainLeft;
+    const float gainRight = rec.gainRight;
+    const float volume = rec.volume;
 
     bool allZeros = true;
 
     if (targetChannels == 2 && channels == 1) {
 
-        for (size_t i = 0; i < m_blockSize; ++i) {
+        // special handling for pan on mono tracks
 
-            sample_t sample = m_processBuffers[0][i];
-
-            m_processBuffers[0][i] = sample * rec.gainLeft;
-            m_processBuffers[1][i] = sample * rec.gainRight;
-
-            if (allZeros && sample != 0.0)
-                allZeros = false;
-        }
+        allZeros = MixKernels::pan(m_processBuffers[0],
+                                   m_processBuffers[0], m_processBuffers[1],
+                                   m_blockSize,
+                                   rec.lastGainLeft, gainLeft,
+                                   rec.lastGainRight, gainRight);
 
         rec.buffers[0]->write(m_processBuffers[0], m_blockSize);
         rec.buffers[1]->write(m_processBuffers[1], m_blockSize);
@@ -1984,22 +2180,23 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
 
         for (unsigned int ch = 0; ch < targetChannels; ++ch) {
 
-            float gain = ((ch == 0) ? rec.gainLeft :
-                          (ch == 1) ? rec.gainRight : rec.volume);
-
-            for (size_t i = 0; i < m_blockSize; ++i) {
+            float from = ((ch == 0) ? rec.lastGainLeft :
+                          (ch == 1) ? rec.lastGainRight : rec.lastVolume);
+            float to = ((ch == 0) ? gainLeft :
+                        (ch == 1) ? gainRight : volume);
 
-                // handle volume and pan
-                m_processBuffers[ch][i] *= gain;
-
-                if (allZeros && m_processBuffers[ch][i] != 0.0)
-                    allZeros = false;
-            }
+            if (!MixKernels::applyGain(m_processBuffers[ch], m_blockSize,
+                                       from, to))
+                allZeros = false;
 
             rec.buffers[ch]->write(m_processBuffers[ch], m_blockSize);
         }
     }
 
+    rec.lastGainLeft = gainLeft;
+    rec.lastGainRight = gainRight;
+    rec.lastVolume = volume;
+
     bool dormant = true;
 
     if (allZeros) {
@@ -2020,10 +2217,10 @@ AudioInstrumentMixer::processBlock(InstrumentId id,
 #endif
 
     rec.dormant = dormant;
-    bufferTime = bufferTime + RealTime::frame2RealTime(m_blockSize,
-                 m_sampleRate);
 
-    rec.filledTo = bufferTime;
+    rec.filledFrames += long(m_blockSize);
+    rec.filledTo = rec.filledFrom +
+        RealTime::frame2RealTime(rec.filledFrames, m_sampleRate);
 
 #ifdef DEBUG_MIXER
 
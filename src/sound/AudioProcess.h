@@ -17,6 +17,7 @@
 #define RG_AUDIO_PROCESS_H
 
 #include "SoundDriver.h"
+#include "base/AtomicCompat.h"
 #include "base/Instrument.h"
 #include "base/RealTime.h"
 #include "RingBuffer.h"
@@ -144,7 +145,8 @@ protected:
     struct BufferRec
     {
         BufferRec() : dormant(true), buffers(), instruments(),
-                      gainLeft(0.0), gainRight(0.0) { }
+                      gainLeft(0.0), gainRight(0.0),
+                      lastGainLeft(0.0), lastGainRight(0.0) { }
         ~BufferRec();
 
         bool dormant;
@@ -154,6 +156,10 @@ protected:
 
         float gainLeft;
         float gainRight;
+
+        // Gains at the end of the last block, to ramp from
+        float lastGainLeft;
+        float lastGainRight;
     };
 
     typedef std::map<int, BufferRec> BufferMap;
@@ -207,6 +213,33 @@ public:
 
     RunnablePluginInstance *getSynthPlugin(InstrumentId id) { return m_synths[id]; }
 
+    /**
+     * Diagnostics for the plugin command queue.  Commands waiting to
+     * be applied; the most there have been waiting at once; the number
+     * of blocks that left some for the next because of the per-block
+     * limit; and the number of times the queue filled up and a writer
+     * had to take the lock and apply them itself.
+     */
+    size_t getPluginCommandsPending() const {
+        return m_pluginCommands.getReadSpace();
+    }
+    int getPluginCommandHighWater() const {
+        return atomicLoad(m_pluginCommandHighWater);
+    }
+    int getPluginCommandBlocksDeferred() const {
+        return atomicLoad(m_pluginCommandBlocksDeferred);
+    }
+    int getPluginCommandOverflows() const {
+        return atomicLoad(m_pluginCommandOverflows);
+    }
+
+    /**
+     * Hand the plugins that the mixer has swapped out of their slots
+     * to the driver's scavenger.  Not RT safe; for call regularly
+     * from a non-RT thread.
+     */
+    void disposeUnwantedPlugins();
+
     /**
      * Return the plugins intended for a particular buss.  (By coincidence,
      * this will also work for instruments, but it's not to be relied on.)
@@ -245,7 +278,8 @@ public:
      * instruments can safely be ignored during playback.
      */
     bool isInstrumentEmpty(InstrumentId id) {
-        return m_bufferMap[id].empty;
+        BufferRec *rec = getBufferRec(id);
+        return !rec || rec->empty;
     }
 
     /**
@@ -255,7 +289,8 @@ public:
      * be ignored (unless also empty).
      */
     bool isInstrumentDormant(InstrumentId id) {
-        return m_bufferMap[id].dormant;
+        BufferRec *rec = getBufferRec(id);
+        return !rec || rec->dormant;
     }
 
     /**
@@ -265,8 +300,9 @@ public:
      * these buffers.
      */
     RingBuffer<sample_t, 2> *getRingBuffer(InstrumentId id, unsigned int channel) {
-        if (channel < (unsigned int)m_bufferMap[id].buffers.size()) {
-            return m_bufferMap[id].buffers[channel];
+        BufferRec *rec = getBufferRec(id);
+        if (rec && channel < (unsigned int)rec->buffers.size()) {
+            return rec->buffers[channel];
         } else {
             return 0;
         }
@@ -283,9 +319,11 @@ protected:
 
     virtual int getPriority() { return 3; }
 
+    struct BufferRec;
+
     void processBlocks(bool &readSomething);
     void processEmptyBlocks(InstrumentId id);
-    bool processBlock(InstrumentId id, PlayableAudioFile **, size_t, bool &readSomething);
+    bool processBlock(BufferRec &rec, PlayableAudioFile **, size_t, bool &readSomething);
     void generateBuffers();
 
     AudioFileReader  *m_fileReader;
@@ -296,25 +334,84 @@ protected:
     // fixed size during normal run time; this will allow us to add
     // and edit plugins without locking.
     RunnablePluginInstance *getPluginInstance(InstrumentId, int);
+    RunnablePluginInstance **getPluginSlot(InstrumentId, int);
     PluginMap m_plugins;
     SynthPluginMap m_synths;
 
+    /**
+     * A change to a plugin, made by the mixer between blocks.  Port
+     * values, bypass and the plugin in a slot are changed this way, so
+     * that the audio threads never see a plugin change under them and
+     * the writers never have to take the mixer's lock.
+     *
+     * The slot is looked up by the writer, so the mixer doesn't have
+     * to touch the maps.  The instance in it is looked up only when
+     * the command is applied, so a value set just after a new plugin
+     * goes to the new plugin.
+     */
+    struct PluginCommand
+    {
+        enum Type { SetPortValue, SetBypass, SetInstance };
+
+        Type type;
+        RunnablePluginInstance **slot;
+        RunnablePluginInstance *instance; // SetInstance
+        unsigned int port;                // SetPortValue
+        float value;                      // SetPortValue
+        bool bypass;                      // SetBypass
+    };
+
+    /// Not RT safe.  Called from one non-RT thread at a time.
+    void queuePluginCommand(const PluginCommand &command);
+
+    /// Apply up to max queued commands.  RT safe, but must be called
+    /// with the lock held (or from kick(false)).
+    void applyPluginCommands(size_t max);
+
+    /// Take the lock and apply everything queued.  Not RT safe.
+    void flushPluginCommands();
+
+    /// Most commands applied between one block and the next
+    static const size_t MAX_PLUGIN_COMMANDS_PER_BLOCK = 64;
+
+    RingBuffer<PluginCommand> m_pluginCommands;
+    pthread_mutex_t m_pluginCommandWriteLock; // for the writers only
+
+    // Plugins swapped out by SetInstance commands, on their way back
+    // to the non-RT side.  There is room for more than can be queued
+    // at once, so the mixer never has to wait for the reader.
+    RingBuffer<RunnablePluginInstance *> m_unwantedPlugins;
+    pthread_mutex_t m_unwantedPluginLock; // for the readers only
+
+    QAtomicInt m_pluginCommandHighWater;
+    QAtomicInt m_pluginCommandBlocksDeferred;
+    QAtomicInt m_pluginCommandOverflows;
+
     // maintain the same number of these as the maximum number of
     // channels on any audio instrument
     std::vector<sample_t *> m_processBuffers;
 
     struct BufferRec
     {
-        BufferRec() : empty(true), dormant(true), zeroFrames(0),
+        BufferRec() : id(0), empty(true), dormant(true), zeroFrames(0),
+                      filledFrom(RealTime::zeroTime), filledFrames(0),
                       filledTo(RealTime::zeroTime), channels(2),
                       buffers(), gainLeft(0.0), gainRight(0.0), volume(0.0),
-                      muted(false) { }
+                      lastGainLeft(0.0), lastGainRight(0.0), lastVolume(0.0),
+                      muted(false), plugins(0), synth(0) { }
         ~BufferRec();
 
+        InstrumentId id;
+
         bool empty;
         bool dormant;
         size_t zeroFrames;
 
+        // filledTo is kept as a count of frames from filledFrom, so
+        // that adding up block durations can't make it drift off the
+        // frame it should be on
+        RealTime filledFrom;
+        long filledFrames;
         RealTime filledTo;
         size_t channels;
         std::vector<RingBuffer<sample_t, 2> *> buffers;
@@ -322,11 +419,49 @@ protected:
         float gainLeft;
         float gainRight;
         float volume;
+
+        // Gains at the end of the last block, to ramp from
+        float lastGainLeft;
+        float lastGainRight;
+        float lastVolume;
+
         bool muted;
+
+        // This instrument's entries in m_plugins and m_synths (synth
+        // is 0 for audio instruments), so as not to have to look
+        // them up while processing.
+        PluginList *plugins;
+        RunnablePluginInstance **synth;
     };
 
-    typedef std::map<InstrumentId, BufferRec> BufferMap;
-    BufferMap m_bufferMap;
+    /**
+     * One BufferRec for each instrument: the audio instruments, then
+     * the synths, in the order the driver numbers them.  The driver's
+     * instrument numbers don't change, so this is allocated once, in
+     * the constructor, and never moves.
+     */
+    BufferRec *m_bufferRecs;
+    int m_bufferRecCount;
+
+    InstrumentId m_audioInstrumentBase;
+    int m_audioInstruments;
+    InstrumentId m_synthInstrumentBase;
+    int m_synthInstruments;
+
+    /// The BufferRec for an instrument, or 0 if it isn't an audio or
+    /// synth instrument.
+    BufferRec *getBufferRec(InstrumentId id) {
+        if (id >= m_audioInstrumentBase &&
+            id < m_audioInstrumentBase + m_audioInstruments) {
+            return &m_bufferRecs[id - m_audioInstrumentBase];
+        }
+        if (id >= m_synthInstrumentBase &&
+            id < m_synthInstrumentBase + m_synthInstruments) {
+            return &m_bufferRecs[m_audioInstruments +
+                                 (id - m_synthInstrumentBase)];
+        }
+        return 0;
+    }
 };
 
 
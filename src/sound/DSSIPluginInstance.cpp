@@ -21,6 +21,7 @@
 
 #include <QtGlobal>
 
+#include <algorithm>
 #include <cstdlib>
 
 
@@ -57,7 +58,7 @@ DSSIPluginInstance::DSSIPluginInstance(PluginFactory *factory,
         m_position(position),
         m_descriptor(descriptor),
         m_programCacheValid(false),
-        m_eventBuffer(EVENT_BUFFER_SIZE),
+        m_eventQueue(EVENT_BUFFER_SIZE),
         m_blockSize(blockSize),
         m_idealChannelCount(idealChannelCount),
         m_sampleRate(sampleRate),
@@ -113,7 +114,7 @@ DSSIPluginInstance::DSSIPluginInstance(PluginFactory *factory,
         m_instrument(instrument),
         m_position(position),
         m_descriptor(descriptor),
-        m_eventBuffer(EVENT_BUFFER_SIZE),
+        m_eventQueue(EVENT_BUFFER_SIZE),
         m_blockSize(blockSize),
         m_inputBuffers(inputBuffers),
         m_outputBuffers(outputBuffers),
@@ -252,7 +253,7 @@ DSSIPluginInstance::discardEvents()
     std::cerr << "DSSIPluginInstance::discardEvents" << std::endl;
 #endif
 
-    m_eventBuffer.reset();
+    m_eventQueue.discard();
 }
 
 void
@@ -834,7 +835,36 @@ DSSIPluginInstance::sendEvent(const RealTime &eventTime,
     // DSSI doesn't use MIDI channels, it uses run_multiple_synths instead.
     ev.data.note.channel = 0;
 
-    m_eventBuffer.write(&ev, 1);
+    m_eventQueue.write(&ev, 1);
+}
+
+void
+DSSIPluginInstance::sendEvents(const void *e, size_t count)
+{
+    const snd_seq_event_t *events = (const snd_seq_event_t *)e;
+
+#ifdef DEBUG_DSSI_PROCESS
+    std::cerr << "DSSIPluginInstance::sendEvents: " << count << " events" << std::endl;
+#endif
+
+    // A chunk at a time, as we have to clear the channels
+
+    static const size_t chunkSize = 64;
+    snd_seq_event_t chunk[chunkSize];
+
+    while (count > 0) {
+        size_t n = std::min(count, chunkSize);
+        for (size_t i = 0; i < n; ++i) {
+            chunk[i] = events[i];
+            chunk[i].data.note.channel = 0;
+        }
+        if (m_eventQueue.write(chunk, n) < n) {
+            std::cerr << "WARNING: DSSIPluginInstance::sendEvents: event queue full, dropping events" << std::endl;
+            return;
+        }
+        events += n;
+        count -= n;
+    }
 }
 
 bool
@@ -872,8 +902,8 @@ void
 DSSIPluginInstance::run(const RealTime &blockTime)
 {
     static snd_seq_event_t localEventBuffer[EVENT_BUFFER_SIZE];
+    size_t evRead = 0;
     int evCount = 0;
-    unsigned int evDeferred = 0;
 
     bool needLock = false;
     if (m_descriptor->select_program)
@@ -894,7 +924,7 @@ DSSIPluginInstance::run(const RealTime &blockTime)
     }
 
     if (!m_descriptor || !m_descriptor->run_synth) {
-        m_eventBuffer.skip(m_eventBuffer.getReadSpace());
+        m_eventQueue.discard();
         if (m_descriptor->LADSPA_Plugin->run) {
             m_descriptor->LADSPA_Plugin->run(m_instanceHandle, m_blockSize);
         } else {
@@ -915,53 +945,30 @@ DSSIPluginInstance::run(const RealTime &blockTime)
 
 #ifdef DEBUG_DSSI_PROCESS
 
-    if (m_eventBuffer.getReadSpace() > 0) {
-        std::cerr << "DSSIPluginInstance::run: event buffer has "
-        << m_eventBuffer.getReadSpace() << " event(s) in it" << std::endl;
+    if (m_eventQueue.getReadSpace() > 0) {
+        std::cerr << "DSSIPluginInstance::run: event queue has "
+        << m_eventQueue.getReadSpace() << " event(s) in it" << std::endl;
     }
 #endif
 
-    while (m_eventBuffer.getReadSpace() > evDeferred) {
+    // This block's events, in order, with their frame offsets.  The
+    // controllers and program changes we handle ourselves are taken
+    // out as we go.
 
-        snd_seq_event_t *ev = localEventBuffer + evCount;
-        *ev = m_eventBuffer.peek();
-        bool accept = true;
+    evRead = m_eventQueue.readBlock(blockTime, m_blockSize, m_sampleRate,
+                                    localEventBuffer, EVENT_BUFFER_SIZE);
 
-        RealTime evTime(ev->time.time.tv_sec, ev->time.time.tv_nsec);
+    for (size_t i = 0; i < evRead; ++i) {
 
-        int frameOffset = 0;
-        if (evTime > blockTime) {
-            frameOffset = (int)RealTime::realTime2Frame(evTime - blockTime, m_sampleRate);
-        }
+        snd_seq_event_t *ev = localEventBuffer + i;
+        bool accept = true;
 
 #ifdef DEBUG_DSSI_PROCESS
-        std::cerr << "DSSIPluginInstance::run: evTime " << evTime << ", blockTime " << blockTime << ", frameOffset " << frameOffset
+        std::cerr << "DSSIPluginInstance::run: frameOffset " << ev->time.tick
         << ", blockSize " << m_blockSize << std::endl;
         std::cerr << "Type: " << int(ev->type) << ", pitch: " << int(ev->data.note.note) << ", velocity: " << int(ev->data.note.velocity) << std::endl;
 #endif
 
-        if (frameOffset >= int(m_blockSize)) {
-            if (m_eventBuffer.getReadSpace() == 1) {
-                break;
-            }
-            // The events are possibly unsorted because we can merge events played in
-            // realtime with recorded events (generally sorted but not immediate), so
-            // we reinsert the current event at the last position and continue to read
-            // the other events.
-            m_eventBuffer.skip(1);
-            m_eventBuffer.write(ev, 1);
-            if (m_eventBuffer.getReadSpace() == ++evDeferred) {
-                // No other events to read.
-                break;
-            }
-            continue;
-        }
-        if (frameOffset < 0)
-            frameOffset = 0;
-
-        ev->time.tick = (unsigned int)frameOffset;
-        m_eventBuffer.skip(1);
-
         if (ev->type == SND_SEQ_EVENT_CONTROLLER) {
             accept = handleController(ev);
         } else if (ev->type == SND_SEQ_EVENT_PGMCHANGE) {
@@ -970,8 +977,8 @@ DSSIPluginInstance::run(const RealTime &blockTime)
         }
 
         if (accept) {
-            if (++evCount >= EVENT_BUFFER_SIZE)
-                break;
+            if (int(i) != evCount) localEventBuffer[evCount] = *ev;
+            ++evCount;
         }
     }
 
@@ -1092,8 +1099,6 @@ DSSIPluginInstance::runGrouped(const RealTime &blockTime)
     size_t index = 0;
     unsigned long *counts = (unsigned long *)
                             alloca(m_groupLocalEventBufferCount * sizeof(unsigned long));
-    unsigned long *evDeferred = (unsigned long *)
-                                alloca(m_groupLocalEventBufferCount * sizeof(unsigned long));
     LADSPA_Handle *instances = (LADSPA_Handle *)
                                alloca(m_groupLocalEventBufferCount * sizeof(LADSPA_Handle));
 
@@ -1104,7 +1109,6 @@ DSSIPluginInstance::runGrouped(const RealTime &blockTime)
 
         DSSIPluginInstance *instance = *i;
         counts[index] = 0;
-        evDeferred[index] = 0;
         instances[index] = instance->m_instanceHandle;
 
 #ifdef DEBUG_DSSI_PROCESS
@@ -1121,47 +1125,21 @@ DSSIPluginInstance::runGrouped(const RealTime &blockTime)
             (instance->m_instanceHandle, bank, program);
         }
 
-        while (instance->m_eventBuffer.getReadSpace() > evDeferred[index]) {
+        snd_seq_event_t *events = m_groupLocalEventBuffers[index];
 
-            snd_seq_event_t *ev = m_groupLocalEventBuffers[index] + counts[index];
-            *ev = instance->m_eventBuffer.peek();
-            bool accept = true;
+        size_t evRead = instance->m_eventQueue.readBlock
+            (blockTime, m_blockSize, m_sampleRate, events, EVENT_BUFFER_SIZE);
 
-            RealTime evTime(ev->time.time.tv_sec, ev->time.time.tv_nsec);
+        for (size_t i = 0; i < evRead; ++i) {
 
-            int frameOffset = 0;
-            if (evTime > blockTime) {
-                frameOffset = (int)RealTime::realTime2Frame(evTime - blockTime, m_sampleRate);
-            }
+            snd_seq_event_t *ev = events + i;
+            bool accept = true;
 
 #ifdef DEBUG_DSSI_PROCESS
-            std::cerr << "DSSIPluginInstance::runGrouped: evTime " << evTime << ", frameOffset " << frameOffset
+            std::cerr << "DSSIPluginInstance::runGrouped: frameOffset " << ev->time.tick
             << ", block size " << m_blockSize << std::endl;
 #endif
 
-            if (frameOffset >= int(m_blockSize)) {
-                if (instance->m_eventBuffer.getReadSpace() == 1) {
-                    break;
-                }
-                // The events are possibly unsorted because we can merge events played in
-                // realtime with recorded events (generally sorted but not immediate), so
-                // we reinsert the current event at the last position and continue to read
-                // the other events.
-                instance->m_eventBuffer.skip(1);
-                instance->m_eventBuffer.write(ev, 1);
-                if (instance->m_eventBuffer.getReadSpace() == ++evDeferred[index]) {
-                    // No other events to read.
-                    break;
-                }
-                continue;
-            }
-
-            if (frameOffset < 0)
-                frameOffset = 0;
-
-            ev->time.tick = (unsigned int)frameOffset;
-            instance->m_eventBuffer.skip(1);
-
             if (ev->type == SND_SEQ_EVENT_CONTROLLER) {
                 accept = instance->handleController(ev);
             } else if (ev->type == SND_SEQ_EVENT_PGMCHANGE) {
@@ -1170,8 +1148,8 @@ DSSIPluginInstance::runGrouped(const RealTime &blockTime)
             }
 
             if (accept) {
-                if (++counts[index] >= EVENT_BUFFER_SIZE)
-                    break;
+                if (i != counts[index]) events[counts[index]] = *ev;
+                ++counts[index];
             }
         }
 
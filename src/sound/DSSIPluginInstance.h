@@ -25,6 +25,7 @@
 #include <dssi.h>
 #include "RingBuffer.h"
 #include "RunnablePluginInstance.h"
+#include "SoftSynthEventQueue.h"
 #include "Scavenger.h"
 #include <pthread.h>
 
@@ -49,6 +50,7 @@ public:
     virtual QString configure(QString key, QString value);
     virtual void sendEvent(const RealTime &eventTime,
                            const void *event);
+    virtual void sendEvents(const void *events, size_t count);
 
     virtual size_t getBufferSize() { return m_blockSize; }
     virtual size_t getAudioInputCount() { return m_audioPortsIn.size(); }
@@ -147,7 +149,7 @@ protected:
     std::vector<ProgramDescriptor> m_cachedPrograms;
     bool m_programCacheValid;
 
-    RingBuffer<snd_seq_event_t> m_eventBuffer;
+    SoftSynthEventQueue m_eventQueue;
 
     size_t                    m_blockSize;
     sample_t                **m_inputBuffers;
@@ -19,6 +19,7 @@
 #include "AlsaDriver.h"
 #include "MappedStudio.h"
 #include "AudioProcess.h"
+#include "MixKernels.h"
 #include "base/Profiler.h"
 #include "base/AudioLevel.h"
 #include "Audit.h"
@@ -68,6 +69,7 @@ JackDriver::JackDriver(AlsaDriver *alsaDriver) :
         m_haveAsyncAudioEvent(false),
         m_kickedOutAt(0),
         m_framesProcessed(0),
+        m_xruns(0),
         m_ok(false)
 {
     Q_ASSERT(sizeof(sample_t) == sizeof(float));
@@ -252,6 +254,7 @@ JackDriver::initialise(bool reinitialise)
 
     // set callbacks
     //
+    jack_set_thread_init_callback(m_client, jackThreadInit, this);
     jack_set_process_callback(m_client, jackProcessStatic, this);
     jack_set_buffer_size_callback(m_client, jackBufferSize, this);
     jack_set_sample_rate_callback(m_client, jackSampleRate, this);
@@ -1070,12 +1073,9 @@ JackDriver::jackProcess(jack_nframes_t nframes)
                 if (actual < nframes) {
                     reportFailure(MappedEvent::FailureBussMixUnderrun);
                 }
-                for (size_t i = 0; i < nframes; ++i) {
-                    sample_t sample = submaster[ch][i];
-                    if (sample > peak[ch])
-                        peak[ch] = sample;
-                    master[ch][i] += sample;
-                }
+                peak[ch] = MixKernels::getPeak(submaster[ch], nframes);
+                MixKernels::mixAdd(master[ch], submaster[ch], nframes,
+                                   1.0f, 1.0f);
             }
         }
 
@@ -1186,12 +1186,10 @@ JackDriver::jackProcess(jack_nframes_t nframes)
                     reportFailure(MappedEvent::FailureMixUnderrun);
                 }
 
-                for (size_t f = 0; f < nframes; ++f) {
-                    sample_t sample = instrument[ch][f];
-                    if (sample > peak[ch])
-                        peak[ch] = sample;
-                    if (directToMaster)
-                        master[ch][f] += sample;
+                peak[ch] = MixKernels::getPeak(instrument[ch], nframes);
+                if (directToMaster) {
+                    MixKernels::mixAdd(master[ch], instrument[ch], nframes,
+                                       1.0f, 1.0f);
                 }
             }
 
@@ -1232,12 +1230,8 @@ JackDriver::jackProcess(jack_nframes_t nframes)
     float masterPeak[2] = { 0.0, 0.0 };
 
     for (int ch = 0; ch < 2; ++ch) {
-        for (size_t i = 0; i < nframes; ++i) {
-            sample_t sample = master[ch][i] * gain;
-            if (sample > masterPeak[ch])
-                masterPeak[ch] = sample;
-            master[ch][i] = sample;
-        }
+        MixKernels::applyGain(master[ch], nframes, gain, gain);
+        masterPeak[ch] = MixKernels::getPeak(master[ch], nframes);
     }
 
     LevelInfo info;
@@ -1870,6 +1864,15 @@ JackDriver::jackSampleRate(jack_nframes_t nframes, void *arg)
     return 0;
 }
 
+void
+JackDriver::jackThreadInit(void *)
+{
+    // Called in each thread JACK makes for us, before it runs any
+    // callbacks there, so this is the place for anything that
+    // allocates
+    Profiles::getInstance()->registerThread("JACK");
+}
+
 void
 JackDriver::jackShutdown(void *arg)
 {
@@ -1897,15 +1900,27 @@ JackDriver::jackXRun(void *arg)
     std::cerr << "JackDriver::jackXRun" << std::endl;
 #endif
 
+    JackDriver *inst = static_cast<JackDriver*>(arg);
+    int xruns = inst->m_xruns.fetchAndAddRelaxed(1) + 1;
+
 #ifdef DEBUG_JACK_XRUN
 
-    std::cerr << "JackDriver::jackXRun" << std::endl;
+    std::cerr << "JackDriver::jackXRun: " << xruns << " so far" << std::endl;
+    if (inst->m_instrumentMixer) {
+        AudioInstrumentMixer *mixer = inst->m_instrumentMixer;
+        std::cerr << "JackDriver::jackXRun: plugin commands pending "
+                  << mixer->getPluginCommandsPending() << ", most pending "
+                  << mixer->getPluginCommandHighWater() << ", blocks deferred "
+                  << mixer->getPluginCommandBlocksDeferred() << ", overflows "
+                  << mixer->getPluginCommandOverflows() << std::endl;
+    }
     Profiles::getInstance()->dump();
+#else
+    (void)xruns;
 #endif
 
     // Report to GUI
     //
-    JackDriver *inst = static_cast<JackDriver*>(arg);
     inst->reportFailure(MappedEvent::FailureXRuns);
 
     return 0;
@@ -2160,6 +2175,7 @@ JackDriver::updateAudioData()
 
     m_bussMixer->updateInstrumentConnections();
     m_instrumentMixer->updateInstrumentMuteStates();
+    m_instrumentMixer->disposeUnwantedPlugins();
 
     if (m_bussMixer->getBussCount() == 0 || m_alsaDriver->getLowLatencyMode()) {
         if (m_bussMixer->running()) {
@@ -2186,6 +2202,23 @@ JackDriver::updateAudioData()
 #endif
 }
 
+QString
+JackDriver::getStatusLog() const
+{
+    QString log = QString("\nJACK xruns: %1\n").arg(getXRunCount());
+
+    if (m_instrumentMixer) {
+        log += QString("Plugin commands: %1 pending, at most %2 pending, "
+                       "%3 blocks deferred, %4 overflows\n")
+            .arg(m_instrumentMixer->getPluginCommandsPending())
+            .arg(m_instrumentMixer->getPluginCommandHighWater())
+            .arg(m_instrumentMixer->getPluginCommandBlocksDeferred())
+            .arg(m_instrumentMixer->getPluginCommandOverflows());
+    }
+
+    return log;
+}
+
 void
 JackDriver::setAudioBussLevels(int bussNo, float dB, float pan)
 {
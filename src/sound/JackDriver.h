@@ -22,9 +22,11 @@
 #include "RunnablePluginInstance.h"
 #include <jack/jack.h>
 #include "SoundDriver.h"
+#include "base/AtomicCompat.h"
 #include "base/Instrument.h"
 #include "base/RealTime.h"
 #include "ExternalTransport.h"
+#include <QAtomicInt>
 #include <QStringList>
 
 namespace Rosegarden
@@ -186,6 +188,14 @@ public:
     // For audit purposes only.
     size_t getFramesProcessed() const { return m_framesProcessed; }
 
+    // Number of xruns JACK has reported since we connected.  For
+    // audit purposes only.
+    int getXRunCount() const { return atomicLoad(m_xruns); }
+
+    // The xrun count and the instrument mixer's plugin command queue
+    // counters, for the sequencer's status log.
+    QString getStatusLog() const;
+
     // Reinitialise if we've been kicked off JACK -- if we can
     // 
     void restoreIfRestorable();
@@ -197,6 +207,7 @@ public:
 protected:
 
     // static methods for JACK process thread:
+    static void  jackThreadInit(void *arg);
     static int   jackProcessStatic(jack_nframes_t nframes, void *arg);
     static int   jackBufferSize(jack_nframes_t nframes, void *arg);
     static int   jackSampleRate(jack_nframes_t nframes, void *arg);
@@ -280,6 +291,7 @@ protected:
 
     time_t                       m_kickedOutAt;
     size_t                       m_framesProcessed;
+    QAtomicInt                   m_xruns;
 
     // initialise() has completed successfully, and there are no other issues
     bool                         m_ok;
@@ -135,7 +135,8 @@ MappedBufMetaIterator::moveIteratorToTime(MappedEventBuffer::iterator &iter,
 
         // We use peek because it's safe even if we have not fully
         // filled the buffer yet.  That means we can get NULL.
-        const MappedEvent *event = iter.peek();
+        // peekResolved() gives us the timing for the current tempo.
+        const MappedEvent *event = iter.peekResolved();
 
         // We know nothing about the event yet.  Stop here.
         if (!event)
@@ -334,7 +335,7 @@ fetchEventsNoncompeting(MappedInserterBase &inserter,
             // which is this lock's scope.
             QReadLocker locker(iter->getLock());
 
-            MappedEvent *event = iter->peek();
+            MappedEvent *event = iter->peekResolved();
 
             // We couldn't fetch an event or it failed a sanity check.
             // So proceed to the next iterator but keep looking at
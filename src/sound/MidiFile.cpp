@@ -38,6 +38,8 @@
 #include "sound/MidiInserter.h"
 #include "sound/SortingInserter.h"
 
+#include <QByteArray>
+#include <QFile>
 #include <QProgressDialog>
 
 #include <fstream>
@@ -58,7 +60,9 @@ MidiFile::MidiFile() :
     m_timingDivision(0),
     m_fps(0),
     m_subframes(0),
+    m_data(0),
     m_fileSize(0),
+    m_readPosition(0),
     m_trackByteCount(0),
     m_decrementCount(false),
     m_bytesRead(0)
@@ -105,21 +109,9 @@ MidiFile::midiBytesToInt(const std::string &bytes)
            static_cast<int>(static_cast<MidiByte>(bytes[1]));
 }
 
-MidiByte
-MidiFile::read(std::ifstream *midiFile)
-{
-    return static_cast<MidiByte>(read(midiFile, 1)[0]);
-}
-
-std::string
-MidiFile::read(std::ifstream *midiFile, unsigned long numberOfBytes)
+void
+MidiFile::checkRead(unsigned long numberOfBytes)
 {
-    if (midiFile->eof()) {
-        RG_WARNING << "read(): MIDI file EOF - got 0 bytes out of " << numberOfBytes;
-
-        throw Exception(qstrtostr(QObject::tr("End of MIDI file encountered while reading")));
-    }
-
     // For each track section we can read only m_trackByteCount bytes.
     if (m_decrementCount  &&
         numberOfBytes > static_cast<unsigned long>(m_trackByteCount)) {
@@ -129,26 +121,18 @@ MidiFile::read(std::ifstream *midiFile, unsigned long numberOfBytes)
         throw Exception(qstrtostr(QObject::tr("Attempt to get more bytes than expected on Track")));
     }
 
-    char fileMidiByte;
-    std::string stringRet;
-
-    // ??? Reading one byte at a time is terribly slow.  However, this
-    //     routine is usually called with numberOfBytes == 1.
-    while (stringRet.length() < numberOfBytes  &&
-           midiFile->read(&fileMidiByte, 1)) {
-        stringRet += fileMidiByte;
-
-        // Kick the event loop to make sure the UI doesn't become
-        // unresponsive during a long load.
-        qApp->processEvents();
-    }
-
     // Unexpected EOF
-    if (stringRet.length() < numberOfBytes) {
-        RG_WARNING << "read(): Attempt to read past file end - got " << stringRet.length() << " bytes out of " << numberOfBytes;
+    if (numberOfBytes > m_fileSize - m_readPosition) {
+        RG_WARNING << "read(): Attempt to read past file end - got " << m_fileSize - m_readPosition << " bytes out of " << numberOfBytes;
 
         throw Exception(qstrtostr(QObject::tr("Attempt to read past MIDI file end")));
     }
+}
+
+void
+MidiFile::advance(unsigned long numberOfBytes)
+{
+    m_readPosition += numberOfBytes;
 
     if (m_decrementCount)
         m_trackByteCount -= numberOfBytes;
@@ -166,29 +150,63 @@ MidiFile::read(std::ifstream *midiFile, unsigned long numberOfBytes)
 
             // This is the first 20% of the "reading" process.
             int progressValue = static_cast<int>(
-                    static_cast<double>(midiFile->tellg()) /
+                    static_cast<double>(m_readPosition) /
                     static_cast<double>(m_fileSize) * 20.0);
 
             m_progressDialog->setValue(progressValue);
         }
+
+        // Kick the event loop to make sure the UI doesn't become
+        // unresponsive during a long load.
+        qApp->processEvents();
     }
+}
+
+MidiByte
+MidiFile::read()
+{
+    checkRead(1);
+
+    MidiByte midiByte = m_data[m_readPosition];
+    advance(1);
+
+    return midiByte;
+}
+
+std::string
+MidiFile::read(unsigned long numberOfBytes)
+{
+    checkRead(numberOfBytes);
+
+    std::string stringRet(
+            reinterpret_cast<const char *>(m_data + m_readPosition),
+            numberOfBytes);
+    advance(numberOfBytes);
 
     return stringRet;
 }
 
-long
-MidiFile::readNumber(std::ifstream *midiFile, int firstByte)
+void
+MidiFile::skip(unsigned long numberOfBytes)
 {
-    if (midiFile->eof())
-        return 0;
+    // Like seeking, skipping off the end isn't an error until we
+    // try to read something there.
+    if (numberOfBytes > m_fileSize - m_readPosition)
+        numberOfBytes = m_fileSize - m_readPosition;
 
+    m_readPosition += numberOfBytes;
+}
+
+long
+MidiFile::readNumber(int firstByte)
+{
     MidiByte midiByte;
 
     // If we already have the first byte, use it
     if (firstByte >= 0) {
         midiByte = static_cast<MidiByte>(firstByte);
     } else {  // read it
-        midiByte = read(midiFile);
+        midiByte = read();
     }
 
     long longRet = midiByte;
@@ -198,16 +216,16 @@ MidiFile::readNumber(std::ifstream *midiFile, int firstByte)
     if (midiByte & 0x80) {
         longRet &= 0x7F;
         do {
-            midiByte = read(midiFile);
+            midiByte = read();
             longRet = (longRet << 7) + (midiByte & 0x7F);
-        } while (!midiFile->eof() && (midiByte & 0x80));
+        } while (midiByte & 0x80);
     }
 
     return longRet;
 }
 
 void
-MidiFile::findNextTrack(std::ifstream *midiFile)
+MidiFile::findNextTrack()
 {
     // Conforms to recommendation in the MIDI spec, section 4, page 3:
     // "Your programs should /expect/ alien chunks and treat them as if
@@ -218,10 +236,10 @@ MidiFile::findNextTrack(std::ifstream *midiFile)
     m_trackByteCount = -1;
 
     // For each chunk
-    while (!midiFile->eof()) {
+    while (m_readPosition < m_fileSize) {
         // Read the chunk type and size.
-        std::string chunkType = read(midiFile, 4);
-        long chunkSize = midiBytesToLong(read(midiFile, 4));
+        std::string chunkType = read(4);
+        long chunkSize = midiBytesToLong(read(4));
 
         // If we've found a track chunk
         if (chunkType.compare(0, 4, MIDI_TRACK_HEADER) == 0) {
@@ -233,7 +251,7 @@ MidiFile::findNextTrack(std::ifstream *midiFile)
         RG_DEBUG << "findNextTrack(): skipping alien chunk.  Type:" << chunkType;
 
         // Alien chunk encountered, initiate evasive maneuvers (skip it).
-        midiFile->seekg(chunkSize, std::ios::cur);
+        skip(chunkSize);
     }
 
     // Track not found.
@@ -249,27 +267,40 @@ MidiFile::read(const QString &filename)
     clearMidiComposition();
 
     // Open the file
-    std::ifstream *midiFile =
-            new std::ifstream(filename.toLocal8Bit(),
-                              std::ios::in | std::ios::binary);
+    QFile midiFile(filename);
 
-    if (!(*midiFile)) {
+    if (!midiFile.open(QIODevice::ReadOnly)) {
         m_error = "File not found or not readable.";
         m_format = MIDI_FILE_NOT_LOADED;
         return false;
     }
 
-    // Compute the file size so we can report progress.
-    midiFile->seekg(0, std::ios::end);
-    m_fileSize = midiFile->tellg();
-    midiFile->seekg(0, std::ios::beg);
+    // Map it, so that the parser can work straight from the page
+    // cache.  Files that can't be mapped (an empty file, say) are
+    // read into memory instead.  Either way the data stays put until
+    // midiFile goes out of scope, and everything the parser keeps
+    // is copied out of it.
+    m_fileSize = midiFile.size();
+    m_data = m_fileSize ? midiFile.map(0, m_fileSize) : 0;
+
+    QByteArray contents;
+    if (!m_data) {
+        contents = midiFile.readAll();
+        m_fileSize = contents.size();
+        m_data = reinterpret_cast<const MidiByte *>(contents.constData());
+    }
+
+    m_readPosition = 0;
+    m_trackByteCount = 0;
+    m_decrementCount = false;
+    m_bytesRead = 0;
 
     // The parsing process throws string exceptions back up here if we
     // run into trouble which we can then pass back out to whomever
     // called us using m_error and a nice bool.
     try {
         // Parse the MIDI header first.
-        parseHeader(midiFile);
+        parseHeader();
 
         // For each track chunk in the MIDI file.
         for (unsigned track = 0; track < m_numberOfTracks; ++track) {
@@ -277,12 +308,12 @@ MidiFile::read(const QString &filename)
             RG_DEBUG << "read(): Parsing MIDI file track " << track;
 
             // Skip any alien chunks.
-            findNextTrack(midiFile);
+            findNextTrack();
 
             RG_DEBUG << "read(): Track has " << m_trackByteCount << " bytes";
 
             // Read the track into m_midiComposition.
-            parseTrack(midiFile);
+            parseTrack();
         }
 
     } catch (const Exception &e) {
@@ -290,19 +321,20 @@ MidiFile::read(const QString &filename)
 
         m_error = e.getMessage();
         m_format = MIDI_FILE_NOT_LOADED;
+        m_data = 0;
         return false;
     }
 
-    midiFile->close();
+    m_data = 0;
 
     return true;
 }
 
 void
-MidiFile::parseHeader(std::ifstream *midiFile)
+MidiFile::parseHeader()
 {
     // The basic MIDI header is 14 bytes.
-    std::string midiHeader = read(midiFile, 14);
+    std::string midiHeader = read(14);
 
     if (midiHeader.size() < 14) {
         RG_WARNING << "parseHeader() - file header undersized";
@@ -339,14 +371,14 @@ MidiFile::parseHeader(std::ifstream *midiFile)
         // MIDI spec section 4, page 5: "[...] more parameters may be
         // added to the MThd chunk in the future: it is important to
         // read and honor the length, even if it is longer than 6."
-        midiFile->seekg(chunkSize - 6, std::ios::cur);
+        skip(chunkSize - 6);
     }
 }
 
 static const std::string defaultTrackName = "Imported MIDI";
 
 void
-MidiFile::parseTrack(std::ifstream *midiFile)
+MidiFile::parseTrack()
 {
     // The term "Track" is overloaded in this routine.  The first
     // meaning is a track in the MIDI file.  That is what this routine
@@ -396,9 +428,9 @@ MidiFile::parseTrack(std::ifstream *midiFile)
     // byte, a single remaining byte in the MIDI file track has to be padding.
     // This is obscure and non-standard, but such files do exist; ordinarily
     // there should be no bytes in the MIDI file track after the last event.
-    while (!midiFile->eof()  &&  m_trackByteCount > 1) {
+    while (m_trackByteCount > 1) {
 
-        unsigned long deltaTime = readNumber(midiFile);
+        unsigned long deltaTime = readNumber();
 
         RG_DEBUG << "parseTrack(): read delta time " << deltaTime;
 
@@ -406,7 +438,7 @@ MidiFile::parseTrack(std::ifstream *midiFile)
         eventTime += deltaTime;
 
         // Get a single byte
-        MidiByte midiByte = read(midiFile);
+        MidiByte midiByte = read();
 
         MidiByte statusByte = 0;
         MidiByte data1 = 0;
@@ -416,7 +448,7 @@ MidiFile::parseTrack(std::ifstream *midiFile)
             RG_DEBUG << "parseTrack(): have new status byte" << QString("0x%1").arg(midiByte, 0, 16);
 
             statusByte = midiByte;
-            data1 = read(midiFile);
+            data1 = read();
         } else {  // Use running status.
             // If we haven't seen a status byte yet, fail.
             if (runningStatus < 0)
@@ -431,11 +463,11 @@ MidiFile::parseTrack(std::ifstream *midiFile)
         if (statusByte == MIDI_FILE_META_EVENT) {
 
             MidiByte metaEventCode = data1;
-            unsigned messageLength = readNumber(midiFile);
+            unsigned messageLength = readNumber();
 
             RG_DEBUG << "parseTrack(): Meta event of type " << QString("0x%1").arg(metaEventCode, 0, 16) << " and " << messageLength << " bytes found";
 
-            std::string metaMessage = read(midiFile, messageLength);
+            std::string metaMessage = read(messageLength);
 
             // Compute the difference between this event and the previous
             // event on this track.
@@ -516,7 +548,7 @@ MidiFile::parseTrack(std::ifstream *midiFile)
         case MIDI_CTRL_CHANGE:
         case MIDI_PITCH_BEND:
             {
-                MidiByte data2 = read(midiFile);
+                MidiByte data2 = read();
 
                 // create and store our event
                 MidiEvent *midiEvent =
@@ -544,13 +576,14 @@ MidiFile::parseTrack(std::ifstream *midiFile)
 
         case MIDI_SYSTEM_EXCLUSIVE:
             {
-                unsigned messageLength = readNumber(midiFile, data1);
+                unsigned messageLength = readNumber(data1);
 
                 RG_DEBUG << "parseTrack(): SysEx of " << messageLength << " bytes found";
 
-                std::string sysex = read(midiFile, messageLength);
+                std::string sysex = read(messageLength);
 
-                if (MidiByte(sysex[sysex.length() - 1]) !=
+                if (sysex.empty()  ||
+                    MidiByte(sysex[sysex.length() - 1]) !=
                         MIDI_END_OF_EXCLUSIVE) {
                     RG_WARNING << "parseTrack() - malformed or unsupported SysEx type";
                     continue;
@@ -578,11 +611,11 @@ MidiFile::parseTrack(std::ifstream *midiFile)
         }
     }
 
-    // If the MIDI file track has a padding byte, read and discard it
-    // to make sure that the stream is positioned at the beginning of
-    // the following MIDI file track (if there is one.)
+    // If the MIDI file track has a padding byte, skip it to make sure
+    // that we are positioned at the beginning of the following MIDI
+    // file track (if there is one.)
     if (m_trackByteCount == 1)
-        midiFile->ignore();
+        skip(1);
 
     if (instrumentName != "")
         trackName += " (" + instrumentName + ")";
@@ -1553,81 +1586,117 @@ void
 MidiFile::consolidateNoteEvents(TrackId trackId)
 {
     MidiTrack &track = m_midiComposition[trackId];
+    const int eventCount = track.size();
 
-    // For each MIDI event on the track.
-    for (MidiTrack::iterator firstEventIter = track.begin();
-         firstEventIter != track.end();
-         ++firstEventIter) {
-        MidiEvent &firstEvent = **firstEventIter;
+    // Each note-on is paired with the first note-off of the same pitch
+    // and channel that follows it and hasn't been claimed by an earlier
+    // note-on.  So overlapping notes of the same pitch are matched
+    // first-in, first-out: the first note-on takes the first note-off.
+    // We do that in one pass, keeping a queue of the note-ons still
+    // waiting for a note-off for each channel and pitch.  The queues
+    // are linked through nextWaiting.
 
-        // Not a note-on?  Try the next event.
-        if (firstEvent.getMessageType() != MIDI_NOTE_ON)
-            continue;
+    std::vector<int> firstWaiting(16 * 128, -1);
+    std::vector<int> lastWaiting(16 * 128, -1);
+    std::vector<int> nextWaiting(eventCount, -1);
 
-        // Note-on with velocity 0 is a note-off.  Try the next event.
-        if (firstEvent.getVelocity() == 0)
-            continue;
+    // For each note-on, the note-off it's paired with, or -1.
+    std::vector<int> noteOffFor(eventCount, -1);
+    // For each note-off, the note-on it's paired with, or -1.
+    std::vector<int> noteOnFor(eventCount, -1);
 
-        // At this point, firstEvent is a note-on event.
-        // Search for the matching note-off event.
-
-        bool noteOffFound = false;
+    // For each MIDI event on the track.
+    for (int i = 0; i < eventCount; ++i) {
+        const MidiEvent &event = *track[i];
+
+        bool noteOn = (event.getMessageType() == MIDI_NOTE_ON  &&
+                       event.getVelocity() != 0);
+        // Note-on with velocity 0 is a note-off.
+        bool noteOff = (event.getMessageType() == MIDI_NOTE_OFF  ||
+                        (event.getMessageType() == MIDI_NOTE_ON  &&
+                         event.getVelocity() == 0));
+
+        // Not a note?  Try the next event.
+        if (!noteOn  &&  !noteOff)
+            continue;
 
-        MidiTrack::iterator secondEventIter;
+        // Note: Since all the events in a track are for a single channel,
+        //       the channel is always the same.
+        const int key = event.getChannelNumber() * 128 +
+                        (event.getPitch() & 0x7f);
+
+        if (noteOn) {
+            // Join the back of the queue.
+            if (lastWaiting[key] < 0)
+                firstWaiting[key] = i;
+            else
+                nextWaiting[lastWaiting[key]] = i;
+            lastWaiting[key] = i;
+            continue;
+        }
 
-        // For each following MIDI event
-        for (secondEventIter = firstEventIter + 1;
-             secondEventIter != track.end();
-             ++secondEventIter) {
-            const MidiEvent &secondEvent = **secondEventIter;
+        // A note-off with nothing waiting for it is left alone.
+        const int on = firstWaiting[key];
+        if (on < 0)
+            continue;
 
-            bool noteOff = (secondEvent.getMessageType() == MIDI_NOTE_OFF  ||
-                    (secondEvent.getMessageType() == MIDI_NOTE_ON  &&
-                     secondEvent.getVelocity() == 0x00));
+        // Take the front of the queue.
+        firstWaiting[key] = nextWaiting[on];
+        if (firstWaiting[key] < 0)
+            lastWaiting[key] = -1;
 
-            // Not a note-off?  Try the next event.
-            if (!noteOff)
-                continue;
+        noteOffFor[on] = i;
+        noteOnFor[i] = on;
+    }
 
-            // Wrong pitch?  Try the next event.
-            if (secondEvent.getPitch() != firstEvent.getPitch())
-                continue;
+    // A note-on without a note-off lasts until the end of the track,
+    // as it stood when the note-on was reached: that is, without the
+    // note-offs taken by earlier note-ons.  Those only ever come off the
+    // end of the track, so we can find the end by moving back from the
+    // last event as we go.
+    int lastEvent = eventCount - 1;
 
-            // Wrong channel?  Try the next event.
-            // Note: Since all the events in a track are for a single channel,
-            //       this will never be true.
-            if (secondEvent.getChannelNumber() != firstEvent.getChannelNumber())
-                continue;
+    for (int i = 0; i < eventCount; ++i) {
+        MidiEvent &noteOnEvent = *track[i];
 
-            timeT noteDuration = secondEvent.getTime() - firstEvent.getTime();
+        if (noteOnEvent.getMessageType() != MIDI_NOTE_ON  ||
+            noteOnEvent.getVelocity() == 0)
+            continue;
 
-            // Some MIDI files floating around in the real world
-            // apparently have note-on followed immediately by note-off
-            // on percussion tracks.  Instead of setting the duration to
-            // 0 in this case, which has no meaning, set it to 1.
-            if (noteDuration == 0) {
-                RG_WARNING << "consolidateNoteEvents() - detected MIDI note duration of 0.  Using duration of 1.  Touch wood.";
-                noteDuration = 1;
-            }
+        if (noteOffFor[i] < 0) {
+            while (noteOnFor[lastEvent] >= 0  &&  noteOnFor[lastEvent] < i)
+                --lastEvent;
 
-            firstEvent.setDuration(noteDuration);
+            // Set Event duration to length of Segment.
+            noteOnEvent.setDuration(
+                    track[lastEvent]->getTime() - noteOnEvent.getTime());
+            continue;
+        }
 
-            // Remove the note-off.
-            delete *secondEventIter;
-            track.erase(secondEventIter);
+        timeT noteDuration =
+                track[noteOffFor[i]]->getTime() - noteOnEvent.getTime();
 
-            noteOffFound = true;
-            break;
+        // Some MIDI files floating around in the real world
+        // apparently have note-on followed immediately by note-off
+        // on percussion tracks.  Instead of setting the duration to
+        // 0 in this case, which has no meaning, set it to 1.
+        if (noteDuration == 0) {
+            RG_WARNING << "consolidateNoteEvents() - detected MIDI note duration of 0.  Using duration of 1.  Touch wood.";
+            noteDuration = 1;
         }
 
-        if (!noteOffFound) {
-            // avoid crash due to secondEventIter == track.end()
-            --secondEventIter;
-            // Set Event duration to length of Segment.
-            firstEvent.setDuration(
-                    (*secondEventIter)->getTime() - firstEvent.getTime());
-        }
+        noteOnEvent.setDuration(noteDuration);
+    }
+
+    // Remove the note-offs that were paired up, in one sweep.
+    int kept = 0;
+    for (int i = 0; i < eventCount; ++i) {
+        if (noteOnFor[i] >= 0)
+            delete track[i];
+        else
+            track[kept++] = track[i];
     }
+    track.resize(kept);
 }
 
 void
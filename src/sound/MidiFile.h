@@ -22,6 +22,7 @@
 #include <QString>
 
 class QProgressDialog;
+class TestMidiFile;
 
 #include <fstream>
 #include <string>
@@ -80,6 +81,9 @@ private:
     // - clearMidiComposition()
     friend class MidiInserter;
 
+    // The import test times read() on its own.
+    friend class ::TestMidiFile;
+
     // *** Standard MIDI File Header
 
     enum FileFormatType {
@@ -123,16 +127,20 @@ private:
     // *** Standard MIDI File to Rosegarden
 
     /// Read a MIDI file into m_midiComposition.
+    /**
+     * The file is mapped into memory (or read in one go if it can't
+     * be) and parsed in place.
+     */
     bool read(const QString &filename);
-    void parseHeader(std::ifstream *midiFile);
+    void parseHeader();
     /// Convert a track to events in m_midiComposition.
-    void parseTrack(std::ifstream *midiFile);
+    void parseTrack();
     // m_midiComposition track to MIDI channel.
     std::map<TrackId, int /*channel*/> m_trackChannelMap;
     // Names for each track.
     std::vector<std::string> m_trackNames;
     /// Find the next track chunk and set m_trackByteCount.
-    void findNextTrack(std::ifstream *midiFile);
+    void findNextTrack();
     /// Combine each note-on/note-off pair into a single note event with a duration.
     void consolidateNoteEvents(TrackId trackId);
     /// Configure the Instrument based on events in Segment at time 0.
@@ -145,16 +153,25 @@ private:
      * In case the first byte has already been read, it can be sent
      * in as firstByte.
      */
-    long readNumber(std::ifstream *midiFile, int firstByte = -1);
-    MidiByte read(std::ifstream *midiFile);
-    std::string read(std::ifstream *midiFile,
-                     unsigned long numberOfBytes);
+    long readNumber(int firstByte = -1);
+    MidiByte read();
+    std::string read(unsigned long numberOfBytes);
+    /// Move past numberOfBytes without reading them.
+    void skip(unsigned long numberOfBytes);
+    /// Bounds and track byte count checks for reading numberOfBytes.
+    void checkRead(unsigned long numberOfBytes);
+    /// Account for numberOfBytes read, and update the progress dialog.
+    void advance(unsigned long numberOfBytes);
 
     // Conversion
     int midiBytesToInt(const std::string &bytes);
     long midiBytesToLong(const std::string &bytes);
 
+    /// The file being read, and our position in it.
+    const MidiByte *m_data;
     size_t m_fileSize;
+    size_t m_readPosition;
+
     /// Number of bytes left to read in the current track.
     long m_trackByteCount;
     /// Allow decrementing of m_trackByteCount while reading.
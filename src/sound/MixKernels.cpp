@@ -0,0 +1,466 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "MixKernels.h"
+
+// Only on x86-64, where scalar float arithmetic is done in SSE
+// registers too, so that the results are the same either way.
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MIX_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace Rosegarden
+{
+
+typedef MixKernels::sample_t sample_t;
+
+// The kernels for one implementation.  The vector versions work
+// through the block a vector at a time and finish off with the scalar
+// code, which computes each sample in exactly the same way.
+
+struct KernelTable
+{
+    MixKernels::Implementation implementation;
+
+    bool (*applyGain)(sample_t *, size_t, float, float);
+    bool (*pan)(const sample_t *, sample_t *, sample_t *, size_t,
+                float, float, float, float);
+    void (*mixAdd)(sample_t *, const sample_t *, size_t, float, float);
+    sample_t (*getPeak)(const sample_t *, size_t);
+};
+
+static inline float
+rampStep(float from, float to, size_t count)
+{
+    return (from == to) ? 0.0f : (to - from) / float(count);
+}
+
+// *** Scalar
+
+static bool
+applyGainScalar(sample_t *buffer, size_t count, float from, float step,
+                size_t start)
+{
+    bool allZeros = true;
+
+    for (size_t i = start; i < count; ++i) {
+        buffer[i] *= from + step * float(i + 1);
+        if (buffer[i] != 0.0f)
+            allZeros = false;
+    }
+
+    return allZeros;
+}
+
+static bool
+applyGainScalar(sample_t *buffer, size_t count, float from, float to)
+{
+    return applyGainScalar(buffer, count, from,
+                           rampStep(from, to, count), 0);
+}
+
+static bool
+panScalar(const sample_t *in, sample_t *left, sample_t *right, size_t count,
+          float leftFrom, float leftStep, float rightFrom, float rightStep,
+          size_t start)
+{
+    bool allZeros = true;
+
+    for (size_t i = start; i < count; ++i) {
+        sample_t sample = in[i];
+        float n = float(i + 1);
+        left[i] = sample * (leftFrom + leftStep * n);
+        right[i] = sample * (rightFrom + rightStep * n);
+        if (sample != 0.0f)
+            allZeros = false;
+    }
+
+    return allZeros;
+}
+
+static bool
+panScalar(const sample_t *in, sample_t *left, sample_t *right, size_t count,
+          float leftFrom, float leftTo, float rightFrom, float rightTo)
+{
+    return panScalar(in, left, right, count,
+                     leftFrom, rampStep(leftFrom, leftTo, count),
+                     rightFrom, rampStep(rightFrom, rightTo, count), 0);
+}
+
+static void
+mixAddScalar(sample_t *destination, const sample_t *source, size_t count,
+             float from, float step, size_t start)
+{
+    for (size_t i = start; i < count; ++i) {
+        destination[i] += source[i] * (from + step * float(i + 1));
+    }
+}
+
+static void
+mixAddScalar(sample_t *destination, const sample_t *source, size_t count,
+             float from, float to)
+{
+    mixAddScalar(destination, source, count, from,
+                 rampStep(from, to, count), 0);
+}
+
+static sample_t
+getPeakScalar(const sample_t *buffer, size_t count, sample_t peak,
+              size_t start)
+{
+    for (size_t i = start; i < count; ++i) {
+        if (buffer[i] > peak)
+            peak = buffer[i];
+    }
+
+    return peak;
+}
+
+static sample_t
+getPeakScalar(const sample_t *buffer, size_t count)
+{
+    return getPeakScalar(buffer, count, 0.0f, 0);
+}
+
+static const KernelTable scalarKernels = {
+    MixKernels::Scalar,
+    applyGainScalar, panScalar, mixAddScalar, getPeakScalar
+};
+
+#ifdef MIX_KERNELS_X86
+
+// *** SSE
+
+// Unaligned loads and stores throughout: the buffers come from
+// plugins and JACK as well as from us.  Sample numbers (i + 1) are
+// kept as floats in a vector, which is exact for any block size we'll
+// ever see.
+
+__attribute__((target("sse")))
+static bool
+applyGainSSE(sample_t *buffer, size_t count, float from, float to)
+{
+    const float step = rampStep(from, to, count);
+    const __m128 vfrom = _mm_set1_ps(from);
+    const __m128 vstep = _mm_set1_ps(step);
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 n = _mm_set_ps(4.0f, 3.0f, 2.0f, 1.0f);
+    __m128 nonZero = zero;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 gain = _mm_add_ps(vfrom, _mm_mul_ps(vstep, n));
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(buffer + i), gain);
+        _mm_storeu_ps(buffer + i, v);
+        nonZero = _mm_or_ps(nonZero, _mm_cmpneq_ps(v, zero));
+        n = _mm_add_ps(n, four);
+    }
+
+    bool allZeros = applyGainScalar(buffer, count, from, step, i);
+    return allZeros && _mm_movemask_ps(nonZero) == 0;
+}
+
+__attribute__((target("sse")))
+static bool
+panSSE(const sample_t *in, sample_t *left, sample_t *right, size_t count,
+       float leftFrom, float leftTo, float rightFrom, float rightTo)
+{
+    const float leftStep = rampStep(leftFrom, leftTo, count);
+    const float rightStep = rampStep(rightFrom, rightTo, count);
+    const __m128 vleftFrom = _mm_set1_ps(leftFrom);
+    const __m128 vleftStep = _mm_set1_ps(leftStep);
+    const __m128 vrightFrom = _mm_set1_ps(rightFrom);
+    const __m128 vrightStep = _mm_set1_ps(rightStep);
+    const __m128 four = _mm_set1_ps(4.0f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 n = _mm_set_ps(4.0f, 3.0f, 2.0f, 1.0f);
+    __m128 nonZero = zero;
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_loadu_ps(in + i);
+        __m128 leftGain = _mm_add_ps(vleftFrom, _mm_mul_ps(vleftStep, n));
+        __m128 rightGain = _mm_add_ps(vrightFrom, _mm_mul_ps(vrightStep, n));
+        _mm_storeu_ps(left + i, _mm_mul_ps(v, leftGain));
+        _mm_storeu_ps(right + i, _mm_mul_ps(v, rightGain));
+        nonZero = _mm_or_ps(nonZero, _mm_cmpneq_ps(v, zero));
+        n = _mm_add_ps(n, four);
+    }
+
+    bool allZeros = panScalar(in, left, right, count,
+                              leftFrom, leftStep, rightFrom, rightStep, i);
+    return allZeros && _mm_movemask_ps(nonZero) == 0;
+}
+
+__attribute__((target("sse")))
+static void
+mixAddSSE(sample_t *destination, const sample_t *source, size_t count,
+          float from, float to)
+{
+    const float step = rampStep(from, to, count);
+    const __m128 vfrom = _mm_set1_ps(from);
+    const __m128 vstep = _mm_set1_ps(step);
+    const __m128 four = _mm_set1_ps(4.0f);
+    __m128 n = _mm_set_ps(4.0f, 3.0f, 2.0f, 1.0f);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 gain = _mm_add_ps(vfrom, _mm_mul_ps(vstep, n));
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(source + i), gain);
+        _mm_storeu_ps(destination + i,
+                      _mm_add_ps(_mm_loadu_ps(destination + i), v));
+        n = _mm_add_ps(n, four);
+    }
+
+    mixAddScalar(destination, source, count, from, step, i);
+}
+
+__attribute__((target("sse")))
+static sample_t
+getPeakSSE(const sample_t *buffer, size_t count)
+{
+    // _mm_max_ps(a, b) gives b unless a > b, which is what the scalar
+    // comparison does too (including for NaNs).
+    __m128 peak = _mm_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        peak = _mm_max_ps(_mm_loadu_ps(buffer + i), peak);
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, peak);
+    return getPeakScalar(buffer, count, getPeakScalar(lanes, 4), i);
+}
+
+static const KernelTable sseKernels = {
+    MixKernels::SSE,
+    applyGainSSE, panSSE, mixAddSSE, getPeakSSE
+};
+
+// *** AVX
+
+__attribute__((target("avx")))
+static bool
+applyGainAVX(sample_t *buffer, size_t count, float from, float to)
+{
+    const float step = rampStep(from, to, count);
+    const __m256 vfrom = _mm256_set1_ps(from);
+    const __m256 vstep = _mm256_set1_ps(step);
+    const __m256 eight = _mm256_set1_ps(8.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 n = _mm256_set_ps(8.0f, 7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f);
+    __m256 nonZero = zero;
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 gain = _mm256_add_ps(vfrom, _mm256_mul_ps(vstep, n));
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(buffer + i), gain);
+        _mm256_storeu_ps(buffer + i, v);
+        nonZero = _mm256_or_ps(nonZero, _mm256_cmp_ps(v, zero, _CMP_NEQ_UQ));
+        n = _mm256_add_ps(n, eight);
+    }
+
+    bool allZeros = applyGainScalar(buffer, count, from, step, i);
+    return allZeros && _mm256_movemask_ps(nonZero) == 0;
+}
+
+__attribute__((target("avx")))
+static bool
+panAVX(const sample_t *in, sample_t *left, sample_t *right, size_t count,
+       float leftFrom, float leftTo, float rightFrom, float rightTo)
+{
+    const float leftStep = rampStep(leftFrom, leftTo, count);
+    const float rightStep = rampStep(rightFrom, rightTo, count);
+    const __m256 vleftFrom = _mm256_set1_ps(leftFrom);
+    const __m256 vleftStep = _mm256_set1_ps(leftStep);
+    const __m256 vrightFrom = _mm256_set1_ps(rightFrom);
+    const __m256 vrightStep = _mm256_set1_ps(rightStep);
+    const __m256 eight = _mm256_set1_ps(8.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 n = _mm256_set_ps(8.0f, 7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f);
+    __m256 nonZero = zero;
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_loadu_ps(in + i);
+        __m256 leftGain =
+            _mm256_add_ps(vleftFrom, _mm256_mul_ps(vleftStep, n));
+        __m256 rightGain =
+            _mm256_add_ps(vrightFrom, _mm256_mul_ps(vrightStep, n));
+        _mm256_storeu_ps(left + i, _mm256_mul_ps(v, leftGain));
+        _mm256_storeu_ps(right + i, _mm256_mul_ps(v, rightGain));
+        nonZero = _mm256_or_ps(nonZero, _mm256_cmp_ps(v, zero, _CMP_NEQ_UQ));
+        n = _mm256_add_ps(n, eight);
+    }
+
+    bool allZeros = panScalar(in, left, right, count,
+                              leftFrom, leftStep, rightFrom, rightStep, i);
+    return allZeros && _mm256_movemask_ps(nonZero) == 0;
+}
+
+__attribute__((target("avx")))
+static void
+mixAddAVX(sample_t *destination, const sample_t *source, size_t count,
+          float from, float to)
+{
+    const float step = rampStep(from, to, count);
+    const __m256 vfrom = _mm256_set1_ps(from);
+    const __m256 vstep = _mm256_set1_ps(step);
+    const __m256 eight = _mm256_set1_ps(8.0f);
+    __m256 n = _mm256_set_ps(8.0f, 7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 gain = _mm256_add_ps(vfrom, _mm256_mul_ps(vstep, n));
+        __m256 v = _mm256_mul_ps(_mm256_loadu_ps(source + i), gain);
+        _mm256_storeu_ps(destination + i,
+                         _mm256_add_ps(_mm256_loadu_ps(destination + i), v));
+        n = _mm256_add_ps(n, eight);
+    }
+
+    mixAddScalar(destination, source, count, from, step, i);
+}
+
+__attribute__((target("avx")))
+static sample_t
+getPeakAVX(const sample_t *buffer, size_t count)
+{
+    __m256 peak = _mm256_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        peak = _mm256_max_ps(_mm256_loadu_ps(buffer + i), peak);
+    }
+
+    float lanes[8];
+    _mm256_storeu_ps(lanes, peak);
+    return getPeakScalar(buffer, count, getPeakScalar(lanes, 8), i);
+}
+
+static const KernelTable avxKernels = {
+    MixKernels::AVX,
+    applyGainAVX, panAVX, mixAddAVX, getPeakAVX
+};
+
+#endif
+
+static const KernelTable *
+getKernels(MixKernels::Implementation implementation)
+{
+#ifdef MIX_KERNELS_X86
+    __builtin_cpu_init();
+
+    switch (implementation) {
+    case MixKernels::AVX:
+        if (__builtin_cpu_supports("avx"))
+            return &avxKernels;
+        break;
+    case MixKernels::SSE:
+        if (__builtin_cpu_supports("sse"))
+            return &sseKernels;
+        break;
+    case MixKernels::Scalar:
+        return &scalarKernels;
+    }
+#else
+    if (implementation == MixKernels::Scalar)
+        return &scalarKernels;
+#endif
+
+    return 0;
+}
+
+static const KernelTable *
+getBestKernels()
+{
+    const KernelTable *kernels = getKernels(MixKernels::AVX);
+    if (!kernels)
+        kernels = getKernels(MixKernels::SSE);
+    if (!kernels)
+        kernels = &scalarKernels;
+    return kernels;
+}
+
+static const KernelTable *kernels = getBestKernels();
+
+bool
+MixKernels::applyGain(sample_t *buffer, size_t count,
+                      float gainFrom, float gainTo)
+{
+    return kernels->applyGain(buffer, count, gainFrom, gainTo);
+}
+
+bool
+MixKernels::pan(const sample_t *in,
+                sample_t *left, sample_t *right, size_t count,
+                float leftFrom, float leftTo,
+                float rightFrom, float rightTo)
+{
+    return kernels->pan(in, left, right, count,
+                        leftFrom, leftTo, rightFrom, rightTo);
+}
+
+void
+MixKernels::mixAdd(sample_t *destination, const sample_t *source,
+                   size_t count, float gainFrom, float gainTo)
+{
+    kernels->mixAdd(destination, source, count, gainFrom, gainTo);
+}
+
+MixKernels::sample_t
+MixKernels::getPeak(const sample_t *buffer, size_t count)
+{
+    return kernels->getPeak(buffer, count);
+}
+
+MixKernels::Implementation
+MixKernels::getImplementation()
+{
+    return kernels->implementation;
+}
+
+bool
+MixKernels::isSupported(Implementation implementation)
+{
+    return getKernels(implementation) != 0;
+}
+
+bool
+MixKernels::setImplementation(Implementation implementation)
+{
+    const KernelTable *table = getKernels(implementation);
+    if (!table)
+        return false;
+
+    kernels = table;
+    return true;
+}
+
+const char *
+MixKernels::getImplementationName(Implementation implementation)
+{
+    switch (implementation) {
+    case Scalar: return "scalar";
+    case SSE: return "SSE";
+    case AVX: return "AVX";
+    }
+
+    return "unknown";
+}
+
+}
@@ -0,0 +1,94 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_MIX_KERNELS_H
+#define RG_MIX_KERNELS_H
+
+#include <stddef.h>
+
+namespace Rosegarden
+{
+
+/**
+ * The inner loops of the audio mixers: gain, pan, mixing and peak
+ * metering over blocks of samples.
+ *
+ * Each kernel has a plain C++ version and, on x86, SSE and AVX
+ * versions.  The fastest one the CPU supports is picked at startup.
+ * All of them give bit-identical results, so which one is in use
+ * makes no audible difference.
+ *
+ * Gains may ramp linearly across a block, to avoid zipper noise when
+ * a fader moves: sample i (counting from 0) gets
+ * from + (to - from) * (i + 1) / count, so the last sample of the
+ * block is at the new gain.  With from == to there's no ramp.
+ *
+ * All of these are RT safe.
+ */
+class MixKernels
+{
+public:
+    typedef float sample_t;
+
+    /// Multiply buffer by the gain.
+    /**
+     * Returns true if every resulting sample is zero.
+     */
+    static bool applyGain(sample_t *buffer, size_t count,
+                          float gainFrom, float gainTo);
+
+    /// Pan a mono buffer into left and right with the given gains.
+    /**
+     * left may be the same buffer as in.  Returns true if every
+     * sample of in was zero.
+     */
+    static bool pan(const sample_t *in,
+                    sample_t *left, sample_t *right, size_t count,
+                    float leftFrom, float leftTo,
+                    float rightFrom, float rightTo);
+
+    /// Add source, multiplied by the gain, to destination.
+    static void mixAdd(sample_t *destination, const sample_t *source,
+                       size_t count, float gainFrom, float gainTo);
+
+    /// The largest sample in buffer, or zero if none is positive.
+    static sample_t getPeak(const sample_t *buffer, size_t count);
+
+    enum Implementation {
+        Scalar,
+        SSE,
+        AVX
+    };
+
+    /// The implementation in use.
+    static Implementation getImplementation();
+
+    /// Whether this CPU (and build) can use the given implementation.
+    static bool isSupported(Implementation implementation);
+
+    /// Switch implementation, for tests and benchmarks.
+    /**
+     * Returns false, and leaves things as they are, if the
+     * implementation isn't supported.  Not to be called while audio
+     * is running.
+     */
+    static bool setImplementation(Implementation implementation);
+
+    static const char *getImplementationName(Implementation implementation);
+};
+
+}
+
+#endif
@@ -0,0 +1,548 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#define RG_MODULE_STRING "[OfflineDriver]"
+
+#include "OfflineDriver.h"
+#include "AudioProcess.h"
+#include "MappedStudio.h"
+#include "MixKernels.h"
+#include "RunnablePluginInstance.h"
+#include "audiostream/AudioWriteStream.h"
+#include "audiostream/AudioWriteStreamFactory.h"
+#include "base/AudioLevel.h"
+
+#include "misc/Debug.h"
+
+#include <QObject>
+
+#include <cstring>
+
+namespace Rosegarden
+{
+
+OfflineDriver::OfflineDriver(MappedStudio *studio,
+                             unsigned int sampleRate,
+                             unsigned int blockSize) :
+    DummyDriver(studio),
+    m_sampleRate(sampleRate),
+    m_blockSize(blockSize),
+    m_fileReader(0),
+    m_instrumentMixer(0),
+    m_bussMixer(0),
+    m_renderStart(RealTime::zeroTime),
+    m_renderFrames(0),
+    m_masterLevel(0.0),
+    m_scratch(blockSize)
+{
+    m_name = "OfflineDriver";
+
+    // The mixers only ever hold a block at a time, as in JACK's low
+    // latency mode.  Read a good way ahead from files, as there's no
+    // deadline to meet and fewer, larger reads are quicker.
+    setLowLatencyMode(true);
+    setAudioBufferSizes(RealTime(0, 60000000),
+                        RealTime(1, 0),
+                        RealTime(0, 200000000),
+                        128);
+}
+
+OfflineDriver::~OfflineDriver()
+{
+    shutdown();
+    clearAudioFiles();
+}
+
+bool
+OfflineDriver::initialise()
+{
+    if (m_instrumentMixer)
+        return true;
+
+    m_fileReader = new AudioFileReader(this, m_sampleRate);
+    m_instrumentMixer = new AudioInstrumentMixer
+        (this, m_fileReader, m_sampleRate, m_blockSize);
+    m_bussMixer = new AudioBussMixer
+        (this, m_instrumentMixer, m_sampleRate, m_blockSize);
+    m_instrumentMixer->setBussMixer(m_bussMixer);
+
+    // The threads are never run: render() drives them all
+
+    return true;
+}
+
+void
+OfflineDriver::shutdown()
+{
+    delete m_bussMixer;
+    m_bussMixer = 0;
+
+    if (m_instrumentMixer) {
+        m_instrumentMixer->destroyAllPlugins();
+        delete m_instrumentMixer;
+        m_instrumentMixer = 0;
+    }
+
+    delete m_fileReader;
+    m_fileReader = 0;
+}
+
+QString
+OfflineDriver::getStatusLog()
+{
+    return QObject::tr("Offline rendering at %1 Hz, no realtime audio").arg(m_sampleRate);
+}
+
+void
+OfflineDriver::setPluginInstance(InstrumentId id, QString identifier,
+                                 int position)
+{
+    if (m_instrumentMixer)
+        m_instrumentMixer->setPlugin(id, position, identifier);
+}
+
+void
+OfflineDriver::removePluginInstance(InstrumentId id, int position)
+{
+    if (m_instrumentMixer)
+        m_instrumentMixer->removePlugin(id, position);
+}
+
+void
+OfflineDriver::removePluginInstances()
+{
+    if (m_instrumentMixer)
+        m_instrumentMixer->removeAllPlugins();
+}
+
+void
+OfflineDriver::setPluginInstancePortValue(InstrumentId id, int position,
+                                          unsigned long portNumber,
+                                          float value)
+{
+    if (m_instrumentMixer)
+        m_instrumentMixer->setPluginPortValue(id, position, portNumber, value);
+}
+
+float
+OfflineDriver::getPluginInstancePortValue(InstrumentId id, int position,
+                                          unsigned long portNumber)
+{
+    if (m_instrumentMixer)
+        return m_instrumentMixer->getPluginPortValue(id, position, portNumber);
+    return 0;
+}
+
+void
+OfflineDriver::setPluginInstanceBypass(InstrumentId id, int position, bool value)
+{
+    if (m_instrumentMixer)
+        m_instrumentMixer->setPluginBypass(id, position, value);
+}
+
+QStringList
+OfflineDriver::getPluginInstancePrograms(InstrumentId id, int position)
+{
+    if (m_instrumentMixer)
+        return m_instrumentMixer->getPluginPrograms(id, position);
+    return QStringList();
+}
+
+QString
+OfflineDriver::getPluginInstanceProgram(InstrumentId id, int position)
+{
+    if (m_instrumentMixer)
+        return m_instrumentMixer->getPluginProgram(id, position);
+    return QString();
+}
+
+QString
+OfflineDriver::getPluginInstanceProgram(InstrumentId id, int position,
+                                        int bank, int program)
+{
+    if (m_instrumentMixer)
+        return m_instrumentMixer->getPluginProgram(id, position, bank, program);
+    return QString();
+}
+
+unsigned long
+OfflineDriver::getPluginInstanceProgram(InstrumentId id, int position,
+                                        QString name)
+{
+    if (m_instrumentMixer)
+        return m_instrumentMixer->getPluginProgram(id, position, name);
+    return 0;
+}
+
+void
+OfflineDriver::setPluginInstanceProgram(InstrumentId id, int position,
+                                        QString program)
+{
+    if (m_instrumentMixer)
+        m_instrumentMixer->setPluginProgram(id, position, program);
+}
+
+QString
+OfflineDriver::configurePlugin(InstrumentId id, int position,
+                               QString key, QString value)
+{
+    if (m_instrumentMixer)
+        return m_instrumentMixer->configurePlugin(id, position, key, value);
+    return QString();
+}
+
+void
+OfflineDriver::setAudioBussLevels(int bussId, float dB, float pan)
+{
+    if (m_bussMixer)
+        m_bussMixer->setBussLevels(bussId, dB, pan);
+}
+
+void
+OfflineDriver::setAudioInstrumentLevels(InstrumentId id, float dB, float pan)
+{
+    if (m_instrumentMixer)
+        m_instrumentMixer->setInstrumentLevels(id, dB, pan);
+}
+
+void
+OfflineDriver::claimUnwantedPlugin(void *plugin)
+{
+    delete static_cast<RunnablePluginInstance *>(plugin);
+}
+
+RunnablePluginInstance *
+OfflineDriver::getSynthPlugin(InstrumentId id)
+{
+    if (m_instrumentMixer)
+        return m_instrumentMixer->getSynthPlugin(id);
+    return 0;
+}
+
+void
+OfflineDriver::updateAudioData()
+{
+    // As JackDriver::updateAudioData(), without the record inputs and
+    // latencies, which don't apply here
+
+    MappedStudio *studio = getMappedStudio();
+    MappedAudioBuss *master = studio->getAudioBuss(0);
+
+    m_masterLevel = 0.0;
+    if (master) {
+        float level = 0.0;
+        (void)master->getProperty(MappedAudioBuss::Level, level);
+        m_masterLevel = level;
+    }
+
+    InstrumentId audioInstrumentBase;
+    int audioInstruments;
+    getAudioInstrumentNumbers(audioInstrumentBase, audioInstruments);
+
+    InstrumentId synthInstrumentBase;
+    int synthInstruments;
+    getSoftSynthInstrumentNumbers(synthInstrumentBase, synthInstruments);
+
+    m_directToMaster.assign(audioInstruments + synthInstruments, false);
+
+    for (int i = 0; i < audioInstruments + synthInstruments; ++i) {
+
+        InstrumentId id;
+        if (i < audioInstruments)
+            id = audioInstrumentBase + i;
+        else
+            id = synthInstrumentBase + (i - audioInstruments);
+
+        MappedAudioFader *fader = studio->getAudioFader(id);
+        if (!fader)
+            continue;
+
+        MappedObjectValueList connections =
+            fader->getConnections(MappedConnectableObject::Out);
+
+        if (connections.empty() ||
+            (master && *connections.begin() == master->getId())) {
+            m_directToMaster[i] = true;
+        }
+    }
+
+    m_bussMixer->updateInstrumentConnections();
+    m_instrumentMixer->updateInstrumentMuteStates();
+}
+
+void
+OfflineDriver::startRender(const RealTime &start)
+{
+    if (!m_instrumentMixer)
+        return;
+
+    m_renderStart = start;
+    m_renderFrames = 0;
+    m_playing = true;
+
+    updateAudioData();
+
+    // As JackDriver::prebufferAudio(), but starting exactly at the
+    // start time rather than on the next JACK slice
+
+    m_instrumentMixer->resetAllPlugins(false);
+
+    m_fileReader->fillBuffers(start);
+
+    if (m_bussMixer->getBussCount() > 0) {
+        m_bussMixer->fillBuffers(start); // also calls on m_instrumentMixer
+    } else {
+        m_instrumentMixer->fillBuffers(start);
+    }
+}
+
+void
+OfflineDriver::renderBlock(sample_t *left, sample_t *right,
+                           InstrumentId instrument,
+                           sample_t *instrumentLeft,
+                           sample_t *instrumentRight)
+{
+    // The mixers have a block ready for us.  Mix it down as
+    // JackDriver::jackProcess() does, then have them make the next.
+
+    const size_t nframes = m_blockSize;
+
+    sample_t *master[2] = { left, right };
+    memset(master[0], 0, nframes * sizeof(sample_t));
+    memset(master[1], 0, nframes * sizeof(sample_t));
+
+    if (!m_instrumentMixer)
+        return;
+
+    // If we have any busses, then we mix from them as well as from
+    // any instruments connected straight to the master
+
+    int bussCount = m_bussMixer->getBussCount();
+
+    for (int buss = 0; buss < bussCount; ++buss) {
+
+        bool dormant = m_bussMixer->isBussDormant(buss);
+
+        for (int ch = 0; ch < 2; ++ch) {
+
+            RingBuffer<AudioBussMixer::sample_t> *rb =
+                m_bussMixer->getRingBuffer(buss, ch);
+            if (!rb)
+                continue;
+
+            if (dormant) {
+                rb->skip(nframes);
+                continue;
+            }
+
+            // Mix straight from the ring buffer's storage
+            const sample_t *first = 0, *second = 0;
+            size_t firstCount = 0, secondCount = 0;
+            size_t n = rb->getReadSpans(first, firstCount,
+                                        second, secondCount);
+            if (n > nframes) {
+                n = nframes;
+            }
+            if (firstCount > n) {
+                firstCount = n;
+            }
+            secondCount = n - firstCount;
+
+            MixKernels::mixAdd(master[ch], first, firstCount, 1.0f, 1.0f);
+            if (secondCount > 0) {
+                MixKernels::mixAdd(master[ch] + firstCount, second,
+                                   secondCount, 1.0f, 1.0f);
+            }
+
+            rb->skip(n);
+        }
+    }
+
+    InstrumentId audioInstrumentBase;
+    int audioInstruments;
+    getAudioInstrumentNumbers(audioInstrumentBase, audioInstruments);
+
+    InstrumentId synthInstrumentBase;
+    int synthInstruments;
+    getSoftSynthInstrumentNumbers(synthInstrumentBase, synthInstruments);
+
+    if (instrumentLeft && instrumentRight) {
+        memset(instrumentLeft, 0, nframes * sizeof(sample_t));
+        memset(instrumentRight, 0, nframes * sizeof(sample_t));
+    }
+
+    for (int i = 0; i < audioInstruments + synthInstruments; ++i) {
+
+        InstrumentId id;
+        if (i < audioInstruments)
+            id = audioInstrumentBase + i;
+        else
+            id = synthInstrumentBase + (i - audioInstruments);
+
+        if (m_instrumentMixer->isInstrumentEmpty(id))
+            continue;
+
+        bool directToMaster =
+            (i < int(m_directToMaster.size()) && m_directToMaster[i]);
+
+        bool dormant = m_instrumentMixer->isInstrumentDormant(id);
+
+        for (int ch = 0; ch < 2; ++ch) {
+
+            RingBuffer<AudioInstrumentMixer::sample_t, 2> *rb =
+                m_instrumentMixer->getRingBuffer(id, ch);
+            if (!rb)
+                continue;
+
+            sample_t *buffer = &m_scratch[0];
+            if (id == instrument && instrumentLeft && instrumentRight) {
+                buffer = (ch == 0 ? instrumentLeft : instrumentRight);
+            }
+
+            if (dormant) {
+                rb->skip(nframes);
+                memset(buffer, 0, nframes * sizeof(sample_t));
+            } else {
+                size_t actual = rb->read(buffer, nframes);
+                if (actual < nframes) {
+                    RG_WARNING << "renderBlock(): read" << actual << "of"
+                               << nframes << "frames for instrument" << id;
+                    memset(buffer + actual, 0,
+                           (nframes - actual) * sizeof(sample_t));
+                }
+                if (directToMaster) {
+                    MixKernels::mixAdd(master[ch], buffer, nframes,
+                                       1.0f, 1.0f);
+                }
+            }
+
+            // The buss mixer reads everything else through reader 1.
+            // With no busses, nothing will, so we skip it here to
+            // keep the instrument moving.
+
+            if (directToMaster || bussCount == 0) {
+                rb->skip(nframes, 1);
+            }
+        }
+    }
+
+    float gain = AudioLevel::dB_to_multiplier(m_masterLevel);
+
+    for (int ch = 0; ch < 2; ++ch) {
+        MixKernels::applyGain(master[ch], nframes, gain, gain);
+    }
+
+    // And on to the next block
+
+    m_renderFrames += long(nframes);
+
+    m_fileReader->kick(false);
+    m_instrumentMixer->kick(false);
+    if (bussCount > 0) {
+        m_bussMixer->kick(false, false);
+    }
+}
+
+void
+OfflineDriver::stopRender()
+{
+    m_playing = false;
+
+    if (m_instrumentMixer)
+        m_instrumentMixer->resetAllPlugins(true);
+}
+
+bool
+OfflineDriver::render(const RealTime &start, const RealTime &end,
+                      QString fileName, InstrumentId instrument)
+{
+    m_error = "";
+
+    if (!m_instrumentMixer) {
+        m_error = QObject::tr("Offline driver has not been initialised");
+        return false;
+    }
+
+    if (end <= start) {
+        m_error = QObject::tr("Nothing to render");
+        return false;
+    }
+
+    AudioWriteStream *ws =
+        AudioWriteStreamFactory::createWriteStream(fileName, 2, m_sampleRate);
+
+    if (!ws) {
+        m_error = QObject::tr("Failed to open \"%1\" for writing").arg(fileName);
+        return false;
+    }
+
+    long frames = RealTime::realTime2Frame(end - start, m_sampleRate);
+
+    std::vector<sample_t> left(m_blockSize), right(m_blockSize);
+    std::vector<sample_t> stemLeft, stemRight;
+    std::vector<sample_t> interleaved(m_blockSize * 2);
+
+    if (instrument != NoInstrument) {
+        stemLeft.resize(m_blockSize);
+        stemRight.resize(m_blockSize);
+    }
+
+    startRender(start);
+
+    bool ok = true;
+
+    while (frames > 0) {
+
+        if (instrument != NoInstrument) {
+            renderBlock(&left[0], &right[0], instrument,
+                        &stemLeft[0], &stemRight[0]);
+        } else {
+            renderBlock(&left[0], &right[0]);
+        }
+
+        const sample_t *l = (instrument != NoInstrument) ? &stemLeft[0] : &left[0];
+        const sample_t *r = (instrument != NoInstrument) ? &stemRight[0] : &right[0];
+
+        size_t n = m_blockSize;
+        if (long(n) > frames)
+            n = size_t(frames);
+
+        for (size_t i = 0; i < n; ++i) {
+            interleaved[i * 2] = l[i];
+            interleaved[i * 2 + 1] = r[i];
+        }
+
+        if (!ws->putInterleavedFrames(n, &interleaved[0])) {
+            m_error = ws->getError();
+            if (m_error == "") {
+                m_error = QObject::tr("Failed to write to \"%1\"").arg(fileName);
+            }
+            ok = false;
+            break;
+        }
+
+        frames -= long(n);
+    }
+
+    stopRender();
+
+    if (!ok) {
+        ws->remove();
+    }
+
+    delete ws;
+    return ok;
+}
+
+}
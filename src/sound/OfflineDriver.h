@@ -0,0 +1,216 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A MIDI and audio sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_OFFLINEDRIVER_H
+#define RG_OFFLINEDRIVER_H
+
+#include "DummyDriver.h"
+#include "base/Instrument.h"
+#include "base/RealTime.h"
+
+#include <QString>
+
+#include <vector>
+
+namespace Rosegarden
+{
+
+class AudioBussMixer;
+class AudioInstrumentMixer;
+class AudioFileReader;
+class RunnablePluginInstance;
+
+/**
+ * A sound driver that renders audio offline, as fast as the CPU
+ * allows, with no JACK server and no realtime threads.
+ *
+ * It owns the same AudioFileReader, AudioInstrumentMixer and
+ * AudioBussMixer that JackDriver uses, but never starts their
+ * threads: render() kicks each of them in turn, a block at a time,
+ * and mixes the result down to the master outputs just as
+ * JackDriver::jackProcess() does.  Plugins run exactly as they would
+ * in playback.  With no threads and no clock, the output for a given
+ * studio and audio queue is the same every time.
+ *
+ * To use, set up the MappedStudio (faders, busses, plugin slots) with
+ * this as its sound driver, call initialise(), add the audio files
+ * with addAudioFile() and the audio events with
+ * initialiseAudioQueue(), then render().
+ *
+ * Soft synths are run, but nothing here sends them MIDI; a caller
+ * may do that through getSynthPlugin().
+ */
+class OfflineDriver : public DummyDriver
+{
+public:
+    typedef float sample_t;
+
+    OfflineDriver(MappedStudio *studio,
+                  unsigned int sampleRate,
+                  unsigned int blockSize = 1024);
+    virtual ~OfflineDriver();
+
+    virtual bool initialise();
+    virtual void shutdown();
+
+    virtual RealTime getSequencerTime() {
+        return m_renderStart +
+            RealTime::frame2RealTime(m_renderFrames, m_sampleRate);
+    }
+
+    virtual unsigned int getSampleRate() const { return m_sampleRate; }
+
+    unsigned int getBlockSize() const { return m_blockSize; }
+
+    // Plugin instance management
+    //
+    virtual void setPluginInstance(InstrumentId id,
+                                   QString identifier,
+                                   int position);
+
+    virtual void removePluginInstance(InstrumentId id, int position);
+
+    virtual void removePluginInstances();
+
+    virtual void setPluginInstancePortValue(InstrumentId id,
+                                            int position,
+                                            unsigned long portNumber,
+                                            float value);
+
+    virtual float getPluginInstancePortValue(InstrumentId id,
+                                             int position,
+                                             unsigned long portNumber);
+
+    virtual void setPluginInstanceBypass(InstrumentId id,
+                                         int position,
+                                         bool value);
+
+    virtual QStringList getPluginInstancePrograms(InstrumentId id,
+                                                  int position);
+
+    virtual QString getPluginInstanceProgram(InstrumentId id,
+                                             int position);
+
+    virtual QString getPluginInstanceProgram(InstrumentId id,
+                                             int position,
+                                             int bank,
+                                             int program);
+
+    virtual unsigned long getPluginInstanceProgram(InstrumentId id,
+                                                   int position,
+                                                   QString name);
+
+    virtual void setPluginInstanceProgram(InstrumentId id,
+                                          int position,
+                                          QString program);
+
+    virtual QString configurePlugin(InstrumentId id,
+                                    int position,
+                                    QString key,
+                                    QString value);
+
+    virtual void setAudioBussLevels(int bussId,
+                                    float dB,
+                                    float pan);
+
+    virtual void setAudioInstrumentLevels(InstrumentId id,
+                                          float dB,
+                                          float pan);
+
+    virtual QString getStatusLog();
+
+    virtual void getAudioInstrumentNumbers(InstrumentId &base, int &count) {
+        base = AudioInstrumentBase;
+        count = AudioInstrumentCount;
+    }
+    virtual void getSoftSynthInstrumentNumbers(InstrumentId &base, int &count) {
+        base = SoftSynthInstrumentBase;
+        count = SoftSynthInstrumentCount;
+    }
+
+    /// Nothing else can be using the plugin, so it's deleted at once.
+    virtual void claimUnwantedPlugin(void *plugin);
+    virtual void scavengePlugins() { }
+
+    RunnablePluginInstance *getSynthPlugin(InstrumentId id);
+
+    /**
+     * Render from start to end into a new audio file, which will be
+     * stereo at the driver's sample rate in whatever format the file
+     * name's extension calls for.
+     *
+     * With instrument set to NoInstrument, this renders the master
+     * mix; otherwise it renders just that instrument's output, after
+     * its own fader and pan but before the master fader, for a stem.
+     *
+     * Returns false, with the reason in getError(), on failure.
+     */
+    bool render(const RealTime &start, const RealTime &end,
+                QString fileName,
+                InstrumentId instrument = NoInstrument);
+
+    QString getError() const { return m_error; }
+
+    /**
+     * Prepare to render blocks from the given time: pick up the
+     * current studio connections and levels, reset the plugins, and
+     * prebuffer.  Call after any change to the studio or audio queue.
+     */
+    void startRender(const RealTime &start);
+
+    /**
+     * Render the next getBlockSize() frames into left and right, and
+     * move on.  If instrument is set, that instrument's output goes
+     * into instrumentLeft and instrumentRight as well.
+     */
+    void renderBlock(sample_t *left, sample_t *right,
+                     InstrumentId instrument = NoInstrument,
+                     sample_t *instrumentLeft = 0,
+                     sample_t *instrumentRight = 0);
+
+    void stopRender();
+
+private:
+    // Not copyable
+    OfflineDriver(const OfflineDriver &);
+    OfflineDriver &operator=(const OfflineDriver &);
+
+    /// Pick up the master level and which instruments go direct to it
+    void updateAudioData();
+
+    unsigned int m_sampleRate;
+    unsigned int m_blockSize;
+
+    AudioFileReader *m_fileReader;
+    AudioInstrumentMixer *m_instrumentMixer;
+    AudioBussMixer *m_bussMixer;
+
+    // Counted in frames, so that the time doesn't drift with rounding
+    RealTime m_renderStart;
+    long m_renderFrames;
+
+    float m_masterLevel;
+
+    // Indexed as for the mixer: audio instruments, then synths
+    std::vector<bool> m_directToMaster;
+
+    // For reading instrument output we don't want
+    std::vector<sample_t> m_scratch;
+
+    QString m_error;
+};
+
+}
+
+#endif
@@ -23,6 +23,8 @@
 #include <vector>
 
 #include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
 #include <QProgressDialog>
 #include <QStringList>
 
@@ -50,6 +52,18 @@ static const float SAMPLE_MAX_8BIT  = (float)(0xff);
 static const float SAMPLE_MAX_16BIT = (float)(0xffff/2);
 static const float SAMPLE_MAX_24BIT = (float)(0xffffff/2);
 static const char AUDIO_BWF_PEAK_ID[] = "levl";  // BWF peak chunk id
+static const char AUDIO_PEAK_MIPMAP_ID[] = "mipm";  // our mipmap chunk id
+static const int AUDIO_PEAK_MIPMAP_VERSION = 1;
+
+namespace
+{
+
+int readLittleEndian32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
+}
+
+}
 
 namespace Rosegarden
 {
@@ -71,61 +85,87 @@ PeakFile::PeakFile(AudioFile *audioFile) :
         m_lastPreviewStartTime(0, 0),
         m_lastPreviewEndTime(0, 0),
         m_lastPreviewWidth( -1),
-        m_lastPreviewShowMinima(false)
+        m_lastPreviewShowMinima(false),
+        m_mapFile(0),
+        m_map(0)
 {
 }
 
 PeakFile::~PeakFile()
 {
+    unmap();
 }
 
 bool
 PeakFile::open()
 {
+    // If we're already open then don't open again
+    //
+    if (m_map)
+        return true;
+
     // Set the file size
     //
     QFileInfo info(m_fileName);
     m_fileSize = (size_t)info.size(); // cast from qint64
 
-    // If we're already open then don't open again
-    //
-    if (m_inFile && m_inFile->is_open())
-        return true;
+    if (m_fileSize < 128)
+        return false;
 
-    // Open
+    // Map the whole file.  It stays mapped until close().
     //
-    m_inFile = new std::ifstream(m_fileName.toLocal8Bit(),
-                                 std::ios::in | std::ios::binary);
-    // Check we're open
-    //
-    if (!(*m_inFile))
+    m_mapFile = new QFile(m_fileName);
+
+    if (m_mapFile->open(QIODevice::ReadOnly))
+        m_map = m_mapFile->map(0, m_fileSize);
+
+    if (!m_map) {
+        unmap();
         return false;
+    }
 
     try {
         parseHeader();
+        setupLevels();
     } catch (BadSoundFileException s) {
 
 #ifdef DEBUG_PEAKFILE
         RG_WARNING << "open() - EXCEPTION \"" << s.getMessage() << "\"";
 #endif
 
+        unmap();
         return false;
     }
 
     return true;
 }
 
+void
+PeakFile::unmap()
+{
+    m_levels.clear();
+    m_mipmapCache.clear();
+
+    if (m_map)
+        m_mapFile->unmap(m_map);
+    m_map = 0;
+
+    delete m_mapFile;
+    m_mapFile = 0;
+
+    // Anything in the preview cache came from the old mapping
+    m_lastPreviewWidth = -1;
+}
+
 void
 PeakFile::parseHeader()
 {
-    if (!(*m_inFile))
+    if (!m_map)
         return ;
 
-    m_inFile->seekg(0, std::ios::beg);
-
     // get full header length
     //
-    std::string header = getBytes(128);
+    std::string header(reinterpret_cast<const char *>(m_map), 128);
 
     if (header.compare(0, 4, AUDIO_BWF_PEAK_ID) != 0) {
         throw(BadSoundFileException(m_fileName, "PeakFile::parseHeader - can't find LEVL identifier"));
@@ -138,6 +178,8 @@ PeakFile::parseHeader()
     if (length == 0)
         throw(BadSoundFileException(m_fileName, "PeakFile::parseHeader - can't get header length"));
 
+    m_bodyBytes = length - 120;
+
     // Get the file information
     //
     m_version = getIntegerFromLittleEndian(header.substr(8, 4));
@@ -166,6 +208,162 @@ PeakFile::parseHeader()
     //printStats();
 }
 
+void
+PeakFile::setupLevels()
+{
+    m_levels.clear();
+    m_mipmapCache.clear();
+
+    if ((m_format != 1 && m_format != 2) ||
+        m_channels <= 0 ||
+        m_pointsPerValue < 1 || m_pointsPerValue > 2 ||
+        m_bodyBytes < 0) {
+        throw(BadSoundFileException(m_fileName, "PeakFile::setupLevels - unsupported peak format"));
+    }
+
+    // Level 0 is the peak chunk itself
+    //
+    const size_t frameBytes = size_t(m_format) * m_pointsPerValue * m_channels;
+
+    PeakLevel level0;
+    level0.data = m_map + 128;
+    level0.peaks = int(std::min(size_t(std::max(m_numberOfPeaks, 0)),
+                                (m_fileSize - 128) / frameBytes));
+    level0.bytesPerValue = m_format;
+    level0.pointsPerValue = m_pointsPerValue;
+    m_levels.push_back(level0);
+
+    if (m_pointsPerValue != 2)
+        return;
+
+    // Use the mipmap chunk following the peaks if it's there and
+    // matches them.
+    //
+    // "mipm", size, version, level count, peaks in each level, and
+    // then the levels themselves.
+    //
+    size_t pos = 128 + size_t(m_bodyBytes);
+    bool haveMipmaps = false;
+
+    if (pos + 16 <= m_fileSize &&
+        std::string(reinterpret_cast<const char *>(m_map + pos), 4) ==
+            AUDIO_PEAK_MIPMAP_ID &&
+        readLittleEndian32(m_map + pos + 8) == AUDIO_PEAK_MIPMAP_VERSION) {
+
+        size_t chunkEnd = pos + 8 + size_t(readLittleEndian32(m_map + pos + 4));
+        int levels = readLittleEndian32(m_map + pos + 12);
+        size_t dataPos = pos + 16 + 4 * size_t(std::max(levels, 0));
+
+        haveMipmaps = (levels >= 0 && chunkEnd <= m_fileSize &&
+                       dataPos <= chunkEnd);
+
+        int peaks = level0.peaks;
+
+        for (int i = 0; haveMipmaps && i < levels; ++i) {
+            PeakLevel level;
+            level.data = m_map + dataPos;
+            level.peaks = readLittleEndian32(m_map + pos + 16 + 4 * i);
+            level.bytesPerValue = 2;
+            level.pointsPerValue = 2;
+
+            dataPos += size_t(level.peaks) * m_channels * 4;
+
+            // Each level halves the one before
+            if (level.peaks != (peaks + 1) / 2 || dataPos > chunkEnd) {
+                haveMipmaps = false;
+                break;
+            }
+
+            m_levels.push_back(level);
+            peaks = level.peaks;
+        }
+
+        if (peaks > 1)
+            haveMipmaps = false;
+    }
+
+    if (haveMipmaps)
+        return;
+
+#ifdef DEBUG_PEAKFILE
+    RG_DEBUG << "setupLevels() - no usable mipmap chunk, building mipmaps";
+#endif
+
+    m_levels.resize(1);
+
+    std::vector<int> levelPeaks;
+    buildMipmaps(level0, m_mipmapCache, levelPeaks);
+
+    const unsigned char *data =
+        reinterpret_cast<const unsigned char *>(m_mipmapCache.data());
+
+    for (size_t i = 0; i < levelPeaks.size(); ++i) {
+        PeakLevel level;
+        level.data = data;
+        level.peaks = levelPeaks[i];
+        level.bytesPerValue = 2;
+        level.pointsPerValue = 2;
+        m_levels.push_back(level);
+
+        data += size_t(level.peaks) * m_channels * 4;
+    }
+}
+
+void
+PeakFile::buildMipmaps(const PeakLevel &level0,
+                       std::string &data,
+                       std::vector<int> &levelPeaks) const
+{
+    data.clear();
+    levelPeaks.clear();
+
+    if (level0.pointsPerValue != 2)
+        return;
+
+    const int values = m_channels * 2;
+
+    // Decode level 0, then keep halving it: each value is the maximum
+    // (or minimum) of the two it replaces.
+    //
+    std::vector<short> current(size_t(level0.peaks) * values);
+
+    for (int peak = 0; peak < level0.peaks; ++peak) {
+        for (int ch = 0; ch < m_channels; ++ch) {
+            current[peak * values + ch * 2] = getValue(level0, peak, ch, 0);
+            current[peak * values + ch * 2 + 1] = getValue(level0, peak, ch, 1);
+        }
+    }
+
+    int peaks = level0.peaks;
+
+    while (peaks > 1) {
+        int nextPeaks = (peaks + 1) / 2;
+        std::vector<short> next(size_t(nextPeaks) * values);
+
+        for (int peak = 0; peak < nextPeaks; ++peak) {
+            const short *a = &current[2 * peak * values];
+            const short *b = (2 * peak + 1 < peaks) ? a + values : a;
+            short *out = &next[peak * values];
+
+            for (int v = 0; v < values; v += 2) {
+                out[v] = std::max(a[v], b[v]);
+                out[v + 1] = std::min(a[v + 1], b[v + 1]);
+            }
+        }
+
+        size_t start = data.size();
+        data.resize(start + next.size() * 2);
+        for (size_t i = 0; i < next.size(); ++i) {
+            data[start + i * 2] = char(next[i] & 0xff);
+            data[start + i * 2 + 1] = char((next[i] >> 8) & 0xff);
+        }
+
+        levelPeaks.push_back(nextPeaks);
+        current.swap(next);
+        peaks = nextPeaks;
+    }
+}
+
 void
 PeakFile::printStats()
 {
@@ -197,6 +395,9 @@ PeakFile::printStats()
 bool
 PeakFile::write()
 {
+    // We're about to rewrite the file, so it mustn't stay mapped
+    unmap();
+
     if (m_outFile) {
         m_outFile->close();
         delete m_outFile;
@@ -234,13 +435,9 @@ PeakFile::write()
 void
 PeakFile::close()
 {
-    // Close any input file handle
+    // Drop any mapping
     //
-    if (m_inFile && m_inFile->is_open()) {
-        m_inFile->close();
-        delete m_inFile;
-        m_inFile = 0;
-    }
+    unmap();
 
     if (m_outFile == 0)
         return ;
@@ -296,6 +493,35 @@ PeakFile::close()
     dateString += "     ";
     putBytes(m_outFile, dateString);
 
+    // Append the mipmap chunk (see setupLevels()) after the peaks
+    //
+    if (m_pointsPerValue == 2 && m_channels > 0) {
+        PeakLevel level0;
+        level0.data =
+            reinterpret_cast<const unsigned char *>(m_writtenPeaks.data());
+        level0.peaks = m_numberOfPeaks;
+        level0.bytesPerValue = m_format;
+        level0.pointsPerValue = m_pointsPerValue;
+
+        std::string data;
+        std::vector<int> levelPeaks;
+        buildMipmaps(level0, data, levelPeaks);
+
+        std::string chunk = AUDIO_PEAK_MIPMAP_ID;
+        chunk += getLittleEndianFromInteger(
+                8 + 4 * levelPeaks.size() + data.size(), 4);
+        chunk += getLittleEndianFromInteger(AUDIO_PEAK_MIPMAP_VERSION, 4);
+        chunk += getLittleEndianFromInteger(levelPeaks.size(), 4);
+        for (size_t i = 0; i < levelPeaks.size(); ++i)
+            chunk += getLittleEndianFromInteger(levelPeaks[i], 4);
+
+        m_outFile->seekp(0, std::ios::end);
+        putBytes(m_outFile, chunk);
+        putBytes(m_outFile, data);
+    }
+
+    m_writtenPeaks.clear();
+
     // Ok, now close and tidy up
     //
     m_outFile->close();
@@ -399,44 +625,6 @@ PeakFile::writeHeader(std::ofstream *file)
     putBytes(file, header);
 }
 
-bool
-PeakFile::scanToPeak(int peak)
-{
-    if (!m_inFile)
-        return false;
-
-    if (!m_inFile->is_open())
-        return false;
-
-    // Scan to start of chunk and then seek to peak number
-    //
-    ssize_t pos = (ssize_t)m_chunkStartPosition + 128 +
-                  peak * m_format * m_channels * m_pointsPerValue;
-
-    ssize_t off = pos - m_inFile->tellg();
-
-    if (off == 0) {
-        return true;
-    } else if (off < 0) {
-        //RG_WARNING << "scanToPeak(): warning: seeking backwards for peak " << peak << " (" << m_inFile->tellg() << " -> " << pos << ")";
-        m_inFile->seekg(pos);
-    } else {
-        m_inFile->seekg(off, std::ios::cur);
-    }
-
-    // Ensure we re-read the input buffer if we're
-    // doing buffered reads as it's now meaningless
-    //
-    m_loseBuffer = true;
-
-    if (m_inFile->eof()) {
-        m_inFile->clear();
-        return false;
-    }
-
-    return true;
-}
-
 #if 0
 bool
 PeakFile::scanForward(int numberOfPeaks)
@@ -505,6 +693,7 @@ PeakFile::writePeaks(std::ofstream *file)
     m_numberOfPeaks = 0;
     m_bodyBytes = 0;
     m_positionPeakOfPeaks = 0;
+    m_writtenPeaks.clear();
 
     // ??? Block count?  How does this differ from m_numberOfPeaks?
     int ct = 0;
@@ -622,15 +811,19 @@ PeakFile::writePeaks(std::ofstream *file)
             sampleFrameCount++;
         }
 
-        // Write absolute peak data in channel order
+        // Write absolute peak data in channel order, keeping a copy
+        // for close() to build the mipmaps from
         //
+        std::string peaks;
         for (unsigned int i = 0; i < m_audioFile->getChannels(); i++) {
-            putBytes(file, getLittleEndianFromInteger(channelPeaks[i].first,
-                     m_format));
-            putBytes(file, getLittleEndianFromInteger(channelPeaks[i].second,
-                     m_format));
+            peaks += getLittleEndianFromInteger(channelPeaks[i].first,
+                                                m_format);
+            peaks += getLittleEndianFromInteger(channelPeaks[i].second,
+                                                m_format);
             m_bodyBytes += m_format * 2;
         }
+        putBytes(file, peaks);
+        m_writtenPeaks += peaks;
 
         // increment number of peak frames
         m_numberOfPeaks++;
@@ -655,42 +848,11 @@ PeakFile::getPreview(const RealTime &startTime,
              << ", showMinima = " << showMinima;
 #endif
 
-    if (getSize() == 0) {
-        RG_DEBUG << "getPreview() - PeakFile size == 0";
+    if (getSize() == 0 || m_levels.empty()) {
+        RG_DEBUG << "getPreview() - no peaks";
         return std::vector<float>();
     }
 
-    // Regenerate cache on these conditions
-    //
-    if (!m_peakCache.length()) {
-#ifdef DEBUG_PEAKFILE_CACHE
-        RG_DEBUG << "getPreview() - no peak cache";
-#endif
-
-        if (getSize() < (256 *1024)) // if less than 256K PeakFile
-        {
-            // Scan to start of peak data
-            scanToPeak(0);
-            try
-            {
-                m_peakCache = getBytes(m_inFile, getSize() - 128);
-            } catch (BadSoundFileException e)
-            {
-                RG_WARNING << "PeakFile::getPreview: " << e.getMessage();
-            }
-
-#ifdef DEBUG_PEAKFILE_CACHE
-            RG_DEBUG << "getPreview() - generated peak cache - size = " << m_peakCache.length();
-#endif
-
-        } else {
-#ifdef DEBUG_PEAKFILE_CACHE
-            RG_DEBUG << "getPreview() - file size = " << getSize() << ", not generating cache";
-#endif
-
-        }
-    }
-
     // Check to see if we hit the "lastPreview" cache by comparing the last
     // query parameters we used.
     //
@@ -722,7 +884,6 @@ PeakFile::getPreview(const RealTime &startTime,
     // Actual possible sample length in RealTime
     //
     double step = double(endPeak - startPeak) / double(width);
-    std::string peakData;
     int peakNumber;
 
 #ifdef DEBUG_PEAKFILE_BRIEF
@@ -752,25 +913,21 @@ PeakFile::getPreview(const RealTime &startTime,
     float *hiValues = new float[m_channels];
     float *loValues = new float[m_channels];
 
+    const int levels = int(m_levels.size());
+    const int availablePeaks = m_levels[0].peaks;
+
     for (int i = 0; i < width; i++) {
 
         peakNumber = startPeak + int(double(i) * step);
         int nextPeakNumber = startPeak + int(double(i + 1) * step);
 
-        // Seek to value
+        // There's nothing to show beyond the ends of the peaks
         //
-        if (!m_peakCache.length()) {
-
-            if (scanToPeak(peakNumber) == false) {
-#ifdef DEBUG_PEAKFILE
-                RG_DEBUG << "getPreview(): scanToPeak(" << peakNumber << ") failed";
-#endif
+        peakNumber = std::max(peakNumber, 0);
+        nextPeakNumber = std::min(nextPeakNumber, availablePeaks);
 
-                m_lastPreviewCache.push_back(0.0f);
-            }
-        }
 #ifdef DEBUG_PEAKFILE
-        RG_DEBUG << "getPreview(): step is " << step << ", format * pointsPerValue * chans is " << (m_format * m_pointsPerValue * m_channels);
+        RG_DEBUG << "getPreview(): step is " << step;
         RG_DEBUG << "              i = " << i << ", peakNumber = " << peakNumber << ", nextPeakNumber = " << nextPeakNumber;
 #endif
 
@@ -779,87 +936,35 @@ PeakFile::getPreview(const RealTime &startTime,
             loValues[ch] = 0.0f;
         }
 
-        // Get peak value over channels
+        // Get peak value over channels.  Cover the peaks with as few
+        // values as possible: each time round, take the coarsest level
+        // with a value that starts here and doesn't run past the end.
+        // That's at most a couple of values per level below the one
+        // matching the step.
         //
         for (int k = 0; peakNumber < nextPeakNumber; ++k) {
 
-            for (int ch = 0; ch < m_channels; ch++) {
-
-                if (!m_peakCache.length()) {
-
-                    try {
-                        peakData = getBytes(m_inFile, m_format * m_pointsPerValue);
-                    } catch (BadSoundFileException e) {
-                        // Problem with the get - probably an EOF
-                        // return the results so far.
-                        //
-#ifdef DEBUG_PEAKFILE
-                        RG_DEBUG << "getPreview() - \"" << e.getMessage() << "\"";
-#endif
-
-                        goto done;
-                    }
-#ifdef DEBUG_PEAKFILE
-                    RG_DEBUG << "getPreview() - read from file";
-#endif
-
-                } else {
-
-                    int valueNum = peakNumber * m_channels + ch;
-                    int charNum = valueNum * m_format * m_pointsPerValue;
-                    int charLength = m_format * m_pointsPerValue;
-
-                    // Get peak value from the cached string if
-                    // the value is valid.
-                    //
-                    if (charNum + charLength <= (int)m_peakCache.length()) {
-                        peakData = m_peakCache.substr(charNum, charLength);
-#ifdef DEBUG_PEAKFILE
-
-                        RG_DEBUG << "getPreview() - hit peakCache";
-#endif
-
-                    }
-                }
-
-
-                if (peakData.length() != (unsigned int)(m_format *
-                                                        m_pointsPerValue)) {
-                    // We didn't get the whole peak block - return what
-                    // we've got so far
-                    //
-#ifdef DEBUG_PEAKFILE
-                    RG_DEBUG << "getPreview() - failed to get complete peak block";
-#endif
-
-                    goto done;
-                }
+            int levelNumber = 0;
+            while (levelNumber + 1 < levels &&
+                   (peakNumber & ((2 << levelNumber) - 1)) == 0 &&
+                   peakNumber + (2 << levelNumber) <= nextPeakNumber) {
+                ++levelNumber;
+            }
 
-                int intDivisor = int(divisor);
-                int inValue =
-                    getIntegerFromLittleEndian(peakData.substr(0, m_format));
+            const PeakLevel &level = m_levels[levelNumber];
+            int index = peakNumber >> levelNumber;
 
-                while (inValue > intDivisor) {
-                    inValue -= (1 << (m_format * 8));
-                }
+            for (int ch = 0; ch < m_channels; ch++) {
 
-#ifdef DEBUG_PEAKFILE
-                RG_DEBUG << "getPreview() - found potential hivalue " << inValue;
-#endif
+                int inValue = getValue(level, index, ch, 0);
 
                 if (k == 0 || inValue > hiValues[ch]) {
                     hiValues[ch] = float(inValue);
                 }
 
-                if (m_pointsPerValue == 2) {
-
-                    inValue =
-                        getIntegerFromLittleEndian(
-                            peakData.substr(m_format, m_format));
+                if (level.pointsPerValue == 2) {
 
-                    while (inValue > intDivisor) {
-                        inValue -= (1 << (m_format * 8));
-                    }
+                    inValue = getValue(level, index, ch, 1);
 
                     if (k == 0 || inValue < loValues[ch]) {
                         loValues[ch] = inValue;
@@ -867,7 +972,7 @@ PeakFile::getPreview(const RealTime &startTime,
                 }
             }
 
-            ++peakNumber;
+            peakNumber += 1 << levelNumber;
         }
 
         for (int ch = 0; ch < m_channels; ++ch) {
@@ -890,8 +995,6 @@ PeakFile::getPreview(const RealTime &startTime,
         }
     }
 
-done:
-    resetStream();
     delete[] hiValues;
     delete[] loValues;
 
@@ -932,7 +1035,9 @@ PeakFile::getSplitPoints(const RealTime &startTime,
                          const RealTime &minLength)
 {
     std::vector<SplitPointPair> points;
-    std::string peakData;
+
+    if (!open())
+        return points;
 
     int startPeak = getPeak(startTime);
     int endPeak = getPeak(endTime);
@@ -940,7 +1045,7 @@ PeakFile::getSplitPoints(const RealTime &startTime,
     if (endPeak < startPeak)
         return std::vector<SplitPointPair>();
 
-    scanToPeak(startPeak);
+    const PeakLevel &level0 = m_levels[0];
 
     float divisor = 0.0f;
     switch (m_format) {
@@ -965,21 +1070,15 @@ PeakFile::getSplitPoints(const RealTime &startTime,
     for (int i = startPeak; i < endPeak; i++) {
         value = 0.0;
 
-        for (int ch = 0; ch < m_channels; ch++) {
-            try {
-                peakData = getBytes(m_inFile, m_format * m_pointsPerValue);
-            } catch (BadSoundFileException e) {
-                RG_WARNING << "getSplitPoints(): " << e.getMessage();
-                break;
-            }
+        for (int ch = 0; i >= 0 && i < level0.peaks && ch < m_channels; ch++) {
+            const unsigned char *peakData = level0.data +
+                (i * m_channels + ch) * m_pointsPerValue * m_format;
 
-            if (peakData.length() == (unsigned int)(m_format *
-                                                    m_pointsPerValue)) {
-                int peakValue =
-                    getIntegerFromLittleEndian(peakData.substr(0, m_format));
+            int peakValue = peakData[0];
+            if (m_format == 2)
+                peakValue |= peakData[1] << 8;
 
-                value += std::fabs(float(peakValue) / divisor);
-            }
+            value += std::fabs(float(peakValue) / divisor);
         }
 
         value /= float(m_channels);
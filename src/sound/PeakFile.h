@@ -12,12 +12,14 @@
     COPYING included with this distribution for more information.
 */
 
+#include <string>
 #include <vector>
 
 #include <QObject>
 #include <QDateTime>
 #include <QPointer>
 
+class QFile;
 class QProgressDialog;
 
 #include "SoundFile.h"
@@ -45,6 +47,14 @@ typedef std::pair<RealTime, RealTime> SplitPointPair;
  * the sample file itself (writeToHandle()) or used to generate an
  * external peak file (write()).  At the moment the only type of file
  * with an embedded peak chunk is the BWF file itself.
+ *
+ * External peak files are memory-mapped by open().  After the peak
+ * chunk, write() appends a "mipm" chunk holding a pyramid of
+ * decimated copies of the peaks, each level covering twice as many
+ * blocks per value as the one before, so that getPreview() only
+ * touches a handful of values per pixel whatever the zoom level.
+ * Files without the mipmap chunk (older ones) get their pyramid built
+ * in memory when they are opened.
  */
 class PeakFile : public QObject, public SoundFile
 {
@@ -126,6 +136,41 @@ protected:
 
     void parseHeader();
 
+    /// One level of the peak pyramid.
+    /**
+     * Level 0 is the peak chunk itself.  Level n holds one maximum and
+     * minimum per channel for each 2^n blocks, as 16-bit little-endian
+     * values.
+     */
+    struct PeakLevel
+    {
+        const unsigned char *data;
+        int peaks;
+        int bytesPerValue;
+        int pointsPerValue;
+    };
+
+    /// Set up m_levels from the mapped file.
+    void setupLevels();
+
+    /// Decimate level 0 into mipmap chunk data (levels 1 and up).
+    void buildMipmaps(const PeakLevel &level0,
+                      std::string &data,
+                      std::vector<int> &levelPeaks) const;
+
+    /// Get value point (0 for the maximum, 1 for the minimum).
+    int getValue(const PeakLevel &level, int peak, int channel,
+                 int point) const
+    {
+        const unsigned char *p = level.data +
+            ((peak * m_channels + channel) * level.pointsPerValue + point) *
+            level.bytesPerValue;
+        if (level.bytesPerValue == 1) return p[0];
+        return short(p[0] | (p[1] << 8));
+    }
+
+    void unmap();
+
     /// The AudioFile that this peak file is based on.
     AudioFile *m_audioFile;
 
@@ -158,10 +203,19 @@ protected:
     /// Optional progress dialog for write().
     QPointer<QProgressDialog> m_progressDialog;
 
-    /// Cached in-memory copy of the peak file for getPreview().
-    std::string        m_peakCache;
-    
-    bool scanToPeak(int peak);
+    /// The peak file, mapped by open().
+    QFile *m_mapFile;
+    unsigned char *m_map;
+
+    /// Level 0 followed by the mipmaps, pointing into m_map (or into
+    /// m_mipmapCache when the file has no mipmap chunk).
+    std::vector<PeakLevel> m_levels;
+    std::string        m_mipmapCache;
+
+    /// The peaks written by writePeaks(), for close() to build the
+    /// mipmap chunk from.
+    std::string        m_writtenPeaks;
+
     //bool scanForward(int numberOfPeaks);
 };
 
@@ -14,6 +14,7 @@
 */
 
 #include "PlayableAudioFile.h"
+#include "base/Profiler.h"
 
 namespace Rosegarden
 {
@@ -287,6 +288,7 @@ RingBufferPool::returnBuffer(RingBuffer<sample_t> *buffer)
 
 
 AudioCache PlayableAudioFile::m_smallFileCache;
+int PlayableAudioFile::m_smallFileCacheSampleRate = 0;
 
 std::vector<PlayableAudioFile::sample_t *> PlayableAudioFile::m_workBuffers;
 size_t PlayableAudioFile::m_workBufferSize = 0;
@@ -631,17 +633,25 @@ PlayableAudioFile::addSamples(std::vector<sample_t *> &destination,
 void
 PlayableAudioFile::checkSmallFileCache(size_t smallFileSize)
 {
-    if (m_smallFileCache.has(m_audioFile)) {
+    // Files are cached at the target sample rate, so anything cached
+    // but not in use at another rate is no good to us
+    if (m_targetSampleRate != m_smallFileCacheSampleRate) {
+        m_smallFileCache.purge();
+        m_smallFileCacheSampleRate = m_targetSampleRate;
+    }
+
+    if (m_smallFileCache.acquire(m_audioFile)) {
 
 #ifdef DEBUG_PLAYABLE
         std::cerr << "PlayableAudioFile::checkSmallFileCache: Found file in small file cache" << std::endl;
 #endif
 
-        m_smallFileCache.incrementReference(m_audioFile);
         m_isSmallFile = true;
 
     } else if (m_audioFile->getSize() <= smallFileSize) {
 
+        Profiler profiler("PlayableAudioFile::checkSmallFileCache: decode");
+
         std::ifstream file(m_audioFile->getFilename().toLocal8Bit(),
                            std::ios::in | std::ios::binary);
 
@@ -48,6 +48,16 @@ public:
 
     static void setRingBufferPoolSizes(size_t n, size_t nframes);
 
+    /// Memory budget for decoded small files (see AudioCache).
+    static void setSmallFileCacheBudget(size_t bytes)
+        { m_smallFileCache.setMemoryBudget(bytes); }
+    static AudioCache::Statistics getSmallFileCacheStatistics()
+        { return m_smallFileCache.getStatistics(); }
+
+    /// Drop any cached data for an AudioFile that is being deleted.
+    static void forgetAudioFile(AudioFile *audioFile)
+        { m_smallFileCache.remove(audioFile); }
+
     void setStartTime(const RealTime &time) { m_startTime = time; }
     RealTime getStartTime() const { return m_startTime; }
 
@@ -186,6 +196,7 @@ protected:
     int                   m_runtimeSegmentId;
 
     static AudioCache     m_smallFileCache;
+    static int            m_smallFileCacheSampleRate;
     bool                  m_isSmallFile;
 
     static std::vector<sample_t *> m_workBuffers;
@@ -25,6 +25,8 @@
 
 #include <locale.h>
 
+#include <map>
+
 namespace Rosegarden
 {
 
@@ -33,6 +35,9 @@ int PluginFactory::m_sampleRate = 48000;
 static LADSPAPluginFactory *ladspaInstance = 0;
 static LADSPAPluginFactory *dssiInstance = 0;
 
+typedef std::map<QString, PluginFactory *> FactoryMap;
+static FactoryMap registeredInstances;
+
 PluginFactory *
 PluginFactory::instance(QString pluginType)
 {
@@ -51,10 +56,18 @@ PluginFactory::instance(QString pluginType)
         }
         return dssiInstance;
     } else {
+        FactoryMap::iterator i = registeredInstances.find(pluginType);
+        if (i != registeredInstances.end()) return i->second;
         return 0;
     }
 }
 
+void
+PluginFactory::registerFactory(QString pluginType, PluginFactory *factory)
+{
+    registeredInstances[pluginType] = factory;
+}
+
 PluginFactory *
 PluginFactory::instanceFor(QString identifier)
 {
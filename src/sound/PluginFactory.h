@@ -34,6 +34,14 @@ public:
     static PluginFactory *instanceFor(QString identifier);
     static void enumerateAllPlugins(MappedObjectPropertyList &);
 
+    /**
+     * Have instance() return the given factory for a plugin type other
+     * than the built-in LADSPA and DSSI ones.  The factory isn't owned
+     * by us, and isn't asked to enumerate its plugins.  This is for
+     * plugins that behave predictably, such as the tests use.
+     */
+    static void registerFactory(QString pluginType, PluginFactory *factory);
+
     static void setSampleRate(int sampleRate) { m_sampleRate = sampleRate; }
 
     /**
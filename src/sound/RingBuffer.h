@@ -20,7 +20,12 @@
 #include <sys/mman.h>
 #include <string.h>
 
+#include <algorithm>
+
+#include <QAtomicInt>
+
 #include "Scavenger.h"
+#include "base/AtomicCompat.h"
 
 //#define DEBUG_RINGBUFFER 1
 //#define DEBUG_RINGBUFFER_CREATE_DESTROY 1
@@ -46,6 +51,16 @@ namespace Rosegarden {
  * For efficiency, RingBuffer frequently initialises samples by
  * writing zeroes into their memory space, so T should normally be a
  * simple type that can safely be set to zero using memset.
+ *
+ * The read and write pointers are atomic.  The writer publishes new
+ * samples with a release store of the write pointer, which each
+ * reader loads with acquire, and vice versa for the space the readers
+ * free up.  So this is safe on CPUs with weak memory ordering as well
+ * as on x86.
+ *
+ * getReadSpans() and getWriteSpans() give direct access to the
+ * samples, for processing them in place (e.g. with vectorised loops)
+ * instead of copying them through read() and write().
  */
 
 template <typename T, int N = 1>
@@ -180,13 +195,68 @@ public:
      */
     size_t zero(size_t n);
 
+    /**
+     * Get the samples available for reading by reader R in place, as
+     * up to two contiguous spans: the first from the read pointer
+     * towards the end of the storage, the second (which may be empty)
+     * continuing from the start of it.  Returns the total number of
+     * samples, firstCount + secondCount.
+     *
+     * The samples stay in the buffer until skip() is called for them.
+     */
+    size_t getReadSpans(const T *&first, size_t &firstCount,
+                        const T *&second, size_t &secondCount,
+                        int R = 0) const;
+
+    /**
+     * Get the space available for writing in place, as up to two
+     * contiguous spans, as for getReadSpans().  Returns the total
+     * number of samples that may be written.
+     *
+     * Nothing written there is visible to the readers until
+     * commitWrite() is called.
+     */
+    size_t getWriteSpans(T *&first, size_t &firstCount,
+                         T *&second, size_t &secondCount);
+
+    /**
+     * Make n samples written in place (see getWriteSpans()) available
+     * to the readers.  Returns the number of samples actually
+     * committed, which is less than n if there isn't room for n.
+     */
+    size_t commitWrite(size_t n);
+
 protected:
+    enum { CacheLineSize = 64 };
+
+    /**
+     * A read or write pointer.  Each one has a cache line to itself,
+     * so that the writer and the readers, which are on different
+     * threads, don't keep taking the line away from each other.
+     */
+    struct Index
+    {
+        char       padding[CacheLineSize];
+        QAtomicInt value;
+    };
+
+    /// Samples available to a reader at reader, given the writer.
+    size_t readSpace(size_t writer, size_t reader) const {
+        return (writer + m_size - reader) % m_size;
+    }
+
+    /// Advance reader R, which is at reader, by n samples.
+    void advanceReader(size_t reader, size_t n, int R) {
+        atomicStoreRelease(m_readers[R].value, int((reader + n) % m_size));
+    }
+
     T               *m_buffer;
-    volatile size_t  m_writer;
-    volatile size_t  m_readers[N];
     size_t           m_size;
     bool             m_mlocked;
 
+    Index            m_writer;
+    Index            m_readers[N];
+
     static Scavenger<ScavengerArrayWrapper<T> > m_scavenger;
 
 private:
@@ -200,7 +270,6 @@ Scavenger<ScavengerArrayWrapper<T> > RingBuffer<T, N>::m_scavenger;
 template <typename T, int N>
 RingBuffer<T, N>::RingBuffer(size_t n) :
     m_buffer(new T[n + 1]),
-    m_writer(0),
     m_size(n + 1),
     m_mlocked(false)
 {
@@ -208,7 +277,7 @@ RingBuffer<T, N>::RingBuffer(size_t n) :
     std::cerr << "RingBuffer<T," << N << ">[" << this << "]::RingBuffer(" << n << ") [now have " << (++extant_ringbuffers) << "]" << std::endl;
 #endif
 
-    for (int i = 0; i < N; ++i) m_readers[i] = 0;
+    reset();
 
     m_scavenger.scavenge();
 }
@@ -284,8 +353,8 @@ RingBuffer<T, N>::resized(int newSize, int R) const
 {
     RingBuffer<T, N> *newBuffer = new RingBuffer<T, N>(newSize);
 
-    int w = m_writer;
-    int r = m_readers[R];
+    int w = atomicLoadAcquire(m_writer.value);
+    int r = atomicLoad(m_readers[R].value);
 
     while (r != w) {
         T value = m_buffer[r];
@@ -330,20 +399,16 @@ RingBuffer<T, N>::reset()
     std::cerr << "RingBuffer<T," << N << ">[" << this << "]::reset" << std::endl;
 #endif
 
-    m_writer = 0;
-    for (int i = 0; i < N; ++i) m_readers[i] = 0;
+    atomicStoreRelease(m_writer.value, 0);
+    for (int i = 0; i < N; ++i) atomicStoreRelease(m_readers[i].value, 0);
 }
 
 template <typename T, int N>
 size_t
 RingBuffer<T, N>::getReadSpace(int R) const
 {
-    size_t writer = m_writer;
-    size_t reader = m_readers[R];
-    size_t space = 0;
-
-    if (writer > reader) space = writer - reader;
-    else space = ((writer + m_size) - reader) % m_size;
+    size_t space = readSpace(atomicLoadAcquire(m_writer.value),
+                             atomicLoad(m_readers[R].value));
 
 #ifdef DEBUG_RINGBUFFER
     std::cerr << "RingBuffer<T," << N << ">[" << this << "]::getReadSpace(" << R << "): " << space << std::endl;
@@ -356,18 +421,20 @@ template <typename T, int N>
 size_t
 RingBuffer<T, N>::getWriteSpace() const
 {
+    size_t writer = atomicLoad(m_writer.value);
     size_t space = 0;
     for (int i = 0; i < N; ++i) {
-        size_t here = (m_readers[i] + m_size - m_writer - 1) % m_size;
+        size_t reader = atomicLoadAcquire(m_readers[i].value);
+        size_t here = (reader + m_size - writer - 1) % m_size;
         if (i == 0 || here < space) space = here;
     }
 
 #ifdef DEBUG_RINGBUFFER
-    size_t rs(getReadSpace()), rp(m_readers[0]);
+    size_t rs(getReadSpace()), rp(atomicLoad(m_readers[0].value));
 
     std::cerr << "RingBuffer: write space " << space << ", read space "
               << rs << ", total " << (space + rs) << ", m_size " << m_size << std::endl;
-    std::cerr << "RingBuffer: reader " << rp << ", writer " << m_writer << std::endl;
+    std::cerr << "RingBuffer: reader " << rp << ", writer " << writer << std::endl;
 #endif
 
 #ifdef DEBUG_RINGBUFFER
@@ -385,7 +452,8 @@ RingBuffer<T, N>::read(T *destination, size_t n, int R)
     std::cerr << "RingBuffer<T," << N << ">[" << this << "]::read(dest, " << n << ", " << R << ")" << std::endl;
 #endif
 
-    size_t available = getReadSpace(R);
+    size_t reader = atomicLoad(m_readers[R].value);
+    size_t available = readSpace(atomicLoadAcquire(m_writer.value), reader);
     if (n > available) {
 #ifdef DEBUG_RINGBUFFER
         std::cerr << "WARNING: Only " << available << " samples available"
@@ -396,18 +464,18 @@ RingBuffer<T, N>::read(T *destination, size_t n, int R)
     }
     if (n == 0) return n;
 
-    size_t here = m_size - m_readers[R];
+    size_t here = m_size - reader;
     if (here >= n) {
-        memcpy(destination, m_buffer + m_readers[R], n * sizeof(T));
+        memcpy(destination, m_buffer + reader, n * sizeof(T));
     } else {
-        memcpy(destination, m_buffer + m_readers[R], here * sizeof(T));
+        memcpy(destination, m_buffer + reader, here * sizeof(T));
         memcpy(destination + here, m_buffer, (n - here) * sizeof(T));
     }
 
-    m_readers[R] = (m_readers[R] + n) % m_size;
+    advanceReader(reader, n, R);
 
 #ifdef DEBUG_RINGBUFFER
-    std::cerr << "RingBuffer<T," << N << ">[" << this << "]::read: read " << n << ", reader now " << m_readers[R] << std::endl;
+    std::cerr << "RingBuffer<T," << N << ">[" << this << "]::read: read " << n << ", reader now " << atomicLoad(m_readers[R].value) << std::endl;
 #endif
 
     return n;
@@ -421,7 +489,8 @@ RingBuffer<T, N>::readAdding(T *destination, size_t n, int R)
     std::cerr << "RingBuffer<T," << N << ">[" << this << "]::readAdding(dest, " << n << ", " << R << ")" << std::endl;
 #endif
 
-    size_t available = getReadSpace(R);
+    size_t reader = atomicLoad(m_readers[R].value);
+    size_t available = readSpace(atomicLoadAcquire(m_writer.value), reader);
     if (n > available) {
 #ifdef DEBUG_RINGBUFFER
         std::cerr << "WARNING: Only " << available << " samples available"
@@ -431,22 +500,17 @@ RingBuffer<T, N>::readAdding(T *destination, size_t n, int R)
     }
     if (n == 0) return n;
 
-    size_t here = m_size - m_readers[R];
+    size_t here = std::min(m_size - reader, n);
+    const T *source = m_buffer + reader;
 
-    if (here >= n) {
-        for (size_t i = 0; i < n; ++i) {
-            destination[i] += (m_buffer + m_readers[R])[i];
-        }
-    } else {
-        for (size_t i = 0; i < here; ++i) {
-            destination[i] += (m_buffer + m_readers[R])[i];
-        }
-        for (size_t i = 0; i < (n - here); ++i) {
-            destination[i + here] += m_buffer[i];
-        }
+    for (size_t i = 0; i < here; ++i) {
+        destination[i] += source[i];
+    }
+    for (size_t i = here; i < n; ++i) {
+        destination[i] += m_buffer[i - here];
     }
 
-    m_readers[R] = (m_readers[R] + n) % m_size;
+    advanceReader(reader, n, R);
     return n;
 }
 
@@ -458,7 +522,8 @@ RingBuffer<T, N>::readOne(int R)
     std::cerr << "RingBuffer<T," << N << ">[" << this << "]::readOne(" << R << ")" << std::endl;
 #endif
 
-    if (m_writer == m_readers[R]) {
+    size_t reader = atomicLoad(m_readers[R].value);
+    if (size_t(atomicLoadAcquire(m_writer.value)) == reader) {
 #ifdef DEBUG_RINGBUFFER
         std::cerr << "WARNING: No sample available"
                   << std::endl;
@@ -467,8 +532,8 @@ RingBuffer<T, N>::readOne(int R)
         memset(&t, 0, sizeof(T));
         return t;
     }
-    T value = m_buffer[m_readers[R]];
-    if (++m_readers[R] == m_size) m_readers[R] = 0;
+    T value = m_buffer[reader];
+    advanceReader(reader, 1, R);
     return value;
 }
 
@@ -480,7 +545,8 @@ RingBuffer<T, N>::peek(T *destination, size_t n, int R) const
     std::cerr << "RingBuffer<T," << N << ">[" << this << "]::peek(dest, " << n << ", " << R << ")" << std::endl;
 #endif
 
-    size_t available = getReadSpace(R);
+    size_t reader = atomicLoad(m_readers[R].value);
+    size_t available = readSpace(atomicLoadAcquire(m_writer.value), reader);
     if (n > available) {
 #ifdef DEBUG_RINGBUFFER
 	std::cerr << "WARNING: Only " << available << " samples available"
@@ -491,11 +557,11 @@ RingBuffer<T, N>::peek(T *destination, size_t n, int R) const
     }
     if (n == 0) return n;
 
-    size_t here = m_size - m_readers[R];
+    size_t here = m_size - reader;
     if (here >= n) {
-	memcpy(destination, m_buffer + m_readers[R], n * sizeof(T));
+	memcpy(destination, m_buffer + reader, n * sizeof(T));
     } else {
-	memcpy(destination, m_buffer + m_readers[R], here * sizeof(T));
+	memcpy(destination, m_buffer + reader, here * sizeof(T));
 	memcpy(destination + here, m_buffer, (n - here) * sizeof(T));
     }
 
@@ -514,7 +580,8 @@ RingBuffer<T, N>::peek(int R) const
     std::cerr << "RingBuffer<T," << N << ">[" << this << "]::peek(" << R << ")" << std::endl;
 #endif
 
-    if (m_writer == m_readers[R]) {
+    size_t reader = atomicLoad(m_readers[R].value);
+    if (size_t(atomicLoadAcquire(m_writer.value)) == reader) {
 #ifdef DEBUG_RINGBUFFER
         std::cerr << "WARNING: No sample available"
                   << std::endl;
@@ -523,7 +590,7 @@ RingBuffer<T, N>::peek(int R) const
         memset(&t, 0, sizeof(T));
         return t;
     }
-    T value = m_buffer[m_readers[R]];
+    T value = m_buffer[reader];
     return value;
 }
 
@@ -535,7 +602,8 @@ RingBuffer<T, N>::skip(size_t n, int R)
     std::cerr << "RingBuffer<T," << N << ">[" << this << "]::skip(" << n << ", " << R << ")" << std::endl;
 #endif
 
-    size_t available = getReadSpace(R);
+    size_t reader = atomicLoad(m_readers[R].value);
+    size_t available = readSpace(atomicLoadAcquire(m_writer.value), reader);
     if (n > available) {
 #ifdef DEBUG_RINGBUFFER
         std::cerr << "WARNING: Only " << available << " samples available"
@@ -544,7 +612,7 @@ RingBuffer<T, N>::skip(size_t n, int R)
         n = available;
     }
     if (n == 0) return n;
-    m_readers[R] = (m_readers[R] + n) % m_size;
+    advanceReader(reader, n, R);
     return n;
 }
 
@@ -566,18 +634,19 @@ RingBuffer<T, N>::write(const T *source, size_t n)
     }
     if (n == 0) return n;
 
-    size_t here = m_size - m_writer;
+    size_t writer = atomicLoad(m_writer.value);
+    size_t here = m_size - writer;
     if (here >= n) {
-        memcpy(m_buffer + m_writer, source, n * sizeof(T));
+        memcpy(m_buffer + writer, source, n * sizeof(T));
     } else {
-        memcpy(m_buffer + m_writer, source, here * sizeof(T));
+        memcpy(m_buffer + writer, source, here * sizeof(T));
         memcpy(m_buffer, source + here, (n - here) * sizeof(T));
     }
 
-    m_writer = (m_writer + n) % m_size;
+    atomicStoreRelease(m_writer.value, int((writer + n) % m_size));
 
 #ifdef DEBUG_RINGBUFFER
-    std::cerr << "RingBuffer<T," << N << ">[" << this << "]::write: wrote " << n << ", writer now " << m_writer << std::endl;
+    std::cerr << "RingBuffer<T," << N << ">[" << this << "]::write: wrote " << n << ", writer now " << atomicLoad(m_writer.value) << std::endl;
 #endif
 
     return n;
@@ -601,15 +670,80 @@ RingBuffer<T, N>::zero(size_t n)
     }
     if (n == 0) return n;
 
-    size_t here = m_size - m_writer;
+    size_t writer = atomicLoad(m_writer.value);
+    size_t here = m_size - writer;
     if (here >= n) {
-        memset(m_buffer + m_writer, 0, n * sizeof(T));
+        memset(m_buffer + writer, 0, n * sizeof(T));
     } else {
-        memset(m_buffer + m_writer, 0, here * sizeof(T));
+        memset(m_buffer + writer, 0, here * sizeof(T));
         memset(m_buffer, 0, (n - here) * sizeof(T));
     }
 
-    m_writer = (m_writer + n) % m_size;
+    atomicStoreRelease(m_writer.value, int((writer + n) % m_size));
+    return n;
+}
+
+template <typename T, int N>
+size_t
+RingBuffer<T, N>::getReadSpans(const T *&first, size_t &firstCount,
+                               const T *&second, size_t &secondCount,
+                               int R) const
+{
+    size_t reader = atomicLoad(m_readers[R].value);
+    size_t available = readSpace(atomicLoadAcquire(m_writer.value), reader);
+
+    first = m_buffer + reader;
+    firstCount = std::min(available, m_size - reader);
+    second = m_buffer;
+    secondCount = available - firstCount;
+
+#ifdef DEBUG_RINGBUFFER
+    std::cerr << "RingBuffer<T," << N << ">[" << this << "]::getReadSpans(" << R << "): " << firstCount << " + " << secondCount << std::endl;
+#endif
+
+    return available;
+}
+
+template <typename T, int N>
+size_t
+RingBuffer<T, N>::getWriteSpans(T *&first, size_t &firstCount,
+                                T *&second, size_t &secondCount)
+{
+    size_t writer = atomicLoad(m_writer.value);
+    size_t available = getWriteSpace();
+
+    first = m_buffer + writer;
+    firstCount = std::min(available, m_size - writer);
+    second = m_buffer;
+    secondCount = available - firstCount;
+
+#ifdef DEBUG_RINGBUFFER
+    std::cerr << "RingBuffer<T," << N << ">[" << this << "]::getWriteSpans: " << firstCount << " + " << secondCount << std::endl;
+#endif
+
+    return available;
+}
+
+template <typename T, int N>
+size_t
+RingBuffer<T, N>::commitWrite(size_t n)
+{
+#ifdef DEBUG_RINGBUFFER
+    std::cerr << "RingBuffer<T," << N << ">[" << this << "]::commitWrite(" << n << ")" << std::endl;
+#endif
+
+    size_t available = getWriteSpace();
+    if (n > available) {
+#ifdef DEBUG_RINGBUFFER
+        std::cerr << "WARNING: Only room for " << available << " samples"
+                  << std::endl;
+#endif
+        n = available;
+    }
+    if (n == 0) return n;
+
+    size_t writer = atomicLoad(m_writer.value);
+    atomicStoreRelease(m_writer.value, int((writer + n) % m_size));
     return n;
 }
 
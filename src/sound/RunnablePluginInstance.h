@@ -79,6 +79,14 @@ public:
     virtual void sendEvent(const RealTime & /* eventTime */,
                            const void * /* event */) { }
 
+    /**
+     * Send count events at once, as an array of whatever type
+     * sendEvent() takes, each with its time already set as
+     * sendEvent() would set it.  They need not be in time order.
+     */
+    virtual void sendEvents(const void * /* events */,
+                            size_t /* count */) { }
+
     virtual bool isBypassed() const = 0;
     virtual void setBypassed(bool value) = 0;
 
@@ -0,0 +1,156 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#include "SoftSynthEventQueue.h"
+
+#include <string.h>
+
+namespace Rosegarden
+{
+
+SoftSynthEventQueue::SoftSynthEventQueue(size_t size) :
+    m_incoming(size),
+    m_size(size),
+    m_sorted(new snd_seq_event_t[size]),
+    m_frames(new long[size]),
+    m_first(0),
+    m_count(0)
+{
+}
+
+SoftSynthEventQueue::~SoftSynthEventQueue()
+{
+    delete[] m_sorted;
+    delete[] m_frames;
+}
+
+size_t
+SoftSynthEventQueue::write(const snd_seq_event_t *events, size_t count)
+{
+    // Not RT safe (but it doesn't need to be)
+
+    return m_incoming.write(events, count);
+}
+
+size_t
+SoftSynthEventQueue::getReadSpace() const
+{
+    return m_count + m_incoming.getReadSpace();
+}
+
+size_t
+SoftSynthEventQueue::getWriteSpace() const
+{
+    return m_incoming.getWriteSpace();
+}
+
+void
+SoftSynthEventQueue::collect(unsigned int sampleRate)
+{
+    // RT safe
+
+    const snd_seq_event_t *first = 0, *second = 0;
+    size_t firstCount = 0, secondCount = 0;
+
+    size_t available = m_incoming.getReadSpans(first, firstCount,
+                                               second, secondCount);
+    if (available == 0) return;
+
+    // Make room at the end, if the taken events have left it at the
+    // start
+
+    if (available > m_size - m_first - m_count && m_first > 0) {
+        memmove(m_sorted, m_sorted + m_first, m_count * sizeof(snd_seq_event_t));
+        memmove(m_frames, m_frames + m_first, m_count * sizeof(long));
+        m_first = 0;
+    }
+
+    size_t taken = 0;
+
+    while (taken < available && m_first + m_count < m_size) {
+
+        const snd_seq_event_t &ev =
+            (taken < firstCount ? first[taken] : second[taken - firstCount]);
+
+        long frame = RealTime::realTime2Frame
+            (RealTime(ev.time.time.tv_sec, ev.time.time.tv_nsec), sampleRate);
+
+        // Insertion sort from the end, after any at the same frame.
+        // They nearly always arrive in order, so this rarely moves
+        // anything.
+
+        size_t end = m_first + m_count;
+        size_t i = end;
+        while (i > m_first && m_frames[i - 1] > frame) --i;
+
+        if (i < end) {
+            memmove(m_sorted + i + 1, m_sorted + i,
+                    (end - i) * sizeof(snd_seq_event_t));
+            memmove(m_frames + i + 1, m_frames + i, (end - i) * sizeof(long));
+        }
+
+        m_sorted[i] = ev;
+        m_frames[i] = frame;
+        ++m_count;
+        ++taken;
+    }
+
+    m_incoming.skip(taken);
+}
+
+size_t
+SoftSynthEventQueue::readBlock(const RealTime &blockTime,
+                               size_t blockSize,
+                               unsigned int sampleRate,
+                               snd_seq_event_t *destination,
+                               size_t max)
+{
+    // RT safe
+
+    collect(sampleRate);
+
+    // Both in frames, so that an event sent for a given frame plays
+    // on exactly that frame
+    const long blockFrame = RealTime::realTime2Frame(blockTime, sampleRate);
+    const long blockEnd = blockFrame + long(blockSize);
+
+    size_t n = 0;
+
+    while (n < m_count && n < max && m_frames[m_first + n] < blockEnd) {
+
+        long offset = m_frames[m_first + n] - blockFrame;
+        if (offset < 0) offset = 0;
+
+        destination[n] = m_sorted[m_first + n];
+        destination[n].time.tick = (unsigned int)offset;
+        ++n;
+    }
+
+    m_first += n;
+    m_count -= n;
+    if (m_count == 0) m_first = 0;
+
+    return n;
+}
+
+void
+SoftSynthEventQueue::discard()
+{
+    m_incoming.skip(m_incoming.getReadSpace());
+    m_first = 0;
+    m_count = 0;
+}
+
+}
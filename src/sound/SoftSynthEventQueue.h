@@ -0,0 +1,101 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+/*
+    Rosegarden
+    A sequencer and musical notation editor.
+    Copyright 2000-2017 the Rosegarden development team.
+    See the AUTHORS file for more details.
+
+    This program is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 2 of the
+    License, or (at your option) any later version.  See the file
+    COPYING included with this distribution for more information.
+*/
+
+#ifndef RG_SOFTSYNTHEVENTQUEUE_H
+#define RG_SOFTSYNTHEVENTQUEUE_H
+
+#include "RingBuffer.h"
+#include "base/RealTime.h"
+
+#include <alsa/seq_event.h>
+
+namespace Rosegarden
+{
+
+/**
+ * The MIDI events waiting to be played by a soft synth, kept in time
+ * order so that the synth can take each block's worth in one pass.
+ *
+ * There is one writer, which sends events in batches with write(),
+ * and one reader, the audio thread running the synth, which calls
+ * readBlock() once per block.  Each event carries its time, in the
+ * same timeline as the block times the mixer runs the synth with, in
+ * time.time.  Events are played at the exact frame their time falls
+ * on, and events with the same time come out in the order they went
+ * in.  An event whose time has already passed is played at the start
+ * of the next block.
+ *
+ * The writer and reader share a lock-free RingBuffer.  The reader
+ * moves what has arrived into a sorted array of its own, which is
+ * cheap as events mostly arrive in order.  Everything is allocated
+ * up front: if the events arrive faster than the synth plays them,
+ * write() writes only as many as there is room for.
+ */
+class SoftSynthEventQueue
+{
+public:
+    /// Make a queue with room for size events.
+    SoftSynthEventQueue(size_t size);
+    ~SoftSynthEventQueue();
+
+    /**
+     * Writer: add count events, with their times in time.time.  They
+     * need not be sorted.  Returns the number there was room for.
+     */
+    size_t write(const snd_seq_event_t *events, size_t count);
+
+    /**
+     * Reader: take up to max events falling in the block of blockSize
+     * frames starting at blockTime, in time order, into destination.
+     * Each event's frame offset from the start of the block is put in
+     * time.tick.  Returns the number of events taken.
+     */
+    size_t readBlock(const RealTime &blockTime,
+                     size_t blockSize,
+                     unsigned int sampleRate,
+                     snd_seq_event_t *destination,
+                     size_t max);
+
+    /// Reader: throw away everything waiting.
+    void discard();
+
+    /// Reader: the number of events waiting.
+    size_t getReadSpace() const;
+
+    /// Writer: the number of events there is room for.
+    size_t getWriteSpace() const;
+
+private:
+    // Not copyable
+    SoftSynthEventQueue(const SoftSynthEventQueue &);
+    SoftSynthEventQueue &operator=(const SoftSynthEventQueue &);
+
+    /// Move what the writer has added into m_sorted
+    void collect(unsigned int sampleRate);
+
+    RingBuffer<snd_seq_event_t> m_incoming;
+
+    // The reader's own, sorted by frame, from m_first to m_first +
+    // m_count, with each event's frame alongside
+    size_t m_size;
+    snd_seq_event_t *m_sorted;
+    long *m_frames;
+    size_t m_first;
+    size_t m_count;
+};
+
+}
+
+#endif
@@ -22,6 +22,7 @@
 #include "WAVAudioFile.h"
 #include "MappedStudio.h"
 #include "AudioPlayQueue.h"
+#include "PlayableAudioFile.h"
 
 #include <unistd.h>
 #include <sys/time.h>
@@ -56,7 +57,8 @@ SoundDriver::SoundDriver(MappedStudio *studio, const std::string &name):
         m_mtcStatus(TRANSPORT_OFF),
         m_mmcId(0),            // default MMC id of 0
         m_midiClockEnabled(false),
-        m_midiClockInterval(0, 0)
+        m_midiClockInterval(0, 0),
+        m_wakeRequested(false)
 {
     m_audioQueue = new AudioPlayQueue();
 }
@@ -329,6 +331,7 @@ SoundDriver::removeAudioFile(unsigned int id)
             RG_DEBUG << "Sequencer::removeAudioFile() = \"" <<
                 (*it)->getFilename() << "\"";
 
+            PlayableAudioFile::forgetAudioFile(*it);
             delete (*it);
             m_audioFiles.erase(it);
             return true;
@@ -356,8 +359,10 @@ SoundDriver::clearAudioFiles()
     //RG_DEBUG << "SoundDriver::clearAudioFiles() - clearing down audio files";
 
     std::vector<AudioFile*>::iterator it;
-    for (it = m_audioFiles.begin(); it != m_audioFiles.end(); ++it)
+    for (it = m_audioFiles.begin(); it != m_audioFiles.end(); ++it) {
+        PlayableAudioFile::forgetAudioFile(*it);
         delete(*it);
+    }
 
     m_audioFiles.erase(m_audioFiles.begin(), m_audioFiles.end());
 }
@@ -365,12 +370,21 @@ SoundDriver::clearAudioFiles()
 void
 SoundDriver::sleep(const RealTime &rt)
 {
-    // The usleep man page says it's deprecated and we should use
-    // nanosleep.  And that's what we did.  But it seems quite a few
-    // people don't have nanosleep, so we're reverting to usleep.
+    QMutexLocker locker(&m_sleepMutex);
+
+    if (!m_wakeRequested)
+        m_sleepCondition.wait(&m_sleepMutex, rt.sec * 1000 + rt.msec());
+
+    m_wakeRequested = false;
+}
+
+void
+SoundDriver::wake()
+{
+    QMutexLocker locker(&m_sleepMutex);
 
-    unsigned long usec = rt.sec * 1000000 + rt.usec();
-    usleep(usec);
+    m_wakeRequested = true;
+    m_sleepCondition.wakeAll();
 }
 
 
@@ -19,7 +19,9 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <QMutex>
 #include <QStringList>
+#include <QWaitCondition>
 
 #include "base/Device.h"
 #include "MappedEventList.h"
@@ -254,8 +256,26 @@ public:
     virtual void setLoop(const RealTime &loopStart, const RealTime &loopEnd)
         = 0;
 
+    /// Wait for up to rt.
+    /**
+     * Returns early if wake() is called.  Subclasses may also return
+     * early when there is MIDI input waiting (see AlsaDriver).
+     */
     virtual void sleep(const RealTime &rt);
 
+    /// Make the sleep() in progress, or else the next one, return at once.
+    /**
+     * May be called from any thread.
+     */
+    virtual void wake();
+
+    /// How long until processPending() next has something to do.
+    /**
+     * Returns false if there is nothing pending that needs the sequencer
+     * thread to wake up for it.
+     */
+    virtual bool getTimeToNextPending(RealTime & /* delay */) { return false; }
+
     virtual QString getStatusLog() = 0;
 
     // Mapped Instruments
@@ -513,6 +533,12 @@ protected:
      * record time.  See RosegardenSequencer::m_songPosition.
      */
     RealTime                     m_midiClockInterval;
+
+private:
+    // For the default sleep() and wake()
+    QMutex                       m_sleepMutex;
+    QWaitCondition               m_sleepCondition;
+    bool                         m_wakeRequested;
 };
 
 }
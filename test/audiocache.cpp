@@ -0,0 +1,219 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "sound/AudioCache.h"
+
+#include <QTest>
+
+using namespace Rosegarden;
+
+// Tests for the AudioCache's reference counting, memory budget and
+// least recently used eviction
+
+namespace
+{
+
+const size_t frames = 1024;
+const size_t entryBytes = frames * sizeof(float);
+
+// Keys for the cache, which only compares the pointers
+int keys[8];
+
+void *key(int n)
+{
+    return &keys[n];
+}
+
+// One channel of frames samples, each sample holding n
+float **makeData(int n)
+{
+    float **data = new float *[1];
+    data[0] = new float[frames];
+    for (size_t i = 0; i < frames; ++i) data[0][i] = float(n);
+    return data;
+}
+
+}
+
+class TestAudioCache : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testHitsAndMisses();
+    void testEvictsOnlyUnreferenced();
+    void testLowerBudget();
+    void testRemove();
+};
+
+void TestAudioCache::testHitsAndMisses()
+{
+    AudioCache cache;
+
+    // Not there: a miss, and the caller adds it
+    QVERIFY(!cache.acquire(key(0)));
+    cache.addData(key(0), 1, frames, makeData(0));
+
+    QVERIFY(cache.acquire(key(0)));
+    QVERIFY(cache.acquire(key(0)));
+    QVERIFY(!cache.acquire(key(1)));
+
+    // Looking data up doesn't count
+    size_t channels = 0, count = 0;
+    float **data = cache.getData(key(0), channels, count);
+    QVERIFY(data);
+    QCOMPARE(channels, size_t(1));
+    QCOMPARE(count, frames);
+    QCOMPARE(data[0][frames - 1], 0.f);
+    QVERIFY(cache.has(key(0)));
+    QVERIFY(!cache.has(key(1)));
+
+    AudioCache::Statistics stats = cache.getStatistics();
+    QCOMPARE(stats.hits, size_t(2));
+    QCOMPARE(stats.misses, size_t(2));
+    QCOMPARE(stats.evictions, size_t(0));
+    QCOMPARE(stats.entries, size_t(1));
+    QCOMPARE(stats.bytesResident, entryBytes);
+
+    // Released data stays for the next acquire(), which is a hit
+    for (int i = 0; i < 3; ++i) cache.decrementReference(key(0));
+    QVERIFY(cache.has(key(0)));
+    QVERIFY(cache.acquire(key(0)));
+    cache.decrementReference(key(0));
+
+    stats = cache.getStatistics();
+    QCOMPARE(stats.hits, size_t(3));
+    QCOMPARE(stats.misses, size_t(2));
+}
+
+void TestAudioCache::testEvictsOnlyUnreferenced()
+{
+    AudioCache cache;
+    cache.setMemoryBudget(3 * entryBytes);
+
+    // Four in use at once go over the budget, but none can go
+    for (int i = 0; i < 4; ++i) {
+        cache.addData(key(i), 1, frames, makeData(i));
+    }
+    AudioCache::Statistics stats = cache.getStatistics();
+    QCOMPARE(stats.entries, size_t(4));
+    QCOMPARE(stats.bytesResident, 4 * entryBytes);
+    QCOMPARE(stats.evictions, size_t(0));
+
+    // Releasing one lets it go, which brings the cache within budget
+    cache.decrementReference(key(1));
+    QVERIFY(!cache.has(key(1)));
+    stats = cache.getStatistics();
+    QCOMPARE(stats.entries, size_t(3));
+    QCOMPARE(stats.bytesResident, 3 * entryBytes);
+    QCOMPARE(stats.evictions, size_t(1));
+
+    // and the next is kept, being within budget
+    cache.decrementReference(key(2));
+    QVERIFY(cache.has(key(2)));
+
+    // Adding another evicts that one, not those still in use
+    cache.addData(key(4), 1, frames, makeData(4));
+    QVERIFY(!cache.has(key(2)));
+    QVERIFY(cache.has(key(0)));
+    QVERIFY(cache.has(key(3)));
+    QVERIFY(cache.has(key(4)));
+
+    stats = cache.getStatistics();
+    QCOMPARE(stats.evictions, size_t(2));
+    QCOMPARE(stats.bytesResident, 3 * entryBytes);
+
+    // The data of those in use is untouched
+    size_t channels = 0, count = 0;
+    QCOMPARE(cache.getData(key(3), channels, count)[0][0], 3.f);
+
+    cache.decrementReference(key(0));
+    cache.decrementReference(key(3));
+    cache.decrementReference(key(4));
+}
+
+void TestAudioCache::testLowerBudget()
+{
+    AudioCache cache;
+    QCOMPARE(cache.getMemoryBudget(), size_t(AudioCache::DefaultMemoryBudget));
+
+    for (int i = 0; i < 6; ++i) {
+        cache.addData(key(i), 1, frames, makeData(i));
+        cache.decrementReference(key(i));
+    }
+
+    // Use 1 and 3 again, so that they're the most recently used
+    QVERIFY(cache.acquire(key(1)));
+    QVERIFY(cache.acquire(key(3)));
+    cache.decrementReference(key(1));
+    cache.decrementReference(key(3));
+
+    // Down to three entries: the least recently used three go
+    cache.setMemoryBudget(3 * entryBytes);
+    QCOMPARE(cache.getMemoryBudget(), 3 * entryBytes);
+
+    AudioCache::Statistics stats = cache.getStatistics();
+    QCOMPARE(stats.entries, size_t(3));
+    QCOMPARE(stats.bytesResident, 3 * entryBytes);
+    QCOMPARE(stats.evictions, size_t(3));
+    QCOMPARE(stats.memoryBudget, 3 * entryBytes);
+    QVERIFY(!cache.has(key(0)));
+    QVERIFY(!cache.has(key(2)));
+    QVERIFY(!cache.has(key(4)));
+    QVERIFY(cache.has(key(5)));
+    QVERIFY(cache.has(key(1)));
+    QVERIFY(cache.has(key(3)));
+
+    // With no budget at all, only the one in use stays
+    QVERIFY(cache.acquire(key(5)));
+    cache.setMemoryBudget(0);
+
+    stats = cache.getStatistics();
+    QCOMPARE(stats.entries, size_t(1));
+    QCOMPARE(stats.bytesResident, entryBytes);
+    QCOMPARE(stats.evictions, size_t(5));
+    QVERIFY(cache.has(key(5)));
+
+    // and goes when it's released
+    cache.decrementReference(key(5));
+    QVERIFY(!cache.has(key(5)));
+    QCOMPARE(cache.getStatistics().bytesResident, size_t(0));
+}
+
+void TestAudioCache::testRemove()
+{
+    AudioCache cache;
+
+    cache.addData(key(0), 1, frames, makeData(0));
+    cache.addData(key(1), 1, frames, makeData(1));
+    cache.decrementReference(key(1));
+
+    // Unreferenced data goes at once, referenced data when released
+    cache.remove(key(1));
+    QVERIFY(!cache.has(key(1)));
+
+    cache.remove(key(0));
+    QVERIFY(cache.has(key(0)));
+    cache.decrementReference(key(0));
+    QVERIFY(!cache.has(key(0)));
+
+    // Neither counts as an eviction
+    AudioCache::Statistics stats = cache.getStatistics();
+    QCOMPARE(stats.entries, size_t(0));
+    QCOMPARE(stats.bytesResident, size_t(0));
+    QCOMPARE(stats.evictions, size_t(0));
+
+    // purge() drops everything unreferenced, whatever the budget
+    for (int i = 0; i < 3; ++i) {
+        cache.addData(key(i), 1, frames, makeData(i));
+    }
+    cache.decrementReference(key(0));
+    cache.decrementReference(key(2));
+    cache.purge();
+    QCOMPARE(cache.getStatistics().entries, size_t(1));
+    QVERIFY(cache.has(key(1)));
+    cache.decrementReference(key(1));
+}
+
+QTEST_MAIN(TestAudioCache)
+
+#include "audiocache.moc"
@@ -0,0 +1,413 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/NotationTypes.h"
+#include "base/Device.h"
+#include "base/Segment.h"
+#include "base/Studio.h"
+#include "base/Track.h"
+#include "document/DocumentCache.h"
+#include "document/GzipInputSource.h"
+#include "document/RosegardenDocument.h"
+#include "misc/ConfigGroups.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSettings>
+#include <QTest>
+
+#include <map>
+
+#include <sys/resource.h>
+
+using namespace Rosegarden;
+
+// Load time and memory use for a large .rg file, from the XML and
+// from the cache written when it was saved
+
+static const int segmentCount = 8;
+static const int notesPerSegment = 20000;
+
+// Peak resident set size so far, in KB
+static long peakRSS()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+class TestDocumentLoad : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testLoad();
+    void testCachedLoad();
+    void testStaleCache();
+    void testDamagedCache();
+    void testTruncatedFile();
+    void benchmarkLoad();
+    void benchmarkCachedLoad();
+
+private:
+    void setUseCache(bool use);
+    void checkDamagedCache(const char *damageAt);
+    void compareSegments(const Segment &a, const Segment &b);
+
+    QString m_fileName;
+    qint64 m_xmlSize;
+};
+
+void TestDocumentLoad::setUseCache(bool use)
+{
+    QSettings settings;
+    settings.beginGroup(GeneralOptionsConfigGroup);
+    settings.setValue("usedocumentcache", use);
+    settings.endGroup();
+}
+
+void TestDocumentLoad::compareSegments(const Segment &a, const Segment &b)
+{
+    using namespace BaseProperties;
+
+    QCOMPARE(a.getTrack(), b.getTrack());
+    QCOMPARE(a.getStartTime(), b.getStartTime());
+    QCOMPARE(a.getEndMarkerTime(), b.getEndMarkerTime());
+    QCOMPARE(a.size(), b.size());
+
+    // Group ids are given out afresh on loading, but must group the
+    // same events
+    std::map<long, long> groups;
+
+    Segment::const_iterator i = a.begin(), j = b.begin();
+    for ( ; i != a.end(); ++i, ++j) {
+        const Event &ea = **i;
+        const Event &eb = **j;
+        QCOMPARE(ea.getType(), eb.getType());
+        QCOMPARE(ea.getAbsoluteTime(), eb.getAbsoluteTime());
+        QCOMPARE(ea.getDuration(), eb.getDuration());
+        QCOMPARE(ea.getSubOrdering(), eb.getSubOrdering());
+        QCOMPARE(ea.getNotationAbsoluteTime(), eb.getNotationAbsoluteTime());
+        QCOMPARE(ea.getNotationDuration(), eb.getNotationDuration());
+
+        Event::PropertyNames names = ea.getPropertyNames();
+        QCOMPARE(names.size(), eb.getPropertyNames().size());
+        QCOMPARE(ea.getPersistentPropertyNames().size(),
+                 eb.getPersistentPropertyNames().size());
+
+        for (size_t k = 0; k < names.size(); ++k) {
+            QVERIFY(eb.has(names[k]));
+            if (names[k] == BEAMED_GROUP_ID) {
+                long ga = ea.get<Int>(BEAMED_GROUP_ID);
+                long gb = eb.get<Int>(BEAMED_GROUP_ID);
+                if (groups.find(ga) == groups.end()) groups[ga] = gb;
+                QCOMPARE(groups[ga], gb);
+            } else {
+                QCOMPARE(ea.getAsString(names[k]), eb.getAsString(names[k]));
+            }
+        }
+    }
+}
+
+void TestDocumentLoad::initTestCase()
+{
+    using namespace BaseProperties;
+
+    // Keep away from the user's settings
+    QCoreApplication::setApplicationName("test_documentload");
+    setUseCache(true);
+
+    m_fileName = QDir::tempPath() + "/rosegarden-documentload-test.rg";
+
+    RosegardenDocument *doc =
+        new RosegardenDocument(0, 0, true /*skip autoload*/, true, false);
+    Composition &comp = doc->getComposition();
+
+    for (int s = 0; s < segmentCount; ++s) {
+        TrackId trackId = comp.getNewTrackId();
+        comp.addTrack(new Track(trackId, MidiInstrumentBase, s));
+
+        Segment *segment = new Segment;
+        segment->setTrack(trackId);
+        for (int i = 0; i < notesPerSegment; ++i) {
+            Event *e = new Event(Note::EventType, i * 240, 240);
+            e->set<Int>(PITCH, 48 + (i * 7 + s) % 36);
+            e->set<Int>(VELOCITY, 64 + i % 64);
+            if (i % 8 < 4) {
+                e->set<Int>(BEAMED_GROUP_ID, i / 8);
+                e->set<String>(BEAMED_GROUP_TYPE, GROUP_TYPE_BEAMED);
+            }
+            if (i % 100 == 0) {
+                e->set<Bool>(IS_GRACE_NOTE, false);
+                e->set<Int>(NOTE_TYPE, Note::Crotchet, false);
+            }
+            segment->insert(e);
+        }
+        comp.addSegment(segment);
+    }
+
+    QString errMsg;
+    QVERIFY(doc->saveDocument(m_fileName, errMsg));
+    delete doc;
+
+    DocumentCache cache;
+    QVERIFY(cache.open(m_fileName));
+
+    // Read it back without parsing, to see how big the XML is
+    GzipInputSource source(m_fileName);
+    QVERIFY(source.isOk());
+    do {
+        source.fetchData();
+    } while (!source.data().isEmpty());
+    QVERIFY(source.isOk());
+    m_xmlSize = source.getBytesRead();
+}
+
+void TestDocumentLoad::cleanupTestCase()
+{
+    QFile::remove(m_fileName);
+    QFile::remove(DocumentCache::getCachePath(m_fileName));
+}
+
+void TestDocumentLoad::testLoad()
+{
+    setUseCache(false);
+
+    RosegardenDocument doc(0, 0, true, true, false);
+
+    long before = peakRSS();
+
+    QVERIFY(doc.openDocument(m_fileName, false /*not permanent*/,
+                             true /*no progress dlg*/, false /*no lock*/));
+
+    qDebug() << "Loading" << m_xmlSize / 1024 << "KB of XML raised peak RSS by"
+             << (peakRSS() - before) << "KB";
+
+    const SegmentMultiSet &segments = doc.getComposition().getSegments();
+    QCOMPARE(int(segments.size()), segmentCount);
+    for (SegmentMultiSet::const_iterator i = segments.begin();
+         i != segments.end(); ++i) {
+        QCOMPARE(int((*i)->size()), notesPerSegment);
+    }
+}
+
+void TestDocumentLoad::testCachedLoad()
+{
+    // Must be the same document as from the XML
+    setUseCache(false);
+    RosegardenDocument expected(0, 0, true, true, false);
+    QVERIFY(expected.openDocument(m_fileName, false, true, false));
+
+    setUseCache(true);
+    RosegardenDocument doc(0, 0, true, true, false);
+
+    long before = peakRSS();
+
+    QVERIFY(doc.openDocument(m_fileName, false, true, false));
+
+    qDebug() << "Loading from the cache raised peak RSS by"
+             << (peakRSS() - before) << "KB";
+
+    const SegmentMultiSet &segments = doc.getComposition().getSegments();
+    const SegmentMultiSet &expectedSegments =
+        expected.getComposition().getSegments();
+    QCOMPARE(segments.size(), expectedSegments.size());
+
+    SegmentMultiSet::const_iterator i = segments.begin();
+    SegmentMultiSet::const_iterator j = expectedSegments.begin();
+    for ( ; i != segments.end(); ++i, ++j) {
+        compareSegments(**i, **j);
+    }
+}
+
+void TestDocumentLoad::testStaleCache()
+{
+    // Save over the file without a cache, as another version or
+    // another program might
+    QString fileName = QDir::tempPath() + "/rosegarden-documentload-stale.rg";
+
+    setUseCache(true);
+    {
+        RosegardenDocument doc(0, 0, true, true, false);
+        QVERIFY(doc.openDocument(m_fileName, false, true, false));
+        QString errMsg;
+        QVERIFY(doc.saveDocument(fileName, errMsg));
+    }
+    {
+        DocumentCache cache;
+        QVERIFY(cache.open(fileName));
+    }
+
+    setUseCache(false);
+    {
+        RosegardenDocument doc(0, 0, true, true, false);
+        Composition &comp = doc.getComposition();
+        TrackId trackId = comp.getNewTrackId();
+        comp.addTrack(new Track(trackId, MidiInstrumentBase, 0));
+        Segment *segment = new Segment;
+        segment->setTrack(trackId);
+        segment->insert(new Event(Note::EventType, 0, 240));
+        comp.addSegment(segment);
+        QString errMsg;
+        QVERIFY(doc.saveDocument(fileName, errMsg));
+    }
+
+    // The cache no longer goes with the file
+    DocumentCache cache;
+    QVERIFY(!cache.open(fileName));
+
+    setUseCache(true);
+    RosegardenDocument doc(0, 0, true, true, false);
+    QVERIFY(doc.openDocument(fileName, false, true, false));
+    QCOMPARE(int(doc.getComposition().getSegments().size()), 1);
+    QCOMPARE(int((*doc.getComposition().begin())->size()), 1);
+
+    QFile::remove(fileName);
+    QFile::remove(DocumentCache::getCachePath(fileName));
+}
+
+void TestDocumentLoad::checkDamagedCache(const char *damageAt)
+{
+    // A cache that passes its checks, but whose XML then fails to
+    // parse at the last damageAt tag
+    QString fileName = QDir::tempPath() + "/rosegarden-documentload-damaged.rg";
+
+    setUseCache(true);
+    {
+        RosegardenDocument doc(0, 0, true, true, false);
+        QVERIFY(doc.openDocument(m_fileName, false, true, false));
+
+        // MIDI devices, which reading the studio adds
+        Studio &studio = doc.getStudio();
+        for (int i = 0; i < 2; ++i) {
+            InstrumentId instrumentBase;
+            DeviceId id = studio.getSpareDeviceId(instrumentBase);
+            studio.addDevice("Damaged cache test", id, instrumentBase,
+                             Device::Midi);
+        }
+
+        QString errMsg;
+        QVERIFY(doc.saveDocument(fileName, errMsg));
+    }
+
+    QString cachePath = DocumentCache::getCachePath(fileName);
+    {
+        QFile file(cachePath);
+        QVERIFY(file.open(QIODevice::ReadWrite));
+        QByteArray data = file.readAll();
+        int last = data.lastIndexOf(damageAt);
+        QVERIFY(last > 0);
+        data[last + 1] = '<';
+        QVERIFY(file.seek(0));
+        QCOMPARE(file.write(data), qint64(data.size()));
+    }
+    {
+        DocumentCache cache;
+        QVERIFY(cache.open(fileName));
+    }
+
+    setUseCache(false);
+    RosegardenDocument expected(0, 0, true, true, false);
+    QVERIFY(expected.openDocument(fileName, false, true, false));
+
+    // The document comes from the XML instead, with nothing left
+    // over from the cache
+    setUseCache(true);
+    RosegardenDocument doc(0, 0, true, true, false);
+    QVERIFY(doc.openDocument(fileName, false, true, false));
+
+    const SegmentMultiSet &segments = doc.getComposition().getSegments();
+    QCOMPARE(int(segments.size()), segmentCount);
+    for (SegmentMultiSet::const_iterator i = segments.begin();
+         i != segments.end(); ++i) {
+        QCOMPARE(int((*i)->size()), notesPerSegment);
+    }
+
+    // The MIDI devices are there, once
+    Studio &studio = doc.getStudio();
+    Studio &expectedStudio = expected.getStudio();
+    QVERIFY(expectedStudio.getDevices()->size() > 2);
+    QCOMPARE(studio.getDevices()->size(), expectedStudio.getDevices()->size());
+    QCOMPARE(studio.getAllInstruments().size(),
+             expectedStudio.getAllInstruments().size());
+
+    // and the damaged cache is gone
+    QVERIFY(!QFile::exists(cachePath));
+
+    QFile::remove(fileName);
+}
+
+void TestDocumentLoad::testDamagedCache()
+{
+    // Damage among the segments, before the studio is read
+    checkDamagedCache("<cached-events");
+    if (QTest::currentTestFailed()) return;
+
+    // and after the studio, so that the cache has added its devices
+    checkDamagedCache("<appearance");
+}
+
+void TestDocumentLoad::testTruncatedFile()
+{
+    // Half of a .rg file, as after a failed copy
+    QString fileName =
+        QDir::tempPath() + "/rosegarden-documentload-truncated.rg";
+    {
+        QFile in(m_fileName);
+        QVERIFY(in.open(QIODevice::ReadOnly));
+        QByteArray data = in.readAll();
+        QFile out(fileName);
+        QVERIFY(out.open(QIODevice::WriteOnly));
+        QCOMPARE(out.write(data.left(data.size() / 2)),
+                 qint64(data.size() / 2));
+    }
+
+    // Reads up to the break, then reports the error rather than an
+    // ordinary end
+    GzipInputSource source(fileName);
+    QVERIFY(source.isOk());
+    do {
+        source.fetchData();
+    } while (!source.data().isEmpty());
+    QVERIFY(!source.isOk());
+    QVERIFY(source.getBytesRead() > 0);
+    QVERIFY(source.getBytesRead() < m_xmlSize);
+
+    QFile::remove(fileName);
+}
+
+void TestDocumentLoad::benchmarkLoad()
+{
+    setUseCache(false);
+
+    RosegardenDocument doc(0, 0, true, true, false);
+
+    QBENCHMARK {
+        doc.openDocument(m_fileName, false, true, false);
+    }
+
+    QCOMPARE(int(doc.getComposition().getSegments().size()), segmentCount);
+}
+
+void TestDocumentLoad::benchmarkCachedLoad()
+{
+    setUseCache(true);
+
+    RosegardenDocument doc(0, 0, true, true, false);
+
+    QBENCHMARK {
+        doc.openDocument(m_fileName, false, true, false);
+    }
+
+    QCOMPARE(int(doc.getComposition().getSegments().size()), segmentCount);
+}
+
+QTEST_MAIN(TestDocumentLoad)
+
+#include "documentload.moc"
@@ -0,0 +1,168 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include "base/Track.h"
+#include "document/GzipInputSource.h"
+#include "document/RosegardenDocument.h"
+#include "misc/ConfigGroups.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QSettings>
+#include <QTest>
+
+using namespace Rosegarden;
+
+// Save through the streaming DocumentWriter, which writes segments'
+// events from several threads, and load the result back
+
+static const int segmentCount = 6;
+static const int notesPerSegment = 3000;
+
+class TestDocumentSave : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testSaveAndReload();
+    void testSaveIsRepeatable();
+
+private:
+    void compareSegments(const Segment &a, const Segment &b);
+    QString readXml(const QString &fileName);
+
+    RosegardenDocument *m_doc;
+    QString m_fileName;
+};
+
+void TestDocumentSave::compareSegments(const Segment &a, const Segment &b)
+{
+    QCOMPARE(a.getLabel(), b.getLabel());
+    QCOMPARE(a.getTrack(), b.getTrack());
+    QCOMPARE(a.getStartTime(), b.getStartTime());
+    QCOMPARE(a.size(), b.size());
+
+    Segment::const_iterator i = a.begin(), j = b.begin();
+    for ( ; i != a.end(); ++i, ++j) {
+        const Event &ea = **i;
+        const Event &eb = **j;
+        QCOMPARE(ea.getType(), eb.getType());
+        QCOMPARE(ea.getAbsoluteTime(), eb.getAbsoluteTime());
+        QCOMPARE(ea.getDuration(), eb.getDuration());
+
+        Event::PropertyNames names = ea.getPropertyNames();
+        QCOMPARE(names.size(), eb.getPropertyNames().size());
+        for (size_t k = 0; k < names.size(); ++k) {
+            QVERIFY(eb.has(names[k]));
+            QCOMPARE(ea.getAsString(names[k]), eb.getAsString(names[k]));
+        }
+    }
+}
+
+QString TestDocumentSave::readXml(const QString &fileName)
+{
+    GzipInputSource source(fileName);
+    if (!source.isOk()) return QString();
+
+    QString xml;
+    do {
+        source.fetchData();
+        xml += source.data();
+    } while (!source.data().isEmpty());
+
+    return xml;
+}
+
+void TestDocumentSave::initTestCase()
+{
+    using namespace BaseProperties;
+
+    // Keep away from the user's settings, and load from the XML
+    QCoreApplication::setApplicationName("test_documentsave");
+    QSettings settings;
+    settings.beginGroup(GeneralOptionsConfigGroup);
+    settings.setValue("usedocumentcache", false);
+    settings.endGroup();
+
+    m_fileName = QDir::tempPath() + "/rosegarden-documentsave-test.rg";
+
+    m_doc = new RosegardenDocument(0, 0, true /*skip autoload*/, true, false);
+    Composition &comp = m_doc->getComposition();
+
+    for (int s = 0; s < segmentCount; ++s) {
+        TrackId trackId = comp.getNewTrackId();
+        comp.addTrack(new Track(trackId, MidiInstrumentBase, s));
+
+        Segment *segment = new Segment;
+        segment->setTrack(trackId);
+
+        // Characters that must be escaped, and some that aren't ASCII
+        std::string label("Segment <\"A\" & 'B'> \xc3\xa9t\xc3\xa9 ");
+        segment->setLabel(label + char('0' + s));
+
+        for (int i = 0; i < notesPerSegment; ++i) {
+            Event *e = new Event(Note::EventType, i * 240, 240);
+            e->set<Int>(PITCH, 48 + (i * 5 + s) % 36);
+            e->set<Int>(VELOCITY, 1 + (i + s) % 127);
+            if (i % 10 == 0) {
+                e->set<Bool>(IS_GRACE_NOTE, false);
+                e->set<Int>(NOTE_TYPE, Note::Crotchet, false);
+            }
+            segment->insert(e);
+        }
+        comp.addSegment(segment);
+    }
+
+    QString errMsg;
+    QVERIFY(m_doc->saveDocument(m_fileName, errMsg));
+}
+
+void TestDocumentSave::cleanupTestCase()
+{
+    delete m_doc;
+    QFile::remove(m_fileName);
+}
+
+void TestDocumentSave::testSaveAndReload()
+{
+    RosegardenDocument doc(0, 0, true, true, false);
+    QVERIFY(doc.openDocument(m_fileName, false /*not permanent*/,
+                             true /*no progress dlg*/, false /*no lock*/));
+
+    const SegmentMultiSet &segments = doc.getComposition().getSegments();
+    const SegmentMultiSet &expected = m_doc->getComposition().getSegments();
+    QCOMPARE(segments.size(), expected.size());
+
+    SegmentMultiSet::const_iterator i = segments.begin();
+    SegmentMultiSet::const_iterator j = expected.begin();
+    for ( ; i != segments.end(); ++i, ++j) {
+        compareSegments(**i, **j);
+    }
+}
+
+void TestDocumentSave::testSaveIsRepeatable()
+{
+    // However the segments are shared out between threads, the file
+    // comes out the same
+    QString fileName = QDir::tempPath() + "/rosegarden-documentsave-again.rg";
+
+    QString errMsg;
+    QVERIFY(m_doc->saveDocument(fileName, errMsg));
+
+    QString xml = readXml(fileName);
+    QVERIFY(!xml.isEmpty());
+    QCOMPARE(xml, readXml(m_fileName));
+
+    QFile::remove(fileName);
+}
+
+QTEST_MAIN(TestDocumentSave)
+
+#include "documentsave.moc"
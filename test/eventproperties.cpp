@@ -0,0 +1,230 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include <QTest>
+
+using namespace Rosegarden;
+
+// Tests and benchmarks for Event property storage
+
+class TestEventProperties : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testTypes();
+    void testPersistence();
+    void testSharing();
+    void testManyProperties();
+
+    void benchmarkLookup();
+    void benchmarkSetNonPersistent();
+    void benchmarkMemory();
+
+private:
+    Composition *m_composition;
+};
+
+static const int segmentCount = 50;
+static const int eventsPerSegment = 10000; // 500k events in total
+
+void TestEventProperties::initTestCase()
+{
+    using namespace BaseProperties;
+
+    m_composition = new Composition;
+
+    for (int s = 0; s < segmentCount; ++s) {
+        Segment *segment = new Segment;
+        segment->setTrack(s);
+        for (int i = 0; i < eventsPerSegment; ++i) {
+            Event *e = new Event(Note::EventType, i * 240, 240);
+            e->set<Int>(PITCH, 36 + (i + s) % 60);
+            e->set<Int>(VELOCITY, 64 + i % 63);
+            if (i % 4 == 0) e->set<Bool>(BEAMED_GROUP_TUPLET_BASE, true);
+            segment->insert(e);
+        }
+        m_composition->addSegment(segment);
+    }
+}
+
+void TestEventProperties::cleanupTestCase()
+{
+    delete m_composition;
+}
+
+void TestEventProperties::testTypes()
+{
+    Event e(Note::EventType, 0, 960);
+    PropertyName i("test::int"), s("test::string"),
+        b("test::bool"), r("test::realtime");
+
+    e.set<Int>(i, 42);
+    e.set<String>(s, "forty-two");
+    e.set<Bool>(b, true);
+    e.set<RealTimeT>(r, RealTime(4, 2));
+
+    QCOMPARE(e.get<Int>(i), 42L);
+    QCOMPARE(e.get<String>(s), std::string("forty-two"));
+    QCOMPARE(e.get<Bool>(b), true);
+    QVERIFY(e.get<RealTimeT>(r) == RealTime(4, 2));
+    QCOMPARE(e.getAsString(r), std::string("4/2"));
+    QCOMPARE(e.getPropertyType(s), String);
+
+    bool caught = false;
+    try {
+        e.get<Int>(s);
+    } catch (const Event::BadType &) {
+        caught = true;
+    }
+    QVERIFY(caught);
+
+    long value = 0;
+    QVERIFY(!e.get<Int>(b, value));
+
+    e.unset(s);
+    QVERIFY(!e.has(s));
+    QVERIFY(e.has(i));
+    QVERIFY(e.has(r));
+}
+
+void TestEventProperties::testPersistence()
+{
+    Event e(Note::EventType, 0, 960);
+    PropertyName p("test::persistent"), n("test::nonpersistent");
+
+    e.set<Int>(p, 1);
+    e.set<String>(n, "n", false);
+    QVERIFY(e.isPersistent<Int>(p));
+    QVERIFY(!e.isPersistent<String>(n));
+
+    e.setMaybe<Int>(p, 2);
+    QCOMPARE(e.get<Int>(p), 1L);
+
+    e.set<String>(n, "m", true);
+    QVERIFY(e.isPersistent<String>(n));
+    QCOMPARE(e.get<String>(n), std::string("m"));
+
+    e.setPersistence<String>(n, false);
+    QVERIFY(!e.isPersistent<String>(n));
+    QCOMPARE(e.getNonPersistentPropertyNames().size(), size_t(1));
+
+    Event copy(e);
+    QVERIFY(!copy.has(n));
+    QCOMPARE(copy.get<Int>(p), 1L);
+}
+
+void TestEventProperties::testSharing()
+{
+    Event e(Note::EventType, 0, 960);
+    PropertyName s("test::string");
+    e.set<String>(s, "original");
+
+    Event copy(e);
+    copy.set<String>(s, "changed");
+    QCOMPARE(e.get<String>(s), std::string("original"));
+    QCOMPARE(copy.get<String>(s), std::string("changed"));
+
+    Event moved(e, 480, 240);
+    QCOMPARE(moved.getNotationAbsoluteTime(), timeT(480));
+    QCOMPARE(moved.getNotationDuration(), timeT(240));
+    QCOMPARE(moved.get<String>(s), std::string("original"));
+}
+
+void TestEventProperties::testManyProperties()
+{
+    Event e(Note::EventType, 0, 960);
+    std::vector<PropertyName> names;
+
+    // Insert in reverse order of interning to exercise sorted insertion
+    for (int i = 0; i < 40; ++i) {
+        names.push_back(PropertyName(QString("test::many%1").arg(i).toStdString()));
+    }
+    for (int i = 39; i >= 0; --i) {
+        e.set<Int>(names[i], i);
+    }
+    for (int i = 0; i < 40; ++i) {
+        QCOMPARE(e.get<Int>(names[i]), long(i));
+    }
+    for (int i = 0; i < 40; i += 2) {
+        e.unset(names[i]);
+    }
+    for (int i = 0; i < 40; ++i) {
+        QCOMPARE(e.has(names[i]), i % 2 == 1);
+    }
+}
+
+void TestEventProperties::benchmarkLookup()
+{
+    using namespace BaseProperties;
+
+    long sum = 0;
+
+    QBENCHMARK {
+        for (Composition::iterator ci = m_composition->begin();
+             ci != m_composition->end(); ++ci) {
+            for (Segment::iterator i = (*ci)->begin(); i != (*ci)->end(); ++i) {
+                long pitch = 0, velocity = 0;
+                (*i)->get<Int>(PITCH, pitch);
+                (*i)->get<Int>(VELOCITY, velocity);
+                sum += pitch + velocity + (*i)->getNotationDuration();
+            }
+        }
+    }
+
+    QVERIFY(sum > 0);
+}
+
+void TestEventProperties::benchmarkSetNonPersistent()
+{
+    PropertyName layoutX("test::layoutx"), layoutY("test::layouty");
+
+    QBENCHMARK {
+        for (Composition::iterator ci = m_composition->begin();
+             ci != m_composition->end(); ++ci) {
+            for (Segment::iterator i = (*ci)->begin(); i != (*ci)->end(); ++i) {
+                (*i)->setMaybe<Int>(layoutX, (*i)->getAbsoluteTime());
+                (*i)->setMaybe<Int>(layoutY, 10);
+            }
+        }
+    }
+
+    for (Composition::iterator ci = m_composition->begin();
+         ci != m_composition->end(); ++ci) {
+        for (Segment::iterator i = (*ci)->begin(); i != (*ci)->end(); ++i) {
+            (*i)->unset(layoutX);
+            (*i)->unset(layoutY);
+        }
+    }
+}
+
+void TestEventProperties::benchmarkMemory()
+{
+    size_t total = 0;
+    size_t count = 0;
+
+    for (Composition::iterator ci = m_composition->begin();
+         ci != m_composition->end(); ++ci) {
+        for (Segment::iterator i = (*ci)->begin(); i != (*ci)->end(); ++i) {
+            total += (*i)->getStorageSize();
+            ++count;
+        }
+    }
+
+    QCOMPARE(count, size_t(segmentCount * eventsPerSegment));
+
+    qDebug() << "Event storage for" << count << "events:"
+             << total / 1024 << "KB," << double(total) / count
+             << "bytes per event";
+}
+
+QTEST_MAIN(TestEventProperties)
+
+#include "eventproperties.moc"
@@ -0,0 +1,177 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/Event.h"
+#include "base/MidiTypes.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include <QTest>
+
+#include <string>
+
+using namespace Rosegarden;
+
+// Tests and benchmarks for interned Event types
+
+class TestEventTypes : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testKnownTypes();
+    void testOtherTypes();
+    void testCopies();
+
+    void benchmarkFilter();
+    void benchmarkFilterById();
+
+private:
+    Segment *m_segment;
+    long m_notes;
+    long m_rests;
+    long m_controllers;
+};
+
+static const int eventCount = 1000000;
+
+void TestEventTypes::initTestCase()
+{
+    m_segment = new Segment;
+    m_notes = m_rests = m_controllers = 0;
+
+    // Mostly notes, as in a typical segment, with a few pitch bends
+    // that none of the filters want
+    for (int i = 0; i < eventCount; ++i) {
+        timeT t = (i / 4) * 240;
+        switch (i % 10) {
+        case 7:
+            m_segment->insert(new Event(Note::EventRestType, t, 240));
+            ++m_rests;
+            break;
+        case 8:
+            m_segment->insert(new Event(Controller::EventType, t));
+            ++m_controllers;
+            break;
+        case 9:
+            m_segment->insert(new Event(PitchBend::EventType, t));
+            break;
+        default:
+            m_segment->insert(new Event(Note::EventType, t, 240));
+            ++m_notes;
+            break;
+        }
+    }
+}
+
+void TestEventTypes::cleanupTestCase()
+{
+    delete m_segment;
+}
+
+void TestEventTypes::testKnownTypes()
+{
+    // However the name was made, the event has the interned one
+    Event fromConstant(Note::EventType, 0, 960);
+    Event fromLiteral("note", 0, 960);
+    Event fromString(std::string("no") + "te", 0, 960);
+
+    QVERIFY(&fromConstant.getType() == &Note::EventType);
+    QVERIFY(&fromLiteral.getType() == &Note::EventType);
+    QVERIFY(&fromString.getType() == &Note::EventType);
+
+    QVERIFY(fromLiteral.isa(Note::EventType));
+    QVERIFY(fromConstant.isa("note"));
+    QVERIFY(fromConstant.isa(std::string("note")));
+    QVERIFY(!fromConstant.isa(Note::EventRestType));
+    QVERIFY(!fromConstant.isa("notes"));
+
+    Event::TypeId note = Event::getTypeId(Note::EventType);
+    QCOMPARE(fromLiteral.getTypeId(), note);
+    QVERIFY(fromString.isa(note));
+    QVERIFY(Event::getTypeId(Note::EventRestType) != note);
+    QVERIFY(Event::getTypeId(Controller::EventType) != note);
+}
+
+void TestEventTypes::testOtherTypes()
+{
+    Event a("test::custom", 0);
+    Event b(std::string("test::cus") + "tom", 480);
+    Event c("test::other", 0);
+
+    QCOMPARE(a.getType(), std::string("test::custom"));
+    QVERIFY(&a.getType() == &b.getType());
+    QCOMPARE(a.getTypeId(), b.getTypeId());
+    QCOMPARE(a.getTypeId(), Event::getTypeId("test::custom"));
+    QVERIFY(a.getTypeId() != c.getTypeId());
+    QVERIFY(a.getTypeId() != Event::getTypeId(Note::EventType));
+
+    QVERIFY(a.isa("test::custom"));
+    QVERIFY(b.isa(std::string("test::custom")));
+    QVERIFY(!c.isa("test::custom"));
+    QVERIFY(!a.isa(Note::EventType));
+}
+
+void TestEventTypes::testCopies()
+{
+    Event e("test::copied", 0, 240);
+    e.set<Int>("test::value", 1);
+
+    // A copy that shares the data, and one that doesn't
+    Event shared(e);
+    Event moved(e, 960, 480);
+
+    QVERIFY(shared.isa("test::copied"));
+    QVERIFY(moved.isa("test::copied"));
+    QCOMPARE(moved.getTypeId(), e.getTypeId());
+    QCOMPARE(moved.getAbsoluteTime(), timeT(960));
+    QVERIFY(&moved.getType() == &e.getType());
+}
+
+void TestEventTypes::benchmarkFilter()
+{
+    long notes = 0, rests = 0, controllers = 0;
+
+    QBENCHMARK {
+        notes = rests = controllers = 0;
+        for (Segment::iterator i = m_segment->begin();
+             i != m_segment->end(); ++i) {
+            if ((*i)->isa(Note::EventType)) ++notes;
+            else if ((*i)->isa(Note::EventRestType)) ++rests;
+            else if ((*i)->isa(Controller::EventType)) ++controllers;
+        }
+    }
+
+    QCOMPARE(notes, m_notes);
+    QCOMPARE(rests, m_rests);
+    QCOMPARE(controllers, m_controllers);
+}
+
+void TestEventTypes::benchmarkFilterById()
+{
+    const Event::TypeId note = Event::getTypeId(Note::EventType);
+    const Event::TypeId rest = Event::getTypeId(Note::EventRestType);
+    const Event::TypeId controller = Event::getTypeId(Controller::EventType);
+
+    long notes = 0, rests = 0, controllers = 0;
+
+    QBENCHMARK {
+        notes = rests = controllers = 0;
+        for (Segment::iterator i = m_segment->begin();
+             i != m_segment->end(); ++i) {
+            Event::TypeId type = (*i)->getTypeId();
+            if (type == note) ++notes;
+            else if (type == rest) ++rests;
+            else if (type == controller) ++controllers;
+        }
+    }
+
+    QCOMPARE(notes, m_notes);
+    QCOMPARE(rests, m_rests);
+    QCOMPARE(controllers, m_controllers);
+}
+
+QTEST_MAIN(TestEventTypes)
+
+#include "eventtypes.moc"
@@ -0,0 +1,184 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "gui/editors/notation/GlyphCache.h"
+#include <QTest>
+
+using namespace Rosegarden;
+
+// Tests for the cache of note font characters
+
+class TestGlyphCache : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testHitsAndMisses();
+    void testMissing();
+    void testKeys();
+    void testEviction();
+    void testShrink();
+    void benchmarkLookup();
+};
+
+static QPixmap glyph()
+{
+    return QPixmap(10, 10);
+}
+
+// 10 x 10 pixels, at whatever depth the platform gives pixmaps
+static size_t glyphBytes()
+{
+    return 10 * 10 * size_t(glyph().depth()) / 8;
+}
+
+static GlyphCache::Key key(int i)
+{
+    return GlyphCache::Key("feta", 8, QString("char%1").arg(i), false);
+}
+
+void TestGlyphCache::testHitsAndMisses()
+{
+    GlyphCache cache(glyphBytes() * 10);
+    QPixmap pixmap;
+
+    QVERIFY(!cache.lookup(key(0), pixmap));
+    cache.add(key(0), glyph());
+    QVERIFY(cache.lookup(key(0), pixmap));
+    QCOMPARE(pixmap.width(), 10);
+    QVERIFY(cache.lookup(key(0), pixmap));
+    QVERIFY(!cache.lookup(key(1), pixmap));
+
+    QCOMPARE(cache.getHits(), 2ul);
+    QCOMPARE(cache.getMisses(), 2ul);
+    QCOMPARE(cache.getHitRate(), 0.5);
+    QCOMPARE(cache.getCount(), size_t(1));
+    QCOMPARE(cache.getBytes(), glyphBytes());
+
+    cache.resetStats();
+    QCOMPARE(cache.getHits(), 0ul);
+    QCOMPARE(cache.getHitRate(), 0.0);
+}
+
+void TestGlyphCache::testMissing()
+{
+    // A character the font doesn't have is found, as a null pixmap,
+    // and takes no room
+    GlyphCache cache(glyphBytes());
+    QPixmap pixmap = glyph();
+
+    cache.add(key(0), QPixmap());
+    QVERIFY(cache.lookup(key(0), pixmap));
+    QVERIFY(pixmap.isNull());
+    QCOMPARE(cache.getBytes(), size_t(0));
+}
+
+void TestGlyphCache::testKeys()
+{
+    GlyphCache cache(glyphBytes() * 10);
+    QPixmap pixmap;
+
+    GlyphCache::Key plain("feta", 8, "notehead", false);
+    cache.add(plain, glyph());
+
+    // Each of these is a different character
+    GlyphCache::Key others[] = {
+        GlyphCache::Key("feta", 6, "notehead", false),
+        GlyphCache::Key("gonville", 8, "notehead", false),
+        GlyphCache::Key("feta", 8, "notehead", true),
+        GlyphCache::Key("feta", 8, "notehead", false, 225, 0, -1),
+        GlyphCache::Key("feta", 8, "notehead", false, 225, 80, -1),
+        GlyphCache::Key("feta", 8, "notehead", false, 0, 0, 255),
+        GlyphCache::Key::shaded("feta", 8, "notehead", false)
+    };
+    const int count = sizeof(others) / sizeof(others[0]);
+
+    for (int i = 0; i < count; ++i) {
+        QVERIFY(!cache.lookup(others[i], pixmap));
+    }
+    for (int i = 0; i < count; ++i) {
+        cache.add(others[i], QPixmap(i + 1, 1));
+    }
+    for (int i = 0; i < count; ++i) {
+        QVERIFY(cache.lookup(others[i], pixmap));
+        QCOMPARE(pixmap.width(), i + 1);
+    }
+
+    QVERIFY(cache.lookup(GlyphCache::Key("feta", 8, "notehead", false),
+                         pixmap));
+    QCOMPARE(pixmap.width(), 10);
+}
+
+void TestGlyphCache::testEviction()
+{
+    GlyphCache cache(glyphBytes() * 3);
+    QPixmap pixmap;
+
+    cache.add(key(0), glyph());
+    cache.add(key(1), glyph());
+    cache.add(key(2), glyph());
+
+    // Using 0 leaves 1 as the least recently used
+    QVERIFY(cache.lookup(key(0), pixmap));
+    cache.add(key(3), glyph());
+
+    QCOMPARE(cache.getEvictions(), 1ul);
+    QCOMPARE(cache.getBytes(), glyphBytes() * 3);
+    QVERIFY(!cache.lookup(key(1), pixmap));
+    QVERIFY(cache.lookup(key(0), pixmap));
+    QVERIFY(cache.lookup(key(2), pixmap));
+    QVERIFY(cache.lookup(key(3), pixmap));
+
+    // Replacing one doesn't count its old size
+    cache.add(key(2), QPixmap(5, 10));
+    QCOMPARE(cache.getBytes(), glyphBytes() * 5 / 2);
+    QCOMPARE(cache.getCount(), size_t(3));
+}
+
+void TestGlyphCache::testShrink()
+{
+    GlyphCache cache(glyphBytes() * 10);
+    QPixmap pixmap;
+
+    for (int i = 0; i < 10; ++i) cache.add(key(i), glyph());
+    QCOMPARE(cache.getCount(), size_t(10));
+
+    // Keeps the most recently added
+    cache.setMaxBytes(glyphBytes() * 4);
+    QCOMPARE(cache.getCount(), size_t(4));
+    QVERIFY(!cache.lookup(key(5), pixmap));
+    QVERIFY(cache.lookup(key(6), pixmap));
+    QVERIFY(cache.lookup(key(9), pixmap));
+
+    cache.clear();
+    QCOMPARE(cache.getCount(), size_t(0));
+    QCOMPARE(cache.getBytes(), size_t(0));
+}
+
+void TestGlyphCache::benchmarkLookup()
+{
+    // The characters of a typical score, in several colours
+    GlyphCache cache(glyphBytes() * 1000);
+    std::vector<GlyphCache::Key> keys;
+    for (int i = 0; i < 50; ++i) {
+        for (int hue = 0; hue < 360; hue += 60) {
+            keys.push_back(GlyphCache::Key("feta", 8, QString("char%1").arg(i),
+                                           false, hue, 0, -1));
+            cache.add(keys.back(), glyph());
+        }
+    }
+
+    QPixmap pixmap;
+    QBENCHMARK {
+        for (int i = 0; i < 100; ++i) {
+            for (size_t j = 0; j < keys.size(); ++j) {
+                cache.lookup(keys[j], pixmap);
+            }
+        }
+    }
+
+    QCOMPARE(cache.getMisses(), 0ul);
+}
+
+QTEST_MAIN(TestGlyphCache)
+
+#include "glyphcache.moc"
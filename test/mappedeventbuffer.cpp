@@ -0,0 +1,547 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/MidiTypes.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include "base/SegmentLinker.h"
+#include "base/Track.h"
+#include "document/RosegardenDocument.h"
+#include "gui/seqmanager/CompositionMapper.h"
+#include "gui/seqmanager/InternalSegmentMapper.h"
+#include "gui/seqmanager/SegmentMapper.h"
+#include "gui/seqmanager/TempoMapCache.h"
+#include "sound/MappedEvent.h"
+#include <QTest>
+
+#include <vector>
+
+using namespace Rosegarden;
+
+// Tests and benchmarks for refilling part of a segment's MappedEventBuffer,
+// for linked and identical segments sharing one, and for following tempo
+// changes without a refill
+
+class TestMappedEventBuffer : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestMappedEventBuffer()
+        : m_doc(0, 0, true /*skip autoload*/, true, false /*no sound*/),
+          m_random(1) {}
+
+private Q_SLOTS:
+    void initTestCase();
+
+    void testRangeRefill();
+    void testRangeRefillRepeating();
+    void testSharedEvents();
+    void testSameContent();
+    void testTempoChange();
+
+    void benchmarkFullRefill();
+    void benchmarkRangeRefill();
+    void benchmarkLinkedSegments();
+
+private:
+    Segment *makeSegment(int notes, timeT spacing);
+    void deleteSegment(Segment *segment);
+    void randomEdit(Segment *segment);
+    void checkRangeRefill(Segment *segment);
+    void checkPlayback(CompositionMapper &mapper, Segment *segment);
+    void checkTempo(SegmentMapper *mapper, Segment *segment);
+    int countOwners(CompositionMapper &mapper,
+                    const std::vector<Segment *> &segments);
+    int random(int n);
+
+    RosegardenDocument m_doc;
+    TrackId m_trackId;
+    unsigned int m_random;
+};
+
+int TestMappedEventBuffer::random(int n)
+{
+    // Repeatable, unlike qrand()
+    m_random = m_random * 1103515245 + 12345;
+    return (m_random >> 16) % n;
+}
+
+void TestMappedEventBuffer::initTestCase()
+{
+    Composition &comp = m_doc.getComposition();
+    m_trackId = comp.getNewTrackId();
+    comp.addTrack(new Track(m_trackId));
+    comp.setEndMarker(100000 * 240);
+    TempoMapCache::getInstance()->update(comp);
+}
+
+Segment *TestMappedEventBuffer::makeSegment(int notes, timeT spacing)
+{
+    using namespace BaseProperties;
+
+    Segment *segment = new Segment;
+    segment->setTrack(m_trackId);
+
+    for (int i = 0; i < notes; ++i) {
+        Event *e = new Event(Note::EventType, i * spacing,
+                             spacing * (1 + random(3)));
+        e->set<Int>(PITCH, 60 + random(12));
+        e->set<Int>(VELOCITY, 100);
+        segment->insert(e);
+
+        if (i % 50 == 0) {
+            Controller controller(7, random(128));
+            segment->insert(controller.getAsEvent(i * spacing));
+        }
+    }
+
+    m_doc.getComposition().addSegment(segment);
+    return segment;
+}
+
+void TestMappedEventBuffer::deleteSegment(Segment *segment)
+{
+    m_doc.getComposition().deleteSegment(segment);
+}
+
+void TestMappedEventBuffer::randomEdit(Segment *segment)
+{
+    using namespace BaseProperties;
+
+    Segment::iterator i = segment->begin();
+    std::advance(i, random(segment->size()));
+
+    switch (random(3)) {
+    case 0: {
+        // Add a note, possibly overlapping others of the same pitch
+        Event *e = new Event(Note::EventType, (*i)->getAbsoluteTime() + 120,
+                             240 * (1 + random(4)));
+        e->set<Int>(PITCH, 60 + random(12));
+        e->set<Int>(VELOCITY, 90);
+        segment->insert(e);
+        break;
+    }
+    case 1:
+        segment->erase(i);
+        break;
+    case 2: {
+        // Move a note
+        Event *e = new Event(**i, (*i)->getAbsoluteTime() + 240);
+        segment->erase(i);
+        segment->insert(e);
+        break;
+    }
+    }
+}
+
+void TestMappedEventBuffer::checkRangeRefill(Segment *segment)
+{
+    SegmentMapper *mapper =
+        SegmentMapper::makeMapperForSegment(&m_doc, segment);
+    mapper->addOwner();
+
+    unsigned int statusId = segment->getNewRefreshStatusId();
+    segment->getRefreshStatus(statusId).setNeedsRefresh(false);
+
+    for (int edit = 0; edit < 50; ++edit) {
+        randomEdit(segment);
+
+        SegmentRefreshStatus &status = segment->getRefreshStatus(statusId);
+        mapper->refresh(status.from(), status.to());
+        status.setNeedsRefresh(false);
+
+        // The result must be the same as a full refill
+        SegmentMapper *expected =
+            SegmentMapper::makeMapperForSegment(&m_doc, segment);
+        expected->addOwner();
+
+        QCOMPARE(mapper->size(), expected->size());
+        for (int i = 0; i < mapper->size(); ++i) {
+            const MappedEvent &a = mapper->getBuffer()[i];
+            const MappedEvent &b = expected->getBuffer()[i];
+            QCOMPARE(a.getType(), b.getType());
+            QCOMPARE(a.getData1(), b.getData1());
+            QCOMPARE(a.getData2(), b.getData2());
+            QVERIFY(a.getEventTime() == b.getEventTime());
+            QVERIFY(a.getDuration() == b.getDuration());
+        }
+
+        expected->removeOwner();
+    }
+
+    mapper->removeOwner();
+}
+
+void TestMappedEventBuffer::testRangeRefill()
+{
+    Segment *segment = makeSegment(2000, 240);
+    checkRangeRefill(segment);
+    deleteSegment(segment);
+}
+
+void TestMappedEventBuffer::testRangeRefillRepeating()
+{
+    Segment *segment = makeSegment(500, 240);
+    segment->setRepeating(true);
+    // End part way thru a repeat, so that the last one is cut short
+    m_doc.getComposition().setEndMarker(500 * 240 * 3 + 1000);
+    checkRangeRefill(segment);
+    deleteSegment(segment);
+    m_doc.getComposition().setEndMarker(100000 * 240);
+}
+
+void TestMappedEventBuffer::checkPlayback(CompositionMapper &mapper,
+                                          Segment *segment)
+{
+    // What the sequencer would play for the segment, shared or not,
+    // must be the same as for a mapping of its own
+    MappedEventBuffer *actual = mapper.getMappedEventBuffer(segment);
+    QVERIFY(actual);
+
+    SegmentMapper *expected =
+        SegmentMapper::makeMapperForSegment(&m_doc, segment);
+    expected->addOwner();
+
+    {
+        MappedEventBuffer::iterator a(actual);
+        MappedEventBuffer::iterator b(expected);
+
+        for (; !b.atEnd(); ++a, ++b) {
+            QVERIFY(!a.atEnd());
+            MappedEvent ea = *a;
+            MappedEvent eb = *b;
+            QCOMPARE(ea.getType(), eb.getType());
+            QCOMPARE(ea.getData1(), eb.getData1());
+            QCOMPARE(ea.getData2(), eb.getData2());
+            QCOMPARE(ea.getTrackId(), eb.getTrackId());
+            QVERIFY(ea.getEventTime() == eb.getEventTime());
+            QVERIFY(ea.getDuration() == eb.getDuration());
+        }
+        QVERIFY(a.atEnd());
+    }
+
+    RealTime actualStart, actualEnd, expectedStart, expectedEnd;
+    actual->getStartEnd(actualStart, actualEnd);
+    expected->getStartEnd(expectedStart, expectedEnd);
+    QVERIFY(actualStart == expectedStart);
+    QVERIFY(actualEnd == expectedEnd);
+
+    expected->removeOwner();
+}
+
+int TestMappedEventBuffer::countOwners(CompositionMapper &mapper,
+                                       const std::vector<Segment *> &segments)
+{
+    // The number of buffers holding events of their own
+    int owners = 0;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        MappedEventBuffer *buffer = mapper.getMappedEventBuffer(segments[i]);
+        if (buffer && !buffer->getSharedSource()) ++owners;
+    }
+    return owners;
+}
+
+void TestMappedEventBuffer::testSharedEvents()
+{
+    using namespace BaseProperties;
+
+    Composition &comp = m_doc.getComposition();
+
+    // Linked copies at different times, one transposed and one
+    // delayed, and an unlinked copy with the same content
+    Segment *original = makeSegment(300, 240);
+    std::vector<Segment *> segments;
+    segments.push_back(original);
+    for (int i = 1; i <= 3; ++i) {
+        Segment *copy = SegmentLinker::createLinkedSegment(original);
+        copy->setStartTime(i * 100000);
+        comp.addSegment(copy);
+        segments.push_back(copy);
+    }
+    segments[2]->setTranspose(5);
+    segments[3]->setDelay(120);
+
+    Segment *unlinked = original->clone(false);
+    unlinked->setStartTime(500000);
+    comp.addSegment(unlinked);
+    segments.push_back(unlinked);
+
+    CompositionMapper mapper(&m_doc);
+
+    QCOMPARE(countOwners(mapper, segments), 1);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        checkPlayback(mapper, segments[i]);
+    }
+
+    // The same edit to each linked segment, as the linker would make
+    for (size_t i = 0; i < 4; ++i) {
+        Event *e = new Event(Note::EventType,
+                             segments[i]->getStartTime() + 1000, 480);
+        e->set<Int>(PITCH, 50);
+        e->set<Int>(VELOCITY, 80);
+        segments[i]->insert(e);
+    }
+    // Tell the mapper in an awkward order, so that the owner of the
+    // old events has to hand them over while others still play them
+    mapper.segmentModified(segments[2]);
+    mapper.segmentModified(segments[0]);
+    mapper.segmentModified(segments[3]);
+    mapper.segmentModified(segments[1]);
+
+    // The linked segments share again, and the unlinked one (which
+    // no longer matches) has its own
+    QCOMPARE(countOwners(mapper, segments), 2);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        checkPlayback(mapper, segments[i]);
+    }
+
+    // Moving a segment only changes where it plays
+    segments[1]->setStartTime(50000);
+    mapper.segmentModified(segments[1]);
+    QCOMPARE(countOwners(mapper, segments), 2);
+    checkPlayback(mapper, segments[1]);
+
+    // Deleting the segment whose events are shared leaves the rest
+    // playing as before
+    comp.deleteSegment(original);
+    mapper.segmentDeleted(original);
+    segments.erase(segments.begin());
+    QCOMPARE(countOwners(mapper, segments), 2);
+    for (size_t i = 0; i < segments.size(); ++i) {
+        checkPlayback(mapper, segments[i]);
+    }
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+        comp.deleteSegment(segments[i]);
+        mapper.segmentDeleted(segments[i]);
+    }
+}
+
+void TestMappedEventBuffer::testSameContent()
+{
+    using namespace BaseProperties;
+
+    Composition &comp = m_doc.getComposition();
+
+    Segment *a = makeSegment(200, 240);
+    Segment *b = a->clone(false);
+    b->setStartTime(100000);
+    comp.addSegment(b);
+
+    std::vector<Segment *> segments;
+    segments.push_back(a);
+    segments.push_back(b);
+
+    QVERIFY(InternalSegmentMapper::haveSameContent(a, b));
+
+    CompositionMapper mapper(&m_doc);
+    QCOMPARE(countOwners(mapper, segments), 1);
+
+    // A different velocity on one note is enough to stop the sharing
+    Segment::iterator i = b->findTime(b->getStartTime() + 240 * 51);
+    QVERIFY(i != b->end());
+    Event *e = new Event(**i);
+    e->set<Int>(VELOCITY, e->get<Int>(VELOCITY) - 1);
+    b->erase(i);
+    b->insert(e);
+
+    QVERIFY(!InternalSegmentMapper::haveSameContent(a, b));
+    mapper.segmentModified(b);
+    QCOMPARE(countOwners(mapper, segments), 2);
+    checkPlayback(mapper, a);
+    checkPlayback(mapper, b);
+
+    // but not a property that isn't saved, which doesn't play
+    i = b->findTime(b->getStartTime() + 240 * 51);
+    e = new Event(**i);
+    e->set<Int>(VELOCITY, e->get<Int>(VELOCITY) + 1);
+    e->set<Int>(BEAMED_GROUP_ID, 1, false);
+    b->erase(i);
+    b->insert(e);
+
+    QVERIFY(InternalSegmentMapper::haveSameContent(a, b));
+    mapper.segmentModified(b);
+    QCOMPARE(countOwners(mapper, segments), 1);
+    checkPlayback(mapper, b);
+
+    // Nor does a different end
+    b->setEndMarkerTime(b->getEndMarkerTime() - 240);
+    QVERIFY(!InternalSegmentMapper::haveSameContent(a, b));
+    mapper.segmentModified(b);
+    QCOMPARE(countOwners(mapper, segments), 2);
+    checkPlayback(mapper, b);
+
+    comp.deleteSegment(b);
+    mapper.segmentDeleted(b);
+    deleteSegment(a);
+}
+
+void TestMappedEventBuffer::checkTempo(SegmentMapper *mapper,
+                                       Segment *segment)
+{
+    Composition &comp = m_doc.getComposition();
+
+    // The snapshot must convert as the Composition does
+    for (Segment::iterator i = segment->begin(); i != segment->end(); ++i) {
+        timeT t = (*i)->getAbsoluteTime();
+        QVERIFY(TempoMapCache::getInstance()->getElapsedRealTime(t) ==
+                comp.getElapsedRealTime(t));
+    }
+    for (int n = 0; n < comp.getTempoChangeCount(); ++n) {
+        timeT t = comp.getTempoChange(n).first;
+        QVERIFY(TempoMapCache::getInstance()->getElapsedRealTime(t) ==
+                comp.getElapsedRealTime(t));
+    }
+
+    // and the events resolved from the buffer filled before the tempo
+    // change must be those of a buffer filled after it
+    SegmentMapper *expected =
+        SegmentMapper::makeMapperForSegment(&m_doc, segment);
+    expected->addOwner();
+
+    {
+        MappedEventBuffer::iterator a(mapper);
+        MappedEventBuffer::iterator b(expected);
+
+        for (; !b.atEnd(); ++a, ++b) {
+            QVERIFY(!a.atEnd());
+            MappedEvent ea = *a;
+            MappedEvent eb = *b.peek();
+            QCOMPARE(ea.getType(), eb.getType());
+            QCOMPARE(ea.getData1(), eb.getData1());
+            QVERIFY(ea.getEventTime() == eb.getEventTime());
+            QVERIFY(ea.getDuration() == eb.getDuration());
+        }
+        QVERIFY(a.atEnd());
+    }
+
+    RealTime actualStart, actualEnd, expectedStart, expectedEnd;
+    mapper->getStartEnd(actualStart, actualEnd);
+    expected->getStartEnd(expectedStart, expectedEnd);
+    QVERIFY(actualStart == expectedStart);
+    QVERIFY(actualEnd == expectedEnd);
+
+    expected->removeOwner();
+}
+
+void TestMappedEventBuffer::testTempoChange()
+{
+    Composition &comp = m_doc.getComposition();
+
+    Segment *segment = makeSegment(2000, 240);
+    segment->setDelay(120);
+
+    SegmentMapper *mapper =
+        SegmentMapper::makeMapperForSegment(&m_doc, segment);
+    mapper->addOwner();
+    QVERIFY(mapper->isTempoIndependent());
+
+    // Each edit as SequenceManager::tempoChanged() would follow it:
+    // a constant tempo change, a ramp to the next change, a ramp to a
+    // target of its own, and a last ramp that runs to the end marker
+    struct {
+        timeT time;
+        double qpm;
+        double targetQpm;
+    } edits[] = {
+        { 48000, 140, -1 },
+        { 96000, 100, 0 },
+        { 192000, 160, -1 },
+        { 240000, 75, 200 },
+        { 288000, 120, -1 },
+        { 360000, 90, 180 }
+    };
+
+    for (size_t n = 0; n < sizeof(edits) / sizeof(edits[0]); ++n) {
+        tempoT target = edits[n].targetQpm < 0 ? -1 :
+            edits[n].targetQpm == 0 ? 0 :
+            Composition::getTempoForQpm(edits[n].targetQpm);
+        comp.addTempoAtTime(edits[n].time,
+                            Composition::getTempoForQpm(edits[n].qpm),
+                            target);
+
+        TempoMapCache::getInstance()->update(comp);
+        mapper->tempoChanged();
+
+        checkTempo(mapper, segment);
+        if (QTest::currentTestFailed()) break;
+    }
+
+    // Moving the end marker moves the end of the last ramp
+    comp.setEndMarker(1000000);
+    TempoMapCache::getInstance()->update(comp);
+    mapper->tempoChanged();
+    checkTempo(mapper, segment);
+
+    comp.setEndMarker(100000 * 240);
+    while (comp.getTempoChangeCount() > 0) {
+        comp.removeTempoChange(comp.getTempoChangeCount() - 1);
+    }
+    TempoMapCache::getInstance()->update(comp);
+
+    mapper->removeOwner();
+    deleteSegment(segment);
+}
+
+void TestMappedEventBuffer::benchmarkFullRefill()
+{
+    Segment *segment = makeSegment(50000, 240);
+    SegmentMapper *mapper =
+        SegmentMapper::makeMapperForSegment(&m_doc, segment);
+    mapper->addOwner();
+
+    QBENCHMARK {
+        mapper->refresh();
+    }
+
+    mapper->removeOwner();
+    deleteSegment(segment);
+}
+
+void TestMappedEventBuffer::benchmarkRangeRefill()
+{
+    Segment *segment = makeSegment(50000, 240);
+    SegmentMapper *mapper =
+        SegmentMapper::makeMapperForSegment(&m_doc, segment);
+    mapper->addOwner();
+
+    // As after editing one note in the middle, away from the
+    // controllers (which need a scan of the whole segment)
+    QBENCHMARK {
+        mapper->refresh(25020 * 240, 25021 * 240);
+    }
+
+    mapper->removeOwner();
+    deleteSegment(segment);
+}
+
+void TestMappedEventBuffer::benchmarkLinkedSegments()
+{
+    // A pattern repeated throughout as linked segments, mapped as on
+    // loading the file or starting playback
+    Composition &comp = m_doc.getComposition();
+    Segment *original = makeSegment(500, 240);
+    std::vector<Segment *> segments;
+    segments.push_back(original);
+    for (int i = 1; i < 100; ++i) {
+        Segment *copy = SegmentLinker::createLinkedSegment(original);
+        copy->setStartTime(i * 500 * 240);
+        comp.addSegment(copy);
+        segments.push_back(copy);
+    }
+
+    QBENCHMARK {
+        CompositionMapper mapper(&m_doc);
+    }
+
+    for (size_t i = 0; i < segments.size(); ++i) {
+        comp.deleteSegment(segments[i]);
+    }
+}
+
+QTEST_MAIN(TestMappedEventBuffer)
+
+#include "mappedeventbuffer.moc"
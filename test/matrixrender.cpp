@@ -0,0 +1,450 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/NotationTypes.h"
+#include "base/RulerScale.h"
+#include "base/Segment.h"
+#include "base/Selection.h"
+#include "base/Track.h"
+#include "document/RosegardenDocument.h"
+#include "gui/editors/matrix/MatrixElement.h"
+#include "gui/editors/matrix/MatrixMouseEvent.h"
+#include "gui/editors/matrix/MatrixScene.h"
+#include "gui/editors/matrix/MatrixSegmentItem.h"
+#include "gui/editors/matrix/MatrixSelector.h"
+#include "gui/editors/matrix/MatrixToolBox.h"
+#include "gui/editors/matrix/MatrixViewSegment.h"
+#include "gui/editors/matrix/MatrixWidget.h"
+#include <QDebug>
+#include <QImage>
+#include <QPainter>
+#include <QTest>
+#include <QTime>
+
+#include <vector>
+
+int init()
+{
+    // No display is needed
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    return 0;
+}
+Q_CONSTRUCTOR_FUNCTION(init)
+
+using namespace Rosegarden;
+
+// The index by which a MatrixSegmentItem finds the notes to draw, hit
+// and select, and how long it takes to draw a screenful of a segment
+// of half a million notes
+
+// Scene pixels, wider than several of the item's buckets
+static const double span = 2000;
+
+// Notes in the large segment, and the time the goal allows a frame
+static const int largeNoteCount = 500000;
+static const double frameGoalMs = 1000.0 / 60;
+
+typedef std::vector<MatrixElement *> Elements;
+
+class TestMatrixRender : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestMatrixRender() :
+        m_doc(0, 0, true /*skip autoload*/, true, false),
+        m_widget(0),
+        m_scene(0),
+        m_segment(0),
+        m_trackId(0) { }
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testIndex();
+    void testMove();
+    void testSelectSpanning();
+
+    void benchmarkLargeSegment();
+
+private:
+    /// A note of the given pitch from scene x x0 to x1
+    Event *makeNote(double x0, double x1, int pitch);
+
+    /// An element for a note from x0 to x1, drawn by item
+    MatrixElement *makeElement(MatrixSegmentItem &item,
+                               double x0, double x1, int pitch);
+
+    void moveElement(MatrixElement *element, double x0, double x1, int pitch);
+
+    double getX(timeT time) const;
+    timeT getTime(double x) const;
+
+    /// The middle of the row of the given pitch
+    double getY(int pitch) const;
+
+    /// The rect from x0 to x1 over the rows of the given pitches
+    QRectF getRect(double x0, double x1, int lowPitch, int highPitch) const;
+
+    RosegardenDocument m_doc;
+    MatrixWidget *m_widget;
+    MatrixScene *m_scene;
+    Segment *m_segment;
+    TrackId m_trackId;
+    std::vector<Event *> m_events;
+};
+
+void TestMatrixRender::initTestCase()
+{
+    Composition &comp = m_doc.getComposition();
+    m_trackId = comp.getNewTrackId();
+    comp.addTrack(new Track(m_trackId, MidiInstrumentBase));
+
+    // The scene is needed for the scale, so the notes go in later
+    m_segment = new Segment;
+    m_segment->setTrack(m_trackId);
+    Event *e = new Event(Note::EventType, 0, 480);
+    e->set<Int>(BaseProperties::PITCH, 20);
+    m_segment->insert(e);
+    comp.addSegment(m_segment);
+
+    std::vector<Segment *> segments;
+    segments.push_back(m_segment);
+
+    m_widget = new MatrixWidget(false);
+    m_widget->setSegments(&m_doc, segments);
+    m_scene = m_widget->getScene();
+    QVERIFY(m_scene);
+    QVERIFY(m_scene->getCurrentViewSegment());
+}
+
+void TestMatrixRender::cleanupTestCase()
+{
+    delete m_widget;
+
+    for (size_t i = 0; i < m_events.size(); ++i) {
+        delete m_events[i];
+    }
+}
+
+double TestMatrixRender::getX(timeT time) const
+{
+    return m_scene->getRulerScale()->getXForTime(time);
+}
+
+timeT TestMatrixRender::getTime(double x) const
+{
+    return m_scene->getRulerScale()->getTimeForX(x);
+}
+
+double TestMatrixRender::getY(int pitch) const
+{
+    int rowHeight = m_scene->getYResolution() + 1;
+    return (127 - pitch) * rowHeight + rowHeight / 2.0;
+}
+
+QRectF TestMatrixRender::getRect(double x0, double x1,
+                                 int lowPitch, int highPitch) const
+{
+    int rowHeight = m_scene->getYResolution() + 1;
+    double top = (127 - highPitch) * rowHeight;
+    double bottom = (128 - lowPitch) * rowHeight;
+    return QRectF(x0, top + 1, x1 - x0, bottom - top - 2);
+}
+
+Event *TestMatrixRender::makeNote(double x0, double x1, int pitch)
+{
+    timeT time = getTime(x0);
+    Event *e = new Event(Note::EventType, time, getTime(x1) - time);
+    e->set<Int>(BaseProperties::PITCH, pitch);
+    e->set<Int>(BaseProperties::VELOCITY, 100);
+    return e;
+}
+
+MatrixElement *TestMatrixRender::makeElement(MatrixSegmentItem &item,
+                                             double x0, double x1, int pitch)
+{
+    Event *e = makeNote(x0, x1, pitch);
+    m_events.push_back(e);
+    return new MatrixElement(m_scene, e, false, 0, &item);
+}
+
+void TestMatrixRender::moveElement(MatrixElement *element,
+                                   double x0, double x1, int pitch)
+{
+    timeT time = getTime(x0);
+    element->reconfigure(time, getTime(x1) - time, pitch);
+}
+
+void TestMatrixRender::testIndex()
+{
+    MatrixSegmentItem item;
+    const double x0 = getX(0);
+
+    // A long note, and short ones near its start, over its middle and
+    // past its end
+    MatrixElement *longNote = makeElement(item, x0, x0 + span, 60);
+    MatrixElement *first = makeElement(item, x0 + 10, x0 + 50, 62);
+    MatrixElement *middle =
+        makeElement(item, x0 + span / 2, x0 + span / 2 + 40, 60);
+    MatrixElement *last = makeElement(item, x0 + span + 10, x0 + span + 40, 58);
+
+    QCOMPARE(item.getElementCount(), size_t(4));
+    QVERIFY(item.boundingRect().contains(longNote->getSceneRect()));
+    QVERIFY(item.boundingRect().contains(last->getSceneRect()));
+
+    // Everything, each once however many buckets it spans, in the
+    // order in which it was added
+    Elements found;
+    item.getElementsIn(getRect(x0 - 10, x0 + span + 100, 0, 127), found);
+    QCOMPARE(found.size(), size_t(4));
+    QCOMPARE(found[0], longNote);
+    QCOMPARE(found[1], first);
+    QCOMPARE(found[2], middle);
+    QCOMPARE(found[3], last);
+
+    // Only the long note reaches a rect buckets away from its start
+    found.clear();
+    item.getElementsIn(getRect(x0 + span / 4, x0 + span / 4 + 100, 0, 127),
+                       found);
+    QCOMPARE(found.size(), size_t(1));
+    QCOMPARE(found[0], longNote);
+
+    // Nor does a rect on another row find it
+    found.clear();
+    item.getElementsIn(getRect(x0 + span / 4, x0 + span / 4 + 100, 61, 61),
+                       found);
+    QVERIFY(found.empty());
+
+    // Elements already in the vector are left as they are, and only
+    // those appended are sorted
+    found.clear();
+    found.push_back(last);
+    item.getElementsIn(getRect(x0 + span / 2 - 10, x0 + span / 2 + 100,
+                               60, 60), found);
+    QCOMPARE(found.size(), size_t(3));
+    QCOMPARE(found[0], last);
+    QCOMPARE(found[1], longNote);
+    QCOMPARE(found[2], middle);
+
+    // The topmost note is hit, which is the one added last
+    QCOMPARE(item.getElementAt(QPointF(x0 + span / 2 + 20, getY(60))), middle);
+    QCOMPARE(item.getElementAt(QPointF(x0 + span / 4, getY(60))), longNote);
+    QCOMPARE(item.getElementAt(QPointF(x0 + 30, getY(62))), first);
+    QVERIFY(!item.getElementAt(QPointF(x0 + span / 4, getY(62))));
+    QVERIFY(!item.getElementAt(QPointF(x0 + span * 3, getY(60))));
+
+    delete middle;
+    QCOMPARE(item.getElementCount(), size_t(3));
+    QCOMPARE(item.getElementAt(QPointF(x0 + span / 2 + 20, getY(60))),
+             longNote);
+
+    delete longNote;
+    delete first;
+    delete last;
+    QCOMPARE(item.getElementCount(), size_t(0));
+    found.clear();
+    item.getElementsIn(getRect(x0 - 10, x0 + span + 100, 0, 127), found);
+    QVERIFY(found.empty());
+}
+
+void TestMatrixRender::testMove()
+{
+    MatrixSegmentItem item;
+    const double x0 = getX(0);
+
+    MatrixElement *first = makeElement(item, x0 + 10, x0 + 50, 62);
+    MatrixElement *longNote = makeElement(item, x0, x0 + span, 60);
+    MatrixElement *last =
+        makeElement(item, x0 + span / 2, x0 + span / 2 + 40, 60);
+
+    // Buckets away, over the other two notes
+    moveElement(first, x0 + span / 2 + 20, x0 + span / 2 + 60, 60);
+
+    Elements found;
+    item.getElementsIn(getRect(x0, x0 + 100, 0, 127), found);
+    QCOMPARE(found.size(), size_t(1));
+    QCOMPARE(found[0], longNote);
+
+    // It's still drawn first, so under the others where they overlap
+    found.clear();
+    item.getElementsIn(getRect(x0 + span / 2 - 10, x0 + span / 2 + 100,
+                               60, 60), found);
+    QCOMPARE(found.size(), size_t(3));
+    QCOMPARE(found[0], first);
+    QCOMPARE(found[1], longNote);
+    QCOMPARE(found[2], last);
+
+    QCOMPARE(item.getElementAt(QPointF(x0 + span / 2 + 30, getY(60))), last);
+    QCOMPARE(item.getElementAt(QPointF(x0 + span / 2 + 50, getY(60))),
+             longNote);
+
+    // The long note moves right past its old end, and is found only
+    // in its new place
+    moveElement(longNote, x0 + span * 2, x0 + span * 3, 60);
+    QVERIFY(item.boundingRect().contains(longNote->getSceneRect()));
+
+    QCOMPARE(item.getElementAt(QPointF(x0 + span / 2 + 50, getY(60))), first);
+    QVERIFY(!item.getElementAt(QPointF(x0 + span / 4, getY(60))));
+    QCOMPARE(item.getElementAt(QPointF(x0 + span * 2.5, getY(60))), longNote);
+
+    found.clear();
+    item.getElementsIn(getRect(x0 - 10, x0 + span * 3 + 100, 0, 127), found);
+    QCOMPARE(found.size(), size_t(3));
+    QCOMPARE(found[0], first);
+    QCOMPARE(found[1], longNote);
+    QCOMPARE(found[2], last);
+
+    // A move within a bucket, to another row
+    moveElement(last, x0 + span / 2 + 2, x0 + span / 2 + 42, 64);
+    QVERIFY(!item.getElementAt(QPointF(x0 + span / 2 + 10, getY(60))));
+    QCOMPARE(item.getElementAt(QPointF(x0 + span / 2 + 10, getY(64))), last);
+
+    delete first;
+    delete longNote;
+    delete last;
+    QCOMPARE(item.getElementCount(), size_t(0));
+}
+
+void TestMatrixRender::testSelectSpanning()
+{
+    const double x0 = getX(0);
+
+    // A long note, and short ones within and outside the rubber band,
+    // which only reaches the end of the long one
+    Event *longNote = makeNote(x0 + 100, x0 + span, 70);
+    Event *inside = makeNote(x0 + span - 200, x0 + span - 160, 72);
+    Event *outside = makeNote(x0 + 200, x0 + 240, 72);
+    Event *above = makeNote(x0 + span - 200, x0 + span - 160, 90);
+    m_segment->insert(longNote);
+    m_segment->insert(inside);
+    m_segment->insert(outside);
+    m_segment->insert(above);
+
+    MatrixViewSegment *viewSegment = m_scene->getCurrentViewSegment();
+    QCOMPARE(&viewSegment->getSegment(), m_segment);
+
+    // Hit-testing the scene finds the long note far from its start
+    MatrixElement *element =
+        m_scene->getElementAt(QPointF(x0 + span - 20, getY(70)));
+    QVERIFY(element);
+    QVERIFY(element->event() == longNote);
+    element = m_scene->getElementAt(QPointF(x0 + span - 180, getY(72)));
+    QVERIFY(element);
+    QVERIFY(element->event() == inside);
+
+    MatrixSelector *selector = dynamic_cast<MatrixSelector *>
+        (m_widget->getToolBox()->getTool(MatrixSelector::ToolName()));
+    QVERIFY(selector);
+    selector->ready();
+
+    QRectF band = getRect(x0 + span - 300, x0 + span - 100, 69, 73);
+
+    MatrixMouseEvent e;
+    e.viewSegment = viewSegment;
+    e.buttons = Qt::LeftButton;
+    e.sceneX = band.left();
+    e.sceneY = int(band.top());
+    e.time = getTime(e.sceneX);
+    selector->handleLeftButtonPress(&e);
+
+    e.sceneX = band.right();
+    e.sceneY = int(band.bottom());
+    e.time = getTime(e.sceneX);
+    selector->handleMouseMove(&e);
+    selector->handleMouseRelease(&e);
+
+    EventSelection *selection = m_scene->getSelection();
+    QVERIFY(selection);
+    QCOMPARE(int(selection->getAddedEvents()), 2);
+    QVERIFY(selection->contains(longNote));
+    QVERIFY(selection->contains(inside));
+    QVERIFY(!selection->contains(outside));
+    QVERIFY(!selection->contains(above));
+
+    selector->stow();
+    m_scene->setSelection(0, false);
+}
+
+void TestMatrixRender::benchmarkLargeSegment()
+{
+    RosegardenDocument doc(0, 0, true, true, false);
+    Composition &comp = doc.getComposition();
+    TrackId trackId = comp.getNewTrackId();
+    comp.addTrack(new Track(trackId, MidiInstrumentBase));
+
+    // Four-note chords of semiquavers
+    Segment *segment = new Segment;
+    segment->setTrack(trackId);
+    const timeT step = 120;
+    for (int i = 0; i < largeNoteCount; ++i) {
+        Event *e = new Event(Note::EventType, (i / 4) * step, step);
+        e->set<Int>(BaseProperties::PITCH, 36 + (i * 7 + (i % 4) * 5) % 60);
+        e->set<Int>(BaseProperties::VELOCITY, 40 + i % 80);
+        segment->insert(e);
+    }
+    comp.addSegment(segment);
+
+    std::vector<Segment *> segments;
+    segments.push_back(segment);
+
+    QTime timer;
+    timer.start();
+
+    MatrixWidget widget(false);
+    widget.setSegments(&doc, segments);
+    MatrixScene *scene = widget.getScene();
+
+    qDebug() << "Opened" << largeNoteCount << "notes in"
+             << timer.elapsed() << "ms";
+
+    QCOMPARE(scene->getCurrentViewSegment()->getSegmentItem()->
+             getElementCount(), size_t(largeNoteCount));
+
+    // A screenful from the middle of the segment
+    const RulerScale *scale = scene->getRulerScale();
+    int rowHeight = scene->getYResolution() + 1;
+    QImage image(1600, 900, QImage::Format_ARGB32_Premultiplied);
+    QRectF source(scale->getXForTime(segment->getEndMarkerTime() / 2),
+                  (127 - 100) * rowHeight, image.width(), image.height());
+
+    QPainter painter(&image);
+
+    const int frames = 60;
+    timer.start();
+    for (int i = 0; i < frames; ++i) {
+        scene->render(&painter, image.rect(),
+                      source.translated(i * 10, 0));
+    }
+    double frameMs = double(timer.elapsed()) / frames;
+
+    // and the notes there under the pointer
+    const int hits = 100000;
+    int found = 0;
+    timer.start();
+    for (int i = 0; i < hits; ++i) {
+        QPointF pos(source.left() + (i * 37) % int(source.width()),
+                    source.top() + (i * 11) % int(source.height()));
+        if (scene->getElementAt(pos)) ++found;
+    }
+    double hitUs = timer.elapsed() * 1000.0 / hits;
+
+    qDebug() << "Drew a screenful in" << frameMs << "ms, against"
+             << frameGoalMs << "ms for 60 fps; hit-tested in" << hitUs
+             << "us," << found << "of" << hits << "on a note";
+
+    QVERIFY(found > 0);
+
+    QBENCHMARK {
+        scene->render(&painter, image.rect(), source);
+    }
+
+    painter.end();
+}
+
+QTEST_MAIN(TestMatrixRender)
+
+#include "matrixrender.moc"
@@ -0,0 +1,339 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "sound/Midi.h"
+#include "sound/MidiEvent.h"
+#include "sound/MidiFile.h"
+#include <QDir>
+#include <QFile>
+#include <QTest>
+
+#include <string>
+#include <vector>
+
+using namespace Rosegarden;
+
+// Reading a large generated Standard MIDI File
+
+static const int trackCount = 16;
+static const int notesPerTrack = 20000;
+static const int division = 480;
+
+class TestMidiFile : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testRead();
+    void testTruncated();
+    void testConsolidateNoteEvents();
+    void benchmarkRead();
+
+private:
+    // What each m_midiComposition track should end up with
+    struct Expected
+    {
+        Expected() : events(0), endTime(0), channel(-1) { }
+        std::string name;
+        int events;
+        unsigned long endTime;
+        int channel;
+    };
+
+    QString m_fileName;
+    QByteArray m_contents;
+    std::vector<Expected> m_expected;
+};
+
+static void writeNumber(std::string &data, unsigned long value)
+{
+    std::string bytes(1, char(value & 0x7f));
+    while (value >>= 7)
+        bytes.insert(bytes.begin(), char((value & 0x7f) | 0x80));
+    data += bytes;
+}
+
+static void writeLong(std::string &data, unsigned long value)
+{
+    data += char((value >> 24) & 0xff);
+    data += char((value >> 16) & 0xff);
+    data += char((value >> 8) & 0xff);
+    data += char(value & 0xff);
+}
+
+static void writeMeta(std::string &data, MidiByte code, const std::string &message)
+{
+    data += char(MIDI_FILE_META_EVENT);
+    data += char(code);
+    writeNumber(data, message.size());
+    data += message;
+}
+
+void TestMidiFile::initTestCase()
+{
+    m_fileName = QDir::tempPath() + "/rosegarden-midifile-test.mid";
+
+    // Format 1 header, with a spare byte on the end to be skipped
+    std::string file = "MThd";
+    writeLong(file, 7);
+    file += '\0'; file += char(1);
+    file += '\0'; file += char(trackCount);
+    file += char(division >> 8); file += char(division & 0xff);
+    file += '\0';
+
+    unsigned int seed = 1;
+
+    for (int track = 0; track < trackCount; ++track) {
+
+        std::string data;
+        Expected expected;
+        std::string name = "Track " + std::string(1, char('A' + track));
+
+        writeNumber(data, 0);
+        writeMeta(data, MIDI_TRACK_NAME, name);
+        expected.name = name;
+        ++expected.events;
+
+        if (track == 0) {
+            // Conductor track: tempo and time signature only
+            writeNumber(data, 0);
+            writeMeta(data, MIDI_SET_TEMPO, std::string("\x07\xa1\x20", 3));
+            writeNumber(data, division * 4);
+            writeMeta(data, MIDI_TIME_SIGNATURE, std::string("\x03\x02\x18\x08", 4));
+            writeNumber(data, 0);
+            writeMeta(data, MIDI_END_OF_TRACK, "");
+            expected.events += 3;
+            expected.endTime = division * 4;
+            m_expected.push_back(expected);
+
+            file += "MTrk";
+            writeLong(file, data.size());
+            file += data;
+
+            // An alien chunk, to be skipped
+            file += "XFIH";
+            writeLong(file, 5);
+            file += "alien";
+            continue;
+        }
+
+        // The last track has its notes on two channels, so it is
+        // split into two tracks on reading
+        int channel = track - 1;
+        bool split = (track == trackCount - 1);
+        Expected second;
+        second.name = name;
+        second.channel = channel + 1;
+        expected.channel = channel;
+
+        writeNumber(data, 0);
+        data += char(MIDI_PROG_CHANGE | channel);
+        data += char(track);
+        ++expected.events;
+
+        if (channel == 0) {
+            // SysEx goes to the track for channel 0 (it's 0xF0)
+            writeNumber(data, 0);
+            data += char(MIDI_SYSTEM_EXCLUSIVE);
+            writeNumber(data, 5);
+            data += std::string("\x7e\x7f\x09\x01", 4);
+            data += char(MIDI_END_OF_EXCLUSIVE);
+            ++expected.events;
+        }
+
+        unsigned long time = 0;
+        int runningStatus = -1;
+
+        for (int note = 0; note < notesPerTrack; ++note) {
+            seed = seed * 1103515245 + 12345;
+            int pitch = 36 + (seed >> 16) % 60;
+            int noteChannel = (split && note % 2) ? channel + 1 : channel;
+            Expected &target = (noteChannel == channel) ? expected : second;
+
+            if (note % 1000 == 999) {
+                // A controller, which breaks the running status
+                writeNumber(data, 0);
+                data += char(MIDI_CTRL_CHANGE | noteChannel);
+                data += char(7);
+                data += char(note % 128);
+                runningStatus = MIDI_CTRL_CHANGE | noteChannel;
+                ++target.events;
+                target.endTime = time;
+            }
+
+            // Note on, then a note on with zero velocity for the
+            // note off, both with running status where possible
+            for (int off = 0; off < 2; ++off) {
+                unsigned long delta = off ? division / 2 : (seed >> 8) % 48;
+                time += delta;
+                writeNumber(data, delta);
+                if (runningStatus != (MIDI_NOTE_ON | noteChannel)) {
+                    runningStatus = MIDI_NOTE_ON | noteChannel;
+                    data += char(runningStatus);
+                }
+                data += char(pitch);
+                data += char(off ? 0 : 100);
+                ++target.events;
+                target.endTime = time;
+            }
+        }
+
+        writeNumber(data, division);
+        writeMeta(data, MIDI_END_OF_TRACK, "");
+        ++expected.events;
+        time += division;
+        expected.endTime = time;
+
+        m_expected.push_back(expected);
+        if (split)
+            m_expected.push_back(second);
+
+        file += "MTrk";
+        writeLong(file, data.size());
+        file += data;
+    }
+
+    m_contents = QByteArray(file.data(), file.size());
+
+    QFile out(m_fileName);
+    QVERIFY(out.open(QIODevice::WriteOnly));
+    QCOMPARE(out.write(m_contents), qint64(m_contents.size()));
+    out.close();
+}
+
+void TestMidiFile::cleanupTestCase()
+{
+    QFile::remove(m_fileName);
+}
+
+void TestMidiFile::testRead()
+{
+    MidiFile midiFile;
+    QVERIFY(midiFile.read(m_fileName));
+
+    QCOMPARE(int(midiFile.m_format), 1);
+    QCOMPARE(int(midiFile.m_numberOfTracks), trackCount);
+    QCOMPARE(midiFile.m_timingDivision, division);
+    QCOMPARE(midiFile.m_midiComposition.size(), m_expected.size());
+    QCOMPARE(midiFile.m_trackNames.size(), m_expected.size());
+
+    for (TrackId i = 0; i < m_expected.size(); ++i) {
+        const MidiFile::MidiTrack &track = midiFile.m_midiComposition[i];
+        QCOMPARE(int(track.size()), m_expected[i].events);
+        QCOMPARE(midiFile.m_trackNames[i], m_expected[i].name);
+
+        if (m_expected[i].channel >= 0) {
+            QCOMPARE(midiFile.m_trackChannelMap[i], m_expected[i].channel);
+        }
+
+        // Event times are deltas from the previous event on the same
+        // track at this point
+        unsigned long endTime = 0;
+        for (size_t e = 0; e < track.size(); ++e) {
+            endTime += track[e]->getTime();
+        }
+        QCOMPARE(endTime, m_expected[i].endTime);
+    }
+
+    // A couple of events in detail
+    const MidiFile::MidiTrack &conductor = midiFile.m_midiComposition[0];
+    QVERIFY(conductor[1]->isMeta());
+    QCOMPARE(conductor[1]->getMetaEventCode(), MidiByte(MIDI_SET_TEMPO));
+    QCOMPARE(conductor[1]->getMetaMessage(), std::string("\x07\xa1\x20", 3));
+
+    const MidiFile::MidiTrack &first = midiFile.m_midiComposition[1];
+    QCOMPARE(first[1]->getEventCode(), MidiByte(MIDI_PROG_CHANGE));
+    QCOMPARE(first[1]->getData1(), MidiByte(1));
+    QCOMPARE(first[2]->getEventCode(), MidiByte(MIDI_SYSTEM_EXCLUSIVE));
+    QCOMPARE(first[2]->getMetaMessage(), std::string("\x7e\x7f\x09\x01", 4));
+    QCOMPARE(first[3]->getEventCode(), MidiByte(MIDI_NOTE_ON));
+    QCOMPARE(first[3]->getVelocity(), MidiByte(100));
+    QCOMPARE(first[4]->getEventCode(), MidiByte(MIDI_NOTE_ON));
+    QCOMPARE(first[4]->getPitch(), first[3]->getPitch());
+    QCOMPARE(first[4]->getVelocity(), MidiByte(0));
+}
+
+void TestMidiFile::testTruncated()
+{
+    // Cut off in the middle of a track
+    QString fileName = QDir::tempPath() + "/rosegarden-midifile-truncated.mid";
+    QFile out(fileName);
+    QVERIFY(out.open(QIODevice::WriteOnly));
+    out.write(m_contents.left(m_contents.size() / 2));
+    out.close();
+
+    MidiFile midiFile;
+    QVERIFY(!midiFile.read(fileName));
+    QCOMPARE(midiFile.getError(),
+             std::string("Attempt to read past MIDI file end"));
+
+    // And an empty file
+    QVERIFY(out.open(QIODevice::WriteOnly));
+    out.close();
+    QVERIFY(!midiFile.read(fileName));
+
+    QFile::remove(fileName);
+}
+
+void TestMidiFile::testConsolidateNoteEvents()
+{
+    MidiFile midiFile;
+    MidiFile::MidiTrack &track = midiFile.m_midiComposition[0];
+
+    // Absolute times, as convertToRosegarden() passes them in
+    track.push_back(new MidiEvent(0, MIDI_NOTE_OFF, 62, 0));   // stray
+    track.push_back(new MidiEvent(0, MIDI_NOTE_ON, 60, 100));
+    track.push_back(new MidiEvent(10, MIDI_NOTE_ON, 60, 90));  // overlaps
+    track.push_back(new MidiEvent(10, MIDI_NOTE_ON, 64, 80));
+    track.push_back(new MidiEvent(20, MIDI_NOTE_ON, 60, 0));   // off
+    track.push_back(new MidiEvent(25, MIDI_CTRL_CHANGE, 7, 100));
+    track.push_back(new MidiEvent(30, MIDI_NOTE_OFF, 60, 64));
+    track.push_back(new MidiEvent(30, MIDI_NOTE_ON, 67, 70));
+    track.push_back(new MidiEvent(30, MIDI_NOTE_OFF, 67, 0));  // zero length
+    track.push_back(new MidiEvent(40, MIDI_NOTE_ON, 60, 60));  // never off
+    track.push_back(new MidiEvent(50, MIDI_NOTE_OFF, 64, 0));
+    track.push_back(new MidiEvent(60, MIDI_CTRL_CHANGE, 7, 90));
+
+    midiFile.consolidateNoteEvents(0);
+
+    // The paired note-offs are gone, and the rest are in order
+    QCOMPARE(int(track.size()), 8);
+
+    QCOMPARE(track[0]->getEventCode(), MidiByte(MIDI_NOTE_OFF));
+    QCOMPARE(track[0]->getPitch(), MidiByte(62));
+
+    // Overlapping notes of the same pitch: first on, first off
+    QCOMPARE(track[1]->getTime(), timeT(0));
+    QCOMPARE(track[1]->getDuration(), timeT(20));
+    QCOMPARE(track[2]->getTime(), timeT(10));
+    QCOMPARE(track[2]->getDuration(), timeT(20));
+
+    QCOMPARE(track[3]->getPitch(), MidiByte(64));
+    QCOMPARE(track[3]->getDuration(), timeT(40));
+
+    QCOMPARE(track[4]->getEventCode(), MidiByte(MIDI_CTRL_CHANGE));
+
+    // A zero length note is made one long
+    QCOMPARE(track[5]->getPitch(), MidiByte(67));
+    QCOMPARE(track[5]->getDuration(), timeT(1));
+
+    // A note that's never switched off lasts to the end of the track
+    QCOMPARE(track[6]->getTime(), timeT(40));
+    QCOMPARE(track[6]->getDuration(), timeT(20));
+
+    QCOMPARE(track[7]->getEventCode(), MidiByte(MIDI_CTRL_CHANGE));
+}
+
+void TestMidiFile::benchmarkRead()
+{
+    QBENCHMARK {
+        MidiFile midiFile;
+        QVERIFY(midiFile.read(m_fileName));
+    }
+}
+
+QTEST_MAIN(TestMidiFile)
+
+#include "midifile.moc"
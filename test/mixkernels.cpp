@@ -0,0 +1,220 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "sound/MixKernels.h"
+#include <QTest>
+
+#include <cstring>
+#include <vector>
+
+using namespace Rosegarden;
+
+// The mixer's DSP kernels: every implementation against the plain
+// one, and timings for each
+
+typedef MixKernels::sample_t sample_t;
+
+static const int blockSize = 512;
+
+Q_DECLARE_METATYPE(MixKernels::Implementation)
+
+class TestMixKernels : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testRamp();
+    void testImplementations();
+    void benchmarkKernels_data();
+    void benchmarkKernels();
+
+private:
+    // Run every kernel over m_input with odd lengths and offsets,
+    // appending all the results to output
+    void runKernels(std::vector<sample_t> &output, std::vector<bool> &flags);
+
+    MixKernels::Implementation m_original;
+    std::vector<sample_t> m_input;
+};
+
+void TestMixKernels::initTestCase()
+{
+    m_original = MixKernels::getImplementation();
+
+    unsigned int seed = 1;
+    for (int i = 0; i < blockSize * 4; ++i) {
+        seed = seed * 1103515245 + 12345;
+        m_input.push_back(float(int((seed >> 8) & 0xffff) - 0x8000) / 0x8000);
+    }
+
+    // Some awkward values, and a run of silence
+    m_input[3] = -0.0f;
+    m_input[17] = 1e-40f;
+    m_input[100] = 1e30f;
+    for (int i = blockSize; i < blockSize + 64; ++i) {
+        m_input[i] = 0.0f;
+    }
+}
+
+void TestMixKernels::cleanupTestCase()
+{
+    MixKernels::setImplementation(m_original);
+}
+
+void TestMixKernels::testRamp()
+{
+    QVERIFY(MixKernels::setImplementation(MixKernels::Scalar));
+
+    std::vector<sample_t> buffer(4, 1.0f);
+    QVERIFY(!MixKernels::applyGain(&buffer[0], 4, 0.0f, 1.0f));
+
+    // Ramps up to finish at the new gain
+    QCOMPARE(buffer[0], 0.25f);
+    QCOMPARE(buffer[1], 0.5f);
+    QCOMPARE(buffer[2], 0.75f);
+    QCOMPARE(buffer[3], 1.0f);
+
+    // Zero gain leaves silence
+    QVERIFY(MixKernels::applyGain(&buffer[0], 4, 0.0f, 0.0f));
+
+    // Pan from mono in place, into a stereo pair
+    std::vector<sample_t> left(4, 0.5f), right(4, 1.0f);
+    QVERIFY(!MixKernels::pan(&left[0], &left[0], &right[0], 4,
+                             1.0f, 1.0f, 0.0f, 0.0f));
+    QCOMPARE(left[3], 0.5f);
+    QCOMPARE(right[3], 0.0f);
+
+    MixKernels::mixAdd(&right[0], &left[0], 4, 2.0f, 2.0f);
+    QCOMPARE(right[0], 1.0f);
+
+    QCOMPARE(MixKernels::getPeak(&right[0], 4), 1.0f);
+    std::vector<sample_t> negative(4, -1.0f);
+    QCOMPARE(MixKernels::getPeak(&negative[0], 4), 0.0f);
+}
+
+void TestMixKernels::runKernels(std::vector<sample_t> &output,
+                                std::vector<bool> &flags)
+{
+    static const size_t counts[] = { 0, 1, 3, 7, 8, 15, 64, 509, blockSize };
+    static const size_t offsets[] = { 0, 1, 3 };
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); ++c) {
+        for (size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); ++o) {
+
+            size_t count = counts[c];
+            const sample_t *in = &m_input[offsets[o]];
+            std::vector<sample_t> a(in, in + count), b(count), d(count + 1);
+
+            flags.push_back(MixKernels::applyGain
+                            (count ? &a[0] : 0, count, 0.3f, 1.7f));
+            output.insert(output.end(), a.begin(), a.end());
+
+            a.assign(in, in + count);
+            flags.push_back(MixKernels::pan
+                            (count ? &a[0] : 0, count ? &a[0] : 0,
+                             count ? &b[0] : 0, count,
+                             0.9f, 0.1f, 0.2f, 0.2f));
+            output.insert(output.end(), a.begin(), a.end());
+            output.insert(output.end(), b.begin(), b.end());
+
+            d.assign(m_input.begin() + blockSize * 2,
+                     m_input.begin() + blockSize * 2 + count + 1);
+            MixKernels::mixAdd(&d[1], in, count, 1.0f, 0.5f);
+            output.insert(output.end(), d.begin(), d.end());
+
+            output.push_back(MixKernels::getPeak(in, count));
+        }
+    }
+}
+
+void TestMixKernels::testImplementations()
+{
+    QVERIFY(MixKernels::setImplementation(MixKernels::Scalar));
+
+    std::vector<sample_t> expected;
+    std::vector<bool> expectedFlags;
+    runKernels(expected, expectedFlags);
+
+    for (int i = MixKernels::SSE; i <= MixKernels::AVX; ++i) {
+
+        MixKernels::Implementation implementation =
+            MixKernels::Implementation(i);
+
+        if (!MixKernels::isSupported(implementation)) {
+            QVERIFY(!MixKernels::setImplementation(implementation));
+            continue;
+        }
+
+        QVERIFY(MixKernels::setImplementation(implementation));
+        QCOMPARE(MixKernels::getImplementation(), implementation);
+
+        std::vector<sample_t> actual;
+        std::vector<bool> actualFlags;
+        runKernels(actual, actualFlags);
+
+        // Exactly the same bits, not just near enough
+        QCOMPARE(actual.size(), expected.size());
+        QVERIFY(memcmp(&actual[0], &expected[0],
+                       expected.size() * sizeof(sample_t)) == 0);
+        QVERIFY(actualFlags == expectedFlags);
+    }
+}
+
+void TestMixKernels::benchmarkKernels_data()
+{
+    QTest::addColumn<MixKernels::Implementation>("implementation");
+    QTest::addColumn<QString>("kernel");
+
+    const char *kernels[] = { "gain", "ramp", "pan", "mix", "peak" };
+
+    for (int i = MixKernels::Scalar; i <= MixKernels::AVX; ++i) {
+        MixKernels::Implementation implementation =
+            MixKernels::Implementation(i);
+        if (!MixKernels::isSupported(implementation))
+            continue;
+        for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+            QString name = QString("%1 %2")
+                .arg(MixKernels::getImplementationName(implementation))
+                .arg(kernels[k]);
+            QTest::newRow(name.toLocal8Bit().data())
+                << implementation << QString(kernels[k]);
+        }
+    }
+}
+
+void TestMixKernels::benchmarkKernels()
+{
+    QFETCH(MixKernels::Implementation, implementation);
+    QFETCH(QString, kernel);
+
+    QVERIFY(MixKernels::setImplementation(implementation));
+
+    std::vector<sample_t> a(m_input.begin(), m_input.begin() + blockSize);
+    std::vector<sample_t> b(blockSize);
+    sample_t peak = 0.0f;
+
+    // Gains that stay near one, so the values neither blow up nor
+    // die away to denormals over many runs
+    QBENCHMARK {
+        if (kernel == "gain") {
+            MixKernels::applyGain(&a[0], blockSize, 1.0f, 1.0f);
+        } else if (kernel == "ramp") {
+            MixKernels::applyGain(&a[0], blockSize, 0.999f, 1.001f);
+        } else if (kernel == "pan") {
+            MixKernels::pan(&a[0], &a[0], &b[0], blockSize,
+                            1.0f, 1.0f, 0.5f, 0.5f);
+        } else if (kernel == "mix") {
+            MixKernels::mixAdd(&b[0], &a[0], blockSize, -1.0f, -1.0f);
+        } else {
+            peak += MixKernels::getPeak(&a[0], blockSize);
+        }
+    }
+
+    QVERIFY(peak >= 0.0f);
+}
+
+QTEST_MAIN(TestMixKernels)
+
+#include "mixkernels.moc"
@@ -0,0 +1,142 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/NotationQuantizer.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include <QTest>
+
+using namespace Rosegarden;
+
+// Notation quantization of recorded (untidy) notes, and timings for a
+// long take
+
+class TestNotationQuantizer : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testQuantize();
+    void testNoLeftovers();
+    void benchmarkQuantize_data();
+    void benchmarkQuantize();
+
+private:
+    // Roughly performed notes of mixed lengths, with some chords
+    static void fillSegment(Segment &segment, int notes);
+};
+
+void TestNotationQuantizer::fillSegment(Segment &segment, int notes)
+{
+    const timeT crotchet = Note(Note::Crotchet).getDuration();
+
+    unsigned int seed = 1;
+    timeT t = 0;
+
+    for (int i = 0; i < notes; ++i) {
+
+        seed = seed * 1103515245 + 12345;
+        int r = (seed >> 8) % 97;
+
+        timeT step = crotchet / (r % 4 + 1);
+        timeT start = t + timeT((seed >> 16) % 31) - 15;
+        if (start < 0) start = 0;
+        timeT duration = step - timeT((seed >> 20) % 40);
+        if (duration < 10) duration = 10;
+
+        Event *e = new Event(Note::EventType, start, duration);
+        e->set<Int>(BaseProperties::PITCH, 40 + r % 40);
+        segment.insert(e);
+
+        if (r % 7 == 0) {
+            e = new Event(Note::EventType, start, duration + 5);
+            e->set<Int>(BaseProperties::PITCH, 30 + r % 40);
+            segment.insert(e);
+        }
+
+        t += step;
+    }
+}
+
+void TestNotationQuantizer::testQuantize()
+{
+    Composition composition;
+    Segment *segment = new Segment;
+    composition.addSegment(segment);
+
+    // Four crotchets, each a little early or late and short or long
+    const timeT times[] = { 12, 955, 1930, 2875 };
+    const timeT durations[] = { 900, 940, 910, 980 };
+    for (int i = 0; i < 4; ++i) {
+        Event *e = new Event(Note::EventType, times[i], durations[i]);
+        e->set<Int>(BaseProperties::PITCH, 60 + i);
+        segment->insert(e);
+    }
+
+    NotationQuantizer quantizer;
+    quantizer.quantize(segment);
+
+    const timeT crotchet = Note(Note::Crotchet).getDuration();
+    int n = 0;
+    for (Segment::iterator i = segment->begin(); i != segment->end(); ++i) {
+        if (!(*i)->isa(Note::EventType)) continue;
+        // Performed times are left alone
+        QCOMPARE((*i)->getAbsoluteTime(), times[n]);
+        QCOMPARE((*i)->getDuration(), durations[n]);
+        QCOMPARE((*i)->getNotationAbsoluteTime(), n * crotchet);
+        QCOMPARE((*i)->getNotationDuration(), crotchet);
+        ++n;
+    }
+    QCOMPARE(n, 4);
+}
+
+void TestNotationQuantizer::testNoLeftovers()
+{
+    Composition composition;
+    Segment *segment = new Segment;
+    composition.addSegment(segment);
+    fillSegment(*segment, 2000);
+
+    NotationQuantizer quantizer;
+    quantizer.quantize(segment);
+
+    // Nothing the quantizer worked out along the way is left behind
+    for (Segment::iterator i = segment->begin(); i != segment->end(); ++i) {
+        Event::PropertyNames names = (*i)->getPropertyNames();
+        for (size_t p = 0; p < names.size(); ++p) {
+            QVERIFY(names[p].getName().find("notationquantizer") ==
+                    std::string::npos);
+        }
+    }
+}
+
+void TestNotationQuantizer::benchmarkQuantize_data()
+{
+    QTest::addColumn<int>("notes");
+
+    QTest::newRow("1000 notes") << 1000;
+    QTest::newRow("20000 notes") << 20000; // a long recorded take
+    QTest::newRow("80000 notes") << 80000;
+}
+
+void TestNotationQuantizer::benchmarkQuantize()
+{
+    QFETCH(int, notes);
+
+    Composition composition;
+    Segment *segment = new Segment;
+    composition.addSegment(segment);
+    fillSegment(*segment, notes);
+
+    NotationQuantizer quantizer;
+
+    QBENCHMARK {
+        quantizer.quantize(segment);
+    }
+}
+
+QTEST_MAIN(TestNotationQuantizer)
+
+#include "notationquantizer.moc"
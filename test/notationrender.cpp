@@ -0,0 +1,342 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include "base/Track.h"
+#include "document/RosegardenDocument.h"
+#include "gui/editors/notation/NotationElement.h"
+#include "gui/editors/notation/NotationHLayout.h"
+#include "gui/editors/notation/NotationScene.h"
+#include "gui/editors/notation/NotationStaff.h"
+#include "gui/editors/notation/NotationWidget.h"
+#include "gui/editors/notation/NoteItem.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QGraphicsPixmapItem>
+#include <QTest>
+
+#include <algorithm>
+
+int init()
+{
+    // No display is needed
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    return 0;
+}
+Q_CONSTRUCTOR_FUNCTION(init)
+
+using namespace Rosegarden;
+
+// Lay out a large score and check that only the elements near the
+// visible part of the scene have scene items, before and after
+// scrolling, and time the scrolling
+
+static const int staffCount = 2;
+static const int barCount = 1500;
+
+class TestNotationRender : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestNotationRender() :
+        m_doc(0, 0, true /*skip autoload*/, true, false),
+        m_widget(0),
+        m_scene(0),
+        m_initialDrawn(0),
+        m_initialItems(0),
+        m_initialPixmaps(0) { }
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testInitialRender();
+    void testScroll();
+
+    void benchmarkScrollStep();
+    void benchmarkScrollJump();
+
+private:
+    /// Check the elements against the render rect, and count them
+    void checkItems(int &drawn, int &total);
+
+    /// Count the scene's items, and the note and pixmap items among them
+    void countSceneItems(int &items, int &notes, int &pixmaps);
+
+    /// Show a rect of the scene and wait for the render rect to follow
+    void scrollTo(const QRectF &visible);
+
+    QRectF getVisibleRect() const;
+    double getSceneXForBar(int bar) const;
+
+    RosegardenDocument m_doc;
+    NotationWidget *m_widget;
+    NotationScene *m_scene;
+    int m_initialDrawn;
+    int m_initialItems;
+    int m_initialPixmaps;
+};
+
+void TestNotationRender::initTestCase()
+{
+    Composition &comp = m_doc.getComposition();
+    timeT endTime = comp.getBarStart(barCount);
+
+    std::vector<Segment *> segments;
+
+    for (int s = 0; s < staffCount; ++s) {
+
+        TrackId trackId = comp.getNewTrackId();
+        comp.addTrack(new Track(trackId, MidiInstrumentBase, s));
+
+        Segment *segment = new Segment;
+        segment->setTrack(trackId);
+
+        // Quavers, with a hairpin every few bars
+        for (int i = 0; i * 480 < endTime; ++i) {
+            Event *e = new Event(Note::EventType, i * 480, 480);
+            e->set<Int>(BaseProperties::PITCH, 55 + (i * 3 + s * 7) % 24);
+            segment->insert(e);
+            if (i % 64 == 0) {
+                segment->insert(Indication(Indication::Crescendo, 1920)
+                                .getAsEvent(i * 480));
+            }
+        }
+
+        comp.addSegment(segment);
+        segments.push_back(segment);
+    }
+
+    m_widget = new NotationWidget;
+    m_widget->setSegments(&m_doc, segments);
+    m_scene = m_widget->getScene();
+
+    QCOMPARE(int(m_scene->getStaffCount()), staffCount);
+    QVERIFY(!m_scene->getRenderRect().isNull());
+}
+
+void TestNotationRender::cleanupTestCase()
+{
+    delete m_widget;
+}
+
+QRectF TestNotationRender::getVisibleRect() const
+{
+    // The render rect is the visible rect with another screenful on
+    // either side and half of one above and below
+    QRectF render = m_scene->getRenderRect();
+    return QRectF(render.left() + render.width() / 3,
+                  render.top() + render.height() / 4,
+                  render.width() / 3, render.height() / 2);
+}
+
+double TestNotationRender::getSceneXForBar(int bar) const
+{
+    NotationStaff *staff = (*m_scene->getStaffs())[0];
+    double layoutX = m_scene->getHLayout()->getBarPosition(bar);
+    return staff->getSceneCoordsForLayoutCoords(layoutX, 0).first;
+}
+
+void TestNotationRender::scrollTo(const QRectF &visible)
+{
+    m_scene->slotSetVisibleRect(visible);
+
+    // The scene redraws on the next pass of the event loop
+    for (int i = 0; i < 100 && !m_scene->getRenderRect().contains(visible);
+         ++i) {
+        QCoreApplication::processEvents();
+    }
+    QVERIFY(m_scene->getRenderRect().contains(visible));
+}
+
+void TestNotationRender::checkItems(int &drawn, int &total)
+{
+    drawn = 0;
+    total = 0;
+
+    QRectF rect = m_scene->getRenderRect();
+
+    // Items are made for whole bars, so may reach a bar past the rect
+    NotationHLayout *hlayout = m_scene->getHLayout();
+    double barWidth = 0;
+    for (int bar = hlayout->getFirstVisibleBar();
+         bar < hlayout->getLastVisibleBar(); ++bar) {
+        barWidth = std::max(barWidth, hlayout->getBarPosition(bar + 1) -
+                                      hlayout->getBarPosition(bar));
+    }
+    QVERIFY(barWidth > 0);
+
+    std::vector<NotationStaff *> *staffs = m_scene->getStaffs();
+
+    for (size_t s = 0; s < staffs->size(); ++s) {
+
+        NotationStaff *staff = (*staffs)[s];
+        NotationElementList *elements = staff->getViewElementList();
+
+        for (NotationElementList::iterator i = elements->begin();
+             i != elements->end(); ++i) {
+
+            NotationElement *el = static_cast<NotationElement *>(*i);
+
+            // Indications are always drawn
+            if (el->event()->isa(Indication::EventType)) {
+                QVERIFY(el->getItem());
+                continue;
+            }
+
+            if (!el->isNote()) continue;
+
+            ++total;
+
+            double x = staff->getSceneCoordsForLayoutCoords
+                (el->getLayoutX(), 0).first;
+
+            if (el->getItem()) {
+                ++drawn;
+                QVERIFY(!el->isOffscreen());
+                QVERIFY(x > rect.left() - barWidth);
+                QVERIFY(x < rect.right() + barWidth);
+            } else {
+                // A note in the rect is always drawn
+                QVERIFY(el->isOffscreen());
+                QVERIFY(x < rect.left() + 1 || x > rect.right() - 1);
+            }
+        }
+    }
+}
+
+void TestNotationRender::countSceneItems(int &items, int &notes, int &pixmaps)
+{
+    notes = 0;
+    pixmaps = 0;
+
+    QList<QGraphicsItem *> list = m_scene->items();
+    items = list.size();
+
+    for (int i = 0; i < list.size(); ++i) {
+        if (dynamic_cast<NoteItem *>(list[i])) ++notes;
+        else if (qgraphicsitem_cast<QGraphicsPixmapItem *>(list[i])) ++pixmaps;
+    }
+}
+
+void TestNotationRender::testInitialRender()
+{
+    int total = 0;
+    checkItems(m_initialDrawn, total);
+    if (QTest::currentTestFailed()) return;
+
+    int notes = 0;
+    countSceneItems(m_initialItems, notes, m_initialPixmaps);
+
+    qDebug() << "Drew" << m_initialDrawn << "of" << total << "notes, in"
+             << m_initialItems << "scene items of which" << notes
+             << "are notes and" << m_initialPixmaps << "pixmaps";
+
+    QCOMPARE(total, staffCount * barCount * 8);
+    QVERIFY(m_initialDrawn > 0);
+    QVERIFY(m_initialDrawn < total / 10);
+
+    // A note item for each note drawn and none for the rest
+    QCOMPARE(notes, m_initialDrawn);
+}
+
+void TestNotationRender::testScroll()
+{
+    QRectF start = getVisibleRect();
+    int drawn = 0, total = 0;
+
+    // A short scroll stays within the render rect, and draws nothing
+    QRectF renderRect = m_scene->getRenderRect();
+    m_scene->slotSetVisibleRect(start.translated(start.width() / 4, 0));
+    QCoreApplication::processEvents();
+    QCOMPARE(m_scene->getRenderRect(), renderRect);
+
+    // To the middle of the score: the notes there are drawn, and the
+    // ones at the start are dropped
+    QRectF middle(start);
+    middle.moveLeft(getSceneXForBar(barCount / 2));
+    scrollTo(middle);
+    if (QTest::currentTestFailed()) return;
+
+    checkItems(drawn, total);
+    if (QTest::currentTestFailed()) return;
+    QVERIFY(drawn > 0);
+    QVERIFY(drawn < total / 10);
+
+    int items = 0, notes = 0, pixmaps = 0;
+    countSceneItems(items, notes, pixmaps);
+    QCOMPARE(notes, drawn);
+
+    // To the end
+    QRectF end(start);
+    end.moveRight(getSceneXForBar(barCount));
+    scrollTo(end);
+    if (QTest::currentTestFailed()) return;
+
+    checkItems(drawn, total);
+    if (QTest::currentTestFailed()) return;
+    QVERIFY(drawn > 0);
+
+    // and back, to the same notes as at first
+    scrollTo(start);
+    if (QTest::currentTestFailed()) return;
+
+    checkItems(drawn, total);
+    if (QTest::currentTestFailed()) return;
+    QCOMPARE(drawn, m_initialDrawn);
+
+    // with nothing left behind on the way
+    countSceneItems(items, notes, pixmaps);
+    QCOMPARE(notes, m_initialDrawn);
+    QCOMPARE(items, m_initialItems);
+    QCOMPARE(pixmaps, m_initialPixmaps);
+}
+
+void TestNotationRender::benchmarkScrollStep()
+{
+    // A screenful at a time, drawing the notes coming into view and
+    // dropping those left behind at each step
+    QRectF start = getVisibleRect();
+    int steps = 0;
+
+    QBENCHMARK {
+        QRectF visible(start);
+        for (steps = 0; steps < 20; ++steps) {
+            visible.translate(visible.width(), 0);
+            scrollTo(visible);
+        }
+        scrollTo(start);
+    }
+
+    int items = 0, notes = 0, pixmaps = 0;
+    countSceneItems(items, notes, pixmaps);
+    qDebug() << steps << "steps and back left" << items << "scene items,"
+             << notes << "notes and" << pixmaps << "pixmaps";
+    QCOMPARE(items, m_initialItems);
+}
+
+void TestNotationRender::benchmarkScrollJump()
+{
+    // From one end of the score to the other, as by dragging the
+    // scroll bar
+    QRectF start = getVisibleRect();
+    QRectF end(start);
+    end.moveRight(getSceneXForBar(barCount));
+
+    QBENCHMARK {
+        scrollTo(end);
+        scrollTo(start);
+    }
+
+    int items = 0, notes = 0, pixmaps = 0;
+    countSceneItems(items, notes, pixmaps);
+    QCOMPARE(items, m_initialItems);
+    QCOMPARE(notes, m_initialDrawn);
+}
+
+QTEST_MAIN(TestNotationRender)
+
+#include "notationrender.moc"
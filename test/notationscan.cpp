@@ -0,0 +1,140 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include "base/Track.h"
+#include "document/RosegardenDocument.h"
+#include "gui/editors/notation/NotationHLayout.h"
+#include "gui/editors/notation/NotationScene.h"
+#include "gui/editors/notation/NotationStaff.h"
+#include "gui/editors/notation/NotationWidget.h"
+#include "misc/Strings.h"
+#include <QTest>
+#include <QThreadPool>
+
+#include <algorithm>
+
+int init()
+{
+    // No display is needed
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    return 0;
+}
+Q_CONSTRUCTOR_FUNCTION(init)
+
+using namespace Rosegarden;
+
+// Scanning the staffs of a score one after another and all at once on
+// the thread pool must come to the same bar data
+
+static const int staffCount = 6;
+static const int barCount = 120;
+
+class TestNotationScan : public QObject
+{
+    Q_OBJECT
+
+public:
+    TestNotationScan() : m_doc(0, 0, true /*skip autoload*/, true, false) { }
+
+private Q_SLOTS:
+    void initTestCase();
+    void testParallelScan();
+
+private:
+    QStringList describeScans(NotationScene *scene);
+
+    RosegardenDocument m_doc;
+    std::vector<Segment *> m_segments;
+};
+
+QStringList TestNotationScan::describeScans(NotationScene *scene)
+{
+    QStringList descriptions;
+    std::vector<NotationStaff *> *staffs = scene->getStaffs();
+    for (size_t i = 0; i < staffs->size(); ++i) {
+        descriptions << strtoqstr
+            (scene->getHLayout()->getScanDescription(*(*staffs)[i]));
+    }
+    return descriptions;
+}
+
+void TestNotationScan::initTestCase()
+{
+    Composition &comp = m_doc.getComposition();
+
+    // A change of time signature half way through
+    comp.addTimeSignature(comp.getBarStart(barCount / 2),
+                          TimeSignature(3, 4));
+    timeT endTime = comp.getBarStart(barCount);
+
+    static const timeT durations[] = { 960, 480, 480, 1440, 240, 240, 480 };
+    static const int durationCount = sizeof(durations) / sizeof(durations[0]);
+
+    for (int s = 0; s < staffCount; ++s) {
+
+        // Labels of different lengths, for different staff name widths
+        TrackId trackId = comp.getNewTrackId();
+        Track *track = new Track(trackId, MidiInstrumentBase, s);
+        track->setLabel(std::string("Staff ") + std::string(s * 3, 'x'));
+        comp.addTrack(track);
+
+        Segment *segment = new Segment;
+        segment->setTrack(trackId);
+        segment->insert(Clef(s % 2 ? Clef::Bass : Clef::Treble).getAsEvent(0));
+        segment->insert(Key("D major").getAsEvent
+                        (comp.getBarStart(barCount / 3)));
+
+        timeT t = 0;
+        for (int i = 0; t < endTime; ++i) {
+            timeT duration = std::min(durations[(i + s) % durationCount],
+                                      endTime - t);
+            Event *e = new Event(Note::EventType, t, duration);
+            e->set<Int>(BaseProperties::PITCH, 40 + (i * 7 + s * 5) % 40);
+            segment->insert(e);
+            t += duration;
+        }
+
+        comp.addSegment(segment);
+        m_segments.push_back(segment);
+    }
+}
+
+void TestNotationScan::testParallelScan()
+{
+    QThreadPool *pool = QThreadPool::globalInstance();
+    int threads = pool->maxThreadCount();
+
+    NotationWidget widget;
+    widget.setSegments(&m_doc, m_segments);
+    NotationScene *scene = widget.getScene();
+    QCOMPARE(int(scene->getStaffCount()), staffCount);
+
+    // With one thread the staffs are scanned in turn
+    pool->setMaxThreadCount(1);
+    scene->suspendLayoutUpdates();
+    scene->resumeLayoutUpdates();
+    QStringList serial = describeScans(scene);
+
+    // and with more, even on one core, all at once
+    pool->setMaxThreadCount(std::max(threads, 4));
+    scene->suspendLayoutUpdates();
+    scene->resumeLayoutUpdates();
+    QStringList parallel = describeScans(scene);
+
+    pool->setMaxThreadCount(threads);
+
+    QCOMPARE(serial.size(), staffCount);
+    QCOMPARE(parallel.size(), staffCount);
+
+    for (int i = 0; i < staffCount; ++i) {
+        QVERIFY(serial[i].contains(QString("bar %1:").arg(barCount - 1)));
+        QCOMPARE(parallel[i], serial[i]);
+    }
+}
+
+QTEST_MAIN(TestNotationScan)
+
+#include "notationscan.moc"
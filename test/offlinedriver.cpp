@@ -0,0 +1,193 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/AudioLevel.h"
+#include "base/Composition.h"
+#include "base/Track.h"
+#include "document/RosegardenDocument.h"
+#include "sound/ControlBlock.h"
+#include "sound/MappedEvent.h"
+#include "sound/MappedStudio.h"
+#include "sound/OfflineDriver.h"
+#include "sound/WAVAudioFile.h"
+#include "sound/audiostream/SimpleWavFileWriteStream.h"
+#include "sound/audiostream/WavFileWriteStream.h"
+#include <QDir>
+#include <QFile>
+#include <QTest>
+
+#include <vector>
+
+using namespace Rosegarden;
+
+// Rendering an audio file through the mixers offline, checked against
+// the source and timed end to end
+
+static const int sampleRate = 44100;
+static const int channels = 2;
+static const int seconds = 30;
+static const unsigned short audioFileId = 1;
+
+class TestOfflineDriver : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testRenderBlocks();
+    void testRenderFile();
+    void benchmarkRender();
+
+private:
+    QString m_fileName;
+    QString m_outputName;
+    std::vector<short> m_samples; // interleaved
+
+    RosegardenDocument *m_doc;
+    MappedStudio *m_studio;
+    OfflineDriver *m_driver;
+};
+
+void TestOfflineDriver::initTestCase()
+{
+#ifdef HAVE_LIBSNDFILE
+    WavFileWriteStream::initStaticObjects();
+#else
+    SimpleWavFileWriteStream::initStaticObjects();
+#endif
+
+    m_fileName = QDir::tempPath() + "/rosegarden-offlinedriver-test.wav";
+    m_outputName = QDir::tempPath() + "/rosegarden-offlinedriver-out.wav";
+
+    // Noise, different on each channel
+    WAVAudioFile writer(m_fileName, channels, sampleRate,
+                        sampleRate * channels * 2, channels * 2, 16);
+    QVERIFY(writer.write());
+
+    unsigned int seed = 1;
+    m_samples.resize(size_t(seconds) * sampleRate * channels);
+    for (size_t i = 0; i < m_samples.size(); ++i) {
+        seed = seed * 1103515245 + 12345;
+        m_samples[i] = short(int((seed >> 8) % 65536) - 32768);
+    }
+
+    std::vector<char> bytes(m_samples.size() * 2);
+    for (size_t i = 0; i < m_samples.size(); ++i) {
+        bytes[i * 2] = char(m_samples[i] & 0xff);
+        bytes[i * 2 + 1] = char((m_samples[i] >> 8) & 0xff);
+    }
+    writer.appendSamples(&bytes[0], m_samples.size() / channels);
+    writer.close();
+
+    // An audio track, so that the mixer doesn't treat the instrument
+    // as unused
+    m_doc = new RosegardenDocument(0, 0, true /*skip autoload*/, true, false);
+    Composition &comp = m_doc->getComposition();
+    comp.addTrack(new Track(comp.getNewTrackId(), AudioInstrumentBase, 0));
+    ControlBlock::getInstance()->setDocument(m_doc);
+
+    // Unity gain throughout
+    AudioLevel::setPanLaw(0);
+
+    m_studio = new MappedStudio;
+    m_driver = new OfflineDriver(m_studio, sampleRate, 512);
+    m_studio->setSoundDriver(m_driver);
+    QVERIFY(m_driver->initialise());
+
+    // Master buss, and a stereo fader for the instrument going
+    // straight to it
+    MappedObject *master = m_studio->createObject(MappedObject::AudioBuss);
+    QVERIFY(master);
+    MappedObject *fader = m_studio->createObject(MappedObject::AudioFader);
+    QVERIFY(fader);
+    fader->setProperty(MappedObject::Instrument, AudioInstrumentBase);
+
+    QVERIFY(m_driver->addAudioFile(m_fileName, audioFileId));
+
+    std::vector<MappedEvent> events;
+    events.push_back(MappedEvent(AudioInstrumentBase, audioFileId,
+                                 RealTime::zeroTime, RealTime(seconds, 0),
+                                 RealTime::zeroTime));
+    m_driver->initialiseAudioQueue(events);
+}
+
+void TestOfflineDriver::cleanupTestCase()
+{
+    delete m_driver;
+    delete m_studio;
+    delete m_doc;
+    QFile::remove(m_fileName);
+    QFile::remove(m_outputName);
+}
+
+void TestOfflineDriver::testRenderBlocks()
+{
+    const int blockSize = int(m_driver->getBlockSize());
+    std::vector<float> left(blockSize), right(blockSize);
+    std::vector<float> stemLeft(blockSize), stemRight(blockSize);
+
+    m_driver->startRender(RealTime::zeroTime);
+
+    // Every frame comes out as it went in, until the file ends
+    const int frames = seconds * sampleRate;
+    for (int frame = 0; frame < frames + blockSize * 4; frame += blockSize) {
+
+        m_driver->renderBlock(&left[0], &right[0], AudioInstrumentBase,
+                              &stemLeft[0], &stemRight[0]);
+
+        for (int i = 0; i < blockSize; ++i) {
+            float expectedLeft = 0.0f, expectedRight = 0.0f;
+            if (frame + i < frames) {
+                expectedLeft = m_samples[(frame + i) * channels] / 32768.0f;
+                expectedRight = m_samples[(frame + i) * channels + 1] / 32768.0f;
+            }
+            QCOMPARE(left[i], expectedLeft);
+            QCOMPARE(right[i], expectedRight);
+            QCOMPARE(stemLeft[i], expectedLeft);
+            QCOMPARE(stemRight[i], expectedRight);
+        }
+    }
+
+    m_driver->stopRender();
+    QCOMPARE(m_driver->getSequencerTime(),
+             RealTime::frame2RealTime(((frames + blockSize * 5 - 1) /
+                                       blockSize) * blockSize, sampleRate));
+}
+
+void TestOfflineDriver::testRenderFile()
+{
+    RealTime start(1, 0), end(11, 0);
+
+    QVERIFY(m_driver->render(start, end, m_outputName));
+    QCOMPARE(m_driver->getError(), QString());
+
+    QFile output(m_outputName);
+    QVERIFY(output.open(QIODevice::ReadOnly));
+    QByteArray first = output.readAll();
+    output.close();
+
+    // Stereo, with a sample per channel per frame, after the header
+    QVERIFY(first.size() >= 10 * sampleRate * channels * 2);
+
+    // And the same again
+    QVERIFY(m_driver->render(start, end, m_outputName));
+    QVERIFY(output.open(QIODevice::ReadOnly));
+    QCOMPARE(output.readAll(), first);
+    output.close();
+
+    QVERIFY(!m_driver->render(end, start, m_outputName));
+    QVERIFY(m_driver->getError() != QString());
+}
+
+void TestOfflineDriver::benchmarkRender()
+{
+    QBENCHMARK {
+        QVERIFY(m_driver->render(RealTime::zeroTime, RealTime(seconds, 0),
+                                 m_outputName));
+    }
+}
+
+QTEST_MAIN(TestOfflineDriver)
+
+#include "offlinedriver.moc"
@@ -0,0 +1,222 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/BaseProperties.h"
+#include "base/Composition.h"
+#include "base/Event.h"
+#include "base/NotationTypes.h"
+#include "base/Segment.h"
+#include "commands/edit/EventQuantizeCommand.h"
+#include "commands/edit/ParallelQuantizeCommand.h"
+#include <QCoreApplication>
+#include <QSettings>
+#include <QTest>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+int init()
+{
+    // No display is needed
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+    return 0;
+}
+Q_CONSTRUCTOR_FUNCTION(init)
+
+using namespace Rosegarden;
+
+// Quantizing segments for notation all at once on the thread pool must
+// come to the same events as an EventQuantizeCommand on each in turn
+
+static const char *const settingsGroup = "Parallel Quantize Test";
+
+class TestParallelQuantize : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testEquivalence();
+
+private:
+    /// Recorded (untidy) notes with some chords and overlaps, from bar
+    /// startBar
+    static void fillSegment(Segment &segment, int notes, int startBar,
+                            unsigned int seed);
+
+    /// Compositions alike, each with a segment per entry of sizes
+    static void makeComposition(Composition &composition,
+                                std::vector<Segment *> &segments);
+
+    void compareSegments(const Segment &a, const Segment &b);
+};
+
+void TestParallelQuantize::initTestCase()
+{
+    // Keep away from the user's settings
+    QCoreApplication::setApplicationName("test_parallelquantize");
+
+    // Every stage that tidies up after quantizing
+    QSettings settings;
+    settings.beginGroup(settingsGroup);
+    settings.setValue("quantizerebeam", true);
+    settings.setValue("quantizemakeviable", true);
+    settings.setValue("quantizedecounterpoint", true);
+    settings.endGroup();
+}
+
+void TestParallelQuantize::fillSegment(Segment &segment, int notes,
+                                       int startBar, unsigned int seed)
+{
+    const timeT crotchet = Note(Note::Crotchet).getDuration();
+
+    timeT t = startBar * 4 * crotchet;
+
+    for (int i = 0; i < notes; ++i) {
+
+        seed = seed * 1103515245 + 12345;
+        int r = (seed >> 8) % 97;
+
+        timeT step = crotchet / (r % 4 + 1);
+        timeT start = t + timeT((seed >> 16) % 31) - 15;
+        if (start < 0) start = 0;
+        timeT duration = step - timeT((seed >> 20) % 40) + (r % 5) * 60;
+        if (duration < 10) duration = 10;
+
+        Event *e = new Event(Note::EventType, start, duration);
+        e->set<Int>(BaseProperties::PITCH, 40 + r % 40);
+        e->set<Int>(BaseProperties::VELOCITY, 100);
+        segment.insert(e);
+
+        if (r % 7 == 0) {
+            e = new Event(Note::EventType, start, duration + 5);
+            e->set<Int>(BaseProperties::PITCH, 30 + r % 40);
+            e->set<Int>(BaseProperties::VELOCITY, 90);
+            segment.insert(e);
+        }
+
+        t += step;
+    }
+}
+
+void TestParallelQuantize::makeComposition(Composition &composition,
+                                           std::vector<Segment *> &segments)
+{
+    static const int sizes[] = { 1, 40, 500, 3000, 7, 1200, 250, 20 };
+    static const int count = sizeof(sizes) / sizeof(sizes[0]);
+
+    composition.addTimeSignature(0, TimeSignature(4, 4));
+    composition.addTimeSignature(composition.getBarStart(40),
+                                 TimeSignature(6, 8));
+    composition.addTimeSignature(composition.getBarStart(90),
+                                 TimeSignature(3, 4));
+    composition.setEndMarker(composition.getBarStart(1000));
+
+    for (int s = 0; s < count; ++s) {
+        Segment *segment = new Segment;
+        segment->setTrack(s);
+        fillSegment(*segment, sizes[s], s % 3, s + 1);
+        composition.addSegment(segment);
+        segments.push_back(segment);
+    }
+}
+
+void TestParallelQuantize::compareSegments(const Segment &a, const Segment &b)
+{
+    using namespace BaseProperties;
+
+    QCOMPARE(a.getStartTime(), b.getStartTime());
+    QCOMPARE(a.getEndMarkerTime(), b.getEndMarkerTime());
+    QCOMPARE(a.size(), b.size());
+
+    // Group ids come from each segment's own counter, but must group
+    // the same events
+    std::map<long, long> groups;
+
+    Segment::const_iterator i = a.begin(), j = b.begin();
+    for ( ; i != a.end(); ++i, ++j) {
+        const Event &ea = **i;
+        const Event &eb = **j;
+        QCOMPARE(ea.getType(), eb.getType());
+        QCOMPARE(ea.getAbsoluteTime(), eb.getAbsoluteTime());
+        QCOMPARE(ea.getDuration(), eb.getDuration());
+        QCOMPARE(ea.getSubOrdering(), eb.getSubOrdering());
+        QCOMPARE(ea.getNotationAbsoluteTime(), eb.getNotationAbsoluteTime());
+        QCOMPARE(ea.getNotationDuration(), eb.getNotationDuration());
+
+        Event::PropertyNames names = ea.getPropertyNames();
+        QCOMPARE(names.size(), eb.getPropertyNames().size());
+
+        for (size_t k = 0; k < names.size(); ++k) {
+            QVERIFY(eb.has(names[k]));
+            if (names[k] == BEAMED_GROUP_ID) {
+                long ga = ea.get<Int>(BEAMED_GROUP_ID);
+                long gb = eb.get<Int>(BEAMED_GROUP_ID);
+                if (groups.find(ga) == groups.end()) groups[ga] = gb;
+                QCOMPARE(groups[ga], gb);
+            } else {
+                QCOMPARE(ea.getAsString(names[k]), eb.getAsString(names[k]));
+            }
+        }
+    }
+}
+
+void TestParallelQuantize::testEquivalence()
+{
+    Composition sequential, parallel;
+    std::vector<Segment *> sequentialSegments, parallelSegments;
+    makeComposition(sequential, sequentialSegments);
+    makeComposition(parallel, parallelSegments);
+
+    // Each in turn, as MIDI import used to
+    std::vector<EventQuantizeCommand *> commands;
+    for (size_t s = 0; s < sequentialSegments.size(); ++s) {
+        Segment &segment = *sequentialSegments[s];
+        EventQuantizeCommand *command = new EventQuantizeCommand
+            (segment, segment.getStartTime(), segment.getEndMarkerTime(),
+             settingsGroup, EventQuantizeCommand::QUANTIZE_NOTATION_ONLY);
+        command->execute();
+        commands.push_back(command);
+    }
+
+    // and all at once, on more threads than segments even on one core
+    QThreadPool *pool = QThreadPool::globalInstance();
+    int threads = pool->maxThreadCount();
+    pool->setMaxThreadCount(std::max(threads, 4));
+
+    ParallelQuantizeCommand command
+        ("Quantize", parallelSegments, settingsGroup,
+         EventQuantizeCommand::QUANTIZE_NOTATION_ONLY);
+    command.execute();
+
+    pool->setMaxThreadCount(threads);
+
+    QCOMPARE(command.getCommands().size(), parallelSegments.size());
+
+    for (size_t s = 0; s < parallelSegments.size(); ++s) {
+        compareSegments(*parallelSegments[s], *sequentialSegments[s]);
+        if (QTest::currentTestFailed()) break;
+    }
+
+    // Undo and redo as the commands in turn would
+    command.unexecute();
+    for (size_t i = commands.size(); i > 0; --i) commands[i - 1]->unexecute();
+    for (size_t s = 0; s < parallelSegments.size(); ++s) {
+        compareSegments(*parallelSegments[s], *sequentialSegments[s]);
+        if (QTest::currentTestFailed()) break;
+    }
+
+    command.execute();
+    for (size_t i = 0; i < commands.size(); ++i) commands[i]->execute();
+    for (size_t s = 0; s < parallelSegments.size(); ++s) {
+        compareSegments(*parallelSegments[s], *sequentialSegments[s]);
+        if (QTest::currentTestFailed()) break;
+    }
+
+    for (size_t i = 0; i < commands.size(); ++i) delete commands[i];
+}
+
+QTEST_MAIN(TestParallelQuantize)
+
+#include "parallelquantize.moc"
@@ -0,0 +1,211 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "sound/PeakFile.h"
+#include "sound/WAVAudioFile.h"
+#include <QDir>
+#include <QFile>
+#include <QTest>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace Rosegarden;
+
+// Audio previews from peak files, checked against the raw peaks and
+// timed across zoom levels
+
+static const int sampleRate = 44100;
+static const int channels = 2;
+static const int seconds = 240;
+static const int previewWidth = 1920;
+
+class TestPeakFile : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testPreview();
+    void benchmarkPreview_data();
+    void benchmarkPreview();
+    void testWithoutMipmaps();
+
+private:
+    // Preview computed directly from the peaks in the file
+    std::vector<float> expectedPreview(int startPeak, int endPeak,
+                                       int width, bool showMinima);
+    void comparePreviews(PeakFile &peakFile);
+
+    static RealTime peakTime(int peak);
+
+    QString m_fileName;
+    WAVAudioFile *m_audioFile;
+    PeakFile *m_peakFile;
+    QByteArray m_peaks;
+};
+
+void TestPeakFile::initTestCase()
+{
+    m_fileName = QDir::tempPath() + "/rosegarden-peakfile-test.wav";
+
+    // Noise under a slowly varying envelope, so that the peaks differ
+    // at every zoom level
+    WAVAudioFile writer(m_fileName, channels, sampleRate,
+                        sampleRate * channels * 2, channels * 2, 16);
+    QVERIFY(writer.write());
+
+    const int frames = 4096;
+    std::vector<char> buffer(frames * channels * 2);
+    unsigned int seed = 1;
+
+    for (long frame = 0; frame < long(seconds) * sampleRate; frame += frames) {
+        for (int i = 0; i < frames; ++i) {
+            double envelope = 0.5 + 0.5 * sin(double(frame + i) / 30000.0);
+            for (int c = 0; c < channels; ++c) {
+                seed = seed * 1103515245 + 12345;
+                int sample = int((int((seed >> 8) % 65536) - 32768) * envelope);
+                buffer[(i * channels + c) * 2] = char(sample & 0xff);
+                buffer[(i * channels + c) * 2 + 1] = char((sample >> 8) & 0xff);
+            }
+        }
+        writer.appendSamples(&buffer[0], frames);
+    }
+    writer.close();
+
+    m_audioFile = new WAVAudioFile(0, "peakfile-test", m_fileName);
+    QVERIFY(m_audioFile->open());
+
+    m_peakFile = new PeakFile(m_audioFile);
+    QVERIFY(m_peakFile->write());
+    m_peakFile->close();
+    QVERIFY(m_peakFile->open());
+
+    QFile file(m_audioFile->getPeakFilename());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    m_peaks = file.readAll();
+}
+
+void TestPeakFile::cleanupTestCase()
+{
+    delete m_peakFile;
+    QFile::remove(m_audioFile->getPeakFilename());
+    delete m_audioFile;
+    QFile::remove(m_fileName);
+}
+
+RealTime TestPeakFile::peakTime(int peak)
+{
+    // Just after the start of the peak, so that rounding can't put us
+    // in the one before
+    long usec = long(double(peak) * 256 * 1000000.0 / sampleRate) + 1;
+    return RealTime(usec / 1000000, (usec % 1000000) * 1000);
+}
+
+std::vector<float> TestPeakFile::expectedPreview(int startPeak, int endPeak,
+                                                 int width, bool showMinima)
+{
+    const unsigned char *data =
+        reinterpret_cast<const unsigned char *>(m_peaks.constData());
+    int peaks = data[28] | (data[29] << 8) | (data[30] << 16) | (data[31] << 24);
+
+    std::vector<float> preview;
+    double step = double(endPeak - startPeak) / double(width);
+
+    for (int i = 0; i < width; ++i) {
+        int first = startPeak + int(double(i) * step);
+        int last = std::min(startPeak + int(double(i + 1) * step), peaks);
+
+        for (int c = 0; c < channels; ++c) {
+            float hi = 0, lo = 0;
+            for (int p = first; p < last; ++p) {
+                const unsigned char *value = data + 128 + (p * channels + c) * 4;
+                short max = short(value[0] | (value[1] << 8));
+                short min = short(value[2] | (value[3] << 8));
+                if (p == first || max > hi) hi = max;
+                if (p == first || min < lo) lo = min;
+            }
+            if (showMinima) {
+                preview.push_back(lo / 32767.0f);
+            } else {
+                preview.push_back(std::max(std::fabs(hi / 32767.0f),
+                                           std::fabs(lo / 32767.0f)));
+            }
+        }
+    }
+
+    return preview;
+}
+
+void TestPeakFile::comparePreviews(PeakFile &peakFile)
+{
+    const int starts[] = { 0, 1, 7, 1000, 33333 };
+    const int widths[] = { 1, 3, 100, 640, previewWidth, 50000 };
+    const int endPeak = seconds * sampleRate / 256 - 10;
+
+    for (size_t s = 0; s < sizeof(starts) / sizeof(starts[0]); ++s) {
+        for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w) {
+            for (int minima = 0; minima < 2; ++minima) {
+                std::vector<float> preview =
+                    peakFile.getPreview(peakTime(starts[s]), peakTime(endPeak),
+                                        widths[w], minima);
+                QCOMPARE(preview.size(), size_t(widths[w] * channels));
+                QVERIFY(preview == expectedPreview(starts[s], endPeak,
+                                                   widths[w], minima));
+            }
+        }
+    }
+}
+
+void TestPeakFile::testPreview()
+{
+    comparePreviews(*m_peakFile);
+}
+
+void TestPeakFile::benchmarkPreview_data()
+{
+    QTest::addColumn<int>("duration");
+
+    QTest::newRow("1 second") << 1;
+    QTest::newRow("10 seconds") << 10;
+    QTest::newRow("1 minute") << 60;
+    QTest::newRow("whole file") << seconds;
+}
+
+void TestPeakFile::benchmarkPreview()
+{
+    QFETCH(int, duration);
+
+    int n = 0;
+
+    QBENCHMARK {
+        // Move by a microsecond each time round, so as not to hit the
+        // last preview cache
+        RealTime start(0, (n++ % 2) * 1000);
+        std::vector<float> preview =
+            m_peakFile->getPreview(start, start + RealTime(duration, 0),
+                                   previewWidth, false);
+        QCOMPARE(preview.size(), size_t(previewWidth * channels));
+    }
+}
+
+void TestPeakFile::testWithoutMipmaps()
+{
+    // A peak file from before the mipmap chunk: the mipmaps are built
+    // when it's opened, and the previews are the same.
+    m_peakFile->close();
+
+    QFile file(m_audioFile->getPeakFilename());
+    const int peaks = seconds * sampleRate / 256;
+    QVERIFY(file.resize(128 + peaks * channels * 4));
+
+    PeakFile peakFile(m_audioFile);
+    QVERIFY(peakFile.open());
+    comparePreviews(peakFile);
+}
+
+QTEST_MAIN(TestPeakFile)
+
+#include "peakfile.moc"
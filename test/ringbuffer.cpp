@@ -0,0 +1,292 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "sound/RingBuffer.h"
+
+#include <QTest>
+#include <QThread>
+
+#include <vector>
+
+using namespace Rosegarden;
+
+// Tests and benchmarks for the lock-free RingBuffer
+
+namespace
+{
+
+const int stressSamples = 4000000;
+
+typedef RingBuffer<int, 3> StressBuffer;
+
+// Writes 0, 1, 2, ... in blocks of varying size, alternating between
+// write() and writing in place.
+class StressWriter : public QThread
+{
+public:
+    StressWriter(StressBuffer &buffer) : m_buffer(buffer) { }
+
+protected:
+    virtual void run()
+    {
+        std::vector<int> block(97);
+        int next = 0;
+        int pass = 0;
+
+        while (next < stressSamples) {
+            int n = std::min(1 + (pass * 7) % 97, stressSamples - next);
+            ++pass;
+
+            if (pass % 2) {
+                for (int i = 0; i < n; ++i) block[i] = next + i;
+                next += int(m_buffer.write(&block[0], n));
+            } else {
+                int *first, *second;
+                size_t firstCount, secondCount;
+                m_buffer.getWriteSpans(first, firstCount, second, secondCount);
+                n = std::min(n, int(firstCount + secondCount));
+                for (int i = 0; i < n; ++i) {
+                    if (size_t(i) < firstCount) first[i] = next + i;
+                    else second[i - firstCount] = next + i;
+                }
+                next += int(m_buffer.commitWrite(n));
+            }
+
+            if (m_buffer.getWriteSpace() == 0) yieldCurrentThread();
+        }
+    }
+
+private:
+    StressBuffer &m_buffer;
+};
+
+// Reads everything back as reader R, each reader a different way,
+// and counts anything out of sequence.
+class StressReader : public QThread
+{
+public:
+    StressReader(StressBuffer &buffer, int reader) :
+        m_buffer(buffer), m_reader(reader), m_errors(0) { }
+
+    int getErrors() const { return m_errors; }
+
+protected:
+    virtual void run()
+    {
+        std::vector<int> block(61);
+        int next = 0;
+
+        while (next < stressSamples) {
+
+            if (m_buffer.getReadSpace(m_reader) == 0) {
+                yieldCurrentThread();
+                continue;
+            }
+
+            switch (m_reader) {
+            case 0: {
+                int n = int(m_buffer.read(&block[0], block.size(), m_reader));
+                for (int i = 0; i < n; ++i) check(block[i], next++);
+                break;
+            }
+            case 1: {
+                const int *first, *second;
+                size_t firstCount, secondCount;
+                m_buffer.getReadSpans(first, firstCount,
+                                      second, secondCount, m_reader);
+                for (size_t i = 0; i < firstCount; ++i) check(first[i], next++);
+                for (size_t i = 0; i < secondCount; ++i) check(second[i], next++);
+                m_buffer.skip(firstCount + secondCount, m_reader);
+                break;
+            }
+            default:
+                check(m_buffer.readOne(m_reader), next++);
+                break;
+            }
+        }
+    }
+
+private:
+    void check(int value, int expected)
+    {
+        if (value != expected) ++m_errors;
+    }
+
+    StressBuffer &m_buffer;
+    int m_reader;
+    int m_errors;
+};
+
+}
+
+class TestRingBuffer : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testReadWrite();
+    void testSpans();
+    void testMultipleReaders();
+
+    void benchmarkCopy();
+    void benchmarkSpans();
+};
+
+void TestRingBuffer::testReadWrite()
+{
+    RingBuffer<int> buffer(15);
+    QCOMPARE(buffer.getSize(), size_t(15));
+    QCOMPARE(buffer.getWriteSpace(), size_t(15));
+
+    int in[20], out[20];
+    for (int i = 0; i < 20; ++i) in[i] = i + 1;
+
+    // Only 15 fit
+    QCOMPARE(buffer.write(in, 20), size_t(15));
+    QCOMPARE(buffer.getReadSpace(), size_t(15));
+    QCOMPARE(buffer.peek(), 1);
+
+    // Reading more than there is zeroes the rest
+    QCOMPARE(buffer.read(out, 10), size_t(10));
+    QCOMPARE(out[9], 10);
+    QCOMPARE(buffer.read(out, 10), size_t(5));
+    QCOMPARE(out[4], 15);
+    QCOMPARE(out[5], 0);
+
+    // Across the wrap point
+    QCOMPARE(buffer.write(in, 12), size_t(12));
+    QCOMPARE(buffer.readOne(), 1);
+    QCOMPARE(buffer.skip(2), size_t(2));
+    for (int i = 0; i < 9; ++i) out[i] = 100;
+    QCOMPARE(buffer.readAdding(out, 9), size_t(9));
+    QCOMPARE(out[0], 104);
+    QCOMPARE(out[8], 112);
+    QCOMPARE(buffer.getReadSpace(), size_t(0));
+    QCOMPARE(buffer.readOne(), 0);
+}
+
+void TestRingBuffer::testSpans()
+{
+    RingBuffer<int, 2> buffer(15);
+    int in[16];
+    for (int i = 0; i < 16; ++i) in[i] = i;
+
+    // Move the pointers on so that the spans wrap
+    buffer.write(in, 10);
+    buffer.skip(10, 0);
+    buffer.skip(10, 1);
+
+    int *first, *second;
+    size_t firstCount, secondCount;
+    QCOMPARE(buffer.getWriteSpans(first, firstCount, second, secondCount),
+             size_t(15));
+    QCOMPARE(firstCount, size_t(6));
+    QCOMPARE(secondCount, size_t(9));
+
+    for (size_t i = 0; i < firstCount; ++i) first[i] = int(i);
+    for (size_t i = 0; i < 6; ++i) second[i] = int(firstCount + i);
+
+    // Nothing is visible until it's committed
+    QCOMPARE(buffer.getReadSpace(0), size_t(0));
+    QCOMPARE(buffer.commitWrite(12), size_t(12));
+    QCOMPARE(buffer.getReadSpace(0), size_t(12));
+    QCOMPARE(buffer.getWriteSpace(), size_t(3));
+    QCOMPARE(buffer.commitWrite(5), size_t(3));
+
+    const int *rfirst, *rsecond;
+    QCOMPARE(buffer.getReadSpans(rfirst, firstCount, rsecond, secondCount, 0),
+             size_t(15));
+    QCOMPARE(firstCount, size_t(6));
+    QCOMPARE(secondCount, size_t(9));
+    QCOMPARE(rfirst[5], 5);
+    QCOMPARE(rsecond[0], 6);
+    QCOMPARE(rsecond[5], 11);
+
+    // The slower reader holds up the writer
+    buffer.skip(15, 0);
+    QCOMPARE(buffer.getReadSpace(0), size_t(0));
+    QCOMPARE(buffer.getReadSpace(1), size_t(15));
+    QCOMPARE(buffer.getWriteSpace(), size_t(0));
+    buffer.skip(4, 1);
+    QCOMPARE(buffer.getWriteSpace(), size_t(4));
+}
+
+void TestRingBuffer::testMultipleReaders()
+{
+    // Small, so that the writer and readers keep catching each other up
+    StressBuffer buffer(255);
+
+    StressWriter writer(buffer);
+    StressReader reader0(buffer, 0);
+    StressReader reader1(buffer, 1);
+    StressReader reader2(buffer, 2);
+
+    reader0.start();
+    reader1.start();
+    reader2.start();
+    writer.start();
+
+    QVERIFY(writer.wait(60000));
+    QVERIFY(reader0.wait(60000));
+    QVERIFY(reader1.wait(60000));
+    QVERIFY(reader2.wait(60000));
+
+    QCOMPARE(reader0.getErrors(), 0);
+    QCOMPARE(reader1.getErrors(), 0);
+    QCOMPARE(reader2.getErrors(), 0);
+}
+
+// Both benchmarks generate a block of samples into the buffer and mix
+// it into an output block, as the audio threads do.  One copies in and
+// out with write() and read(), the other works in place.
+
+static const int blockSize = 1024;
+static const int blocksPerRun = 10000;
+
+void TestRingBuffer::benchmarkCopy()
+{
+    RingBuffer<float> buffer(4 * blockSize - 1);
+    std::vector<float> in(blockSize), temp(blockSize), out(blockSize, 0.0f);
+
+    QBENCHMARK {
+        for (int b = 0; b < blocksPerRun; ++b) {
+            for (int i = 0; i < blockSize; ++i) in[i] = 0.5f;
+            buffer.write(&in[0], blockSize);
+
+            buffer.read(&temp[0], blockSize);
+            for (int i = 0; i < blockSize; ++i) out[i] += temp[i];
+        }
+    }
+
+    QVERIFY(out[0] > 0);
+}
+
+void TestRingBuffer::benchmarkSpans()
+{
+    RingBuffer<float> buffer(4 * blockSize - 1);
+    std::vector<float> out(blockSize, 0.0f);
+
+    QBENCHMARK {
+        for (int b = 0; b < blocksPerRun; ++b) {
+            float *first, *second;
+            size_t firstCount, secondCount;
+            buffer.getWriteSpans(first, firstCount, second, secondCount);
+            size_t n = std::min(firstCount, size_t(blockSize));
+            for (size_t i = 0; i < n; ++i) first[i] = 0.5f;
+            for (size_t i = n; i < size_t(blockSize); ++i) second[i - n] = 0.5f;
+            buffer.commitWrite(blockSize);
+
+            const float *rfirst, *rsecond;
+            buffer.getReadSpans(rfirst, firstCount, rsecond, secondCount);
+            for (size_t i = 0; i < firstCount; ++i) out[i] += rfirst[i];
+            for (size_t i = 0; i < secondCount; ++i)
+                out[i + firstCount] += rsecond[i];
+            buffer.skip(firstCount + secondCount);
+        }
+    }
+
+    QVERIFY(out[0] > 0);
+}
+
+QTEST_MAIN(TestRingBuffer)
+
+#include "ringbuffer.moc"
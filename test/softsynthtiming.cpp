@@ -0,0 +1,355 @@
+/* -*- c-basic-offset: 4 indent-tabs-mode: nil -*- vi:set ts=8 sts=4 sw=4: */
+
+#include "base/AudioLevel.h"
+#include "base/Composition.h"
+#include "base/Track.h"
+#include "document/RosegardenDocument.h"
+#include "sound/ControlBlock.h"
+#include "sound/MappedStudio.h"
+#include "sound/OfflineDriver.h"
+#include "sound/PluginFactory.h"
+#include "sound/RunnablePluginInstance.h"
+#include "sound/SoftSynthEventQueue.h"
+#include <QTest>
+
+#include <alsa/seq_event.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <string.h>
+
+using namespace Rosegarden;
+
+// MIDI events sent to a soft synth, played through the offline
+// driver's mixer and checked for the exact frame each one lands on
+
+static const int sampleRate = 44100;
+static const int blockSize = 512;
+static const InstrumentId synthId = SoftSynthInstrumentBase;
+
+// A synth that plays each note on as a single sample, of its
+// velocity, at the frame the note falls on
+class ClickSynth : public RunnablePluginInstance
+{
+public:
+    ClickSynth(PluginFactory *factory, QString identifier,
+               size_t bufferSize) :
+        RunnablePluginInstance(factory, identifier),
+        m_bufferSize(bufferSize),
+        m_queue(65536),
+        m_events(bufferSize),
+        m_bypassed(false)
+    {
+        m_outputs[0] = new sample_t[bufferSize];
+        m_outputs[1] = new sample_t[bufferSize];
+    }
+
+    virtual ~ClickSynth() {
+        delete[] m_outputs[0];
+        delete[] m_outputs[1];
+    }
+
+    virtual bool isOK() const { return true; }
+    virtual QString getIdentifier() const { return m_identifier; }
+
+    virtual void run(const RealTime &blockStartTime) {
+        memset(m_outputs[0], 0, m_bufferSize * sizeof(sample_t));
+        memset(m_outputs[1], 0, m_bufferSize * sizeof(sample_t));
+        size_t count = m_queue.readBlock(blockStartTime, m_bufferSize,
+                                         sampleRate,
+                                         &m_events[0], m_events.size());
+        for (size_t i = 0; i < count; ++i) {
+            if (m_events[i].type != SND_SEQ_EVENT_NOTEON) continue;
+            size_t offset = m_events[i].time.tick;
+            sample_t value = m_events[i].data.note.velocity / 127.0f;
+            m_outputs[0][offset] = value;
+            m_outputs[1][offset] = value;
+        }
+    }
+
+    virtual size_t getBufferSize() { return m_bufferSize; }
+    virtual size_t getAudioInputCount() { return 0; }
+    virtual size_t getAudioOutputCount() { return 2; }
+    virtual sample_t **getAudioInputBuffers() { return 0; }
+    virtual sample_t **getAudioOutputBuffers() { return m_outputs; }
+
+    virtual void setPortValue(unsigned int, float) { }
+    virtual float getPortValue(unsigned int) { return 0.0f; }
+
+    virtual void sendEvent(const RealTime &eventTime, const void *event) {
+        snd_seq_event_t ev(*(const snd_seq_event_t *)event);
+        ev.time.time.tv_sec = eventTime.sec;
+        ev.time.time.tv_nsec = eventTime.nsec;
+        m_queue.write(&ev, 1);
+    }
+
+    virtual void sendEvents(const void *events, size_t count) {
+        m_queue.write((const snd_seq_event_t *)events, count);
+    }
+
+    virtual bool isBypassed() const { return m_bypassed; }
+    virtual void setBypassed(bool value) { m_bypassed = value; }
+    virtual size_t getLatency() { return 0; }
+    virtual void silence() { }
+    virtual void discardEvents() { m_queue.discard(); }
+    virtual void setIdealChannelCount(size_t) { }
+
+private:
+    size_t m_bufferSize;
+    sample_t *m_outputs[2];
+    SoftSynthEventQueue m_queue;
+    std::vector<snd_seq_event_t> m_events;
+    bool m_bypassed;
+};
+
+class ClickSynthFactory : public PluginFactory
+{
+public:
+    ClickSynthFactory() { m_identifiers.push_back("clicktest:click:click"); }
+    virtual ~ClickSynthFactory() { }
+
+    virtual void discoverPlugins() { }
+    virtual const std::vector<QString> &getPluginIdentifiers() const {
+        return m_identifiers;
+    }
+    virtual void enumeratePlugins(MappedObjectPropertyList &) { }
+    virtual void populatePluginSlot(QString, MappedPluginSlot &) { }
+
+    virtual RunnablePluginInstance *instantiatePlugin(QString identifier,
+                                                      int, int,
+                                                      unsigned int,
+                                                      unsigned int blockSize,
+                                                      unsigned int) {
+        return new ClickSynth(this, identifier, blockSize);
+    }
+
+protected:
+    virtual void releasePlugin(RunnablePluginInstance *, QString) { }
+
+private:
+    std::vector<QString> m_identifiers;
+};
+
+static snd_seq_event_t noteOn(long frame, int velocity)
+{
+    snd_seq_event_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.type = SND_SEQ_EVENT_NOTEON;
+    ev.data.note.note = 60;
+    ev.data.note.velocity = (unsigned char)velocity;
+    RealTime t = RealTime::frame2RealTime(frame, sampleRate);
+    ev.time.time.tv_sec = t.sec;
+    ev.time.time.tv_nsec = t.nsec;
+    return ev;
+}
+
+class TestSoftSynthTiming : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void testExactFrames();
+    void testSameFrameOrder();
+    void testLateEvent();
+    void testDiscard();
+    void benchmarkDenseEvents();
+
+private:
+    /// Render blocks from the start of the timeline, returning the
+    /// synth's left output
+    std::vector<float> render(int blocks, bool start = true);
+
+    ClickSynthFactory m_factory;
+
+    RosegardenDocument *m_doc;
+    MappedStudio *m_studio;
+    OfflineDriver *m_driver;
+};
+
+void TestSoftSynthTiming::initTestCase()
+{
+    // A track on the synth, so that the mixer doesn't treat it as
+    // unused
+    m_doc = new RosegardenDocument(0, 0, true /*skip autoload*/, true, false);
+    Composition &comp = m_doc->getComposition();
+    comp.addTrack(new Track(comp.getNewTrackId(), synthId, 0));
+    ControlBlock::getInstance()->setDocument(m_doc);
+
+    // Unity gain throughout
+    AudioLevel::setPanLaw(0);
+
+    PluginFactory::registerFactory("clicktest", &m_factory);
+
+    m_studio = new MappedStudio;
+    m_driver = new OfflineDriver(m_studio, sampleRate, blockSize);
+    m_studio->setSoundDriver(m_driver);
+    QVERIFY(m_driver->initialise());
+
+    MappedObject *master = m_studio->createObject(MappedObject::AudioBuss);
+    QVERIFY(master);
+    MappedObject *fader = m_studio->createObject(MappedObject::AudioFader);
+    QVERIFY(fader);
+    fader->setProperty(MappedObject::Instrument, synthId);
+
+    m_driver->setPluginInstance(synthId, "clicktest:click:click",
+                                Instrument::SYNTH_PLUGIN_POSITION);
+    QVERIFY(m_driver->getSynthPlugin(synthId));
+}
+
+void TestSoftSynthTiming::cleanupTestCase()
+{
+    delete m_driver;
+    delete m_studio;
+    delete m_doc;
+}
+
+std::vector<float>
+TestSoftSynthTiming::render(int blocks, bool start)
+{
+    std::vector<float> left(blockSize), right(blockSize);
+    std::vector<float> stemLeft(blockSize), stemRight(blockSize);
+    std::vector<float> output;
+
+    if (start) m_driver->startRender(RealTime::zeroTime);
+
+    for (int i = 0; i < blocks; ++i) {
+        m_driver->renderBlock(&left[0], &right[0], synthId,
+                              &stemLeft[0], &stemRight[0]);
+        output.insert(output.end(), stemLeft.begin(), stemLeft.end());
+    }
+
+    return output;
+}
+
+void TestSoftSynthTiming::testExactFrames()
+{
+    // Either side of block boundaries, and well into the render where
+    // adding up block durations would have drifted
+    long frames[] = { 0, 1, 511, 512, 513, 1000, 44100 * 3 + 7,
+                      44100 * 10 + 300, 44100 * 20 - 1, 44100 * 20 };
+    const int count = sizeof(frames) / sizeof(frames[0]);
+
+    // Most of them in one batch, out of order, and the rest one by one
+    std::vector<snd_seq_event_t> batch;
+    for (int i = 0; i < count - 3; ++i) {
+        batch.push_back(noteOn(frames[i], 127));
+    }
+    unsigned int seed = 1;
+    for (size_t i = batch.size(); i > 1; --i) {
+        seed = seed * 1103515245 + 12345;
+        std::swap(batch[i - 1], batch[(seed >> 8) % i]);
+    }
+
+    RunnablePluginInstance *synth = m_driver->getSynthPlugin(synthId);
+    QVERIFY(synth);
+    synth->sendEvents(&batch[0], batch.size());
+    for (int i = count - 3; i < count; ++i) {
+        snd_seq_event_t ev = noteOn(0, 127);
+        synth->sendEvent(RealTime::frame2RealTime(frames[i], sampleRate), &ev);
+    }
+
+    std::vector<float> output = render(44100 * 21 / blockSize);
+    m_driver->stopRender();
+
+    std::vector<long> found;
+    for (size_t i = 0; i < output.size(); ++i) {
+        if (output[i] != 0.0f) {
+            QCOMPARE(output[i], 1.0f);
+            found.push_back(long(i));
+        }
+    }
+
+    QCOMPARE(int(found.size()), count);
+    for (int i = 0; i < count; ++i) {
+        QCOMPARE(found[i], frames[i]);
+    }
+}
+
+void TestSoftSynthTiming::testSameFrameOrder()
+{
+    // The synth writes over earlier notes at the same frame, so what
+    // comes out shows which was played last
+    RunnablePluginInstance *synth = m_driver->getSynthPlugin(synthId);
+    QVERIFY(synth);
+
+    snd_seq_event_t events[4] = {
+        noteOn(2000, 64), noteOn(1000, 127), noteOn(2000, 127), noteOn(1000, 64)
+    };
+    synth->sendEvents(events, 4);
+
+    std::vector<float> output = render(8);
+    m_driver->stopRender();
+
+    QCOMPARE(output[1000], 64 / 127.0f);
+    QCOMPARE(output[2000], 1.0f);
+}
+
+void TestSoftSynthTiming::testLateEvent()
+{
+    std::vector<float> output = render(16);
+    for (size_t i = 0; i < output.size(); ++i) {
+        QCOMPARE(output[i], 0.0f);
+    }
+
+    // Already passed: it plays once, as soon as it can
+    RunnablePluginInstance *synth = m_driver->getSynthPlugin(synthId);
+    QVERIFY(synth);
+    snd_seq_event_t ev = noteOn(100, 127);
+    synth->sendEvents(&ev, 1);
+
+    output = render(64, false);
+    m_driver->stopRender();
+
+    int clicks = 0;
+    for (size_t i = 0; i < output.size(); ++i) {
+        if (output[i] != 0.0f) ++clicks;
+    }
+    QCOMPARE(clicks, 1);
+}
+
+void TestSoftSynthTiming::testDiscard()
+{
+    RunnablePluginInstance *synth = m_driver->getSynthPlugin(synthId);
+    QVERIFY(synth);
+    snd_seq_event_t ev = noteOn(44100, 127);
+    synth->sendEvents(&ev, 1);
+
+    // Stopping throws away what hasn't played yet
+    render(1);
+    m_driver->stopRender();
+
+    std::vector<float> output = render(44100 * 2 / blockSize);
+    m_driver->stopRender();
+
+    for (size_t i = 0; i < output.size(); ++i) {
+        QCOMPARE(output[i], 0.0f);
+    }
+}
+
+void TestSoftSynthTiming::benchmarkDenseEvents()
+{
+    // A note every 16 frames for ten seconds
+    const int seconds = 10;
+    std::vector<snd_seq_event_t> events;
+    for (long frame = 0; frame < seconds * sampleRate; frame += 16) {
+        events.push_back(noteOn(frame, 127));
+    }
+
+    RunnablePluginInstance *synth = m_driver->getSynthPlugin(synthId);
+    QVERIFY(synth);
+
+    QBENCHMARK {
+        synth->sendEvents(&events[0], events.size());
+        std::vector<float> output = render(seconds * sampleRate / blockSize);
+        m_driver->stopRender();
+        QCOMPARE(output[16 * 1000], 1.0f);
+    }
+}
+
+QTEST_MAIN(TestSoftSynthTiming)
+
+#include "softsynthtiming.moc"